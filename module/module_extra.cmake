@@ -0,0 +1,60 @@
+# SQLite is used directly by the position index for its R*Tree virtual table
+find_package(SQLite3 REQUIRED)
+target_include_directories(${PROJECT_NAME} PUBLIC ${SQLite3_INCLUDE_DIRS})
+target_link_libraries(${PROJECT_NAME} ${SQLite3_LIBRARIES})
+
+# zstd compresses the stored flight states
+find_package(PkgConfig REQUIRED)
+pkg_check_modules(ZSTD REQUIRED libzstd)
+target_include_directories(${PROJECT_NAME} PUBLIC ${ZSTD_INCLUDE_DIRS})
+target_link_libraries(${PROJECT_NAME} ${ZSTD_LIBRARIES})
+
+# Scoped trace zones recorded per thread and exported as Chrome trace json, compiled out when disabled
+option(OVERMYROOF_TRACE "Record trace zones of ingest, cache and REST activity" OFF)
+if(OVERMYROOF_TRACE)
+    target_compile_definitions(${PROJECT_NAME} PUBLIC OVERMYROOF_TRACE)
+endif()
+
+# Tools to measure performance, see the tools directory
+option(OVERMYROOF_BUILD_TOOLS "Build the benchmark and test tools" ON)
+if(OVERMYROOF_BUILD_TOOLS)
+    # Benchmark of the hot paths on generated traffic, writes the timings as json to compare builds
+    add_executable(overmyroofbenchmark
+        ${CMAKE_CURRENT_SOURCE_DIR}/tools/overmyroofbenchmark.cpp
+        ${CMAKE_CURRENT_SOURCE_DIR}/tools/trafficgenerator.cpp
+        ${CMAKE_CURRENT_SOURCE_DIR}/tools/trafficgenerator.h)
+    target_include_directories(overmyroofbenchmark PRIVATE ${CMAKE_CURRENT_SOURCE_DIR}/src ${CMAKE_CURRENT_SOURCE_DIR}/tools)
+    target_link_libraries(overmyroofbenchmark ${PROJECT_NAME})
+
+    # Serves a feed recorded by the logger at a configurable speed, to test ingest without polling the live feed
+    if(UNIX)
+        add_executable(feedreplayserver ${CMAKE_CURRENT_SOURCE_DIR}/tools/feedreplayserver.cpp)
+        target_include_directories(feedreplayserver PRIVATE ${CMAKE_CURRENT_SOURCE_DIR}/src)
+        target_link_libraries(feedreplayserver ${PROJECT_NAME})
+
+        # Drives the REST api of a running instance with concurrent requests and reports the latency distribution
+        find_package(Threads REQUIRED)
+        add_executable(loadgenerator ${CMAKE_CURRENT_SOURCE_DIR}/tools/loadgenerator.cpp)
+        target_include_directories(loadgenerator PRIVATE ${CMAKE_CURRENT_SOURCE_DIR}/src)
+        target_link_libraries(loadgenerator ${PROJECT_NAME} Threads::Threads)
+    endif()
+endif()
+
+# Unit tests of the modules, one executable per test in the test directory, run with ctest
+option(OVERMYROOF_BUILD_TESTS "Build the unit tests" ON)
+if(OVERMYROOF_BUILD_TESTS)
+    enable_testing()
+    function(overmyroof_add_test name)
+        add_executable(${name} ${CMAKE_CURRENT_SOURCE_DIR}/test/${name}.cpp ${CMAKE_CURRENT_SOURCE_DIR}/test/testcheck.h)
+        target_include_directories(${name} PRIVATE ${CMAKE_CURRENT_SOURCE_DIR}/src ${CMAKE_CURRENT_SOURCE_DIR}/test)
+        target_link_libraries(${name} ${PROJECT_NAME})
+        add_test(NAME ${name} COMMAND ${name})
+    endfunction()
+
+    overmyroof_add_test(utilstest)
+    overmyroof_add_test(flightstatetest)
+    overmyroof_add_test(flightstateslogstoretest)
+    overmyroof_add_test(trafficrollupstest)
+    overmyroof_add_test(disturbancedetectortest)
+    overmyroof_add_test(bloomfiltertest)
+endif()
@@ -0,0 +1,87 @@
+#include "adddisturbancewatchcall.h"
+#include "trace.h"
+#include "restutils.h"
+#include "restcontenttypes.h"
+#include "nap/logger.h"
+#include "rapidjson/document.h"
+#include "rapidjson/stringbuffer.h"
+#include "rapidjson/prettywriter.h"
+#include "utils.h"
+
+RTTI_BEGIN_CLASS(nap::AddDisturbanceWatchCall)
+    RTTI_PROPERTY("FetchFlightsCall", &nap::AddDisturbanceWatchCall::mFetchFlightsCall, nap::rtti::EPropertyMetaData::Required, "Resolves the location of the watch")
+    RTTI_PROPERTY("DisturbanceWatches", &nap::AddDisturbanceWatchCall::mDisturbanceWatches, nap::rtti::EPropertyMetaData::Required, "The registered watches")
+    RTTI_PROPERTY("MaxPeriod", &nap::AddDisturbanceWatchCall::mMaxPeriod, nap::rtti::EPropertyMetaData::Default, "Maximum period in minutes of a watch")
+    RTTI_PROPERTY("MinPeriod", &nap::AddDisturbanceWatchCall::mMinPeriod, nap::rtti::EPropertyMetaData::Default, "Minimum period in minutes of a watch")
+    RTTI_PROPERTY("MaxOccurrences", &nap::AddDisturbanceWatchCall::mMaxOccurrences, nap::rtti::EPropertyMetaData::Default, "Maximum number of flights in a disturbance period of a watch")
+    RTTI_PROPERTY("Metrics", &nap::AddDisturbanceWatchCall::mMetrics, nap::rtti::EPropertyMetaData::Default, "Optional metrics the request duration is reported in")
+RTTI_END_CLASS
+
+namespace nap
+{
+    bool AddDisturbanceWatchCall::init(utility::ErrorState &errorState)
+    {
+        if(mMetrics != nullptr)
+            mRequestDuration = &mMetrics->addRequestHistogram(mID);
+
+        if(!errorState.check(mMinPeriod > 0 && mMinPeriod <= mMaxPeriod, "MinPeriod must be greater than 0 and not greater than MaxPeriod"))
+            return false;
+
+        return errorState.check(mMaxOccurrences > 0, "MaxOccurrences must be greater than 0");
+    }
+
+
+    RestResponse AddDisturbanceWatchCall::call(const RestValueMap &values)
+    {
+        TRACE_ZONE("AddDisturbanceWatchCall::call");
+        Metrics::ScopedTimer request_timer(mRequestDuration);
+        utility::ErrorState error_state;
+        int occurrences, period;
+        if(!extractValue("occurrences", values, occurrences, error_state))
+            return utility::generateErrorResponse(error_state.toString());
+        if(occurrences < 1)
+            return utility::generateErrorResponse("occurrences must be greater than 0");
+        if(occurrences > mMaxOccurrences)
+            return utility::generateErrorResponse(utility::stringFormat("occurrences must not be greater than %d", mMaxOccurrences));
+
+        if(!extractValue("period", values, period, error_state))
+            return utility::generateErrorResponse(error_state.toString());
+        if(period < mMinPeriod)
+            return utility::generateErrorResponse(utility::stringFormat("period must be greater than %d minutes", mMinPeriod));
+        if(period > mMaxPeriod)
+            return utility::generateErrorResponse(utility::stringFormat("period must be less than %d minutes", mMaxPeriod));
+
+        float lat, lon, altitude, radius;
+        if(!mFetchFlightsCall->getLocation(values, lat, lon, error_state))
+            return utility::generateErrorResponse(error_state.toString());
+        if(!extractValue("altitude", values, altitude, error_state))
+            return utility::generateErrorResponse(error_state.toString());
+        if(!extractValue("radius", values, radius, error_state))
+            return utility::generateErrorResponse(error_state.toString());
+        if(radius <= 0.0f)
+            return utility::generateErrorResponse("radius must be greater than 0");
+
+        std::string id;
+        if(!mDisturbanceWatches->addWatch(lat, lon, radius, altitude, period, occurrences, id, error_state))
+            return utility::generateErrorResponse(error_state.toString());
+
+        // Create the json document
+        rapidjson::Document document(rapidjson::kObjectType);
+        rapidjson::Value data(rapidjson::kObjectType);
+        document.AddMember("status", "ok", document.GetAllocator());
+        data.AddMember("id", rapidjson::Value(id.c_str(), document.GetAllocator()), document.GetAllocator());
+        document.AddMember("data", data, document.GetAllocator());
+
+        // Serialize the response
+        rapidjson::StringBuffer buffer;
+        rapidjson::PrettyWriter<rapidjson::StringBuffer> writer(buffer);
+        document.Accept(writer);
+
+        // Create the response
+        RestResponse response;
+        response.mData = buffer.GetString();
+        response.mContentType = rest::contenttypes::json;
+
+        return response;
+    }
+}
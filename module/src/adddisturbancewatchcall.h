@@ -0,0 +1,33 @@
+#pragma once
+
+#include <restfunction.h>
+
+#include "fetchflightscall.h"
+#include "disturbancewatches.h"
+#include "metrics.h"
+
+namespace nap
+{
+    /**
+     * AddDisturbanceWatchCall is a RestFunction that registers a disturbance watch for a location.
+     * The watch is evaluated with every new snapshot, its state is read with the get disturbance watch call.
+     * The parameters are the same as the ones of the find disturbances call, without a time window.
+     */
+    class NAPAPI AddDisturbanceWatchCall : public RestFunction
+    {
+    RTTI_ENABLE(RestFunction)
+    public:
+        bool init(utility::ErrorState &errorState) final;
+
+        RestResponse call(const RestValueMap &values) override;
+
+        ResourcePtr<FetchFlightsCall> mFetchFlightsCall; ///< Property "FetchFlightsCall" : Resolves the location of the watch
+        ResourcePtr<DisturbanceWatches> mDisturbanceWatches; ///< Property "DisturbanceWatches" : The registered watches
+        int mMaxPeriod = 2880; ///< Property "MaxPeriod" : Maximum period in minutes of a watch
+        int mMinPeriod = 10; ///< Property "MinPeriod" : Minimum period in minutes of a watch
+        int mMaxOccurrences = 1000; ///< Property "MaxOccurrences" : Maximum number of flights in a disturbance period of a watch
+        ResourcePtr<Metrics> mMetrics; ///< Property "Metrics" : Optional metrics the request duration is reported in
+    private:
+        Metrics::Histogram* mRequestDuration = nullptr;
+    };
+}
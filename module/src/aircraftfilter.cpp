@@ -0,0 +1,160 @@
+#include "aircraftfilter.h"
+
+#include <algorithm>
+#include <mutex>
+#include <unordered_map>
+#include <string.h>
+
+namespace nap
+{
+    // Types after the last id share it, the bitmap then only rules out fewer snapshots
+    static constexpr uint16 sMaxTypeId = 0xffff;
+
+    static void splitList(const std::string& list, std::vector<std::string>& items)
+    {
+        std::string item;
+        for(size_t i = 0; i <= list.size(); i++)
+        {
+            if(i == list.size() || list[i] == ',')
+            {
+                if(!item.empty())
+                    items.emplace_back(std::move(item));
+                item.clear();
+            }else if(list[i] != ' ')
+            {
+                item += static_cast<char>(toupper(static_cast<unsigned char>(list[i])));
+            }
+        }
+    }
+
+
+    static bool startsWith(const char* text, const std::string& prefix)
+    {
+        return strncmp(text, prefix.c_str(), prefix.size()) == 0;
+    }
+
+
+    struct TypeIds
+    {
+        std::mutex mMutex;
+        std::unordered_map<std::string, uint16> mIds;
+    };
+
+
+    static TypeIds& getTypeIds()
+    {
+        static TypeIds type_ids;
+        return type_ids;
+    }
+
+
+    static void setBit(uint16 id, std::vector<uint64>& bitmap)
+    {
+        if(bitmap.size() <= id / 64u)
+            bitmap.resize(id / 64u + 1, 0);
+        bitmap[id / 64u] |= 1ull << (id % 64u);
+    }
+
+
+    uint16 AircraftTypes::intern(const std::string& type)
+    {
+        auto& type_ids = getTypeIds();
+        std::lock_guard<std::mutex> lock(type_ids.mMutex);
+        auto it = type_ids.mIds.find(type);
+        if(it != type_ids.mIds.end())
+            return it->second;
+
+        uint16 id = static_cast<uint16>(std::min<size_t>(type_ids.mIds.size(), sMaxTypeId));
+        type_ids.mIds.emplace(type, id);
+        return id;
+    }
+
+
+    bool AircraftTypes::find(const std::string& type, uint16& id)
+    {
+        auto& type_ids = getTypeIds();
+        std::lock_guard<std::mutex> lock(type_ids.mMutex);
+        auto it = type_ids.mIds.find(type);
+        if(it == type_ids.mIds.end())
+            return false;
+
+        id = it->second;
+        return true;
+    }
+
+
+    size_t AircraftTypes::getCount()
+    {
+        auto& type_ids = getTypeIds();
+        std::lock_guard<std::mutex> lock(type_ids.mMutex);
+        return type_ids.mIds.size();
+    }
+
+
+    void AircraftTypes::addToBitmap(const std::string& type, std::vector<uint64>& bitmap)
+    {
+        setBit(intern(type), bitmap);
+    }
+
+
+    void AircraftFilter::parse(const std::string& types, const std::string& registrations)
+    {
+        mTypes.clear();
+        mTypeBitmap.clear();
+        mRegistrations.clear();
+        mUnknownTypes = false;
+
+        // Type codes and registrations are upper case in the feed
+        splitList(types, mTypes);
+        splitList(registrations, mRegistrations);
+
+        // Types are only looked up, a type that was never interned isn't in any snapshot yet
+        mTypeCount = AircraftTypes::getCount();
+        for(const auto& type : mTypes)
+        {
+            uint16 id;
+            if(AircraftTypes::find(type, id))
+                setBit(id, mTypeBitmap);
+            else
+                mUnknownTypes = true;
+        }
+    }
+
+
+    bool AircraftFilter::matchesTypes(const std::vector<uint64>& bitmap) const
+    {
+        if(mTypes.empty())
+            return true;
+
+        size_t size = std::min(bitmap.size(), mTypeBitmap.size());
+        for(size_t i = 0; i < size; i++)
+        {
+            if((bitmap[i] & mTypeBitmap[i]) != 0)
+                return true;
+        }
+
+        // A type that was unknown can have been interned since, by a snapshot added after the filter was parsed
+        if(mUnknownTypes)
+        {
+            for(size_t i = mTypeCount / 64u; i < bitmap.size(); i++)
+            {
+                uint64 interned_since = i == mTypeCount / 64u ? ~0ull << (mTypeCount % 64u) : ~0ull;
+                if((bitmap[i] & interned_since) != 0)
+                    return true;
+            }
+        }
+        return false;
+    }
+
+
+    bool AircraftFilter::matches(const char* aircraftType, const char* registration) const
+    {
+        if(!mTypes.empty() && std::none_of(mTypes.begin(), mTypes.end(), [aircraftType](const std::string& type){ return type == aircraftType; }))
+            return false;
+
+        if(!mRegistrations.empty() && std::none_of(mRegistrations.begin(), mRegistrations.end(), [registration](const std::string& prefix){ return startsWith(registration, prefix); }))
+            return false;
+
+        return true;
+    }
+}
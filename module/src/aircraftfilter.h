@@ -0,0 +1,94 @@
+#pragma once
+
+#include <nap/numeric.h>
+#include <string>
+#include <vector>
+
+#include "flightstate.h"
+
+namespace nap
+{
+    /**
+     * Interns aircraft type codes into small ids, so the types present in a snapshot fit in a small bitmap.
+     * Ids are assigned in order of appearance and only valid within the running process. Thread safe
+     */
+    class NAPAPI AircraftTypes
+    {
+    public:
+        /**
+         * Get the id of a type, assigns a new id to types that weren't seen before
+         * @param type the aircraft type code, for example B744
+         * @return the id of the type
+         */
+        static uint16 intern(const std::string& type);
+
+        /**
+         * Get the id of a type without assigning one, types in requests are looked up so clients can't grow the table
+         * @param type the aircraft type code
+         * @param id the id of the type
+         * @return false if the type wasn't interned, no snapshot holds it
+         */
+        static bool find(const std::string& type, uint16& id);
+
+        /**
+         * @return the number of interned types, types interned later get an id of at least this number
+         */
+        static size_t getCount();
+
+        /**
+         * Sets the bit of the type in a bitmap of type ids, the bitmap grows when needed
+         * Interns the type, only used for the types in the feed
+         * @param type the aircraft type code
+         * @param bitmap the bitmap
+         */
+        static void addToBitmap(const std::string& type, std::vector<uint64>& bitmap);
+    };
+
+
+    /**
+     * Filters aircraft on type and registration prefix, an empty filter matches every aircraft.
+     * An aircraft matches when its type is one of the types and its registration starts with one of the prefixes,
+     * either list is ignored when empty
+     */
+    class NAPAPI AircraftFilter
+    {
+    public:
+        /**
+         * Parses comma separated lists of types and registration prefixes
+         * @param types the aircraft types, for example "B744,B77W", may be empty
+         * @param registrations the registration prefixes, for example "PH-B", may be empty
+         */
+        void parse(const std::string& types, const std::string& registrations);
+
+        /**
+         * @return if the filter matches every aircraft
+         */
+        bool isEmpty() const { return mTypes.empty() && mRegistrations.empty(); }
+
+        /**
+         * Checks if a snapshot holds any of the types, snapshots that don't can be skipped completely
+         * @param bitmap the bitmap of the type ids in the snapshot, see AircraftTypes::addToBitmap()
+         * @return false if none of the types are in the snapshot
+         */
+        bool matchesTypes(const std::vector<uint64>& bitmap) const;
+
+        /**
+         * @param state the aircraft
+         * @return if the aircraft matches the filter
+         */
+        bool matches(const FlightState& state) const { return matches(state.mAircraftType.c_str(), state.mRegistration.c_str()); }
+
+        /**
+         * @param aircraftType the type of the aircraft
+         * @param registration the registration of the aircraft
+         * @return if the aircraft matches the filter
+         */
+        bool matches(const char* aircraftType, const char* registration) const;
+    private:
+        std::vector<std::string> mTypes;
+        std::vector<uint64> mTypeBitmap;
+        bool mUnknownTypes = false; // Some types weren't interned when the filter was parsed
+        size_t mTypeCount = 0;      // Number of interned types when the filter was parsed
+        std::vector<std::string> mRegistrations;
+    };
+}
@@ -0,0 +1,341 @@
+#include "aircraftindex.h"
+#include "utils.h"
+#include "trace.h"
+
+#include <nap/logger.h>
+#include <sqlite3.h>
+#include <unordered_set>
+#include <cstring>
+
+RTTI_BEGIN_CLASS(nap::AircraftIndex)
+    RTTI_PROPERTY("FlightStatesDatabase", &nap::AircraftIndex::mFlightStatesDatabase, nap::rtti::EPropertyMetaData::Required)
+    RTTI_PROPERTY("Compression", &nap::AircraftIndex::mCompression, nap::rtti::EPropertyMetaData::Default)
+    RTTI_PROPERTY("FlightStatesTableName", &nap::AircraftIndex::mFlightStatesTableName, nap::rtti::EPropertyMetaData::Default)
+    RTTI_PROPERTY("DatabaseName", &nap::AircraftIndex::mDatabaseName, nap::rtti::EPropertyMetaData::Default)
+    RTTI_PROPERTY("TableName", &nap::AircraftIndex::mTableName, nap::rtti::EPropertyMetaData::Default)
+    RTTI_PROPERTY("BitsPerAircraft", &nap::AircraftIndex::mBitsPerAircraft, nap::rtti::EPropertyMetaData::Default)
+    RTTI_PROPERTY("BackfillHours", &nap::AircraftIndex::mBackfillHours, nap::rtti::EPropertyMetaData::Default)
+    RTTI_PROPERTY("RetentionHours", &nap::AircraftIndex::mRetentionHours, nap::rtti::EPropertyMetaData::Default)
+    RTTI_PROPERTY("UpdateInterval", &nap::AircraftIndex::mUpdateInterval, nap::rtti::EPropertyMetaData::Default)
+RTTI_END_CLASS
+
+namespace nap
+{
+    // An hour in uint64 YYYYMMDDHHMMSS units, an hour is the timestamp of its first second
+    static constexpr uint64 sHour = 10000;
+
+    // Time between the end of an hour and indexing it, so the last snapshot of the hour is stored
+    static constexpr int sSettleSeconds = 60;
+
+    AircraftIndex::~AircraftIndex()
+    {
+        {
+            std::lock_guard<std::mutex> lock(mStopMutex);
+            mStop = true;
+        }
+        mStopCondition.notify_all();
+        if(mThread.joinable())
+            mThread.join();
+
+        sqlite3_finalize(mInsertStatement);
+        if(mDatabase != nullptr)
+            sqlite3_close(mDatabase);
+    }
+
+
+    bool AircraftIndex::init(utility::ErrorState &errorState)
+    {
+        if(!errorState.check(mBitsPerAircraft > 0, "BitsPerAircraft must be greater than 0"))
+            return false;
+
+        if(!errorState.check(mBackfillHours >= 0, "BackfillHours must be 0 or greater"))
+            return false;
+
+        if(!errorState.check(mRetentionHours > 0, "RetentionHours must be greater than 0"))
+            return false;
+
+        if(!errorState.check(mUpdateInterval > 0.0f, "UpdateInterval must be greater than 0"))
+            return false;
+
+        mFlightStatesStore = mFlightStatesDatabase->getFlightStatesStore(mFlightStatesTableName, errorState);
+        if(mFlightStatesStore == nullptr)
+            return false;
+
+        if(!errorState.check(sqlite3_open(mDatabaseName.c_str(), &mDatabase) == SQLITE_OK,
+                             "Failed to open aircraft index database %s", mDatabaseName.c_str()))
+            return false;
+
+        sqlite3_busy_timeout(mDatabase, 5000);
+        if(!exec("PRAGMA journal_mode=WAL", errorState))
+            return false;
+
+        if(!exec(utility::stringFormat("CREATE TABLE IF NOT EXISTS %s (Hour INTEGER PRIMARY KEY, Hashes INTEGER, Filter BLOB)", mTableName.c_str()), errorState))
+            return false;
+
+        if(!exec(utility::stringFormat("CREATE TABLE IF NOT EXISTS %s_meta (Key TEXT PRIMARY KEY, Value INTEGER)", mTableName.c_str()), errorState))
+            return false;
+
+        // Read the progress of the job
+        sqlite3_stmt* statement = nullptr;
+        if(!prepare(utility::stringFormat("SELECT Key, Value FROM %s_meta", mTableName.c_str()), &statement, errorState))
+            return false;
+
+        while(sqlite3_step(statement) == SQLITE_ROW)
+        {
+            std::string key = reinterpret_cast<const char*>(sqlite3_column_text(statement, 0));
+            uint64 value = static_cast<uint64>(sqlite3_column_int64(statement, 1));
+            if(key == "IndexedSince")
+                mIndexedSince = value;
+            else if(key == "IndexedUntil")
+                mIndexedUntil = value;
+        }
+        sqlite3_finalize(statement);
+
+        // The filters are small, a month of hours fits in a few megabytes, lookups never touch the database
+        if(!prepare(utility::stringFormat("SELECT Hour, Hashes, Filter FROM %s", mTableName.c_str()), &statement, errorState))
+            return false;
+
+        int result;
+        while((result = sqlite3_step(statement)) == SQLITE_ROW)
+        {
+            uint64 hour = static_cast<uint64>(sqlite3_column_int64(statement, 0));
+            int hashes = sqlite3_column_int(statement, 1);
+            const void* blob = sqlite3_column_blob(statement, 2);
+            size_t size = static_cast<size_t>(sqlite3_column_bytes(statement, 2));
+            std::vector<uint64> bits(size / sizeof(uint64));
+            if(!bits.empty())
+                memcpy(bits.data(), blob, bits.size() * sizeof(uint64));
+            mFilters.emplace(hour, BloomFilter(std::move(bits), hashes));
+        }
+        sqlite3_finalize(statement);
+        if(!errorState.check(result == SQLITE_DONE, "Failed to read aircraft index : %s", sqlite3_errmsg(mDatabase)))
+            return false;
+
+        if(!prepare(utility::stringFormat("INSERT OR REPLACE INTO %s (Hour, Hashes, Filter) VALUES (?1, ?2, ?3)", mTableName.c_str()),
+                    &mInsertStatement, errorState))
+            return false;
+
+        mThread = std::thread([this](){ run(); });
+        return true;
+    }
+
+
+    bool AircraftIndex::findAircraft(const std::string& icao, uint64 begin, uint64 end, std::vector<Observation>& observations,
+                                     int& segments, utility::ErrorState& errorState)
+    {
+        std::vector<std::pair<uint64, uint64>> ranges;
+        if(!getRanges(icao, begin, end, ranges, segments, errorState))
+            return false;
+
+        // The key is only looked up, the snapshots that hold the aircraft remember its identifier when they're parsed
+        uint64 key = findICAO(icao.c_str());
+        auto add_snapshot = [key, &observations](uint64 timestamp, const std::vector<FlightState>& states)
+        {
+            auto it = std::find_if(states.begin(), states.end(), [key](const FlightState& state){ return state.mICAO == key; });
+            if(it == states.end())
+                return;
+
+            Observation observation;
+            observation.mTimeStamp = timestamp;
+            observation.mState = *it;
+            observations.emplace_back(std::move(observation));
+        };
+
+        for(const auto& range : ranges)
+        {
+            if(!mFlightStatesStore->readSnapshots(range.first, range.second, mCompression.get(), add_snapshot, errorState))
+                return false;
+        }
+
+        return true;
+    }
+
+
+    bool AircraftIndex::getRanges(const std::string& icao, uint64 begin, uint64 end, std::vector<std::pair<uint64, uint64>>& ranges,
+                                  int& segments, utility::ErrorState& errorState)
+    {
+        segments = 0;
+        std::lock_guard<std::mutex> lock(mMutex);
+
+        // Every hour that overlaps (begin, end]
+        for(uint64 hour = begin - begin % sHour; hour <= end;)
+        {
+            uint64 hour_end = 0;
+            if(!utility::nextPeriod(hour, sHour, hour_end, errorState))
+                return false;
+
+            // Hours without a filter, not indexed yet or expired, are always read
+            auto it = mFilters.find(hour);
+            bool indexed = hour >= mIndexedSince && hour < mIndexedUntil && it != mFilters.end();
+            if(!indexed || it->second.mayContain(icao))
+            {
+                uint64 range_begin = 0;
+                uint64 range_end = 0;
+                if(!utility::getSnapshotRange(hour, hour_end, range_begin, range_end, errorState))
+                    return false;
+
+                range_begin = std::max(range_begin, begin);
+                range_end = std::min(range_end, end);
+                if(range_begin < range_end)
+                {
+                    if(!ranges.empty() && ranges.back().second == range_begin)
+                        ranges.back().second = range_end;
+                    else
+                        ranges.emplace_back(range_begin, range_end);
+                    segments++;
+                }
+            }
+            hour = hour_end;
+        }
+
+        return true;
+    }
+
+
+    void AircraftIndex::run()
+    {
+        TRACE_THREAD_NAME("aircraft index");
+        auto stopping = [this]()
+        {
+            std::lock_guard<std::mutex> lock(mStopMutex);
+            return mStop;
+        };
+
+        // Without filters the job starts with the history that is already logged
+        uint64 indexed_until = 0;
+        {
+            std::lock_guard<std::mutex> lock(mMutex);
+            if(mIndexedUntil == 0)
+            {
+                utility::ErrorState error_state;
+                uint64 start = utility::uint64FromDateTime(DateTime(SystemClock::now() - std::chrono::hours(mBackfillHours)));
+                start -= start % sHour;
+                if(!setMeta("IndexedSince", start, error_state) || !setMeta("IndexedUntil", start, error_state))
+                {
+                    nap::Logger::error(*this, "Failed to start aircraft index : %s", error_state.toString().c_str());
+                    return;
+                }
+                mIndexedSince = start;
+                mIndexedUntil = start;
+            }
+            indexed_until = mIndexedUntil;
+        }
+
+        while(true)
+        {
+            // Index every hour that is completed
+            while(!stopping())
+            {
+                utility::ErrorState error_state;
+                uint64 hour_end = 0;
+                if(!utility::nextPeriod(indexed_until, sHour, hour_end, error_state))
+                {
+                    nap::Logger::error(*this, "Invalid index hour %s : %s", std::to_string(indexed_until).c_str(), error_state.toString().c_str());
+                    return;
+                }
+
+                uint64 settled = utility::uint64FromDateTime(DateTime(SystemClock::now() - std::chrono::seconds(sSettleSeconds)));
+                if(hour_end > settled)
+                    break;
+
+                if(!indexHour(indexed_until, error_state))
+                {
+                    // Retried on the next update
+                    nap::Logger::error(*this, "Failed to index hour %s : %s", std::to_string(indexed_until).c_str(), error_state.toString().c_str());
+                    break;
+                }
+                indexed_until = hour_end;
+            }
+
+            std::unique_lock<std::mutex> lock(mStopMutex);
+            mStopCondition.wait_for(lock, std::chrono::duration<float>(mUpdateInterval), [this](){ return mStop; });
+            if(mStop)
+                return;
+        }
+    }
+
+
+    bool AircraftIndex::indexHour(uint64 hour, utility::ErrorState& errorState)
+    {
+        TRACE_ZONE("AircraftIndex::indexHour");
+        uint64 hour_end = 0;
+        if(!utility::nextPeriod(hour, sHour, hour_end, errorState))
+            return false;
+
+        // The hour is [hour, hour_end)
+        uint64 begin = 0;
+        uint64 end = 0;
+        if(!utility::getSnapshotRange(hour, hour_end, begin, end, errorState))
+            return false;
+
+        // Collect the aircraft outside of the lock, lookups only wait for the write
+        std::unordered_set<uint64> aircraft;
+        auto add_snapshot = [&aircraft](uint64 timestamp, const std::vector<FlightState>& states)
+        {
+            for(const auto& state : states)
+                aircraft.emplace(state.mICAO);
+        };
+        if(!mFlightStatesStore->readSnapshots(begin, end, mCompression.get(), add_snapshot, errorState))
+            return false;
+
+        // Filters hash the formatted identifier, so the filters stored while identifiers were kept as strings remain valid
+        BloomFilter filter(aircraft.size(), mBitsPerAircraft);
+        for(uint64 icao : aircraft)
+            filter.add(formatICAO(icao));
+
+        uint64 expired = 0;
+        if(!utility::subtractFromTimeStamp(hour_end, std::chrono::hours(mRetentionHours), expired, errorState))
+            return false;
+
+        // The filter, the progress and the retention are written in one transaction, so a failed hour is simply indexed again
+        std::lock_guard<std::mutex> lock(mMutex);
+        if(!exec("BEGIN TRANSACTION", errorState))
+            return false;
+
+        const auto& bits = filter.getBits();
+        sqlite3_bind_int64(mInsertStatement, 1, static_cast<sqlite3_int64>(hour));
+        sqlite3_bind_int(mInsertStatement, 2, filter.getHashes());
+        sqlite3_bind_blob(mInsertStatement, 3, bits.data(), static_cast<int>(bits.size() * sizeof(uint64)), SQLITE_STATIC);
+        int result = sqlite3_step(mInsertStatement);
+        sqlite3_reset(mInsertStatement);
+
+        bool success = errorState.check(result == SQLITE_DONE, "Failed to insert aircraft filter : %s", sqlite3_errmsg(mDatabase)) &&
+                       setMeta("IndexedUntil", hour_end, errorState) &&
+                       exec(utility::stringFormat("DELETE FROM %s WHERE Hour < %s", mTableName.c_str(), std::to_string(expired).c_str()), errorState);
+
+        if(!exec(success ? "COMMIT" : "ROLLBACK", errorState) || !success)
+            return false;
+
+        mFilters[hour] = std::move(filter);
+        mFilters.erase(mFilters.begin(), mFilters.lower_bound(expired));
+        mIndexedUntil = hour_end;
+        return true;
+    }
+
+
+    bool AircraftIndex::setMeta(const char* key, uint64 value, utility::ErrorState& errorState)
+    {
+        return exec(utility::stringFormat("INSERT OR REPLACE INTO %s_meta (Key, Value) VALUES ('%s', %s)",
+                                          mTableName.c_str(), key, std::to_string(value).c_str()), errorState);
+    }
+
+
+    bool AircraftIndex::exec(const std::string& sql, utility::ErrorState& errorState)
+    {
+        char* error = nullptr;
+        if(sqlite3_exec(mDatabase, sql.c_str(), nullptr, nullptr, &error) != SQLITE_OK)
+        {
+            errorState.fail("SQL error : %s", error != nullptr ? error : "unknown");
+            sqlite3_free(error);
+            return false;
+        }
+        return true;
+    }
+
+
+    bool AircraftIndex::prepare(const std::string& sql, sqlite3_stmt** statement, utility::ErrorState& errorState)
+    {
+        return errorState.check(sqlite3_prepare_v2(mDatabase, sql.c_str(), -1, statement, nullptr) == SQLITE_OK,
+                                "Failed to prepare statement : %s", sqlite3_errmsg(mDatabase));
+    }
+}
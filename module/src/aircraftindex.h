@@ -0,0 +1,109 @@
+#pragma once
+
+#include <nap/resource.h>
+#include <nap/resourceptr.h>
+#include <nap/numeric.h>
+#include <mutex>
+#include <thread>
+#include <condition_variable>
+#include <map>
+
+#include "bloomfilter.h"
+#include "databasetableresource.h"
+#include "flightstatescompression.h"
+#include "flightstatesstore.h"
+
+// Forward declares
+struct sqlite3;
+struct sqlite3_stmt;
+
+namespace nap
+{
+    /**
+     * A membership index of the logged aircraft per hour, used to find the history of a single aircraft
+     * A background job reads every completed hour from the flight states store once and stores a bloom filter of the ICAO
+     * codes seen during that hour. Looking up an aircraft only decodes the hours whose filter contains it,
+     * the hours the job hasn't indexed yet, like the current hour, are always decoded.
+     * The filters live in their own database file and are kept in memory, all methods are thread safe
+     */
+    class NAPAPI AircraftIndex : public Resource
+    {
+    RTTI_ENABLE(Resource)
+    public:
+        /**
+         * A single observation of an aircraft
+         */
+        struct Observation
+        {
+            uint64 mTimeStamp = 0; ///< Timestamp of the snapshot in uint64 YYYYMMDDHHMMSS
+            FlightState mState; ///< The state of the aircraft
+        };
+
+        /**
+         * Destructor, stops the job and closes the database
+         */
+        ~AircraftIndex() override;
+
+        /**
+         * Opens the database, loads the filters and starts the index job
+         * @param errorState the error state to store errors in
+         * @return true if the index was initialized
+         */
+        bool init(utility::ErrorState &errorState) final;
+
+        /**
+         * Get every observation of an aircraft between begin and end, in time order
+         * @param icao the ICAO address of the aircraft as passed in the request
+         * @param begin the begin timestamp in uint64 YYYYMMDDHHMMSS, exclusive
+         * @param end the end timestamp in uint64 YYYYMMDDHHMMSS, inclusive
+         * @param observations the observations of the aircraft
+         * @param segments the number of hours that were decoded
+         * @param errorState the error state to store errors in
+         * @return true if the query succeeded
+         */
+        bool findAircraft(const std::string& icao, uint64 begin, uint64 end, std::vector<Observation>& observations,
+                          int& segments, utility::ErrorState& errorState);
+
+        /**
+         * Get the parts of (begin, end] that may hold observations of an aircraft, adjacent hours are merged
+         * @param icao the ICAO address of the aircraft as passed in the request
+         * @param begin the begin timestamp in uint64 YYYYMMDDHHMMSS, exclusive
+         * @param end the end timestamp in uint64 YYYYMMDDHHMMSS, inclusive
+         * @param ranges the ranges to read, (begin, end] in uint64 YYYYMMDDHHMMSS, ordered by time
+         * @param segments the number of hours in the ranges
+         * @param errorState the error state to store errors in
+         * @return true if the timestamps could be parsed
+         */
+        bool getRanges(const std::string& icao, uint64 begin, uint64 end, std::vector<std::pair<uint64, uint64>>& ranges,
+                       int& segments, utility::ErrorState& errorState);
+
+        ResourcePtr<DatabaseTableResource> mFlightStatesDatabase; ///< Property: "FlightStatesDatabase" - The database holding the flight states
+        ResourcePtr<FlightStatesCompression> mCompression; ///< Property: "Compression" - Optional compression of the stored flight states
+        std::string mFlightStatesTableName = "states"; ///< Property: "FlightStatesTableName" - Flight states table name
+        std::string mDatabaseName = "aircraft.db"; ///< Property: "DatabaseName" - The database file that holds the filters
+        std::string mTableName = "aircraft"; ///< Property: "TableName" - Name of the filters table
+        int mBitsPerAircraft = 10; ///< Property: "BitsPerAircraft" - Filter bits per aircraft, 10 bits gives about 1% false positives
+        int mBackfillHours = 768; ///< Property: "BackfillHours" - Hours of existing history to index when no filters exist yet
+        int mRetentionHours = 768; ///< Property: "RetentionHours" - Hours to keep the filters, should match the retention of the flight states
+        float mUpdateInterval = 60.0f; ///< Property: "UpdateInterval" - Seconds between checks for completed hours
+    private:
+        void run();
+        bool indexHour(uint64 hour, utility::ErrorState& errorState);
+        bool setMeta(const char* key, uint64 value, utility::ErrorState& errorState);
+        bool exec(const std::string& sql, utility::ErrorState& errorState);
+        bool prepare(const std::string& sql, sqlite3_stmt** statement, utility::ErrorState& errorState);
+
+        FlightStatesStore* mFlightStatesStore = nullptr;
+        std::mutex mMutex;
+        sqlite3* mDatabase = nullptr;
+        sqlite3_stmt* mInsertStatement = nullptr;
+        std::map<uint64, BloomFilter> mFilters;
+        uint64 mIndexedSince = 0;
+        uint64 mIndexedUntil = 0;
+
+        std::thread mThread;
+        std::mutex mStopMutex;
+        std::condition_variable mStopCondition;
+        bool mStop = false;
+    };
+}
@@ -0,0 +1,80 @@
+#include "bloomfilter.h"
+
+#include <math.h>
+
+namespace nap
+{
+    /**
+     * 64 bit FNV-1a, the second hash is derived from it using double hashing
+     */
+    static uint64 hashKey(const std::string& key)
+    {
+        uint64 hash = 14695981039346656037ull;
+        for(char c : key)
+        {
+            hash ^= static_cast<uint8>(c);
+            hash *= 1099511628211ull;
+        }
+        return hash;
+    }
+
+
+    static uint64 deriveHash(uint64 hash)
+    {
+        hash ^= hash >> 33;
+        hash *= 0xff51afd7ed558ccdull;
+        hash ^= hash >> 33;
+        return hash | 1;
+    }
+
+
+    BloomFilter::BloomFilter(size_t count, int bitsPerKey)
+    {
+        // The optimal number of hashes is ln(2) * bits per key
+        size_t bits = std::max<size_t>(count * static_cast<size_t>(std::max(bitsPerKey, 1)), 64);
+        mBits.resize((bits + 63) / 64, 0);
+        mHashes = std::max(1, static_cast<int>(std::round(bitsPerKey * 0.693)));
+    }
+
+
+    BloomFilter::BloomFilter(std::vector<uint64> bits, int hashes) :
+        mBits(std::move(bits)), mHashes(std::max(hashes, 1))
+    {
+    }
+
+
+    void BloomFilter::add(const std::string& key)
+    {
+        if(mBits.empty())
+            return;
+
+        uint64 size = mBits.size() * 64;
+        uint64 hash = hashKey(key);
+        uint64 delta = deriveHash(hash);
+        for(int i = 0; i < mHashes; i++)
+        {
+            uint64 bit = hash % size;
+            mBits[bit / 64] |= 1ull << (bit % 64);
+            hash += delta;
+        }
+    }
+
+
+    bool BloomFilter::mayContain(const std::string& key) const
+    {
+        if(mBits.empty())
+            return false;
+
+        uint64 size = mBits.size() * 64;
+        uint64 hash = hashKey(key);
+        uint64 delta = deriveHash(hash);
+        for(int i = 0; i < mHashes; i++)
+        {
+            uint64 bit = hash % size;
+            if((mBits[bit / 64] & (1ull << (bit % 64))) == 0)
+                return false;
+            hash += delta;
+        }
+        return true;
+    }
+}
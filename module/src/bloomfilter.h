@@ -0,0 +1,58 @@
+#pragma once
+
+#include <nap/numeric.h>
+#include <string>
+#include <vector>
+
+namespace nap
+{
+    /**
+     * A fixed size set membership filter without false negatives.
+     * mayContain() is true for every added key and for a small fraction of the other keys,
+     * roughly 1% at 10 bits per key. Hashes are stable across runs so filters can be stored.
+     */
+    class NAPAPI BloomFilter
+    {
+    public:
+        BloomFilter() = default;
+
+        /**
+         * Creates an empty filter sized for the given number of keys
+         * @param count expected number of keys
+         * @param bitsPerKey number of bits per key, more bits give fewer false positives
+         */
+        BloomFilter(size_t count, int bitsPerKey);
+
+        /**
+         * Creates a filter from stored bits
+         * @param bits the bits of the filter
+         * @param hashes number of hashes per key
+         */
+        BloomFilter(std::vector<uint64> bits, int hashes);
+
+        /**
+         * Adds a key
+         * @param key the key to add
+         */
+        void add(const std::string& key);
+
+        /**
+         * @param key the key to look up
+         * @return false if the key was definitely not added
+         */
+        bool mayContain(const std::string& key) const;
+
+        /**
+         * @return the bits of the filter, to store it
+         */
+        const std::vector<uint64>& getBits() const { return mBits; }
+
+        /**
+         * @return number of hashes per key, to store it
+         */
+        int getHashes() const { return mHashes; }
+    private:
+        std::vector<uint64> mBits;
+        int mHashes = 1;
+    };
+}
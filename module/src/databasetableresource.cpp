@@ -1,11 +1,48 @@
 #include "databasetableresource.h"
+#include "flightstatesstore.h"
+#include "flightstateslogstore.h"
+
+#include <filesystem>
 
 RTTI_BEGIN_CLASS(nap::DatabaseTableResource)
     RTTI_PROPERTY("DatabaseName", &nap::DatabaseTableResource::mDatabaseName, nap::rtti::EPropertyMetaData::Default)
+    RTTI_PROPERTY("Backend", &nap::DatabaseTableResource::mBackend, nap::rtti::EPropertyMetaData::Default)
+    RTTI_PROPERTY("LogDirectory", &nap::DatabaseTableResource::mLogDirectory, nap::rtti::EPropertyMetaData::Default)
+    RTTI_PROPERTY("SegmentMinutes", &nap::DatabaseTableResource::mSegmentMinutes, nap::rtti::EPropertyMetaData::Default)
 RTTI_END_CLASS
 
 
 namespace nap
 {
+    DatabaseTableResource::~DatabaseTableResource() = default;
+
+
+    FlightStatesStore* DatabaseTableResource::getFlightStatesStore(const std::string& tableName, utility::ErrorState& errorState)
+    {
+        auto it = mStores.find(tableName);
+        if(it != mStores.end())
+        {
+            return it->second.get();
+        }
+
+        if(mBackend == "Log")
+        {
+            auto store = std::make_unique<LogFlightStatesStore>((std::filesystem::path(mLogDirectory) / tableName).string(), mSegmentMinutes);
+            if(!store->init(errorState))
+                return nullptr;
+            mStores[tableName] = std::move(store);
+        }else
+        {
+            auto* table = getDatabaseTable<FlightStatesData>(tableName);
+            if(!errorState.check(table != nullptr, "Failed to get table %s", tableName.c_str()))
+                return nullptr;
+
+            auto store = std::make_unique<SQLiteFlightStatesStore>(*table);
+            if(!store->init(errorState))
+                return nullptr;
+            mStores[tableName] = std::move(store);
+        }
 
-}
\ No newline at end of file
+        return mStores[tableName].get();
+    }
+}
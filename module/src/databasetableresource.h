@@ -7,12 +7,20 @@
 
 namespace nap
 {
+    // Forward declares
+    class FlightStatesStore;
+
     class NAPAPI DatabaseTableResource : public Resource
     {
     RTTI_ENABLE(Resource)
     public:
+        ~DatabaseTableResource() override;
+
         bool init(utility::ErrorState &errorState)
         {
+            if(!errorState.check(mBackend == "SQLite" || mBackend == "Log", "Backend must be SQLite or Log"))
+                return false;
+
             mDatabase = std::make_unique<Database>(mDatabaseFactory);
             if (!mDatabase->init(mDatabaseName, errorState))
             {
@@ -23,13 +31,25 @@ namespace nap
         }
 
         std::string mDatabaseName = "test.db";
+        std::string mBackend = "SQLite"; ///< Property: "Backend" - Storage of flight states tables, SQLite or Log
+        std::string mLogDirectory = "states"; ///< Property: "LogDirectory" - Directory of the segment files of the Log backend
+        int mSegmentMinutes = 60; ///< Property: "SegmentMinutes" - Duration of a segment file of the Log backend, must divide an hour
 
         template<typename T>
         DatabaseTable* getDatabaseTable(const std::string& tableName);
+
+        /**
+         * Get or create the store of a flight states table, using the configured backend
+         * @param tableName name of the table
+         * @param errorState the error state to store errors in
+         * @return the store, nullptr on failure
+         */
+        FlightStatesStore* getFlightStatesStore(const std::string& tableName, utility::ErrorState& errorState);
     private:
         std::unique_ptr<Database> mDatabase;
         rtti::Factory mDatabaseFactory;
         std::unordered_map<std::string, DatabaseTable*> mTables;
+        std::unordered_map<std::string, std::unique_ptr<FlightStatesStore>> mStores;
     };
 
     template<typename T>
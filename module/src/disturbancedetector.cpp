@@ -0,0 +1,151 @@
+#include "disturbancedetector.h"
+#include "utils.h"
+
+namespace nap
+{
+    void DisturbancePeriod::addToJson(rapidjson::Value& periods, const FlightRows& flights, rapidjson::Document& document) const
+    {
+        rapidjson::Value disturbance(rapidjson::kObjectType);
+        disturbance.AddMember("begin", mBegin, document.GetAllocator());
+        disturbance.AddMember("end", mEnd, document.GetAllocator());
+        disturbance.AddMember("flights", rapidjson::Value(rapidjson::kArrayType), document.GetAllocator());
+        for(size_t i = mFirst; i < mFirst + mOccurrences; i++)
+        {
+            const auto& f = flights[i].mState;
+            rapidjson::Value flight(rapidjson::kObjectType);
+            flight.AddMember("icao", rapidjson::Value(formatICAO(f.mICAO).c_str(), document.GetAllocator()), document.GetAllocator());
+            flight.AddMember("reg", rapidjson::Value(f.mRegistration.c_str(), document.GetAllocator()), document.GetAllocator());
+            flight.AddMember("aircraft_type", rapidjson::Value(f.mAircraftType.c_str(), document.GetAllocator()), document.GetAllocator());
+            flight.AddMember("lat", f.mLatitude, document.GetAllocator());
+            flight.AddMember("lon", f.mLongitude, document.GetAllocator());
+            flight.AddMember("altitude", f.mAltitude, document.GetAllocator());
+            flight.AddMember("timestamp", flights[i].mTimeStamp, document.GetAllocator());
+            disturbance["flights"].PushBack(flight, document.GetAllocator());
+        }
+        disturbance.AddMember("occurrences", mOccurrences, document.GetAllocator());
+        periods.PushBack(disturbance, document.GetAllocator());
+    }
+
+
+    bool DisturbanceDetector::addFlight(uint64 timestamp, utility::ErrorState& errorState)
+    {
+        DateTime dt;
+        if(!utility::dateTimeFromUINT64(timestamp, dt, errorState))
+            return false;
+        mFlightCount++;
+
+        // Every flight is compared to the one before it
+        if(!mHasPrevious)
+        {
+            mHasPrevious = true;
+            mPreviousTimeStamp = timestamp;
+            mPreviousTime = dt.getTimeStamp();
+            return true;
+        }
+
+        // if the time difference is less than the period, we are in a (potential) disturbance period
+        auto dt_diff_minutes = (std::chrono::duration<double, std::milli>(dt.getTimeStamp() - mPreviousTime).count() / 1000) / 60;
+        if(dt_diff_minutes < mPeriod)
+        {
+            if(mInPeriodCount == 0 && !mCurrentlyInPeriod)
+            {
+                mBeginCurrentPeriod = mPreviousTimeStamp;
+
+                // the period starts at the previous flight
+                mFirstCurrentPeriod = mFlightCount - 2;
+                mDisturbancesCount++;
+            }
+
+            // advance the count
+            mInPeriodCount++;
+            mDisturbancesCount++;
+
+            // if we have enough occurrences, we are in a disturbance period
+            if(mInPeriodCount >= mOccurrences)
+            {
+                mCurrentlyInPeriod = true;
+                mInPeriodCount = 0;
+                mEndCurrentPeriod = timestamp;
+            }
+        }else
+        {
+            closePeriod();
+        }
+
+        mPreviousTimeStamp = timestamp;
+        mPreviousTime = dt.getTimeStamp();
+        return true;
+    }
+
+
+    bool DisturbanceDetector::advance(uint64 timestamp, utility::ErrorState& errorState)
+    {
+        if(!mHasPrevious)
+            return true;
+
+        DateTime dt;
+        if(!utility::dateTimeFromUINT64(timestamp, dt, errorState))
+            return false;
+
+        // The next flight can't be part of the current period anymore
+        if(dt.getTimeStamp() - mPreviousTime >= std::chrono::minutes(mPeriod))
+            closePeriod();
+
+        return true;
+    }
+
+
+    void DisturbanceDetector::finish()
+    {
+        // register the period if we have enough occurrences
+        if(mCurrentlyInPeriod && mDisturbancesCount >= mOccurrences)
+            registerPeriod();
+    }
+
+
+    size_t DisturbanceDetector::getFirstPending() const
+    {
+        // A new period can start at the last flight
+        if(mInPeriodCount > 0 || mCurrentlyInPeriod)
+            return mFirstCurrentPeriod;
+        return mHasPrevious ? mFlightCount - 1 : mFlightCount;
+    }
+
+
+    void DisturbanceDetector::takePeriods(std::vector<DisturbancePeriod>& periods)
+    {
+        for(auto& period : mPeriods)
+            periods.emplace_back(std::move(period));
+        mPeriods.clear();
+    }
+
+
+    void DisturbanceDetector::closePeriod()
+    {
+        // if we are in a disturbance period with enough occurrences the period is registered, otherwise it is discarded
+        if(mCurrentlyInPeriod && mDisturbancesCount >= mOccurrences)
+            registerPeriod();
+        else
+            resetPeriod();
+    }
+
+
+    void DisturbanceDetector::registerPeriod()
+    {
+        DisturbancePeriod disturbance_period;
+        disturbance_period.mBegin = mBeginCurrentPeriod;
+        disturbance_period.mEnd = mEndCurrentPeriod;
+        disturbance_period.mFirst = mFirstCurrentPeriod;
+        disturbance_period.mOccurrences = mDisturbancesCount;
+        mPeriods.emplace_back(std::move(disturbance_period));
+        resetPeriod();
+    }
+
+
+    void DisturbanceDetector::resetPeriod()
+    {
+        mCurrentlyInPeriod = false;
+        mInPeriodCount = 0;
+        mDisturbancesCount = 0;
+    }
+}
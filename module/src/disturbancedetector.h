@@ -0,0 +1,121 @@
+#pragma once
+
+#include <nap/numeric.h>
+#include <nap/datetime.h>
+#include <vector>
+#include <rapidjson/document.h>
+
+#include "flightstate.h"
+
+namespace nap
+{
+    /**
+     * Structure to hold a disturbance period
+     */
+    struct NAPAPI DisturbancePeriod
+    {
+    public:
+        uint64 mBegin; ///< Begin timestamp of the disturbance period
+        uint64 mEnd; ///< End timestamp of the disturbance period
+        size_t mFirst; ///< Index of the first flight of the period, in the order the flights were added to the detector
+        int mOccurrences; ///< Number of occurrences in the disturbance period, the flights following mFirst
+
+        /**
+         * Adds the period to a json array of periods
+         * @param periods the json array
+         * @param flights the flights the period refers to
+         * @param document the document that owns the array
+         */
+        void addToJson(rapidjson::Value& periods, const FlightRows& flights, rapidjson::Document& document) const;
+    };
+
+
+    /**
+     * Detects disturbance periods in a stream of flights over a location.
+     * Flights less than Period minutes apart form a potential disturbance period, the period is registered
+     * when it holds at least Occurrences flights. Flights are added one by one in time order, so the same
+     * detector serves a one off query over a window and a watch that is updated with every new snapshot.
+     */
+    class NAPAPI DisturbanceDetector
+    {
+    public:
+        /**
+         * @param period maximum time in minutes between two flights of a disturbance period
+         * @param occurrences minimum number of flights in a disturbance period
+         */
+        DisturbanceDetector(int period, int occurrences) : mPeriod(period), mOccurrences(occurrences) {}
+
+        /**
+         * Adds the next flight, flights must be added in time order
+         * The detector only keeps the index of every flight, periods refer to the flights by the order they were added in
+         * @param timestamp the moment the flight was seen in uint64 YYYYMMDDHHMMSS
+         * @param errorState the error state to store errors in
+         * @return false if the timestamp couldn't be parsed
+         */
+        bool addFlight(uint64 timestamp, utility::ErrorState& errorState);
+
+        /**
+         * Closes the current period when no flight can extend it anymore
+         * @param timestamp the current time in uint64 YYYYMMDDHHMMSS
+         * @param errorState the error state to store errors in
+         * @return false if the timestamp couldn't be parsed
+         */
+        bool advance(uint64 timestamp, utility::ErrorState& errorState);
+
+        /**
+         * Registers the current period if it holds enough flights, call when no more flights follow
+         */
+        void finish();
+
+        /**
+         * @return if the flights seen last are part of a disturbance period
+         */
+        bool isDisturbed() const { return mCurrentlyInPeriod; }
+
+        /**
+         * @return begin timestamp of the current disturbance period, only valid when disturbed
+         */
+        uint64 getCurrentBegin() const { return mBeginCurrentPeriod; }
+
+        /**
+         * @return number of flights in the current disturbance period, only valid when disturbed
+         */
+        int getCurrentOccurrences() const { return mDisturbancesCount; }
+
+        /**
+         * @return the number of flights added
+         */
+        size_t getFlightCount() const { return mFlightCount; }
+
+        /**
+         * @return index of the oldest flight that can still become part of a period, older flights are only referred to by registered periods
+         */
+        size_t getFirstPending() const;
+
+        /**
+         * Moves the registered periods out of the detector
+         * @param periods vector to add the periods to, in time order
+         */
+        void takePeriods(std::vector<DisturbancePeriod>& periods);
+    private:
+        void closePeriod();
+        void registerPeriod();
+        void resetPeriod();
+
+        int mPeriod;
+        int mOccurrences;
+
+        size_t mFlightCount = 0; // number of flights added
+        bool mHasPrevious = false;
+        uint64 mPreviousTimeStamp = 0;
+        SystemTimeStamp mPreviousTime;
+
+        int mInPeriodCount = 0; // count of flights in the period
+        int mDisturbancesCount = 0; // count of total disturbances in a period
+        bool mCurrentlyInPeriod = false; // are we currently in a disturbance period
+        uint64 mBeginCurrentPeriod = 0; // timestamp of the beginning of the current period
+        uint64 mEndCurrentPeriod = 0; // timestamp of the end of the current period
+        size_t mFirstCurrentPeriod = 0; // index of the first flight of the current period
+        std::vector<DisturbancePeriod> mPeriods; // list of found disturbance periods
+    };
+}
@@ -0,0 +1,296 @@
+#include "disturbancewatches.h"
+#include "utils.h"
+
+#include <nap/logger.h>
+#include <math.h>
+
+RTTI_BEGIN_CLASS(nap::DisturbanceWatches)
+    RTTI_PROPERTY("StatesCache", &nap::DisturbanceWatches::mStatesCache, nap::rtti::EPropertyMetaData::Default)
+    RTTI_PROPERTY("MaxWatches", &nap::DisturbanceWatches::mMaxWatches, nap::rtti::EPropertyMetaData::Default)
+    RTTI_PROPERTY("MaxPeriods", &nap::DisturbanceWatches::mMaxPeriods, nap::rtti::EPropertyMetaData::Default)
+    RTTI_PROPERTY("ExpireHours", &nap::DisturbanceWatches::mExpireHours, nap::rtti::EPropertyMetaData::Default)
+    RTTI_PROPERTY("CellSize", &nap::DisturbanceWatches::mCellSize, nap::rtti::EPropertyMetaData::Default)
+RTTI_END_CLASS
+
+namespace nap
+{
+    double calcGPSDistance(double latitude_new, double longitude_new, double latitude_old, double longitude_old);
+
+    // Meters per degree latitude, used to convert the radius of a watch into a bounding box
+    static constexpr double sMetersPerDegree = 111320.0;
+
+    bool DisturbanceWatches::init(utility::ErrorState &errorState)
+    {
+        if(!errorState.check(mMaxWatches > 0, "MaxWatches must be greater than 0"))
+            return false;
+
+        if(!errorState.check(mMaxPeriods > 0, "MaxPeriods must be greater than 0"))
+            return false;
+
+        if(!errorState.check(mExpireHours > 0, "ExpireHours must be greater than 0"))
+            return false;
+
+        if(!errorState.check(mCellSize > 0.0f, "CellSize must be greater than 0"))
+            return false;
+
+        // Ids are random so watches of other clients can't be guessed
+        mRandom.seed(std::random_device()());
+        return true;
+    }
+
+
+    bool DisturbanceWatches::addWatch(float latitude, float longitude, float radius, float altitude, int period, int occurrences,
+                                      std::string& id, utility::ErrorState& errorState)
+    {
+        {
+            std::lock_guard<std::mutex> lock(mMutex);
+            if(!errorState.check(mWatches.size() < static_cast<size_t>(mMaxWatches), "Maximum number of watches reached"))
+                return false;
+        }
+
+        auto watch = std::make_unique<Watch>(period, occurrences);
+        watch->mLatitude = latitude;
+        watch->mLongitude = longitude;
+        watch->mRadius = radius;
+        watch->mAltitude = altitude;
+        watch->mPeriod = period;
+        watch->mLastRead = SystemClock::now();
+
+        // Replay the recent history, enough to establish whether the location is disturbed right now.
+        // The watch isn't registered yet, so the replay doesn't block the snapshots that are added meanwhile
+        uint64 newest = mStatesCache != nullptr ? mStatesCache->getMostRecentTimeStamp() : 0;
+        if(newest != 0)
+        {
+            uint64 begin = 0;
+            auto history = std::chrono::minutes(static_cast<int64>(period) * (static_cast<int64>(occurrences) + 1));
+            if(!utility::subtractFromTimeStamp(newest, history, begin, errorState) || !replay(*watch, begin, newest, errorState))
+                return false;
+        }
+
+        std::lock_guard<std::mutex> lock(mMutex);
+        if(!errorState.check(mWatches.size() < static_cast<size_t>(mMaxWatches), "Maximum number of watches reached"))
+            return false;
+
+        // The cache receives a snapshot before the watches do, so replaying what the cache received since the replay
+        // under the lock means no snapshot is missed. Snapshots the watches receive later are skipped as evaluated already
+        if(mStatesCache != nullptr && mStatesCache->getMostRecentTimeStamp() > watch->mUpdated)
+        {
+            if(!replay(*watch, watch->mUpdated, mStatesCache->getMostRecentTimeStamp(), errorState))
+                return false;
+        }
+
+        do
+        {
+            watch->mID = utility::stringFormat("%016llx", static_cast<unsigned long long>(mRandom()));
+        }while(mWatches.find(watch->mID) != mWatches.end());
+
+        // Register the watch in every grid cell its area overlaps
+        double lat_delta = radius / sMetersPerDegree;
+        double lon_delta = radius / (sMetersPerDegree * std::max(std::cos(latitude * M_PI / 180.0), 0.01));
+        for(int32 cell_lat = toCellIndex(latitude - lat_delta); cell_lat <= toCellIndex(latitude + lat_delta); cell_lat++)
+        {
+            for(int32 cell_lon = toCellIndex(longitude - lon_delta); cell_lon <= toCellIndex(longitude + lon_delta); cell_lon++)
+            {
+                uint64 key = toCellKey(cell_lat, cell_lon);
+                mGrid[key].emplace_back(watch.get());
+                watch->mCells.emplace_back(key);
+            }
+        }
+
+        id = watch->mID;
+        mWatches.emplace(id, std::move(watch));
+        return true;
+    }
+
+
+    bool DisturbanceWatches::getWatch(const std::string& id, Status& status)
+    {
+        std::lock_guard<std::mutex> lock(mMutex);
+        auto it = mWatches.find(id);
+        if(it == mWatches.end())
+            return false;
+
+        auto& watch = *it->second;
+        watch.mLastRead = SystemClock::now();
+        status.mDisturbed = watch.mDetector.isDisturbed();
+        status.mCurrentBegin = watch.mDetector.getCurrentBegin();
+        status.mCurrentOccurrences = watch.mDetector.getCurrentOccurrences();
+        status.mUpdated = watch.mUpdated;
+        // The periods are handed out with only their own flights, indexed from the first flight of the oldest period
+        if(!watch.mPeriods.empty())
+        {
+            size_t first = watch.mPeriods.front().mFirst;
+            size_t last = watch.mPeriods.back().mFirst + watch.mPeriods.back().mOccurrences;
+            status.mFlights.assign(watch.mFlights.begin() + (first - watch.mFirstFlight), watch.mFlights.begin() + (last - watch.mFirstFlight));
+            for(const auto& period : watch.mPeriods)
+            {
+                status.mPeriods.emplace_back(period);
+                status.mPeriods.back().mFirst -= first;
+            }
+        }
+        return true;
+    }
+
+
+    void DisturbanceWatches::addStates(uint64 timestamp, const std::vector<FlightState>& states)
+    {
+        utility::ErrorState error_state;
+        DateTime dt;
+        if(!utility::dateTimeFromUINT64(timestamp, dt, error_state))
+        {
+            nap::Logger::error(*this, "Invalid snapshot timestamp %s", std::to_string(timestamp).c_str());
+            return;
+        }
+        auto time = dt.getTimeStamp();
+
+        std::lock_guard<std::mutex> lock(mMutex);
+
+        // Only the watches in the cell of an aircraft can contain it
+        for(const auto& state : states)
+        {
+            auto it = mGrid.find(toCellKey(toCellIndex(state.mLatitude), toCellIndex(state.mLongitude)));
+            if(it == mGrid.end())
+                continue;
+
+            for(auto* watch : it->second)
+            {
+                // Snapshots that were replayed when the watch was added are skipped
+                if(timestamp > watch->mUpdated)
+                    evaluate(*watch, state, timestamp, time);
+            }
+        }
+
+        // Every watch advances, also when no aircraft is near it
+        auto now = SystemClock::now();
+        std::vector<std::string> expired;
+        for(auto& pair : mWatches)
+        {
+            auto& watch = *pair.second;
+            if(now - watch.mLastRead > std::chrono::hours(mExpireHours))
+            {
+                expired.emplace_back(pair.first);
+                continue;
+            }
+
+            if(timestamp > watch.mUpdated)
+                complete(watch, timestamp, time);
+        }
+
+        for(const auto& id : expired)
+            removeWatch(id);
+    }
+
+
+    void DisturbanceWatches::evaluate(Watch& watch, const FlightState& state, uint64 timestamp, SystemTimeStamp time)
+    {
+        if(watch.mAltitude > 0 && state.mAltitude > watch.mAltitude)
+            return;
+
+        double distance = calcGPSDistance(watch.mLatitude, watch.mLongitude, state.mLatitude, state.mLongitude);
+        if(distance >= watch.mRadius)
+            return;
+
+        // An aircraft that stays in the area is a single flight
+        auto it = watch.mLastSeen.find(state.mICAO);
+        if(it != watch.mLastSeen.end())
+        {
+            it->second = time;
+            return;
+        }
+        watch.mLastSeen.emplace(state.mICAO, time);
+
+        // The timestamp was parsed by the caller already
+        utility::ErrorState error_state;
+        watch.mFlights.push_back({ state, timestamp, static_cast<float>(distance) });
+        watch.mDetector.addFlight(timestamp, error_state);
+    }
+
+
+    void DisturbanceWatches::complete(Watch& watch, uint64 timestamp, SystemTimeStamp time)
+    {
+        // Aircraft that have been gone for the period count as a new flight when they return
+        for(auto it = watch.mLastSeen.begin(); it != watch.mLastSeen.end();)
+        {
+            if(time - it->second >= std::chrono::minutes(watch.mPeriod))
+                it = watch.mLastSeen.erase(it);
+            else
+                ++it;
+        }
+
+        utility::ErrorState error_state;
+        watch.mDetector.advance(timestamp, error_state);
+
+        std::vector<DisturbancePeriod> periods;
+        watch.mDetector.takePeriods(periods);
+        for(auto& period : periods)
+            watch.mPeriods.emplace_back(std::move(period));
+        while(watch.mPeriods.size() > static_cast<size_t>(mMaxPeriods))
+            watch.mPeriods.pop_front();
+
+        // Flights before the oldest kept period that can't become part of a new period aren't needed anymore
+        size_t first_needed = watch.mDetector.getFirstPending();
+        if(!watch.mPeriods.empty())
+            first_needed = std::min(first_needed, watch.mPeriods.front().mFirst);
+        while(watch.mFirstFlight < first_needed)
+        {
+            watch.mFlights.pop_front();
+            watch.mFirstFlight++;
+        }
+
+        watch.mUpdated = timestamp;
+    }
+
+
+    bool DisturbanceWatches::replay(Watch& watch, uint64 begin, uint64 end, utility::ErrorState& errorState)
+    {
+        std::vector<FlightStates> snapshots;
+        mStatesCache->getStates(begin, end, watch.mAltitude, snapshots);
+        for(const auto& snapshot : snapshots)
+        {
+            if(snapshot.mTimeStamp <= watch.mUpdated)
+                continue;
+
+            DateTime dt;
+            if(!utility::dateTimeFromUINT64(snapshot.mTimeStamp, dt, errorState))
+                return false;
+
+            for(const auto& state : snapshot.mStates)
+                evaluate(watch, state, snapshot.mTimeStamp, dt.getTimeStamp());
+            complete(watch, snapshot.mTimeStamp, dt.getTimeStamp());
+        }
+        return true;
+    }
+
+
+    void DisturbanceWatches::removeWatch(const std::string& id)
+    {
+        auto it = mWatches.find(id);
+        if(it == mWatches.end())
+            return;
+
+        for(uint64 key : it->second->mCells)
+        {
+            auto cell = mGrid.find(key);
+            if(cell == mGrid.end())
+                continue;
+
+            auto& watches = cell->second;
+            watches.erase(std::remove(watches.begin(), watches.end(), it->second.get()), watches.end());
+            if(watches.empty())
+                mGrid.erase(cell);
+        }
+        mWatches.erase(it);
+    }
+
+
+    uint64 DisturbanceWatches::toCellKey(int32 latitude, int32 longitude) const
+    {
+        return (static_cast<uint64>(static_cast<uint32>(latitude)) << 32) | static_cast<uint32>(longitude);
+    }
+
+
+    int32 DisturbanceWatches::toCellIndex(float coordinate) const
+    {
+        return static_cast<int32>(std::floor(coordinate / mCellSize));
+    }
+}
@@ -0,0 +1,114 @@
+#pragma once
+
+#include <nap/resource.h>
+#include <nap/resourceptr.h>
+#include <mutex>
+#include <random>
+#include <deque>
+#include <unordered_map>
+
+#include "statescache.h"
+#include "disturbancedetector.h"
+
+namespace nap
+{
+    /**
+     * Registered disturbance watches that are evaluated incrementally with every new snapshot.
+     * A watch covers a location, radius and altitude. Every aircraft entering the area counts as a flight,
+     * aircraft that stay in the area count once until they've been gone for the period of the watch.
+     * The flights are fed to a disturbance detector, so the current state and the recent periods of a watch
+     * are always up to date and reading them doesn't scan any history.
+     * Watches that aren't read for ExpireHours are removed. All methods are thread safe
+     */
+    class NAPAPI DisturbanceWatches : public Resource
+    {
+    RTTI_ENABLE(Resource)
+    public:
+        /**
+         * The state of a watch
+         */
+        struct Status
+        {
+            bool mDisturbed = false; ///< If the last flights are part of a disturbance period
+            uint64 mCurrentBegin = 0; ///< Begin of the current disturbance period, only valid when disturbed
+            int mCurrentOccurrences = 0; ///< Flights in the current disturbance period, only valid when disturbed
+            uint64 mUpdated = 0; ///< Timestamp of the last evaluated snapshot
+            std::vector<DisturbancePeriod> mPeriods; ///< The most recent completed periods, in time order
+            FlightRows mFlights; ///< The flights of the periods, which refer to them by index
+        };
+
+        /**
+         * @param errorState the error state to store errors in
+         * @return true if the properties are valid
+         */
+        bool init(utility::ErrorState &errorState) final;
+
+        /**
+         * Registers a watch, the watch is seeded with the recent history in the states cache
+         * @param latitude latitude of the location
+         * @param longitude longitude of the location
+         * @param radius radius in meters
+         * @param altitude maximum altitude of the flights, ignored when <= 0
+         * @param period maximum time in minutes between two flights of a disturbance period
+         * @param occurrences minimum number of flights in a disturbance period
+         * @param id the id of the new watch
+         * @param errorState the error state to store errors in
+         * @return true if the watch was registered
+         */
+        bool addWatch(float latitude, float longitude, float radius, float altitude, int period, int occurrences,
+                      std::string& id, utility::ErrorState& errorState);
+
+        /**
+         * Get the state of a watch, keeps the watch from expiring
+         * @param id the id of the watch
+         * @param status the state of the watch
+         * @return false if the watch doesn't exist
+         */
+        bool getWatch(const std::string& id, Status& status);
+
+        /**
+         * Evaluates all watches with a new snapshot, called by the logger for every snapshot
+         * @param timestamp the timestamp of the snapshot in uint64 YYYYMMDDHHMMSS
+         * @param states all states of the snapshot
+         */
+        void addStates(uint64 timestamp, const std::vector<FlightState>& states);
+
+        ResourcePtr<StatesCache> mStatesCache; ///< Property: "StatesCache" - Optional cache used to seed new watches with recent history
+        int mMaxWatches = 10000; ///< Property: "MaxWatches" - Maximum number of registered watches
+        int mMaxPeriods = 20; ///< Property: "MaxPeriods" - Number of completed periods kept per watch
+        int mExpireHours = 168; ///< Property: "ExpireHours" - Hours after which a watch that isn't read is removed
+        float mCellSize = 0.05f; ///< Property: "CellSize" - Size in degrees of the grid cells used to find the watches near an aircraft
+    private:
+        struct Watch
+        {
+            Watch(int period, int occurrences) : mDetector(period, occurrences) {}
+
+            std::string mID;
+            float mLatitude = 0.0f;
+            float mLongitude = 0.0f;
+            float mRadius = 0.0f;
+            float mAltitude = 0.0f;
+            int mPeriod = 0;
+            DisturbanceDetector mDetector;
+            std::unordered_map<uint64, SystemTimeStamp> mLastSeen; // Last moment every aircraft in the area was seen
+            std::deque<DisturbancePeriod> mPeriods;
+            std::deque<FlightRow> mFlights; // Flights of the kept periods and flights that can still become part of a period
+            size_t mFirstFlight = 0; // Index in the detector of the first flight in mFlights
+            std::vector<uint64> mCells;
+            uint64 mUpdated = 0;
+            SystemTimeStamp mLastRead;
+        };
+
+        void evaluate(Watch& watch, const FlightState& state, uint64 timestamp, SystemTimeStamp time);
+        void complete(Watch& watch, uint64 timestamp, SystemTimeStamp time);
+        bool replay(Watch& watch, uint64 begin, uint64 end, utility::ErrorState& errorState);
+        void removeWatch(const std::string& id);
+        uint64 toCellKey(int32 latitude, int32 longitude) const;
+        int32 toCellIndex(float coordinate) const;
+
+        std::mutex mMutex;
+        std::unordered_map<std::string, std::unique_ptr<Watch>> mWatches;
+        std::unordered_map<uint64, std::vector<Watch*>> mGrid;
+        std::mt19937_64 mRandom;
+    };
+}
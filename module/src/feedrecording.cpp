@@ -0,0 +1,133 @@
+#include "feedrecording.h"
+
+#include <utility/stringutils.h>
+#include <zstd.h>
+#include <filesystem>
+#include <limits>
+
+namespace nap
+{
+    // Recorded responses are large and rarely read, a fast level keeps the recorder cheap for the logger
+    static constexpr int sCompressionLevel = 3;
+
+    FeedRecording::FeedRecording(const std::string& directory) :
+        mDirectory(directory), mStore(directory, 60)
+    {
+        mNextSegment = mSegments.end();
+    }
+
+
+    bool FeedRecording::init(utility::ErrorState& errorState)
+    {
+        if(!mStore.init(errorState))
+            return false;
+
+        // The store created the directory, list the segments to read them in order
+        std::error_code error;
+        for(const auto& entry : std::filesystem::directory_iterator(mDirectory, error))
+        {
+            if(entry.path().extension() != ".log")
+                continue;
+
+            try
+            {
+                mSegments.insert(std::stoull(entry.path().stem().string()));
+            }
+            catch(const std::exception&)
+            {
+                continue;
+            }
+        }
+        if(!errorState.check(!error, "Failed to list directory %s : %s", mDirectory.c_str(), error.message().c_str()))
+            return false;
+
+        mNextSegment = mSegments.begin();
+        return true;
+    }
+
+
+    bool FeedRecording::add(uint64 timestamp, const std::string& response, utility::ErrorState& errorState)
+    {
+        FlightStatesData row;
+        row.mTimeStamp = timestamp;
+        row.mData.resize(ZSTD_compressBound(response.size()));
+        size_t size = ZSTD_compress(&row.mData[0], row.mData.size(), response.data(), response.size(), sCompressionLevel);
+        if(!errorState.check(!ZSTD_isError(size), "Failed to compress response : %s", ZSTD_getErrorName(size)))
+            return false;
+
+        row.mData.resize(size);
+        return mStore.add(row, errorState);
+    }
+
+
+    bool FeedRecording::readNext(std::vector<std::unique_ptr<FlightStatesData>>& responses, utility::ErrorState& errorState)
+    {
+        if(mNextSegment == mSegments.end())
+            return false;
+
+        // Segments start at the hour, the rows of a segment are newer than the second before it
+        uint64 key = *mNextSegment++;
+        uint64 next_key = mNextSegment != mSegments.end() ? *mNextSegment : std::numeric_limits<uint64>::max();
+        size_t first = responses.size();
+        if(!mStore.query(key - 1, next_key - 1, responses, errorState))
+            return false;
+
+        for(size_t i = first; i < responses.size(); i++)
+        {
+            auto& row = *responses[i];
+            auto content_size = ZSTD_getFrameContentSize(row.mData.data(), row.mData.size());
+            if(!errorState.check(content_size != ZSTD_CONTENTSIZE_ERROR && content_size != ZSTD_CONTENTSIZE_UNKNOWN,
+                                 "Response at %s is not valid", std::to_string(row.mTimeStamp).c_str()))
+                return false;
+
+            std::string response(content_size, '\0');
+            size_t size = ZSTD_decompress(&response[0], response.size(), row.mData.data(), row.mData.size());
+            if(!errorState.check(!ZSTD_isError(size), "Failed to decompress response at %s : %s",
+                                 std::to_string(row.mTimeStamp).c_str(), ZSTD_getErrorName(size)))
+                return false;
+            row.mData = std::move(response);
+        }
+
+        return true;
+    }
+
+
+    std::string FeedRecording::merge(const std::vector<std::string>& responses)
+    {
+        if(responses.size() == 1)
+            return responses.front();
+
+        // Duplicate members, like the stats of every tile, are allowed by the parser, aircraft reported by
+        // more than one tile are deduplicated by the logger
+        std::string merged = "{";
+        for(const auto& response : responses)
+        {
+            auto begin = response.find('{');
+            auto end = response.rfind('}');
+            if(begin == std::string::npos || end == std::string::npos || end <= begin + 1)
+                continue;
+
+            auto members = response.substr(begin + 1, end - begin - 1);
+            if(members.find_first_not_of(" \t\r\n") == std::string::npos)
+                continue;
+
+            if(merged.size() > 1)
+                merged += ',';
+            merged += members;
+        }
+        merged += '}';
+        return merged;
+    }
+
+
+    void FeedRecording::addFeedTime(uint64 timestamp, std::string& response)
+    {
+        auto begin = response.find('{');
+        if(begin == std::string::npos)
+            return;
+
+        // Members are only separated when the response has members already
+        bool empty = response.find_first_not_of(" \t\r\n", begin + 1) == response.find('}', begin + 1);
+        response.insert(begin + 1, utility::stringFormat("\"%s\":%s%s", kFeedTimeMember, std::to_string(timestamp).c_str(), empty ? "" : ","));
+    }
+}
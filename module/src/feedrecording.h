@@ -0,0 +1,69 @@
+#pragma once
+
+#include <nap/numeric.h>
+#include <set>
+
+#include "flightstateslogstore.h"
+
+namespace nap
+{
+    /**
+     * Raw feed responses stored with the moment they were received, so the feed can be replayed later
+     * Responses are compressed with zstd and appended to hourly segments of a log store, one row per poll.
+     * Reading is sequential: the segments are listed when the recording is opened and read one at a time.
+     */
+    class NAPAPI FeedRecording
+    {
+    public:
+        /**
+         * @param directory the directory holding the segments
+         */
+        FeedRecording(const std::string& directory);
+
+        /**
+         * Opens the recording, creates the directory when it doesn't exist
+         * @param errorState the error state to store errors in
+         * @return true if the recording was opened
+         */
+        bool init(utility::ErrorState& errorState);
+
+        /**
+         * Appends a response, responses must be added in time order
+         * @param timestamp the moment the response was received in uint64 YYYYMMDDHHMMSS
+         * @param response the raw response
+         * @param errorState the error state to store errors in
+         * @return true if the response was stored
+         */
+        bool add(uint64 timestamp, const std::string& response, utility::ErrorState& errorState);
+
+        /**
+         * Reads the responses of the next segment, starting at the first segment after init()
+         * @param responses the rows of the segment in time order, the data of every row is decompressed
+         * @param errorState the error state to store errors in
+         * @return false when all segments were read or a row couldn't be decompressed, see hasErrors() of the error state
+         */
+        bool readNext(std::vector<std::unique_ptr<FlightStatesData>>& responses, utility::ErrorState& errorState);
+
+        /**
+         * Merges the responses of several tiles into one response the logger parses as a single tile
+         * Aircraft are members of the response object, so the members of all responses are concatenated
+         * @param responses the responses to merge
+         * @return the merged response
+         */
+        static std::string merge(const std::vector<std::string>& responses);
+
+        /**
+         * Adds the moment a replayed response was recorded to the response, see PlaneLoggerComponent::mUseFeedTime
+         * @param timestamp the moment the response was recorded in uint64 YYYYMMDDHHMMSS
+         * @param response the response to add the time to
+         */
+        static void addFeedTime(uint64 timestamp, std::string& response);
+
+        static constexpr const char* kFeedTimeMember = "replay_time";
+    private:
+        std::string mDirectory;
+        LogFlightStatesStore mStore;
+        std::set<uint64> mSegments;
+        std::set<uint64>::iterator mNextSegment;
+    };
+}
@@ -8,6 +8,8 @@
 #include "restutils.h"
 #include "restcontenttypes.h"
 #include "addresscachedata.h"
+#include "trace.h"
+#include "requestarena.h"
 
 #include <math.h>
 #include "utils.h"
@@ -20,9 +22,14 @@ RTTI_END_CLASS
 RTTI_BEGIN_CLASS(nap::FetchFlightsCall)
     RTTI_PROPERTY("FlightStatesDatabase", &nap::FetchFlightsCall::mFlightStatesDatabase, nap::rtti::EPropertyMetaData::Required)
     RTTI_PROPERTY("StatesCache", &nap::FetchFlightsCall::mStatesCache, nap::rtti::EPropertyMetaData::Required)
+    RTTI_PROPERTY("PositionIndex", &nap::FetchFlightsCall::mPositionIndex, nap::rtti::EPropertyMetaData::Default)
+    RTTI_PROPERTY("WorkerPool", &nap::FetchFlightsCall::mWorkerPool, nap::rtti::EPropertyMetaData::Default)
+    RTTI_PROPERTY("Compression", &nap::FetchFlightsCall::mCompression, nap::rtti::EPropertyMetaData::Default)
     RTTI_PROPERTY("FlightStatesTableName", &nap::FetchFlightsCall::mFlightStatesTableName, nap::rtti::EPropertyMetaData::Default)
     RTTI_PROPERTY("AddressCacheRetentionDays", &nap::FetchFlightsCall::mAddressCacheRetentionDays, nap::rtti::EPropertyMetaData::Default)
     RTTI_PROPERTY("MaxDurationHours", &nap::FetchFlightsCall::mMaxDurationHours, nap::rtti::EPropertyMetaData::Default)
+    RTTI_PROPERTY("Metrics", &nap::FetchFlightsCall::mMetrics, nap::rtti::EPropertyMetaData::Default)
+    RTTI_PROPERTY("SlowRequestMillis", &nap::FetchFlightsCall::mSlowRequestMillis, nap::rtti::EPropertyMetaData::Default)
 RTTI_END_CLASS
 
 #define ENABLE_DEBUG_LOG 0
@@ -34,11 +41,27 @@ RTTI_END_CLASS
 
 namespace nap
 {
-    double calcGPSDistance(double latitude_new, double longitude_new, double latitude_old, double longitude_old);
+    double NAPAPI calcGPSDistance(double latitude_new, double longitude_new, double latitude_old, double longitude_old);
 
     bool FetchFlightsCall::init(utility::ErrorState &errorState)
     {
-        mDatabaseTable = mFlightStatesDatabase->getDatabaseTable<FlightStatesData>(mFlightStatesTableName);
+        auto* store = mFlightStatesDatabase->getFlightStatesStore(mFlightStatesTableName, errorState);
+        if(store == nullptr)
+            return false;
+
+        if(mMetrics != nullptr)
+        {
+            mRequestDuration = &mMetrics->addRequestHistogram(mID);
+            mAddressCacheLookups = &mMetrics->addCounter("overmyroof_geocode_lookups", "Postal codes resolved to a location", { { "source", "cache" } });
+            mPro6ppLookups = &mMetrics->addCounter("overmyroof_geocode_lookups", "Postal codes resolved to a location", { { "source", "pro6pp" } });
+            mPro6ppErrors = &mMetrics->addCounter("overmyroof_geocode_errors", "Requests to Pro6pp that failed");
+            mPro6ppDuration = &mMetrics->addHistogram("overmyroof_geocode_pro6pp_seconds", "Duration of the requests to Pro6pp", Metrics::kDurationBuckets);
+        }
+
+        // The cache is preferred, anything it doesn't hold is read from the database
+        mPlanner = std::make_unique<StatesQueryPlanner>(mWorkerPool.get(), mMetrics.get());
+        mPlanner->addTier(std::make_unique<CacheStatesTier>(*mStatesCache));
+        mPlanner->addTier(std::make_unique<DatabaseStatesTier>(*store, mPositionIndex.get(), mCompression.get()));
 
         // try and get the pro6pp key from the file
         if(!utility::readFileToString(mPro6ppDescription->mPro6ppKeyFile, mPro6ppKey, errorState))
@@ -53,50 +76,71 @@ namespace nap
 
     RestResponse FetchFlightsCall::call(const std::unordered_map<std::string, std::unique_ptr<APIBaseValue>> &values)
     {
+        TRACE_ZONE("FetchFlightsCall::call");
         // The timer calculates the time it takes to execute the request
         // This is used to determine the performance of the request
         // The amount of milliseconds it took to execute the request is added to the response
         SteadyTimer timer;
         timer.start();
+        Metrics::ScopedTimer request_timer(mRequestDuration);
+
+        // The rows, the response document and the serialized response are released in one go when the call returns
+        RequestArena arena;
+
+        // Timings are collected when requested or to log slow requests
+        bool timings_requested = timingsRequested(values);
+        RequestTimings timings;
+        RequestTimings* request_timings = timings_requested || mSlowRequestMillis > 0.0f ? &timings : nullptr;
 
         // Get states
         utility::ErrorState error_state;
-        std::vector<FlightState> filtered_states;
-        std::unordered_map<std::string, uint64> timestamps;
-        std::unordered_map<std::string, float> distances;
-        if(!getFlights(values, filtered_states, timestamps, distances, error_state))
+        StatesQueryPlanner::Result flights_result(arena.getResource());
+        if(!getFlights(values, flights_result, error_state, request_timings))
             return utility::generateErrorResponse(error_state.toString());
 
         // Create the json document
-        rapidjson::Document document(rapidjson::kObjectType);
+        auto response_start = std::chrono::steady_clock::now();
+        rapidjson::Document document(rapidjson::kObjectType, &arena.getJsonAllocator());
         rapidjson::Value data(rapidjson::kObjectType);
         document.AddMember("status", "ok", document.GetAllocator());
 
         // Add found flights to the response
         rapidjson::Value flights(rapidjson::kArrayType);
-        for(const auto& state : filtered_states)
+        for(const auto& row : flights_result.mFlights)
         {
+            const auto& state = row.mState;
             rapidjson::Value flight(rapidjson::kObjectType);
-            flight.AddMember("icao", rapidjson::Value(state.mICAO.c_str(), document.GetAllocator()), document.GetAllocator());
+            flight.AddMember("icao", rapidjson::Value(formatICAO(state.mICAO).c_str(), document.GetAllocator()), document.GetAllocator());
             flight.AddMember("reg", rapidjson::Value(state.mRegistration.c_str(), document.GetAllocator()), document.GetAllocator());
             flight.AddMember("aircraft_type", rapidjson::Value(state.mAircraftType.c_str(), document.GetAllocator()), document.GetAllocator());
             flight.AddMember("lat", state.mLatitude, document.GetAllocator());
             flight.AddMember("lon", state.mLongitude, document.GetAllocator());
             flight.AddMember("altitude", state.mAltitude, document.GetAllocator());
-            flight.AddMember("timestamp", timestamps[state.mICAO], document.GetAllocator());
-            flight.AddMember("distance", distances[state.mICAO], document.GetAllocator());
+            flight.AddMember("timestamp", row.mTimeStamp, document.GetAllocator());
+            flight.AddMember("distance", row.mDistance, document.GetAllocator());
 
             flights.PushBack(flight, document.GetAllocator());
         }
         data.AddMember("flights", flights, document.GetAllocator());
         data.AddMember("ms", timer.getMillis().count(), document.GetAllocator());
+        if(request_timings != nullptr)
+            timings.addTime("response", RequestTimings::getMillis(response_start, std::chrono::steady_clock::now()));
+        if(timings_requested)
+            timings.addToJson(data, document);
         document.AddMember("data", data, document.GetAllocator());
 
-        // Serialize the response
-        rapidjson::StringBuffer buffer;
-        rapidjson::PrettyWriter<rapidjson::StringBuffer> writer(buffer);
-        writer.SetMaxDecimalPlaces(4);
-        document.Accept(writer);
+        // Serialize the response, the serialization time can only be logged
+        RequestArena::JsonBuffer buffer(&arena.getJsonAllocator());
+        {
+            RequestTimings::Scope serialize_scope(request_timings, "serialize");
+            rapidjson::PrettyWriter<RequestArena::JsonBuffer> writer(buffer);
+            writer.SetMaxDecimalPlaces(4);
+            document.Accept(writer);
+        }
+
+        float millis = static_cast<float>(timer.getMillis().count());
+        if(timings_requested || (mSlowRequestMillis > 0.0f && millis > mSlowRequestMillis))
+            nap::Logger::info(*this, "Request took %.0f ms : %s", millis, timings.toString().c_str());
 
         // Create the response
         RestResponse response;
@@ -108,13 +152,90 @@ namespace nap
 
 
     bool FetchFlightsCall::getFlights(const nap::RestValueMap &values,
-                                      std::vector<FlightState> &filteredStates,
-                                      std::unordered_map<std::string, uint64> &timeStamps,
-                                      std::unordered_map<std::string, float> &distances,
-                                      utility::ErrorState &errorState)
+                                      StatesQueryPlanner::Result &result,
+                                      utility::ErrorState &errorState,
+                                      RequestTimings* timings)
     {
         float lat, lon, altitude, radius;
-        std::string begin, end, postal_code, streetnumber_and_premise;
+        std::string begin, end;
+        if(!getLocation(values, lat, lon, errorState, timings))
+            return false;
+
+        if(!extractValue("altitude", values, altitude, errorState))
+        {
+            return false;
+        }
+        if(!extractValue("radius", values, radius, errorState))
+        {
+            return false;
+        }
+        if(!extractValue("begin", values, begin, errorState))
+        {
+            return false;
+        }
+        if(!extractValue("end", values, end, errorState))
+        {
+            return false;
+        }
+
+        // The requested window is (begin, end]
+        uint64 begin_timestamp = std::stoull(begin);
+        uint64 end_timestamp = std::stoull(end);
+
+        // check if end and begin are smaller than allowed period
+        DateTime begin_dt;
+        if(!utility::dateTimeFromUINT64(begin_timestamp, begin_dt, errorState))
+            return false;
+
+        DateTime end_dt;
+        if(!utility::dateTimeFromUINT64(end_timestamp, end_dt, errorState))
+            return false;
+
+        // check if the duration is smaller than the allowed period
+        std::chrono::hours max_duration(mMaxDurationHours);
+        if(!errorState.check(std::chrono::duration_cast<std::chrono::hours>(end_dt.getTimeStamp() - begin_dt.getTimeStamp()) <= max_duration,
+                             utility::stringFormat("Duration exceeds maximum duration of %d hours", mMaxDurationHours)))
+            return false;
+
+        // Every part of the window is read from the cheapest source that holds it
+        StatesQuery query;
+        query.mLatitude = lat;
+        query.mLongitude = lon;
+        query.mRadius = radius;
+        query.mAltitude = altitude;
+
+        // Optional comma separated aircraft types and registration prefixes
+        std::string types, registrations;
+        if(values.find("types") != values.end() && !extractValue("types", values, types, errorState))
+            return false;
+        if(values.find("registrations") != values.end() && !extractValue("registrations", values, registrations, errorState))
+            return false;
+        query.mFilter.parse(types, registrations);
+
+        if(!mPlanner->execute(begin_timestamp, end_timestamp, query, result, errorState, timings))
+            return false;
+
+        if(timings != nullptr)
+            timings->addCount("aircraft_matched", result.mFlights.size());
+
+        DEBUG_LOG(*this, "Read %d snapshots", result.mRows);
+        DEBUG_LOG(*this, "Filtered %d states", result.mFlights.size());
+
+        return true;
+    }
+
+
+    bool FetchFlightsCall::timingsRequested(const nap::RestValueMap &values) const
+    {
+        utility::ErrorState error_state;
+        int timings = 0;
+        return values.find("timings") != values.end() && extractValue("timings", values, timings, error_state) && timings != 0;
+    }
+
+
+    bool FetchFlightsCall::getLocation(const nap::RestValueMap &values, float &lat, float &lon, utility::ErrorState &errorState, RequestTimings* timings)
+    {
+        std::string postal_code, streetnumber_and_premise;
 
         // If postal_code is not provided, lat and lon should be provided
         utility::ErrorState error_state_2;
@@ -145,6 +266,8 @@ namespace nap
             bool acquired_lat_lon_from_cache = false;
             if(address_cache_table != nullptr)
             {
+                RequestTimings::Scope cache_scope(timings, "address_cache");
+                TRACE_ZONE("AddressCache::query");
                 if(address_cache_table->query(utility::stringFormat("%s = '%s' AND %s = '%s'", "postalCode",
                                                                     postal_code.c_str(),
                                                                     "streetNumberAndPremise",
@@ -172,6 +295,10 @@ namespace nap
                             lat = data->mLat;
                             lon = data->mLon;
                             acquired_lat_lon_from_cache = true;
+                            if(mAddressCacheLookups != nullptr)
+                                mAddressCacheLookups->increment();
+                            if(timings != nullptr)
+                                timings->addCount("address_cache_hits", 1);
                         }else
                         {
                             DEBUG_LOG(*this, "Cache data is too old, removing it");
@@ -198,8 +325,17 @@ namespace nap
                 pro6pp_values.emplace_back(std::make_unique<APIValue<std::string>>(mPro6ppDescription->mPro6ppStreetNumberAndPremiseDescription, streetnumber_and_premise));
                 pro6pp_values.emplace_back(std::make_unique<APIValue<std::string>>(mPro6ppDescription->mPro6ppAuthKeyDescription, mPro6ppKey));
                 RestResponse pro6pp_response;
-                if(!mPro6ppClient->getBlocking(mPro6ppDescription->mPro6ppAddress, pro6pp_values, pro6pp_response, errorState))
+                bool received;
                 {
+                    Metrics::ScopedTimer pro6pp_timer(mPro6ppDuration);
+                    RequestTimings::Scope pro6pp_scope(timings, "pro6pp");
+                    TRACE_ZONE("Pro6pp");
+                    received = mPro6ppClient->getBlocking(mPro6ppDescription->mPro6ppAddress, pro6pp_values, pro6pp_response, errorState);
+                }
+                if(!received)
+                {
+                    if(mPro6ppErrors != nullptr)
+                        mPro6ppErrors->increment();
                     errorState.fail(utility::stringFormat("pro6pp error : %s", errorState.toString().c_str()));
                     return false;
                 }
@@ -208,7 +344,10 @@ namespace nap
                 // return error if parsing fails
 
                 rapidjson::Document document;
-                document.Parse(pro6pp_response.mData.c_str());
+                {
+                    RequestTimings::Scope parse_scope(timings, "pro6pp_parse");
+                    document.Parse(pro6pp_response.mData.c_str());
+                }
                 if(document.HasParseError())
                 {
                     errorState.fail(utility::stringFormat("Failed to parse pro6pp response, document contents : %s", pro6pp_response.mData.c_str()));
@@ -234,11 +373,16 @@ namespace nap
                 // done
                 lat = document[mPro6ppDescription->mPro6ppLatitudeDescription.c_str()].GetFloat();
                 lon = document[mPro6ppDescription->mPro6ppLongitudeDescription.c_str()].GetFloat();
+                if(mPro6ppLookups != nullptr)
+                    mPro6ppLookups->increment();
+                if(timings != nullptr)
+                    timings->addCount("pro6pp_requests", 1);
 
                 // Save the lat and lon to the cache
                 if(address_cache_table != nullptr)
                 {
                     DEBUG_LOG(*this, "Saving lat and lon to cache");
+                    RequestTimings::Scope cache_add_scope(timings, "address_cache_add");
 
                     auto valid_ts = DateTime(SystemClock::now());
                     std::string valid_ts_format = utility::stringFormat("%d%02d%02d%02d%02d%02d",
@@ -264,144 +408,6 @@ namespace nap
             }
         }
 
-        if(!extractValue("altitude", values, altitude, errorState))
-        {
-            return false;
-        }
-        if(!extractValue("radius", values, radius, errorState))
-        {
-            return false;
-        }
-        if(!extractValue("begin", values, begin, errorState))
-        {
-            return false;
-        }
-        if(!extractValue("end", values, end, errorState))
-        {
-            return false;
-        }
-
-        std::vector<std::unique_ptr<rtti::Object>> objects;
-        rtti::Factory factory;
-        std::unordered_map<std::string, std::string> callsigns_to_ignore;
-
-        // Determine how many states we need to fetch from the database and cache
-        uint64 begin_timestamp_db = std::stoull(begin);
-        uint64 end_timestamp_db = std::stoull(end);
-        uint64 begin_timestamp_cache = mStatesCache->getOldestTimeStamp();
-        uint64 end_timestamp_cache = mStatesCache->getMostRecentTimeStamp();
-        bool ignore_cache = false;
-        bool ignore_database = false;
-
-        // check if end and begin are smaller than allowed period
-        DateTime begin_dt;
-        if(!utility::dateTimeFromUINT64(begin_timestamp_db, begin_dt, errorState))
-            return false;
-
-        DateTime end_dt;
-        if(!utility::dateTimeFromUINT64(end_timestamp_db, end_dt, errorState))
-            return false;
-
-        // check if the duration is smaller than the allowed period
-        std::chrono::hours max_duration(mMaxDurationHours);
-        if(!errorState.check(std::chrono::duration_cast<std::chrono::hours>(end_dt.getTimeStamp() - begin_dt.getTimeStamp()) <= max_duration,
-                             utility::stringFormat("Duration exceeds maximum duration of %d hours", mMaxDurationHours)))
-            return false;
-
-        // Completely ignore the cache if timestamps are not overlapping with the cache
-        if(begin_timestamp_db < begin_timestamp_cache && end_timestamp_db < begin_timestamp_cache)
-        {
-            ignore_cache = true;
-        }else if(begin_timestamp_db < begin_timestamp_cache && end_timestamp_db > begin_timestamp_cache)
-        {
-            // Fetch from cache and database
-            if(end_timestamp_db < end_timestamp_cache)
-            {
-                end_timestamp_cache = end_timestamp_db;
-            }
-            end_timestamp_db = begin_timestamp_cache;
-        }else if(begin_timestamp_db > begin_timestamp_cache)
-        {
-            // Fetch only from cache
-            begin_timestamp_cache = begin_timestamp_db;
-            end_timestamp_cache = end_timestamp_db;
-            ignore_database = true;
-        }
-
-        if(!ignore_database)
-        {
-            if(mDatabaseTable->query(utility::stringFormat("%s > %s AND %s < %s", "TimeStamp",
-                                                           std::to_string(begin_timestamp_db).c_str(),
-                                                           "TimeStamp",
-                                                           std::to_string(end_timestamp_db).c_str()),
-                                     objects, factory, errorState))
-            {
-                // Iterate over all the objects
-                for(auto& object : objects)
-                {
-                    assert(object->get_type().is_derived_from<FlightStatesData>());
-
-                    // Cast the object to the correct type
-                    auto* data = static_cast<FlightStatesData*>(object.get());
-                    std::vector<FlightState> states;
-
-                    // Parse the data
-                    if(data->ParseData(states, altitude, errorState))
-                    {
-                        for(const auto& state : states)
-                        {
-                            if(callsigns_to_ignore.find(state.mICAO) != callsigns_to_ignore.end())
-                            {
-                                continue;
-                            }
-
-                            double distance = calcGPSDistance(lat, lon, state.mLatitude, state.mLongitude);
-                            if(distance < radius)
-                            {
-                                filteredStates.push_back(state);
-                                callsigns_to_ignore[state.mICAO] = state.mICAO;
-                                timeStamps[state.mICAO] = data->mTimeStamp;
-                                distances[state.mICAO] = distance;
-                            }
-                        }
-                    }else
-                    {
-                        return false;
-                    }
-                }
-            }
-        }
-
-        std::vector<FlightStates> states;
-        if(!ignore_cache)
-        {
-            if(mStatesCache->getStates(begin_timestamp_cache, end_timestamp_cache, altitude, states))
-            {
-                for(const auto& state : states)
-                {
-                    for(const auto& flight : state.mStates)
-                    {
-                        if(callsigns_to_ignore.find(flight.mICAO) != callsigns_to_ignore.end())
-                        {
-                            continue;
-                        }
-
-                        double distance = calcGPSDistance(lat, lon, flight.mLatitude, flight.mLongitude);
-                        if(distance < radius)
-                        {
-                            filteredStates.push_back(flight);
-                            callsigns_to_ignore[flight.mICAO] = flight.mICAO;
-                            timeStamps[flight.mICAO] = state.mTimeStamp;
-                            distances[flight.mICAO] = distance;
-                        }
-                    }
-                }
-            }
-        }
-
-        DEBUG_LOG(*this, "Got %d states from database and %d states from cache", objects.size(), states.size());
-        DEBUG_LOG(*this, "Filtered %d states", filteredStates.size());
-
         return true;
     }
 
@@ -415,7 +421,7 @@ namespace nap
     #define GRADOS_RADIANES PI / 180
     #define RADIANES_GRADOS 180 / PI
 
-    double calcGPSDistance(double latitude_new, double longitude_new, double latitude_old, double longitude_old)
+    double NAPAPI calcGPSDistance(double latitude_new, double longitude_new, double latitude_old, double longitude_old)
     {
         double lat_new = latitude_old * GRADOS_RADIANES;
         double lat_old = latitude_new * GRADOS_RADIANES;
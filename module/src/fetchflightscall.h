@@ -8,6 +8,13 @@
 #include "statescache.h"
 #include "flightstate.h"
 #include "pro6ppdescription.h"
+#include "positionindex.h"
+#include "workerpool.h"
+#include "flightstatescompression.h"
+#include "flightstatesstore.h"
+#include "statesqueryplanner.h"
+#include "metrics.h"
+#include "requesttimings.h"
 
 namespace nap
 {
@@ -28,6 +35,8 @@ namespace nap
      * It can also fetches the lat, lon from the postal code and street number premise using Pro6pp client
      * which makes a call to the Pro6pp API
      * Lat, lon coordinates are cached in the address cache
+     * The optional types and registrations values limit the flights to comma separated aircraft types and registration prefixes
+     * When the optional timings value is not 0 the response holds the time spent per stage and the snapshots and aircraft examined
      */
     class NAPAPI FetchFlightsCall : public Pro6ppInterface
     {
@@ -37,21 +46,61 @@ namespace nap
 
         RestResponse call(const RestValueMap &values) override;
 
+        /**
+         * Finds the flights that passed the location of a request within its time window
+         * @param values the values of the request
+         * @param result the first observation of every aircraft in time order, with its timestamp and distance
+         * @param errorState the error state to store errors in
+         * @param timings the stage timings to add to, nullptr to skip measuring
+         * @return true if the flights were found
+         */
         bool getFlights(const RestValueMap &values,
-                        std::vector<FlightState> &filteredStates,
-                        std::unordered_map<std::string, uint64> &timeStamps,
-                        std::unordered_map<std::string, float> &distances,
-                        utility::ErrorState& errorState);
+                        StatesQueryPlanner::Result &result,
+                        utility::ErrorState& errorState,
+                        RequestTimings* timings = nullptr);
+
+        /**
+         * Get the location of a request, either from the lat and lon values or by looking up the postal code
+         * and street number using the address cache and the Pro6pp API
+         * @param values the values of the request
+         * @param lat the latitude of the location
+         * @param lon the longitude of the location
+         * @param errorState the error state to store errors in
+         * @param timings optional timings the address cache and Pro6pp lookups are added to
+         * @return true if the location was found
+         */
+        bool getLocation(const RestValueMap &values, float &lat, float &lon, utility::ErrorState& errorState, RequestTimings* timings = nullptr);
+
+        /**
+         * @param values the values of a request
+         * @return if the request asks for the timings of its stages with a timings value that is not 0
+         */
+        bool timingsRequested(const RestValueMap &values) const;
+
+        /**
+         * @return the planner that reads flight states from the cache and the database
+         */
+        const StatesQueryPlanner& getPlanner() const { return *mPlanner; }
 
         // Properties
         ResourcePtr<DatabaseTableResource> mFlightStatesDatabase; ///< Property "FlightStatesDatabase" : Flight states database
         ResourcePtr<StatesCache> mStatesCache; ///< Property "StatesCache" : States cache
+        ResourcePtr<PositionIndex> mPositionIndex; ///< Property "PositionIndex" : Optional spatial index used for database queries
+        ResourcePtr<WorkerPool> mWorkerPool; ///< Property "WorkerPool" : Optional worker pool used to scan the database in parallel
+        ResourcePtr<FlightStatesCompression> mCompression; ///< Property "Compression" : Optional compression of the stored flight states
         int mAddressCacheRetentionDays = 180; ///< Property "AddressCacheRetentionDays" : Address cache retention days
         std::string mFlightStatesTableName = "states"; ///< Property "FlightStatesTableName" : Flight states table name
         std::string mAddressCacheTableName = "addressCache"; ///< Property "AddressCacheTableName" : Address cache table name
         int mMaxDurationHours = 48; ///< Property "MaxDurationHours" : Maximum duration in hours to search for flights
+        ResourcePtr<Metrics> mMetrics; ///< Property "Metrics" : Optional metrics the requests, address lookups and snapshots read per tier are reported in
+        float mSlowRequestMillis = 0.0f; ///< Property "SlowRequestMillis" : Requests slower than this are logged with their timings, 0 disables
     protected:
-        DatabaseTable* mDatabaseTable;
+        std::unique_ptr<StatesQueryPlanner> mPlanner;
         std::string mPro6ppKey;
+        Metrics::Histogram* mRequestDuration = nullptr;
+        Metrics::Counter* mAddressCacheLookups = nullptr;
+        Metrics::Counter* mPro6ppLookups = nullptr;
+        Metrics::Counter* mPro6ppErrors = nullptr;
+        Metrics::Histogram* mPro6ppDuration = nullptr;
     };
 }
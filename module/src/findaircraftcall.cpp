@@ -0,0 +1,108 @@
+#include "findaircraftcall.h"
+#include "trace.h"
+#include "restutils.h"
+#include "restcontenttypes.h"
+#include "nap/logger.h"
+#include "rapidjson/document.h"
+#include "rapidjson/stringbuffer.h"
+#include "rapidjson/prettywriter.h"
+#include <nap/datetime.h>
+#include "utils.h"
+
+RTTI_BEGIN_CLASS(nap::FindAircraftCall)
+    RTTI_PROPERTY("AircraftIndex", &nap::FindAircraftCall::mAircraftIndex, nap::rtti::EPropertyMetaData::Required, "Per hour membership index of the logged aircraft")
+    RTTI_PROPERTY("MaxDurationDays", &nap::FindAircraftCall::mMaxDurationDays, nap::rtti::EPropertyMetaData::Default, "Maximum duration in days to search")
+    RTTI_PROPERTY("Metrics", &nap::FindAircraftCall::mMetrics, nap::rtti::EPropertyMetaData::Default, "Optional metrics the request duration is reported in")
+RTTI_END_CLASS
+
+namespace nap
+{
+    // Identifiers that don't fit a key are remembered by the process, requests can't add arbitrary long ones
+    static constexpr size_t sMaxICAOLength = 32;
+
+    bool FindAircraftCall::init(utility::ErrorState &errorState)
+    {
+        if(mMetrics != nullptr)
+            mRequestDuration = &mMetrics->addRequestHistogram(mID);
+
+        return errorState.check(mMaxDurationDays > 0, "MaxDurationDays must be greater than 0");
+    }
+
+
+    RestResponse FindAircraftCall::call(const RestValueMap &values)
+    {
+        TRACE_ZONE("FindAircraftCall::call");
+        // The amount of milliseconds it took to execute the request is added to the response
+        SteadyTimer timer;
+        timer.start();
+        Metrics::ScopedTimer request_timer(mRequestDuration);
+
+        utility::ErrorState error_state;
+        std::string icao, begin, end;
+        if(!extractValue("icao", values, icao, error_state))
+            return utility::generateErrorResponse(error_state.toString());
+        if(icao.empty() || icao.size() > sMaxICAOLength)
+            return utility::generateErrorResponse(utility::stringFormat("icao must be 1 to %d characters", static_cast<int>(sMaxICAOLength)));
+        if(!extractValue("begin", values, begin, error_state))
+            return utility::generateErrorResponse(error_state.toString());
+        if(!extractValue("end", values, end, error_state))
+            return utility::generateErrorResponse(error_state.toString());
+
+        // The requested window is (begin, end]
+        uint64 begin_timestamp = std::stoull(begin);
+        uint64 end_timestamp = std::stoull(end);
+        DateTime begin_dt;
+        DateTime end_dt;
+        if(!utility::dateTimeFromUINT64(begin_timestamp, begin_dt, error_state) || !utility::dateTimeFromUINT64(end_timestamp, end_dt, error_state))
+            return utility::generateErrorResponse(error_state.toString());
+
+        if(end_timestamp <= begin_timestamp)
+            return utility::generateErrorResponse("end must be after begin");
+
+        if(end_dt.getTimeStamp() - begin_dt.getTimeStamp() > std::chrono::hours(24 * mMaxDurationDays))
+            return utility::generateErrorResponse(utility::stringFormat("Duration exceeds maximum duration of %d days", mMaxDurationDays));
+
+        std::vector<AircraftIndex::Observation> observations;
+        int segments = 0;
+        if(!mAircraftIndex->findAircraft(icao, begin_timestamp, end_timestamp, observations, segments, error_state))
+            return utility::generateErrorResponse(error_state.toString());
+
+        // Create the json document
+        rapidjson::Document document(rapidjson::kObjectType);
+        rapidjson::Value data(rapidjson::kObjectType);
+        document.AddMember("status", "ok", document.GetAllocator());
+        data.AddMember("icao", rapidjson::Value(icao.c_str(), document.GetAllocator()), document.GetAllocator());
+
+        // Add the observations in time order
+        rapidjson::Value track(rapidjson::kArrayType);
+        for(const auto& observation : observations)
+        {
+            const auto& state = observation.mState;
+            rapidjson::Value point(rapidjson::kObjectType);
+            point.AddMember("timestamp", observation.mTimeStamp, document.GetAllocator());
+            point.AddMember("reg", rapidjson::Value(state.mRegistration.c_str(), document.GetAllocator()), document.GetAllocator());
+            point.AddMember("aircraft_type", rapidjson::Value(state.mAircraftType.c_str(), document.GetAllocator()), document.GetAllocator());
+            point.AddMember("lat", state.mLatitude, document.GetAllocator());
+            point.AddMember("lon", state.mLongitude, document.GetAllocator());
+            point.AddMember("altitude", state.mAltitude, document.GetAllocator());
+            track.PushBack(point, document.GetAllocator());
+        }
+        data.AddMember("track", track, document.GetAllocator());
+        data.AddMember("segments", segments, document.GetAllocator());
+        data.AddMember("ms", timer.getMillis().count(), document.GetAllocator());
+        document.AddMember("data", data, document.GetAllocator());
+
+        // Serialize the response
+        rapidjson::StringBuffer buffer;
+        rapidjson::PrettyWriter<rapidjson::StringBuffer> writer(buffer);
+        writer.SetMaxDecimalPlaces(4);
+        document.Accept(writer);
+
+        // Create the response
+        RestResponse response;
+        response.mData = buffer.GetString();
+        response.mContentType = rest::contenttypes::json;
+
+        return response;
+    }
+}
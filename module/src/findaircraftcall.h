@@ -0,0 +1,29 @@
+#pragma once
+
+#include <restfunction.h>
+
+#include "aircraftindex.h"
+#include "metrics.h"
+
+namespace nap
+{
+    /**
+     * FindAircraftCall is a RestFunction that returns where an aircraft was between begin and end.
+     * Only the hours that the aircraft index can't rule out are decoded, tracking a single aircraft over the
+     * whole retention period touches the hours it was logged in plus a small fraction of false positives.
+     */
+    class NAPAPI FindAircraftCall : public RestFunction
+    {
+    RTTI_ENABLE(RestFunction)
+    public:
+        bool init(utility::ErrorState &errorState) final;
+
+        RestResponse call(const RestValueMap &values) override;
+
+        ResourcePtr<AircraftIndex> mAircraftIndex; ///< Property "AircraftIndex" : Per hour membership index of the logged aircraft
+        int mMaxDurationDays = 32; ///< Property "MaxDurationDays" : Maximum duration in days to search
+        ResourcePtr<Metrics> mMetrics; ///< Property "Metrics" : Optional metrics the request duration is reported in
+    private:
+        Metrics::Histogram* mRequestDuration = nullptr;
+    };
+}
@@ -6,6 +6,8 @@
 #include <databasetable.h>
 
 #include "fetchflightscall.h"
+#include "disturbancedetector.h"
+#include "metrics.h"
 
 namespace nap
 {
@@ -20,7 +22,8 @@ namespace nap
         ResourcePtr<FetchFlightsCall> mFetchFlightsCall;
         int mMaxPeriod = 2880; ///< Property "MaxPeriod" : Maximum period in minutes to search for disturbances
         int mMinPeriod = 10; ///< Property "MinPeriod" : Minimum period in minutes to search for disturbances
+        ResourcePtr<Metrics> mMetrics; ///< Property "Metrics" : Optional metrics the request duration is reported in
     private:
-
+        Metrics::Histogram* mRequestDuration = nullptr;
     };
 }
@@ -3,6 +3,10 @@
 
 #include <rapidjson/rapidjson.h>
 #include <rapidjson/document.h>
+#include <rapidjson/writer.h>
+#include <cmath>
+#include <mutex>
+#include <unordered_map>
 
 RTTI_BEGIN_CLASS(nap::FlightStatesData)
     RTTI_PROPERTY(nap::FlightStatesData::kTimeStampPropertyName, &nap::FlightStatesData::mTimeStamp, nap::rtti::EPropertyMetaData::Default)
@@ -12,8 +16,198 @@ RTTI_END_STRUCT
 
 namespace nap
 {
+    // Keys of identifiers that don't fit are a hash with the highest bit set, which packed ASCII never has
+    static constexpr uint64 sLongICAOFlag = 1ull << 63;
+
+    // The identifiers behind the hashed keys, so they can be formatted again
+    static std::mutex sLongICAOMutex;
+    static std::unordered_map<uint64, std::string> sLongICAOs;
+
+    static uint64 createICAOKey(const char* icao)
+    {
+        uint64 key = 0;
+        size_t length = 0;
+        for(; icao[length] != '\0'; length++)
+            key = (key << 8) | static_cast<unsigned char>(icao[length]);
+
+        // Shorter identifiers are padded with zero bytes, which orders them before every longer identifier they prefix
+        if(length == 0)
+            return 0;
+        if(length <= kMaxICAOLength && static_cast<unsigned char>(icao[0]) < 0x80)
+            return key << (8 * (kMaxICAOLength - length));
+
+        // 64 bit FNV-1a, the same identifier gets the same key in every process so stored deltas stay ordered
+        key = 14695981039346656037ull;
+        for(size_t i = 0; i < length; i++)
+        {
+            key ^= static_cast<unsigned char>(icao[i]);
+            key *= 1099511628211ull;
+        }
+        return key | sLongICAOFlag;
+    }
+
+
+    uint64 parseICAO(const char* icao)
+    {
+        uint64 key = createICAOKey(icao);
+        if((key & sLongICAOFlag) != 0)
+        {
+            std::lock_guard<std::mutex> lock(sLongICAOMutex);
+            sLongICAOs.emplace(key, icao);
+        }
+        return key;
+    }
+
+
+    uint64 findICAO(const char* icao)
+    {
+        return createICAOKey(icao);
+    }
+
+
+    std::string formatICAO(uint64 icao)
+    {
+        if((icao & sLongICAOFlag) != 0)
+        {
+            std::lock_guard<std::mutex> lock(sLongICAOMutex);
+            auto it = sLongICAOs.find(icao);
+            return it != sLongICAOs.end() ? it->second : std::string();
+        }
+
+        std::string result;
+        for(int shift = 8 * (kMaxICAOLength - 1); shift >= 0; shift -= 8)
+        {
+            char c = static_cast<char>((icao >> shift) & 0xFF);
+            if(c == '\0')
+                break;
+            result += c;
+        }
+        return result;
+    }
+
+
+    void FlightStatesDelta::sortByICAO(std::vector<FlightState>& states)
+    {
+        std::stable_sort(states.begin(), states.end(), [](const FlightState& a, const FlightState& b)
+        {
+            return a.mICAO < b.mICAO;
+        });
+        states.erase(std::unique(states.begin(), states.end(), [](const FlightState& a, const FlightState& b)
+        {
+            return a.mICAO != 0 && a.mICAO == b.mICAO;
+        }), states.end());
+    }
+
+
+    static bool hasMoved(const FlightState& a, const FlightState& b, float threshold)
+    {
+        // Equirectangular approximation, accurate enough for distances this small
+        static constexpr float meters_per_degree = 111320.0f;
+        float lat_distance = (b.mLatitude - a.mLatitude) * meters_per_degree;
+        float lon_distance = (b.mLongitude - a.mLongitude) * meters_per_degree * std::cos(a.mLatitude * static_cast<float>(M_PI) / 180.0f);
+        return lat_distance * lat_distance + lon_distance * lon_distance > threshold * threshold ||
+               std::abs(b.mAltitude - a.mAltitude) > threshold;
+    }
+
+
+    void FlightStatesDelta::create(const std::vector<FlightState>& previous, const std::vector<FlightState>& next, float threshold, FlightStatesDelta& delta)
+    {
+        // Both snapshots are ordered by ICAO, walk them side by side
+        auto prev = previous.begin();
+        for(const auto& state : next)
+        {
+            if(state.mICAO == 0)
+            {
+                delta.mAdded.emplace_back(state);
+                continue;
+            }
+
+            while(prev != previous.end() && prev->mICAO < state.mICAO)
+            {
+                if(prev->mICAO != 0)
+                    delta.mRemoved.emplace_back(prev->mICAO);
+                ++prev;
+            }
+
+            if(prev == previous.end() || prev->mICAO != state.mICAO ||
+               prev->mRegistration != state.mRegistration || prev->mAircraftType != state.mAircraftType)
+            {
+                delta.mAdded.emplace_back(state);
+            }else if(hasMoved(*prev, state, threshold))
+            {
+                delta.mMoved.push_back({ state.mICAO, state.mLatitude, state.mLongitude, state.mAltitude });
+            }
+
+            if(prev != previous.end() && prev->mICAO == state.mICAO)
+                ++prev;
+        }
+
+        for(; prev != previous.end(); ++prev)
+        {
+            if(prev->mICAO != 0)
+                delta.mRemoved.emplace_back(prev->mICAO);
+        }
+    }
+
+
+    void FlightStatesDelta::apply(std::vector<FlightState>& states) const
+    {
+        std::vector<FlightState> result;
+        result.reserve(states.size() + mAdded.size());
+
+        // Aircraft without ICAO are not tracked, the delta adds them again when they're still there
+        auto added = mAdded.begin();
+        auto moved = mMoved.begin();
+        auto removed = mRemoved.begin();
+        for(auto& state : states)
+        {
+            if(state.mICAO == 0)
+                continue;
+
+            while(added != mAdded.end() && added->mICAO < state.mICAO)
+                result.emplace_back(*added++);
+            while(moved != mMoved.end() && moved->mICAO < state.mICAO)
+                ++moved;
+            while(removed != mRemoved.end() && *removed < state.mICAO)
+                ++removed;
+
+            if(added != mAdded.end() && added->mICAO == state.mICAO)
+            {
+                result.emplace_back(*added++);
+                continue;
+            }
+
+            if(removed != mRemoved.end() && *removed == state.mICAO)
+                continue;
+
+            result.emplace_back(std::move(state));
+            if(moved != mMoved.end() && moved->mICAO == result.back().mICAO)
+            {
+                result.back().mLatitude = moved->mLatitude;
+                result.back().mLongitude = moved->mLongitude;
+                result.back().mAltitude = moved->mAltitude;
+            }
+        }
+        result.insert(result.end(), added, mAdded.end());
+
+        states = std::move(result);
+    }
+
+
+    bool FlightStatesData::IsDelta() const
+    {
+        return mData.compare(0, 8, "{\"delta\"") == 0;
+    }
+
+
     bool FlightStatesData::ParseData(std::vector<FlightState>& states, float altitude, utility::ErrorState& errorState) const
     {
+        if(!errorState.check(!IsDelta(), "Data at %s is a delta, not a keyframe", std::to_string(mTimeStamp).c_str()))
+            return false;
+
+        if(!errorState.check(mData.empty() || mData[0] == '{', "Data at %s is compressed", std::to_string(mTimeStamp).c_str()))
+            return false;
+
         rapidjson::Document d(rapidjson::kObjectType);
         d.Parse(mData.c_str());
         bool ignore_above_altitude = altitude > 0;
@@ -41,7 +235,7 @@ namespace nap
                             state.mLatitude = m->value[0].GetFloat();
                             state.mLongitude = m->value[1].GetFloat();
                             state.mAltitude = m->value[2].GetFloat();
-                            state.mICAO = m->value[3].GetString();
+                            state.mICAO = parseICAO(m->value[3].GetString());
                             state.mRegistration = m->value[4].GetString();
                             state.mAircraftType = m->value[5].GetString();
                             states.push_back(state);
@@ -58,4 +252,143 @@ namespace nap
 
         return true;
     }
-}
\ No newline at end of file
+
+
+    bool FlightStatesData::ParseDelta(FlightStatesDelta& delta, utility::ErrorState& errorState) const
+    {
+        if(!errorState.check(IsDelta(), "Data at %s is a keyframe, not a delta", std::to_string(mTimeStamp).c_str()))
+            return false;
+
+        rapidjson::Document d(rapidjson::kObjectType);
+        d.Parse(mData.c_str());
+        if(!errorState.check(!d.HasParseError() && d.IsObject(), "Failed to parse delta at %s", std::to_string(mTimeStamp).c_str()))
+            return false;
+
+        auto flights = d.FindMember("flights");
+        if(flights != d.MemberEnd() && flights->value.IsArray())
+        {
+            for(auto q = flights->value.Begin(); q != flights->value.End(); ++q)
+            {
+                const auto& data = (*q)["data"];
+                FlightState state;
+                state.mLatitude = data[0].GetFloat();
+                state.mLongitude = data[1].GetFloat();
+                state.mAltitude = data[2].GetFloat();
+                state.mICAO = parseICAO(data[3].GetString());
+                state.mRegistration = data[4].GetString();
+                state.mAircraftType = data[5].GetString();
+                delta.mAdded.emplace_back(std::move(state));
+            }
+        }
+
+        auto moved = d.FindMember("moved");
+        if(moved != d.MemberEnd() && moved->value.IsArray())
+        {
+            for(auto q = moved->value.Begin(); q != moved->value.End(); ++q)
+                delta.mMoved.push_back({ parseICAO((*q)[3].GetString()), (*q)[0].GetFloat(), (*q)[1].GetFloat(), (*q)[2].GetFloat() });
+        }
+
+        auto removed = d.FindMember("removed");
+        if(removed != d.MemberEnd() && removed->value.IsArray())
+        {
+            for(auto q = removed->value.Begin(); q != removed->value.End(); ++q)
+                delta.mRemoved.emplace_back(parseICAO(q->GetString()));
+        }
+
+        return true;
+    }
+
+
+    static void writeFlights(const std::vector<FlightState>& states, rapidjson::Document& document)
+    {
+        rapidjson::Value flights(rapidjson::kArrayType);
+        for(const auto &state: states)
+        {
+            rapidjson::Value flight(rapidjson::kObjectType);
+            rapidjson::Value data(rapidjson::kArrayType);
+
+            data.PushBack(state.mLatitude, document.GetAllocator());
+            data.PushBack(state.mLongitude, document.GetAllocator());
+            data.PushBack(state.mAltitude, document.GetAllocator());
+            data.PushBack(rapidjson::Value(formatICAO(state.mICAO).c_str(), document.GetAllocator()), document.GetAllocator());
+            data.PushBack(rapidjson::StringRef(state.mRegistration.c_str()), document.GetAllocator());
+            data.PushBack(rapidjson::StringRef(state.mAircraftType.c_str()), document.GetAllocator());
+
+            flight.AddMember("data", data, document.GetAllocator());
+            flights.PushBack(flight, document.GetAllocator());
+        }
+
+        // Add the flights to the document
+        document.AddMember("flights", flights, document.GetAllocator());
+    }
+
+
+    static std::string serialize(const rapidjson::Document& document)
+    {
+        rapidjson::StringBuffer buffer;
+        rapidjson::Writer<rapidjson::StringBuffer> writer(buffer);
+        document.Accept(writer);
+        return buffer.GetString();
+    }
+
+
+    void FlightStatesData::WriteData(const std::vector<FlightState>& states)
+    {
+        rapidjson::Document document(rapidjson::kObjectType);
+        writeFlights(states, document);
+        mData = serialize(document);
+    }
+
+
+    void FlightStatesData::WriteDelta(const FlightStatesDelta& delta)
+    {
+        // The delta member comes first, IsDelta() only looks at the start of the data
+        rapidjson::Document document(rapidjson::kObjectType);
+        document.AddMember("delta", true, document.GetAllocator());
+        writeFlights(delta.mAdded, document);
+
+        // Moved aircraft are known already, only their position is stored
+        rapidjson::Value moved(rapidjson::kArrayType);
+        for(const auto& position : delta.mMoved)
+        {
+            rapidjson::Value data(rapidjson::kArrayType);
+            data.PushBack(position.mLatitude, document.GetAllocator());
+            data.PushBack(position.mLongitude, document.GetAllocator());
+            data.PushBack(position.mAltitude, document.GetAllocator());
+            data.PushBack(rapidjson::Value(formatICAO(position.mICAO).c_str(), document.GetAllocator()), document.GetAllocator());
+            moved.PushBack(data, document.GetAllocator());
+        }
+        document.AddMember("moved", moved, document.GetAllocator());
+
+        rapidjson::Value removed(rapidjson::kArrayType);
+        for(const auto& icao : delta.mRemoved)
+            removed.PushBack(rapidjson::Value(formatICAO(icao).c_str(), document.GetAllocator()), document.GetAllocator());
+        document.AddMember("removed", removed, document.GetAllocator());
+
+        mData = serialize(document);
+    }
+
+
+    bool FlightStatesDecoder::decode(const FlightStatesData& data, utility::ErrorState& errorState)
+    {
+        if(!data.IsDelta())
+        {
+            mStates.clear();
+            if(!data.ParseData(mStates, -1, errorState))
+                return false;
+            FlightStatesDelta::sortByICAO(mStates);
+            mHasStates = true;
+            return true;
+        }
+
+        FlightStatesDelta delta;
+        if(!data.ParseDelta(delta, errorState))
+            return false;
+
+        // Without the previous snapshot there is nothing to apply the delta to
+        if(mHasStates)
+            delta.apply(mStates);
+
+        return true;
+    }
+}
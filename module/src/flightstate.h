@@ -3,14 +3,46 @@
 #include <nap/resourceptr.h>
 #include <nap/numeric.h>
 #include <databasetableresource.h>
+#include <memory_resource>
+#include <vector>
 
 namespace nap
 {
+    // Maximum number of characters of an identifier that is packed into its key
+    constexpr size_t kMaxICAOLength = sizeof(uint64);
+
+    /**
+     * Packs the identifier the feed reports for an aircraft into an integer key, its characters are stored big endian
+     * so keys compare like the strings they were packed from. Aircraft are keyed by this integer everywhere in memory,
+     * the string is only formatted again when serialized.
+     * Longer identifiers are keyed by a hash that orders after every packed key, the identifier is remembered
+     * for the lifetime of the process so formatICAO() returns it unchanged
+     * @param icao the identifier as reported by the feed or stored in the database
+     * @return the key, 0 when the identifier is empty
+     */
+    uint64 NAPAPI parseICAO(const char* icao);
+
+    /**
+     * Creates the key of an identifier the way parseICAO() does, without remembering longer identifiers
+     * Used for identifiers from requests, so clients can't grow the identifiers that are remembered
+     * @param icao the identifier as passed in a request
+     * @return the key, 0 when the identifier is empty
+     */
+    uint64 NAPAPI findICAO(const char* icao);
+
+    /**
+     * Formats a key created by parseICAO() as the identifier it was created from
+     * @param icao the key
+     * @return the identifier, empty when the key is 0
+     */
+    std::string NAPAPI formatICAO(uint64 icao);
+
+
     struct NAPAPI FlightState
     {
     public:
         // Properties
-        std::string mICAO;
+        uint64 mICAO = 0; ///< Identifier of the aircraft packed by parseICAO(), 0 when the aircraft has none
         std::string mRegistration;
         std::string mAircraftType;
         float mLatitude;
@@ -19,16 +51,146 @@ namespace nap
     };
 
 
+    /**
+     * A state found by a query, with the moment it was seen and its distance to the queried location
+     */
+    struct NAPAPI FlightRow
+    {
+    public:
+        FlightState mState;
+        uint64 mTimeStamp = 0;
+        float mDistance = 0.0f;
+    };
+
+    // Rows of a query, allocated from the memory of the request when it has an arena, see RequestArena
+    using FlightRows = std::pmr::vector<FlightRow>;
+
+
+    /**
+     * The position of a tracked aircraft that moved since the previous snapshot
+     */
+    struct NAPAPI FlightPosition
+    {
+    public:
+        uint64 mICAO;
+        float mLatitude;
+        float mLongitude;
+        float mAltitude;
+    };
+
+
+    /**
+     * The changes between two consecutive snapshots
+     * Aircraft are tracked by ICAO. Aircraft without an ICAO can't be tracked, they are part of every delta.
+     * Snapshots that deltas are created from and applied to are ordered by ICAO, see sortByICAO()
+     */
+    struct NAPAPI FlightStatesDelta
+    {
+    public:
+        std::vector<FlightState> mAdded;        ///< Aircraft that appeared, changed registration or type, or have no ICAO
+        std::vector<FlightPosition> mMoved;     ///< Tracked aircraft that moved more than the threshold
+        std::vector<uint64> mRemoved;           ///< Tracked aircraft that disappeared
+
+        /**
+         * Orders states by ICAO and removes aircraft that are reported more than once
+         * @param states the states to sort
+         */
+        static void sortByICAO(std::vector<FlightState>& states);
+
+        /**
+         * Creates the delta between two snapshots, both ordered by ICAO
+         * Aircraft that moved less than the threshold keep their previous position, so the error never exceeds the threshold
+         * as long as deltas are created against the reconstructed snapshot instead of the previous poll
+         * @param previous the previous snapshot
+         * @param next the next snapshot
+         * @param threshold minimum horizontal or vertical movement in meters, 0 records every change
+         * @param delta the resulting delta
+         */
+        static void create(const std::vector<FlightState>& previous, const std::vector<FlightState>& next, float threshold, FlightStatesDelta& delta);
+
+        /**
+         * Applies the delta to the previous snapshot, the result remains ordered by ICAO
+         * @param states the previous snapshot ordered by ICAO, replaced by the snapshot of this delta
+         */
+        void apply(std::vector<FlightState>& states) const;
+    };
+
+
     class NAPAPI FlightStatesData : public rtti::Object
     {
     RTTI_ENABLE(rtti::Object)
     public:
         static constexpr const char* kTimeStampPropertyName = "TimeStamp";
 
+        // Keyframes are written at least this often, readers look back this far to find the keyframe of a delta
+        static constexpr int kMaxKeyFrameMinutes = 10;
+
         // Properties
         std::string mData;
         nap::uint64 mTimeStamp;
 
+        /**
+         * Parses a keyframe, states are ordered by altitude
+         * @param states vector to add the states to
+         * @param altitude maximum altitude, ignored when <= 0
+         * @param errorState the error state to store errors in
+         * @return true if the data was parsed, false if it isn't valid or is a delta
+         */
         bool ParseData(std::vector<FlightState>& states, float altitude, utility::ErrorState& errorState) const;
+
+        /**
+         * Parses a delta
+         * @param delta the delta to fill
+         * @param errorState the error state to store errors in
+         * @return true if the data was parsed, false if it isn't valid or is a keyframe
+         */
+        bool ParseDelta(FlightStatesDelta& delta, utility::ErrorState& errorState) const;
+
+        /**
+         * @return if the data is a delta to the previous row instead of a keyframe
+         */
+        bool IsDelta() const;
+
+        /**
+         * Stores states as keyframe
+         * @param states all states
+         */
+        void WriteData(const std::vector<FlightState>& states);
+
+        /**
+         * Stores a delta to the previous row
+         * @param delta the delta
+         */
+        void WriteDelta(const FlightStatesDelta& delta);
+    };
+
+
+    /**
+     * Reconstructs snapshots from consecutive rows of keyframes and deltas
+     */
+    class NAPAPI FlightStatesDecoder
+    {
+    public:
+        /**
+         * Decodes the next row, rows must be decoded in time order
+         * Deltas before the first keyframe can't be reconstructed and are skipped, see hasStates()
+         * @param data the row to decode
+         * @param errorState the error state to store errors in
+         * @return false if the row couldn't be parsed
+         */
+        bool decode(const FlightStatesData& data, utility::ErrorState& errorState);
+
+        /**
+         * @return if the last decoded row could be reconstructed
+         */
+        bool hasStates() const { return mHasStates; }
+
+        /**
+         * @return the snapshot of the last decoded row, ordered by ICAO
+         */
+        const std::vector<FlightState>& getStates() const { return mStates; }
+    private:
+        std::vector<FlightState> mStates;
+        bool mHasStates = false;
     };
-}
\ No newline at end of file
+}
@@ -0,0 +1,370 @@
+#include "flightstatescompression.h"
+
+#include <nap/logger.h>
+#include <sqlite3.h>
+#include <zstd.h>
+#include <zdict.h>
+#include <algorithm>
+
+RTTI_BEGIN_CLASS(nap::CompressionDictionaryData)
+    RTTI_PROPERTY(nap::CompressionDictionaryData::kIdPropertyName, &nap::CompressionDictionaryData::mId, nap::rtti::EPropertyMetaData::Default)
+    RTTI_PROPERTY("Data", &nap::CompressionDictionaryData::mData, nap::rtti::EPropertyMetaData::Default)
+RTTI_END_CLASS
+
+RTTI_BEGIN_CLASS(nap::FlightStatesCompression)
+    RTTI_PROPERTY("Database", &nap::FlightStatesCompression::mDatabase, nap::rtti::EPropertyMetaData::Required)
+    RTTI_PROPERTY("TableName", &nap::FlightStatesCompression::mTableName, nap::rtti::EPropertyMetaData::Default)
+    RTTI_PROPERTY("Level", &nap::FlightStatesCompression::mLevel, nap::rtti::EPropertyMetaData::Default)
+    RTTI_PROPERTY("DictionarySamples", &nap::FlightStatesCompression::mDictionarySamples, nap::rtti::EPropertyMetaData::Default)
+    RTTI_PROPERTY("DictionarySize", &nap::FlightStatesCompression::mDictionarySize, nap::rtti::EPropertyMetaData::Default)
+    RTTI_PROPERTY("RetrainRows", &nap::FlightStatesCompression::mRetrainRows, nap::rtti::EPropertyMetaData::Default)
+RTTI_END_CLASS
+
+namespace nap
+{
+    // Prefix of compressed data, json data always starts with a brace
+    static constexpr const char* sZstdTag = "zstd:";
+    static constexpr size_t sZstdTagLength = 5;
+
+    // Trained dictionaries are at least this large to be of use and at most this large to remain cheap to keep in memory,
+    // every dictionary that was ever trained is loaded
+    static constexpr int sMinDictionarySize = 1024;
+    static constexpr int sMaxDictionarySize = 1024 * 1024;
+
+    static const char* sBase64Chars = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+
+    static std::string encodeBase64(const char* data, size_t size)
+    {
+        std::string result;
+        result.reserve((size + 2) / 3 * 4);
+        for(size_t i = 0; i < size; i += 3)
+        {
+            uint32 block = static_cast<uint8>(data[i]) << 16;
+            if(i + 1 < size)
+                block |= static_cast<uint8>(data[i + 1]) << 8;
+            if(i + 2 < size)
+                block |= static_cast<uint8>(data[i + 2]);
+
+            result += sBase64Chars[(block >> 18) & 0x3f];
+            result += sBase64Chars[(block >> 12) & 0x3f];
+            result += i + 1 < size ? sBase64Chars[(block >> 6) & 0x3f] : '=';
+            result += i + 2 < size ? sBase64Chars[block & 0x3f] : '=';
+        }
+        return result;
+    }
+
+
+    static bool decodeBase64(const char* data, size_t size, std::string& result)
+    {
+        static const std::array<int, 256> values = []()
+        {
+            std::array<int, 256> values;
+            values.fill(-1);
+            for(int i = 0; i < 64; i++)
+                values[static_cast<uint8>(sBase64Chars[i])] = i;
+            return values;
+        }();
+
+        if(size % 4 != 0)
+            return false;
+
+        result.clear();
+        result.reserve(size / 4 * 3);
+        for(size_t i = 0; i < size; i += 4)
+        {
+            uint32 block = 0;
+            int padding = 0;
+            for(size_t j = 0; j < 4; j++)
+            {
+                char c = data[i + j];
+                if(c == '=' && i + 4 == size && j >= 2)
+                {
+                    padding++;
+                    block <<= 6;
+                    continue;
+                }
+
+                int value = values[static_cast<uint8>(c)];
+                if(value < 0 || padding > 0)
+                    return false;
+                block = (block << 6) | value;
+            }
+
+            result += static_cast<char>((block >> 16) & 0xff);
+            if(padding < 2)
+                result += static_cast<char>((block >> 8) & 0xff);
+            if(padding < 1)
+                result += static_cast<char>(block & 0xff);
+        }
+        return true;
+    }
+
+
+    FlightStatesCompression::~FlightStatesCompression()
+    {
+        ZSTD_freeCCtx(mCompressContext);
+        ZSTD_freeCDict(mCompressDictionary);
+        for(auto& dictionary : mDecompressDictionaries)
+            ZSTD_freeDDict(dictionary.second);
+        if(mSQLite != nullptr)
+            sqlite3_close(mSQLite);
+    }
+
+
+    bool FlightStatesCompression::init(utility::ErrorState &errorState)
+    {
+        if(!errorState.check(mLevel >= 1 && mLevel <= ZSTD_maxCLevel(), "Level must be between 1 and %d", ZSTD_maxCLevel()))
+            return false;
+
+        if(!errorState.check(mDictionarySamples >= 0, "DictionarySamples must be 0 or greater"))
+            return false;
+
+        if(!errorState.check(mDictionarySize >= sMinDictionarySize && mDictionarySize <= sMaxDictionarySize,
+                             "DictionarySize must be between %d and %d", sMinDictionarySize, sMaxDictionarySize))
+            return false;
+
+        if(!errorState.check(mRetrainRows >= 0, "RetrainRows must be 0 or greater"))
+            return false;
+
+        if(!errorState.check(mRetrainRows == 0 || mRetrainRows >= mDictionarySamples, "RetrainRows must be 0 or at least DictionarySamples"))
+            return false;
+
+        mCompressContext = ZSTD_createCCtx();
+        if(!errorState.check(mCompressContext != nullptr, "Failed to create compression context"))
+            return false;
+
+        mTable = mDatabase->getDatabaseTable<CompressionDictionaryData>(mTableName);
+        if(!errorState.check(mTable != nullptr, "Failed to open table %s", mTableName.c_str()))
+            return false;
+
+        // Dictionaries are stored as blob in a table of the same database, the database table only stores strings
+        if(!errorState.check(sqlite3_open(mDatabase->mDatabaseName.c_str(), &mSQLite) == SQLITE_OK,
+                             "Failed to open database %s", mDatabase->mDatabaseName.c_str()))
+            return false;
+
+        sqlite3_busy_timeout(mSQLite, 5000);
+        if(!exec(utility::stringFormat("CREATE TABLE IF NOT EXISTS %s_blob (Id INTEGER PRIMARY KEY, Data BLOB NOT NULL)", mTableName.c_str()), errorState))
+            return false;
+
+        return loadDictionaries(errorState);
+    }
+
+
+    bool FlightStatesCompression::loadDictionaries(utility::ErrorState& errorState)
+    {
+        std::vector<std::pair<uint64, std::string>> dictionaries;
+
+        // Dictionaries of earlier versions, base64 encoded
+        rtti::Factory factory;
+        std::vector<std::unique_ptr<rtti::Object>> objects;
+        if(!mTable->query(utility::stringFormat("%s >= 0", CompressionDictionaryData::kIdPropertyName), objects, factory, errorState))
+            return false;
+
+        for(auto& object : objects)
+        {
+            assert(object->get_type().is_derived_from<CompressionDictionaryData>());
+            auto* data = static_cast<CompressionDictionaryData*>(object.get());
+            std::string dictionary;
+            if(!errorState.check(decodeBase64(data->mData.data(), data->mData.size(), dictionary),
+                                 "Dictionary %s is not valid base64", std::to_string(data->mId).c_str()))
+                return false;
+            dictionaries.emplace_back(data->mId, std::move(dictionary));
+        }
+
+        sqlite3_stmt* statement = nullptr;
+        if(!errorState.check(sqlite3_prepare_v2(mSQLite, utility::stringFormat("SELECT Id, Data FROM %s_blob", mTableName.c_str()).c_str(),
+                                                -1, &statement, nullptr) == SQLITE_OK, "Failed to prepare statement : %s", sqlite3_errmsg(mSQLite)))
+            return false;
+
+        int result;
+        while((result = sqlite3_step(statement)) == SQLITE_ROW)
+        {
+            const char* data = static_cast<const char*>(sqlite3_column_blob(statement, 1));
+            dictionaries.emplace_back(static_cast<uint64>(sqlite3_column_int64(statement, 0)),
+                                      std::string(data != nullptr ? data : "", sqlite3_column_bytes(statement, 1)));
+        }
+        sqlite3_finalize(statement);
+        if(!errorState.check(result == SQLITE_DONE, "Failed to read dictionaries : %s", sqlite3_errmsg(mSQLite)))
+            return false;
+
+        // Load all dictionaries in the order they were trained, the most recent one is used for compression
+        std::sort(dictionaries.begin(), dictionaries.end(), [](const auto& a, const auto& b)
+        {
+            return a.first < b.first;
+        });
+
+        for(const auto& dictionary : dictionaries)
+        {
+            mNextSequence = std::max(mNextSequence, (dictionary.first >> 32) + 1);
+            if(!addDictionary(dictionary.second, errorState))
+                return false;
+        }
+
+        return true;
+    }
+
+
+    bool FlightStatesCompression::compress(std::string& data, utility::ErrorState& errorState)
+    {
+        std::string compressed(ZSTD_compressBound(data.size()), '\0');
+        size_t size = mCompressDictionary != nullptr ?
+                      ZSTD_compress_usingCDict(mCompressContext, &compressed[0], compressed.size(), data.data(), data.size(), mCompressDictionary) :
+                      ZSTD_compressCCtx(mCompressContext, &compressed[0], compressed.size(), data.data(), data.size(), mLevel);
+        if(!errorState.check(!ZSTD_isError(size), "Failed to compress : %s", ZSTD_getErrorName(size)))
+            return false;
+
+        // Collect samples until there are enough to train a dictionary on. Without dictionary that is the first rows,
+        // afterwards the last rows before RetrainRows is reached
+        bool first = mCompressDictionary == nullptr && !mTrainingDone;
+        mRowsSinceTraining++;
+        bool retrain = !first && mRetrainRows > 0 && mRowsSinceTraining > mRetrainRows - mDictionarySamples;
+        if((first || retrain) && mDictionarySamples > 0)
+        {
+            mSamples.emplace_back(data);
+            if(mSamples.size() >= static_cast<size_t>(mDictionarySamples))
+            {
+                utility::ErrorState train_error;
+                if(!trainDictionary(train_error))
+                    nap::Logger::error("Failed to train compression dictionary : %s", train_error.toString().c_str());
+
+                // Training is attempted once, and again after the next RetrainRows rows
+                mSamples.clear();
+                mSamples.shrink_to_fit();
+                mTrainingDone = true;
+                mRowsSinceTraining = 0;
+            }
+        }
+
+        data = sZstdTag + encodeBase64(compressed.data(), size);
+        return true;
+    }
+
+
+    bool FlightStatesCompression::decompress(std::string& data, utility::ErrorState& errorState) const
+    {
+        if(!isCompressed(data))
+            return true;
+
+        std::string compressed;
+        if(!errorState.check(decodeBase64(data.data() + sZstdTagLength, data.size() - sZstdTagLength, compressed), "Compressed data is not valid base64"))
+            return false;
+
+        auto content_size = ZSTD_getFrameContentSize(compressed.data(), compressed.size());
+        if(!errorState.check(content_size != ZSTD_CONTENTSIZE_ERROR && content_size != ZSTD_CONTENTSIZE_UNKNOWN, "Compressed data is not valid"))
+            return false;
+
+        ZSTD_DDict* dictionary = nullptr;
+        unsigned int dictionary_id = ZSTD_getDictID_fromFrame(compressed.data(), compressed.size());
+        if(dictionary_id != 0)
+        {
+            std::lock_guard<std::mutex> lock(mMutex);
+            auto it = mDecompressDictionaries.find(dictionary_id);
+            if(!errorState.check(it != mDecompressDictionaries.end(), "Unknown compression dictionary %u", dictionary_id))
+                return false;
+            dictionary = it->second;
+        }
+
+        // Decompression contexts are reused per thread
+        struct Context
+        {
+            ~Context() { ZSTD_freeDCtx(mContext); }
+            ZSTD_DCtx* mContext = ZSTD_createDCtx();
+        };
+        thread_local Context context;
+
+        std::string result(content_size, '\0');
+        size_t size = dictionary != nullptr ?
+                      ZSTD_decompress_usingDDict(context.mContext, &result[0], result.size(), compressed.data(), compressed.size(), dictionary) :
+                      ZSTD_decompressDCtx(context.mContext, &result[0], result.size(), compressed.data(), compressed.size());
+        if(!errorState.check(!ZSTD_isError(size), "Failed to decompress : %s", ZSTD_getErrorName(size)))
+            return false;
+
+        result.resize(size);
+        data = std::move(result);
+        return true;
+    }
+
+
+    bool FlightStatesCompression::isCompressed(const std::string& data)
+    {
+        return data.compare(0, sZstdTagLength, sZstdTag) == 0;
+    }
+
+
+    bool FlightStatesCompression::addDictionary(const std::string& dictionary, utility::ErrorState& errorState)
+    {
+        auto* decompress_dictionary = ZSTD_createDDict(dictionary.data(), dictionary.size());
+        if(!errorState.check(decompress_dictionary != nullptr, "Failed to load compression dictionary"))
+            return false;
+
+        auto* compress_dictionary = ZSTD_createCDict(dictionary.data(), dictionary.size(), mLevel);
+        if(!errorState.check(compress_dictionary != nullptr, "Failed to load compression dictionary"))
+        {
+            ZSTD_freeDDict(decompress_dictionary);
+            return false;
+        }
+
+        {
+            std::lock_guard<std::mutex> lock(mMutex);
+            auto& entry = mDecompressDictionaries[ZSTD_getDictID_fromDDict(decompress_dictionary)];
+            ZSTD_freeDDict(entry);
+            entry = decompress_dictionary;
+        }
+
+        ZSTD_freeCDict(mCompressDictionary);
+        mCompressDictionary = compress_dictionary;
+        return true;
+    }
+
+
+    bool FlightStatesCompression::trainDictionary(utility::ErrorState& errorState)
+    {
+        std::string samples;
+        std::vector<size_t> sample_sizes;
+        for(const auto& sample : mSamples)
+        {
+            samples += sample;
+            sample_sizes.emplace_back(sample.size());
+        }
+
+        std::string dictionary(mDictionarySize, '\0');
+        size_t size = ZDICT_trainFromBuffer(&dictionary[0], dictionary.size(), samples.data(), sample_sizes.data(), sample_sizes.size());
+        if(!errorState.check(!ZDICT_isError(size), "%s", ZDICT_getErrorName(size)))
+            return false;
+        dictionary.resize(size);
+
+        // Store the dictionary before using it, rows compressed with it must always be readable
+        uint64 id = (mNextSequence << 32) | ZDICT_getDictID(dictionary.data(), dictionary.size());
+        sqlite3_stmt* statement = nullptr;
+        if(!errorState.check(sqlite3_prepare_v2(mSQLite, utility::stringFormat("INSERT INTO %s_blob (Id, Data) VALUES (?1, ?2)", mTableName.c_str()).c_str(),
+                                                -1, &statement, nullptr) == SQLITE_OK, "Failed to prepare statement : %s", sqlite3_errmsg(mSQLite)))
+            return false;
+
+        sqlite3_bind_int64(statement, 1, static_cast<sqlite3_int64>(id));
+        sqlite3_bind_blob(statement, 2, dictionary.data(), static_cast<int>(dictionary.size()), SQLITE_STATIC);
+        int result = sqlite3_step(statement);
+        sqlite3_finalize(statement);
+        if(!errorState.check(result == SQLITE_DONE, "Failed to store dictionary : %s", sqlite3_errmsg(mSQLite)))
+            return false;
+
+        if(!addDictionary(dictionary, errorState))
+            return false;
+        mNextSequence++;
+
+        nap::Logger::info("Trained compression dictionary %s of %d bytes", std::to_string(id).c_str(), static_cast<int>(size));
+        return true;
+    }
+
+
+    bool FlightStatesCompression::exec(const std::string& sql, utility::ErrorState& errorState)
+    {
+        char* error = nullptr;
+        if(sqlite3_exec(mSQLite, sql.c_str(), nullptr, nullptr, &error) != SQLITE_OK)
+        {
+            errorState.fail("SQL error : %s", error != nullptr ? error : "unknown");
+            sqlite3_free(error);
+            return false;
+        }
+        return true;
+    }
+}
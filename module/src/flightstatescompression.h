@@ -0,0 +1,105 @@
+#pragma once
+
+#include <nap/resource.h>
+#include <nap/resourceptr.h>
+#include <nap/numeric.h>
+#include <databasetableresource.h>
+#include <mutex>
+
+// Forward declares
+struct sqlite3;
+struct ZSTD_CCtx_s;
+struct ZSTD_CDict_s;
+struct ZSTD_DDict_s;
+
+namespace nap
+{
+    /**
+     * A compression dictionary stored in the database by earlier versions, which stored the dictionary base64 encoded.
+     * These are still loaded so the rows they compressed remain readable, new dictionaries are stored as blob
+     */
+    class NAPAPI CompressionDictionaryData : public rtti::Object
+    {
+    RTTI_ENABLE(rtti::Object)
+    public:
+        static constexpr const char* kIdPropertyName = "Id";
+
+        // Properties
+        nap::uint64 mId; // Sequence number of the dictionary in the high 32 bits, zstd dictionary id in the low 32 bits
+        std::string mData; // base64 encoded dictionary
+    };
+
+
+    /**
+     * Compresses the data of flight states rows with zstd
+     * Rows are dominated by the same ICAO codes, registrations and aircraft types, so a dictionary trained on our own feed
+     * compresses far better than zstd on its own. The first DictionarySamples rows are compressed without dictionary and
+     * used to train one, which is stored in the database and used from then on. The feed changes over time, so after
+     * every RetrainRows rows a new dictionary is trained on the most recent rows. Every dictionary is kept in the database,
+     * next to the rows, so all rows remain readable.
+     * Compressed data is base64 encoded and tagged, untagged data is plain json so rows written before compression
+     * was enabled still read. The dictionary of a row is identified by the dictionary id in its zstd frame.
+     */
+    class NAPAPI FlightStatesCompression : public Resource
+    {
+    RTTI_ENABLE(Resource)
+    public:
+        /**
+         * Destructor, frees the compression contexts
+         */
+        ~FlightStatesCompression() override;
+
+        /**
+         * Loads all dictionaries from the database
+         * @param errorState the error state to store errors in
+         * @return true if the compression was initialized
+         */
+        bool init(utility::ErrorState &errorState) final;
+
+        /**
+         * Compresses data in place, the data is left untouched on failure. Not thread safe, call from the writer only
+         * @param data the data to compress
+         * @param errorState the error state to store errors in
+         * @return true if the data was compressed
+         */
+        bool compress(std::string& data, utility::ErrorState& errorState);
+
+        /**
+         * Decompresses data in place when it is compressed, thread safe
+         * @param data the data to decompress
+         * @param errorState the error state to store errors in
+         * @return true if the data is decompressed or wasn't compressed
+         */
+        bool decompress(std::string& data, utility::ErrorState& errorState) const;
+
+        /**
+         * @param data the data of a row
+         * @return if the data is compressed
+         */
+        static bool isCompressed(const std::string& data);
+
+        ResourcePtr<DatabaseTableResource> mDatabase; ///< Property: "Database" - The database to store the dictionaries in
+        std::string mTableName = "dictionaries"; ///< Property: "TableName" - Name of the dictionaries table
+        int mLevel = 3; ///< Property: "Level" - zstd compression level
+        int mDictionarySamples = 50; ///< Property: "DictionarySamples" - Number of rows to train the dictionary on, 0 disables training
+        int mDictionarySize = 112640; ///< Property: "DictionarySize" - Maximum size of the dictionary in bytes
+        int mRetrainRows = 60480; ///< Property: "RetrainRows" - Number of rows after which a new dictionary is trained, 0 trains only once
+    private:
+        bool addDictionary(const std::string& dictionary, utility::ErrorState& errorState);
+        bool trainDictionary(utility::ErrorState& errorState);
+        bool loadDictionaries(utility::ErrorState& errorState);
+        bool exec(const std::string& sql, utility::ErrorState& errorState);
+
+        DatabaseTable* mTable = nullptr;
+        sqlite3* mSQLite = nullptr;
+        ZSTD_CCtx_s* mCompressContext = nullptr;
+        ZSTD_CDict_s* mCompressDictionary = nullptr;
+        std::vector<std::string> mSamples;
+        bool mTrainingDone = false;
+        int mRowsSinceTraining = 0; // Rows compressed since the last dictionary was trained
+        uint64 mNextSequence = 1; // Sequence number of the next trained dictionary, orders the dictionaries by creation
+
+        mutable std::mutex mMutex;
+        std::unordered_map<uint32, ZSTD_DDict_s*> mDecompressDictionaries;
+    };
+}
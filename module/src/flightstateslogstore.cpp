@@ -0,0 +1,411 @@
+#include "flightstateslogstore.h"
+
+#include <filesystem>
+#include <fstream>
+#include <cstring>
+
+#ifndef _WIN32
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+namespace nap
+{
+    // Every row is stored as its timestamp, the size of its data and the data itself
+    static constexpr size_t sRowHeaderSize = sizeof(uint64) + sizeof(uint32);
+
+    // Every this many rows the timestamp and offset of a row is added to the index
+    static constexpr uint64 sIndexInterval = 64;
+
+    struct IndexEntry
+    {
+        uint64 mTimeStamp;
+        uint64 mOffset;
+    };
+
+
+    /**
+     * Read only view of a file, memory mapped where supported
+     */
+    class FileView
+    {
+    public:
+        ~FileView()
+        {
+#ifndef _WIN32
+            if(mData != nullptr)
+                munmap(const_cast<char*>(mData), mSize);
+#endif
+        }
+
+        bool open(const std::string& path)
+        {
+#ifndef _WIN32
+            int file = ::open(path.c_str(), O_RDONLY);
+            if(file < 0)
+                return false;
+
+            struct stat file_stat;
+            if(fstat(file, &file_stat) == 0 && file_stat.st_size > 0)
+            {
+                void* data = mmap(nullptr, file_stat.st_size, PROT_READ, MAP_PRIVATE, file, 0);
+                if(data != MAP_FAILED)
+                {
+                    mData = static_cast<const char*>(data);
+                    mSize = file_stat.st_size;
+                    madvise(data, mSize, MADV_SEQUENTIAL);
+                }
+            }
+            ::close(file);
+            return true;
+#else
+            std::ifstream stream(path, std::ios::binary);
+            if(!stream)
+                return false;
+            mBuffer.assign(std::istreambuf_iterator<char>(stream), std::istreambuf_iterator<char>());
+            mData = mBuffer.data();
+            mSize = mBuffer.size();
+            return true;
+#endif
+        }
+
+        const char* mData = nullptr;
+        size_t mSize = 0;
+    private:
+#ifdef _WIN32
+        std::string mBuffer;
+#endif
+    };
+
+
+    /**
+     * Reads the header of the row at the given offset
+     * @return false if the view doesn't hold the complete row
+     */
+    static bool readRowHeader(const FileView& view, uint64 offset, uint64& timestamp, uint32& size)
+    {
+        if(offset + sRowHeaderSize > view.mSize)
+            return false;
+
+        std::memcpy(&timestamp, view.mData + offset, sizeof(uint64));
+        std::memcpy(&size, view.mData + offset + sizeof(uint64), sizeof(uint32));
+        return offset + sRowHeaderSize + size <= view.mSize;
+    }
+
+
+    LogFlightStatesStore::LogFlightStatesStore(const std::string& directory, int segmentMinutes) :
+        mDirectory(directory), mSegmentMinutes(segmentMinutes)
+    {}
+
+
+    LogFlightStatesStore::~LogFlightStatesStore()
+    {
+        closeSegment();
+    }
+
+
+    bool LogFlightStatesStore::init(utility::ErrorState& errorState)
+    {
+        if(!errorState.check(mSegmentMinutes > 0 && 60 % mSegmentMinutes == 0, "SegmentMinutes must divide an hour"))
+            return false;
+
+        std::error_code error;
+        std::filesystem::create_directories(mDirectory, error);
+        if(!errorState.check(!error, "Failed to create directory %s : %s", mDirectory.c_str(), error.message().c_str()))
+            return false;
+
+        for(const auto& entry : std::filesystem::directory_iterator(mDirectory, error))
+        {
+            if(entry.path().extension() != ".log")
+                continue;
+
+            try
+            {
+                mSegments.insert(std::stoull(entry.path().stem().string()));
+            }
+            catch(const std::exception&)
+            {
+                continue;
+            }
+        }
+        if(!errorState.check(!error, "Failed to list directory %s : %s", mDirectory.c_str(), error.message().c_str()))
+            return false;
+
+        // Only the newest segment was being written to
+        if(!mSegments.empty() && !repairSegment(*mSegments.rbegin(), errorState))
+            return false;
+
+        return true;
+    }
+
+
+    bool LogFlightStatesStore::add(const FlightStatesData& data, utility::ErrorState& errorState)
+    {
+        std::lock_guard<std::mutex> lock(mMutex);
+        if(!errorState.check(data.mTimeStamp >= mLastTimeStamp, "Rows must be added in time order"))
+            return false;
+
+        uint64 key = getSegmentKey(data.mTimeStamp);
+        if(mFile == nullptr || key != mFileKey)
+        {
+            closeSegment();
+            if(!openSegment(key, errorState))
+                return false;
+        }
+
+        // The first row after opening is always indexed, the size of the rows written before is unknown
+        bool indexed = mFileRows % sIndexInterval == 0;
+        if(indexed)
+        {
+            IndexEntry entry = { data.mTimeStamp, mFileSize };
+            if(std::fwrite(&entry, sizeof(IndexEntry), 1, mIndexFile) != 1 || std::fflush(mIndexFile) != 0)
+            {
+                // An index entry without its row would point past the end of the segment
+                utility::ErrorState truncate_error;
+                if(!truncateSegment(truncate_error))
+                    errorState.fail("%s", truncate_error.toString().c_str());
+                errorState.fail("Failed to write to index of segment %s", std::to_string(key).c_str());
+                return false;
+            }
+        }
+
+        // Write the row with a single write, so readers never see the header without the data in the file
+        std::string row(sRowHeaderSize + data.mData.size(), '\0');
+        uint32 size = static_cast<uint32>(data.mData.size());
+        std::memcpy(&row[0], &data.mTimeStamp, sizeof(uint64));
+        std::memcpy(&row[sizeof(uint64)], &size, sizeof(uint32));
+        std::memcpy(&row[sRowHeaderSize], data.mData.data(), data.mData.size());
+        bool written = std::fwrite(row.data(), 1, row.size(), mFile) == row.size() && std::fflush(mFile) == 0;
+        if(!written)
+        {
+            // Remove the partial row and its index entry, the segment is reopened on the next write
+            utility::ErrorState truncate_error;
+            if(!truncateSegment(truncate_error))
+                errorState.fail("%s", truncate_error.toString().c_str());
+            errorState.fail("Failed to write to segment %s", std::to_string(key).c_str());
+            return false;
+        }
+
+        if(indexed)
+            mIndexSize += sizeof(IndexEntry);
+        mFileSize += row.size();
+        mFileRows++;
+        mLastTimeStamp = data.mTimeStamp;
+        return true;
+    }
+
+
+    bool LogFlightStatesStore::query(uint64 begin, uint64 end, std::vector<std::unique_ptr<FlightStatesData>>& rows, utility::ErrorState& errorState)
+    {
+        std::vector<uint64> keys;
+        {
+            std::lock_guard<std::mutex> lock(mMutex);
+            for(auto it = mSegments.lower_bound(getSegmentKey(begin)); it != mSegments.end() && *it <= end; ++it)
+                keys.emplace_back(*it);
+        }
+
+        for(auto key : keys)
+        {
+            if(!scanSegment(key, begin, end, rows, errorState))
+                return false;
+        }
+
+        return true;
+    }
+
+
+    bool LogFlightStatesStore::removeOlderThan(uint64 timestamp, utility::ErrorState& errorState)
+    {
+        // A segment can only go when all of its rows are older, which is when it lies before the segment of the timestamp
+        std::lock_guard<std::mutex> lock(mMutex);
+        uint64 key = getSegmentKey(timestamp);
+        while(!mSegments.empty() && *mSegments.begin() < key)
+        {
+            uint64 oldest = *mSegments.begin();
+            if(oldest == mFileKey)
+                closeSegment();
+
+            // Readers that mapped the segment keep reading it until they unmap it
+            std::error_code error;
+            std::filesystem::remove(getSegmentPath(oldest, ".idx"), error);
+            std::filesystem::remove(getSegmentPath(oldest, ".log"), error);
+            if(!errorState.check(!error, "Failed to remove segment %s : %s", std::to_string(oldest).c_str(), error.message().c_str()))
+                return false;
+            mSegments.erase(mSegments.begin());
+        }
+
+        return true;
+    }
+
+
+    bool LogFlightStatesStore::clear(utility::ErrorState& errorState)
+    {
+        std::lock_guard<std::mutex> lock(mMutex);
+        closeSegment();
+        for(auto key : mSegments)
+        {
+            std::error_code error;
+            std::filesystem::remove(getSegmentPath(key, ".idx"), error);
+            std::filesystem::remove(getSegmentPath(key, ".log"), error);
+            if(!errorState.check(!error, "Failed to remove segment %s : %s", std::to_string(key).c_str(), error.message().c_str()))
+                return false;
+        }
+        mSegments.clear();
+        mLastTimeStamp = 0;
+
+        return true;
+    }
+
+
+    uint64 LogFlightStatesStore::getSegmentKey(uint64 timestamp) const
+    {
+        // Timestamps are YYYYMMDDHHMMSS, round down to the start of the segment within the hour
+        uint64 minutes = (timestamp / 100) % 100;
+        return timestamp / 10000 * 10000 + minutes / mSegmentMinutes * mSegmentMinutes * 100;
+    }
+
+
+    std::string LogFlightStatesStore::getSegmentPath(uint64 key, const char* extension) const
+    {
+        return (std::filesystem::path(mDirectory) / (std::to_string(key) + extension)).string();
+    }
+
+
+    bool LogFlightStatesStore::openSegment(uint64 key, utility::ErrorState& errorState)
+    {
+        mFile = std::fopen(getSegmentPath(key, ".log").c_str(), "ab");
+        if(!errorState.check(mFile != nullptr, "Failed to open segment %s", std::to_string(key).c_str()))
+            return false;
+
+        mIndexFile = std::fopen(getSegmentPath(key, ".idx").c_str(), "ab");
+        if(!errorState.check(mIndexFile != nullptr, "Failed to open index of segment %s", std::to_string(key).c_str()))
+        {
+            closeSegment();
+            return false;
+        }
+
+        std::error_code error;
+        mFileSize = std::filesystem::file_size(getSegmentPath(key, ".log"), error);
+        mIndexSize = std::filesystem::file_size(getSegmentPath(key, ".idx"), error);
+        if(!errorState.check(!error, "Failed to get size of segment %s : %s", std::to_string(key).c_str(), error.message().c_str()))
+        {
+            closeSegment();
+            return false;
+        }
+        mFileKey = key;
+        mFileRows = 0;
+        mSegments.insert(key);
+        return true;
+    }
+
+
+    void LogFlightStatesStore::closeSegment()
+    {
+        if(mFile != nullptr)
+            std::fclose(mFile);
+        if(mIndexFile != nullptr)
+            std::fclose(mIndexFile);
+        mFile = nullptr;
+        mIndexFile = nullptr;
+    }
+
+
+    bool LogFlightStatesStore::truncateSegment(utility::ErrorState& errorState)
+    {
+        // Back to the end of the last row that was written completely, the segment is reopened on the next write
+        closeSegment();
+        std::error_code error;
+        std::filesystem::resize_file(getSegmentPath(mFileKey, ".log"), mFileSize, error);
+        if(!error)
+            std::filesystem::resize_file(getSegmentPath(mFileKey, ".idx"), mIndexSize, error);
+        return errorState.check(!error, "Failed to truncate segment %s : %s", std::to_string(mFileKey).c_str(), error.message().c_str());
+    }
+
+
+    bool LogFlightStatesStore::repairSegment(uint64 key, utility::ErrorState& errorState)
+    {
+        // Find the end of the last complete row
+        uint64 offset = 0;
+        {
+            FileView view;
+            if(!view.open(getSegmentPath(key, ".log")))
+                return true;
+
+            uint64 timestamp = 0;
+            uint32 size = 0;
+            while(readRowHeader(view, offset, timestamp, size))
+            {
+                offset += sRowHeaderSize + size;
+                mLastTimeStamp = std::max(mLastTimeStamp, timestamp);
+            }
+            if(offset == view.mSize)
+                return true;
+        }
+
+        // Drop the partial row and the index entries pointing at or beyond it
+        std::error_code error;
+        std::filesystem::resize_file(getSegmentPath(key, ".log"), offset, error);
+        if(!errorState.check(!error, "Failed to repair segment %s : %s", std::to_string(key).c_str(), error.message().c_str()))
+            return false;
+
+        FileView index_view;
+        std::vector<IndexEntry> entries;
+        if(index_view.open(getSegmentPath(key, ".idx")))
+        {
+            for(size_t i = 0; i + sizeof(IndexEntry) <= index_view.mSize; i += sizeof(IndexEntry))
+            {
+                IndexEntry entry;
+                std::memcpy(&entry, index_view.mData + i, sizeof(IndexEntry));
+                if(entry.mOffset < offset)
+                    entries.emplace_back(entry);
+            }
+        }
+
+        std::ofstream index(getSegmentPath(key, ".idx"), std::ios::binary | std::ios::trunc);
+        index.write(reinterpret_cast<const char*>(entries.data()), entries.size() * sizeof(IndexEntry));
+        return errorState.check(index.good(), "Failed to repair index of segment %s", std::to_string(key).c_str());
+    }
+
+
+    bool LogFlightStatesStore::scanSegment(uint64 key, uint64 begin, uint64 end, std::vector<std::unique_ptr<FlightStatesData>>& rows, utility::ErrorState& errorState) const
+    {
+        // Segments can be removed by retention after they were listed
+        FileView view;
+        if(!view.open(getSegmentPath(key, ".log")))
+            return true;
+
+        // Start at the last indexed row that isn't newer than begin
+        uint64 offset = 0;
+        FileView index_view;
+        if(index_view.open(getSegmentPath(key, ".idx")))
+        {
+            for(size_t i = 0; i + sizeof(IndexEntry) <= index_view.mSize; i += sizeof(IndexEntry))
+            {
+                IndexEntry entry;
+                std::memcpy(&entry, index_view.mData + i, sizeof(IndexEntry));
+                if(entry.mTimeStamp > begin)
+                    break;
+                if(entry.mOffset < view.mSize)
+                    offset = entry.mOffset;
+            }
+        }
+
+        uint64 timestamp = 0;
+        uint32 size = 0;
+        while(readRowHeader(view, offset, timestamp, size) && timestamp <= end)
+        {
+            if(timestamp > begin)
+            {
+                auto row = std::make_unique<FlightStatesData>();
+                row->mTimeStamp = timestamp;
+                row->mData.assign(view.mData + offset + sRowHeaderSize, size);
+                rows.emplace_back(std::move(row));
+            }
+            offset += sRowHeaderSize + size;
+        }
+
+        return true;
+    }
+}
@@ -0,0 +1,67 @@
+#pragma once
+
+#include <mutex>
+#include <set>
+#include <cstdio>
+
+#include "flightstatesstore.h"
+
+namespace nap
+{
+    /**
+     * Stores flight states rows in append only segment files, without any SQL layer
+     * Every segment holds the rows of SegmentMinutes minutes, appended sequentially as they are written.
+     * Next to every segment a sparse index holds the offset of every 64th row, so a range scan starts close to
+     * the first requested row and reads the segment sequentially from a memory map.
+     * Retention unlinks whole segments, a segment is only removed once all its rows are older than the retention.
+     * A row that was partially written when the process stopped is truncated on the next start.
+     */
+    class NAPAPI LogFlightStatesStore : public FlightStatesStore
+    {
+    public:
+        /**
+         * @param directory the directory holding the segment files
+         * @param segmentMinutes the duration of a segment, must divide an hour
+         */
+        LogFlightStatesStore(const std::string& directory, int segmentMinutes);
+
+        /**
+         * Closes the segment that is written to
+         */
+        ~LogFlightStatesStore() override;
+
+        /**
+         * Creates the directory, finds existing segments and repairs the newest segment
+         * @param errorState the error state to store errors in
+         * @return true if the store was initialized
+         */
+        bool init(utility::ErrorState& errorState);
+
+        bool add(const FlightStatesData& data, utility::ErrorState& errorState) override;
+        bool query(uint64 begin, uint64 end, std::vector<std::unique_ptr<FlightStatesData>>& rows, utility::ErrorState& errorState) override;
+        bool removeOlderThan(uint64 timestamp, utility::ErrorState& errorState) override;
+        bool clear(utility::ErrorState& errorState) override;
+        bool isConcurrent() const override { return true; }
+    private:
+        uint64 getSegmentKey(uint64 timestamp) const;
+        std::string getSegmentPath(uint64 key, const char* extension) const;
+        bool openSegment(uint64 key, utility::ErrorState& errorState);
+        void closeSegment();
+        bool truncateSegment(utility::ErrorState& errorState);
+        bool repairSegment(uint64 key, utility::ErrorState& errorState);
+        bool scanSegment(uint64 key, uint64 begin, uint64 end, std::vector<std::unique_ptr<FlightStatesData>>& rows, utility::ErrorState& errorState) const;
+
+        std::string mDirectory;
+        int mSegmentMinutes = 60;
+
+        std::mutex mMutex;
+        std::set<uint64> mSegments;         // Keys of all segments, ordered by time
+        std::FILE* mFile = nullptr;         // Segment that is written to
+        std::FILE* mIndexFile = nullptr;    // Index of the segment that is written to
+        uint64 mFileKey = 0;
+        uint64 mFileSize = 0;               // Size of the segment up to the last row that was written completely
+        uint64 mIndexSize = 0;              // Size of the index up to the entry of the last indexed row
+        uint64 mFileRows = 0;
+        uint64 mLastTimeStamp = 0;
+    };
+}
@@ -0,0 +1,96 @@
+#include "flightstatesstore.h"
+#include "utils.h"
+
+#include <rtti/factory.h>
+
+namespace nap
+{
+    bool FlightStatesStore::readSnapshots(uint64 begin, uint64 end, FlightStatesCompression* compression,
+                                          const SnapshotCallback& callback, utility::ErrorState& errorState)
+    {
+        // Deltas are reconstructed from the keyframe before them, so start reading where that keyframe can be
+        uint64 query_begin = 0;
+        if(!utility::subtractFromTimeStamp(begin, std::chrono::minutes(FlightStatesData::kMaxKeyFrameMinutes), query_begin, errorState))
+            return false;
+
+        std::vector<std::unique_ptr<FlightStatesData>> rows;
+        if(!query(query_begin, end, rows, errorState))
+            return false;
+
+        // Iterate over all the rows
+        FlightStatesDecoder decoder;
+        for(auto& data : rows)
+        {
+            // Decompress and decode the data
+            if(compression != nullptr && !compression->decompress(data->mData, errorState))
+                return false;
+
+            if(!decoder.decode(*data, errorState))
+                return false;
+
+            if(data->mTimeStamp <= begin || !decoder.hasStates())
+                continue;
+
+            callback(data->mTimeStamp, decoder.getStates());
+        }
+
+        return true;
+    }
+
+
+    bool SQLiteFlightStatesStore::init(utility::ErrorState& errorState)
+    {
+        auto property_path = DatabasePropertyPath::sCreate(RTTI_OF(FlightStatesData),
+                                                           rtti::Path::fromString(FlightStatesData::kTimeStampPropertyName),
+                                                           errorState);
+        if(property_path == nullptr)
+            return false;
+
+        return mTable.getOrCreateIndex(*property_path, errorState);
+    }
+
+
+    bool SQLiteFlightStatesStore::add(const FlightStatesData& data, utility::ErrorState& errorState)
+    {
+        return mTable.add(data, errorState);
+    }
+
+
+    bool SQLiteFlightStatesStore::query(uint64 begin, uint64 end, std::vector<std::unique_ptr<FlightStatesData>>& rows, utility::ErrorState& errorState)
+    {
+        rtti::Factory factory;
+        std::vector<std::unique_ptr<rtti::Object>> objects;
+        if(!mTable.query(utility::stringFormat("%s > %s AND %s <= %s",
+                                               FlightStatesData::kTimeStampPropertyName,
+                                               std::to_string(begin).c_str(),
+                                               FlightStatesData::kTimeStampPropertyName,
+                                               std::to_string(end).c_str()),
+                         objects, factory, errorState))
+        {
+            return false;
+        }
+
+        rows.reserve(rows.size() + objects.size());
+        for(auto& object : objects)
+        {
+            assert(object->get_type().is_derived_from<FlightStatesData>());
+            rows.emplace_back(static_cast<FlightStatesData*>(object.release()));
+        }
+
+        return true;
+    }
+
+
+    bool SQLiteFlightStatesStore::removeOlderThan(uint64 timestamp, utility::ErrorState& errorState)
+    {
+        return mTable.remove(utility::stringFormat("%s < %s",
+                                                   FlightStatesData::kTimeStampPropertyName,
+                                                   std::to_string(timestamp).c_str()), errorState);
+    }
+
+
+    bool SQLiteFlightStatesStore::clear(utility::ErrorState& errorState)
+    {
+        return mTable.clear(errorState);
+    }
+}
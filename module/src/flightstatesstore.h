@@ -0,0 +1,108 @@
+#pragma once
+
+#include <nap/numeric.h>
+#include <databasetable.h>
+#include <functional>
+
+#include "flightstate.h"
+#include "flightstatescompression.h"
+
+namespace nap
+{
+    /**
+     * Storage of flight states rows, written in time order and read by time range
+     * Stores are created by the DatabaseTableResource, its Backend property selects the implementation
+     * All methods are thread safe
+     */
+    class NAPAPI FlightStatesStore
+    {
+    public:
+        virtual ~FlightStatesStore() = default;
+
+        /**
+         * Appends a row, rows must be added in time order
+         * @param data the row to add
+         * @param errorState the error state to store errors in
+         * @return true if the row was added
+         */
+        virtual bool add(const FlightStatesData& data, utility::ErrorState& errorState) = 0;
+
+        /**
+         * Get all rows between begin and end, ordered by time
+         * @param begin the begin timestamp in uint64 YYYYMMDDHHMMSS, exclusive
+         * @param end the end timestamp in uint64 YYYYMMDDHHMMSS, inclusive
+         * @param rows vector to add the rows to
+         * @param errorState the error state to store errors in
+         * @return true if the query succeeded
+         */
+        virtual bool query(uint64 begin, uint64 end, std::vector<std::unique_ptr<FlightStatesData>>& rows, utility::ErrorState& errorState) = 0;
+
+        /**
+         * Removes all rows older than the given timestamp. Stores may keep rows that share storage with newer rows
+         * @param timestamp timestamp in uint64 YYYYMMDDHHMMSS
+         * @param errorState the error state to store errors in
+         * @return true if the rows were removed
+         */
+        virtual bool removeOlderThan(uint64 timestamp, utility::ErrorState& errorState) = 0;
+
+        /**
+         * Removes all rows
+         * @param errorState the error state to store errors in
+         * @return true if the rows were removed
+         */
+        virtual bool clear(utility::ErrorState& errorState) = 0;
+
+        /**
+         * @return if queries on different threads run concurrently, otherwise they are serialized on a single connection
+         * and reading a range in parallel chunks only adds contention
+         */
+        virtual bool isConcurrent() const { return false; }
+
+        /**
+         * Called for every snapshot read by readSnapshots()
+         * @param timestamp the timestamp of the snapshot in uint64 YYYYMMDDHHMMSS
+         * @param states all states of the snapshot, ordered by ICAO
+         */
+        using SnapshotCallback = std::function<void(uint64 timestamp, const std::vector<FlightState>& states)>;
+
+        /**
+         * Reads all snapshots between begin and end in time order
+         * Rows are decompressed and deltas are reconstructed from the keyframe before them
+         * @param begin the begin timestamp in uint64 YYYYMMDDHHMMSS, exclusive
+         * @param end the end timestamp in uint64 YYYYMMDDHHMMSS, inclusive
+         * @param compression optional compression the rows were stored with
+         * @param callback called for every snapshot
+         * @param errorState the error state to store errors in
+         * @return true if all rows were read
+         */
+        bool readSnapshots(uint64 begin, uint64 end, FlightStatesCompression* compression,
+                           const SnapshotCallback& callback, utility::ErrorState& errorState);
+    };
+
+
+    /**
+     * Stores flight states rows in a table of the SQLite database
+     */
+    class NAPAPI SQLiteFlightStatesStore : public FlightStatesStore
+    {
+    public:
+        /**
+         * @param table the table to store the rows in
+         */
+        SQLiteFlightStatesStore(DatabaseTable& table) : mTable(table) {}
+
+        /**
+         * Creates the timestamp index
+         * @param errorState the error state to store errors in
+         * @return true if the store was initialized
+         */
+        bool init(utility::ErrorState& errorState);
+
+        bool add(const FlightStatesData& data, utility::ErrorState& errorState) override;
+        bool query(uint64 begin, uint64 end, std::vector<std::unique_ptr<FlightStatesData>>& rows, utility::ErrorState& errorState) override;
+        bool removeOlderThan(uint64 timestamp, utility::ErrorState& errorState) override;
+        bool clear(utility::ErrorState& errorState) override;
+    private:
+        DatabaseTable& mTable;
+    };
+}
@@ -0,0 +1,76 @@
+#include "getdisturbancewatchcall.h"
+#include "trace.h"
+#include "restutils.h"
+#include "restcontenttypes.h"
+#include "nap/logger.h"
+#include "rapidjson/document.h"
+#include "rapidjson/stringbuffer.h"
+#include "rapidjson/prettywriter.h"
+#include "utils.h"
+
+RTTI_BEGIN_CLASS(nap::GetDisturbanceWatchCall)
+    RTTI_PROPERTY("DisturbanceWatches", &nap::GetDisturbanceWatchCall::mDisturbanceWatches, nap::rtti::EPropertyMetaData::Required, "The registered watches")
+    RTTI_PROPERTY("Metrics", &nap::GetDisturbanceWatchCall::mMetrics, nap::rtti::EPropertyMetaData::Default, "Optional metrics the request duration is reported in")
+RTTI_END_CLASS
+
+namespace nap
+{
+    bool GetDisturbanceWatchCall::init(utility::ErrorState &errorState)
+    {
+        if(mMetrics != nullptr)
+            mRequestDuration = &mMetrics->addRequestHistogram(mID);
+
+        return true;
+    }
+
+
+    RestResponse GetDisturbanceWatchCall::call(const RestValueMap &values)
+    {
+        TRACE_ZONE("GetDisturbanceWatchCall::call");
+        // The amount of milliseconds it took to execute the request is added to the response
+        SteadyTimer timer;
+        timer.start();
+        Metrics::ScopedTimer request_timer(mRequestDuration);
+
+        utility::ErrorState error_state;
+        std::string id;
+        if(!extractValue("id", values, id, error_state))
+            return utility::generateErrorResponse(error_state.toString());
+
+        DisturbanceWatches::Status status;
+        if(!mDisturbanceWatches->getWatch(id, status))
+            return utility::generateErrorResponse(utility::stringFormat("Unknown watch %s", id.c_str()));
+
+        // Create the json document
+        rapidjson::Document document(rapidjson::kObjectType);
+        rapidjson::Value data(rapidjson::kObjectType);
+        document.AddMember("status", "ok", document.GetAllocator());
+        data.AddMember("disturbed", status.mDisturbed, document.GetAllocator());
+        if(status.mDisturbed)
+        {
+            data.AddMember("current_begin", status.mCurrentBegin, document.GetAllocator());
+            data.AddMember("current_occurrences", status.mCurrentOccurrences, document.GetAllocator());
+        }
+        data.AddMember("updated", status.mUpdated, document.GetAllocator());
+
+        rapidjson::Value periods(rapidjson::kArrayType);
+        for(const auto& p : status.mPeriods)
+            p.addToJson(periods, status.mFlights, document);
+        data.AddMember("disturbance_periods", periods, document.GetAllocator());
+        data.AddMember("ms", timer.getMillis().count(), document.GetAllocator());
+        document.AddMember("data", data, document.GetAllocator());
+
+        // Serialize the response
+        rapidjson::StringBuffer buffer;
+        rapidjson::PrettyWriter<rapidjson::StringBuffer> writer(buffer);
+        writer.SetMaxDecimalPlaces(4);
+        document.Accept(writer);
+
+        // Create the response
+        RestResponse response;
+        response.mData = buffer.GetString();
+        response.mContentType = rest::contenttypes::json;
+
+        return response;
+    }
+}
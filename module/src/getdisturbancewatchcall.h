@@ -0,0 +1,27 @@
+#pragma once
+
+#include <restfunction.h>
+
+#include "disturbancewatches.h"
+#include "metrics.h"
+
+namespace nap
+{
+    /**
+     * GetDisturbanceWatchCall is a RestFunction that returns the state of a disturbance watch.
+     * The state is kept up to date with every new snapshot, the call doesn't read any history.
+     */
+    class NAPAPI GetDisturbanceWatchCall : public RestFunction
+    {
+    RTTI_ENABLE(RestFunction)
+    public:
+        bool init(utility::ErrorState &errorState) final;
+
+        RestResponse call(const RestValueMap &values) override;
+
+        ResourcePtr<DisturbanceWatches> mDisturbanceWatches; ///< Property "DisturbanceWatches" : The registered watches
+        ResourcePtr<Metrics> mMetrics; ///< Property "Metrics" : Optional metrics the request duration is reported in
+    private:
+        Metrics::Histogram* mRequestDuration = nullptr;
+    };
+}
@@ -0,0 +1,100 @@
+#include "mainloopscheduler.h"
+
+#ifndef _WIN32
+#include <unistd.h>
+#include <fcntl.h>
+#include <poll.h>
+#endif
+
+RTTI_BEGIN_CLASS(nap::MainLoopScheduler)
+    RTTI_PROPERTY("MaxSleep", &nap::MainLoopScheduler::mMaxSleep, nap::rtti::EPropertyMetaData::Default)
+RTTI_END_CLASS
+
+namespace nap
+{
+    // Write end of the pipe of the active scheduler, used from the signal handler
+    static std::atomic<int> sSignalPipe = { -1 };
+
+    MainLoopScheduler::~MainLoopScheduler()
+    {
+#ifndef _WIN32
+        sSignalPipe = -1;
+        if(mPipe[0] >= 0)
+            close(mPipe[0]);
+        if(mPipe[1] >= 0)
+            close(mPipe[1]);
+#endif
+    }
+
+
+    bool MainLoopScheduler::init(utility::ErrorState &errorState)
+    {
+        if(!errorState.check(mMaxSleep > 0.0f, "MaxSleep must be greater than 0"))
+            return false;
+
+#ifndef _WIN32
+        if(!errorState.check(pipe(mPipe) == 0, "Failed to create wake up pipe"))
+            return false;
+
+        // Non blocking, so a full pipe never blocks a writer and draining never blocks the reader
+        fcntl(mPipe[0], F_SETFL, fcntl(mPipe[0], F_GETFL) | O_NONBLOCK);
+        fcntl(mPipe[1], F_SETFL, fcntl(mPipe[1], F_GETFL) | O_NONBLOCK);
+        sSignalPipe = mPipe[1];
+#endif
+
+        return true;
+    }
+
+
+    void MainLoopScheduler::waitUntil(SteadyTimeStamp deadline)
+    {
+        auto max_deadline = SteadyClock::now() + std::chrono::duration_cast<SteadyClock::duration>(std::chrono::duration<float>(mMaxSleep));
+        deadline = std::min(deadline, max_deadline);
+
+#ifndef _WIN32
+        auto timeout = std::chrono::duration_cast<std::chrono::milliseconds>(deadline - SteadyClock::now());
+        if(timeout.count() > 0)
+        {
+            // Round up, waking before the deadline would only make the loop spin
+            pollfd fd = { mPipe[0], POLLIN, 0 };
+            poll(&fd, 1, static_cast<int>(timeout.count()) + 1);
+        }
+
+        // Drain all pending wake ups
+        char buffer[64];
+        while(read(mPipe[0], buffer, sizeof(buffer)) > 0) {}
+#else
+        std::unique_lock<std::mutex> lock(mMutex);
+        mCondition.wait_until(lock, deadline, [this](){ return mWoken; });
+        mWoken = false;
+#endif
+    }
+
+
+    void MainLoopScheduler::wake()
+    {
+#ifndef _WIN32
+        char byte = 1;
+        [[maybe_unused]] auto written = write(mPipe[1], &byte, 1);
+#else
+        {
+            std::lock_guard<std::mutex> lock(mMutex);
+            mWoken = true;
+        }
+        mCondition.notify_one();
+#endif
+    }
+
+
+    void MainLoopScheduler::wakeFromSignal()
+    {
+#ifndef _WIN32
+        int fd = sSignalPipe.load();
+        if(fd >= 0)
+        {
+            char byte = 1;
+            [[maybe_unused]] auto written = write(fd, &byte, 1);
+        }
+#endif
+    }
+}
@@ -0,0 +1,55 @@
+#pragma once
+
+#include <nap/resource.h>
+#include <nap/datetime.h>
+#include <condition_variable>
+
+namespace nap
+{
+    /**
+     * Puts the main loop to sleep until there is work to do
+     * The app calls waitUntil() with the next timer deadline every frame instead of ticking at a fixed framerate,
+     * the wait ends early when wake() is called, for example when a request completes or a signal arrives.
+     * On POSIX systems the wait is a poll on a self pipe, which makes waking up from a signal handler safe.
+     * Other platforms wake up from signals after at most MaxSleep seconds.
+     */
+    class NAPAPI MainLoopScheduler : public Resource
+    {
+    RTTI_ENABLE(Resource)
+    public:
+        /**
+         * Destructor, closes the wake up pipe
+         */
+        ~MainLoopScheduler() override;
+
+        /**
+         * Creates the wake up pipe
+         * @param errorState the error state to store errors in
+         * @return true if the scheduler was initialized
+         */
+        bool init(utility::ErrorState &errorState) final;
+
+        /**
+         * Blocks until the deadline is reached, wake() is called or MaxSleep seconds have passed
+         * @param deadline the moment the next timer expires
+         */
+        void waitUntil(SteadyTimeStamp deadline);
+
+        /**
+         * Wakes up the main loop, thread safe
+         */
+        void wake();
+
+        /**
+         * Wakes up the main loop of the active scheduler, async signal safe
+         */
+        static void wakeFromSignal();
+
+        float mMaxSleep = 1.0f; ///< Property: "MaxSleep" - Maximum time in seconds the main loop sleeps without being woken up
+    private:
+        int mPipe[2] = { -1, -1 };
+        std::mutex mMutex;
+        std::condition_variable mCondition;
+        bool mWoken = false;
+    };
+}
@@ -0,0 +1,212 @@
+#include "metrics.h"
+
+#include <utility/stringutils.h>
+#include <algorithm>
+#include <cassert>
+#include <cmath>
+#include <filesystem>
+#include <limits>
+
+RTTI_BEGIN_CLASS(nap::Metrics)
+    RTTI_PROPERTY("StoragePaths", &nap::Metrics::mStoragePaths, nap::rtti::EPropertyMetaData::Default)
+RTTI_END_CLASS
+
+namespace nap
+{
+    const std::vector<double> Metrics::kDurationBuckets = { 0.0005, 0.001, 0.0025, 0.005, 0.01, 0.025, 0.05, 0.1, 0.25, 0.5, 1.0, 2.5, 5.0, 10.0, 30.0 };
+
+    /**
+     * Formats a value the way Prometheus parses it, integers without a fraction
+     */
+    static std::string formatValue(double value)
+    {
+        if(value == std::numeric_limits<double>::infinity())
+            return "+Inf";
+        if(value == std::floor(value) && std::abs(value) < 1e15)
+            return std::to_string(static_cast<int64>(value));
+        return utility::stringFormat("%.9g", value);
+    }
+
+
+    static std::string escape(const std::string& value, bool quotes)
+    {
+        std::string escaped;
+        for(char c : value)
+        {
+            if(c == '\\')
+                escaped += "\\\\";
+            else if(c == '\n')
+                escaped += "\\n";
+            else if(c == '"' && quotes)
+                escaped += "\\\"";
+            else
+                escaped += c;
+        }
+        return escaped;
+    }
+
+
+    static uint64 getStorageSize(const std::string& path)
+    {
+        std::error_code error;
+        if(std::filesystem::is_regular_file(path, error))
+            return std::filesystem::file_size(path, error);
+
+        uint64 size = 0;
+        for(const auto& entry : std::filesystem::recursive_directory_iterator(path, error))
+        {
+            if(entry.is_regular_file(error))
+                size += entry.file_size(error);
+        }
+        return size;
+    }
+
+
+    Metrics::Histogram::Histogram(const std::vector<double>& bounds) :
+        mBounds(bounds), mBuckets(new std::atomic<uint64>[bounds.size() + 1])
+    {
+        for(size_t i = 0; i <= mBounds.size(); i++)
+            mBuckets[i] = 0;
+    }
+
+
+    void Metrics::Histogram::observe(double value)
+    {
+        // Buckets are inclusive, a value equal to the bound is counted in that bucket
+        size_t bucket = std::lower_bound(mBounds.begin(), mBounds.end(), value) - mBounds.begin();
+        mBuckets[bucket].fetch_add(1, std::memory_order_relaxed);
+        mCount.fetch_add(1, std::memory_order_relaxed);
+
+        double sum = mSum.load(std::memory_order_relaxed);
+        while(!mSum.compare_exchange_weak(sum, sum + value, std::memory_order_relaxed));
+    }
+
+
+    Metrics::ScopedTimer::~ScopedTimer()
+    {
+        if(mHistogram != nullptr)
+            mHistogram->observe(std::chrono::duration<double>(std::chrono::steady_clock::now() - mStart).count());
+    }
+
+
+    bool Metrics::init(utility::ErrorState& errorState)
+    {
+        for(const auto& path : mStoragePaths)
+        {
+            if(!errorState.check(!path.empty(), "StoragePaths can't hold an empty path"))
+                return false;
+            mStorageSizes.emplace_back(&addGauge("overmyroof_storage_bytes", "Size of the files of a storage path", { { "path", path } }));
+        }
+        return true;
+    }
+
+
+    Metrics::Counter& Metrics::addCounter(const std::string& name, const std::string& help, const Labels& labels)
+    {
+        auto& series = addSeries(name, help, EType::Counter, labels);
+        if(series.mCounter == nullptr)
+            series.mCounter = std::make_unique<Counter>();
+        return *series.mCounter;
+    }
+
+
+    Metrics::Gauge& Metrics::addGauge(const std::string& name, const std::string& help, const Labels& labels)
+    {
+        auto& series = addSeries(name, help, EType::Gauge, labels);
+        if(series.mGauge == nullptr)
+            series.mGauge = std::make_unique<Gauge>();
+        return *series.mGauge;
+    }
+
+
+    Metrics::Histogram& Metrics::addHistogram(const std::string& name, const std::string& help, const std::vector<double>& bounds, const Labels& labels)
+    {
+        auto& series = addSeries(name, help, EType::Histogram, labels);
+        if(series.mHistogram == nullptr)
+            series.mHistogram = std::make_unique<Histogram>(bounds);
+        return *series.mHistogram;
+    }
+
+
+    Metrics::Histogram& Metrics::addRequestHistogram(const std::string& function)
+    {
+        return addHistogram("overmyroof_request_seconds", "Duration of the requests of a REST function", kDurationBuckets, { { "function", function } });
+    }
+
+
+    Metrics::Series& Metrics::addSeries(const std::string& name, const std::string& help, EType type, const Labels& labels)
+    {
+        std::string formatted_labels;
+        for(const auto& label : labels)
+        {
+            if(!formatted_labels.empty())
+                formatted_labels += ',';
+            formatted_labels += utility::stringFormat("%s=\"%s\"", label.first.c_str(), escape(label.second, true).c_str());
+        }
+
+        // Metrics are owned by pointer, so the references handed out stay valid when series and families are added
+        std::lock_guard<std::mutex> lock(mMutex);
+        auto family = std::find_if(mFamilies.begin(), mFamilies.end(), [&name](const Family& family) { return family.mName == name; });
+        if(family == mFamilies.end())
+        {
+            mFamilies.push_back({ name, help, type, {} });
+            family = std::prev(mFamilies.end());
+        }
+        assert(family->mType == type);
+
+        for(auto& series : family->mSeries)
+        {
+            if(series.mLabels == formatted_labels)
+                return series;
+        }
+        family->mSeries.emplace_back();
+        family->mSeries.back().mLabels = formatted_labels;
+        return family->mSeries.back();
+    }
+
+
+    std::string Metrics::format()
+    {
+        for(size_t i = 0; i < mStorageSizes.size(); i++)
+            mStorageSizes[i]->set(static_cast<double>(getStorageSize(mStoragePaths[i])));
+
+        std::lock_guard<std::mutex> lock(mMutex);
+        std::string result;
+        for(const auto& family : mFamilies)
+        {
+            static const char* type_names[] = { "counter", "gauge", "histogram" };
+            std::string name = family.mType == EType::Counter ? family.mName + "_total" : family.mName;
+            result += utility::stringFormat("# HELP %s %s\n# TYPE %s %s\n", name.c_str(), escape(family.mHelp, false).c_str(),
+                                            name.c_str(), type_names[static_cast<int>(family.mType)]);
+
+            for(const auto& series : family.mSeries)
+            {
+                std::string labels = series.mLabels.empty() ? "" : "{" + series.mLabels + "}";
+                if(family.mType == EType::Counter)
+                {
+                    result += utility::stringFormat("%s%s %s\n", name.c_str(), labels.c_str(), formatValue(static_cast<double>(series.mCounter->get())).c_str());
+                }else if(family.mType == EType::Gauge)
+                {
+                    result += utility::stringFormat("%s%s %s\n", name.c_str(), labels.c_str(), formatValue(series.mGauge->get()).c_str());
+                }else
+                {
+                    // Buckets are cumulative, the count is read first so it never exceeds the +Inf bucket of a concurrent update
+                    const auto& histogram = *series.mHistogram;
+                    std::string prefix = series.mLabels.empty() ? "" : series.mLabels + ",";
+                    uint64 count = histogram.getCount();
+                    uint64 cumulative = 0;
+                    for(size_t i = 0; i <= histogram.getBounds().size(); i++)
+                    {
+                        cumulative += histogram.getBucket(i);
+                        double bound = i < histogram.getBounds().size() ? histogram.getBounds()[i] : std::numeric_limits<double>::infinity();
+                        result += utility::stringFormat("%s_bucket{%sle=\"%s\"} %s\n", name.c_str(), prefix.c_str(), formatValue(bound).c_str(),
+                                                        std::to_string(i < histogram.getBounds().size() ? cumulative : std::max(cumulative, count)).c_str());
+                    }
+                    result += utility::stringFormat("%s_sum%s %s\n", name.c_str(), labels.c_str(), formatValue(histogram.getSum()).c_str());
+                    result += utility::stringFormat("%s_count%s %s\n", name.c_str(), labels.c_str(), std::to_string(std::max(cumulative, count)).c_str());
+                }
+            }
+        }
+        return result;
+    }
+}
@@ -0,0 +1,171 @@
+#pragma once
+
+#include <nap/resource.h>
+#include <atomic>
+#include <chrono>
+#include <memory>
+#include <mutex>
+
+namespace nap
+{
+    /**
+     * Counters, gauges and histograms of the module, served in the Prometheus text format by the MetricsCall
+     * Metrics are registered once, when the resource or component that updates them is initialized. Updating a
+     * metric is a relaxed atomic operation without locks, so the ingest and request paths can update them freely.
+     * Registering and formatting are thread safe
+     */
+    class NAPAPI Metrics : public Resource
+    {
+    RTTI_ENABLE(Resource)
+    public:
+        /**
+         * Label names and values of a metric
+         */
+        using Labels = std::vector<std::pair<std::string, std::string>>;
+
+        /**
+         * A value that only goes up
+         */
+        class NAPAPI Counter
+        {
+        public:
+            void increment(uint64 value = 1) { mValue.fetch_add(value, std::memory_order_relaxed); }
+            uint64 get() const { return mValue.load(std::memory_order_relaxed); }
+        private:
+            std::atomic<uint64> mValue = { 0 };
+        };
+
+        /**
+         * A value that is set to the current state
+         */
+        class NAPAPI Gauge
+        {
+        public:
+            void set(double value) { mValue.store(value, std::memory_order_relaxed); }
+            double get() const { return mValue.load(std::memory_order_relaxed); }
+        private:
+            std::atomic<double> mValue = { 0.0 };
+        };
+
+        /**
+         * Counts observations in buckets with an upper bound
+         */
+        class NAPAPI Histogram
+        {
+        public:
+            /**
+             * @param bounds the upper bounds of the buckets in increasing order, larger values only count in +Inf
+             */
+            Histogram(const std::vector<double>& bounds);
+
+            /**
+             * @param value the observed value
+             */
+            void observe(double value);
+
+            const std::vector<double>& getBounds() const { return mBounds; }
+            uint64 getBucket(size_t index) const { return mBuckets[index].load(std::memory_order_relaxed); }
+            uint64 getCount() const { return mCount.load(std::memory_order_relaxed); }
+            double getSum() const { return mSum.load(std::memory_order_relaxed); }
+        private:
+            std::vector<double> mBounds;
+            std::unique_ptr<std::atomic<uint64>[]> mBuckets; // Observations per bucket, not cumulative
+            std::atomic<uint64> mCount = { 0 };
+            std::atomic<double> mSum = { 0.0 };
+        };
+
+        /**
+         * Observes the seconds since construction in a histogram on destruction, does nothing without a histogram
+         */
+        class NAPAPI ScopedTimer
+        {
+        public:
+            ScopedTimer(Histogram* histogram) : mHistogram(histogram), mStart(std::chrono::steady_clock::now()) {}
+            ~ScopedTimer();
+        private:
+            Histogram* mHistogram;
+            std::chrono::steady_clock::time_point mStart;
+        };
+
+        // Bucket bounds in seconds of durations from a fraction of a millisecond up to half a minute
+        static const std::vector<double> kDurationBuckets;
+
+        /**
+         * @param errorState the error state to store errors in
+         * @return true if the storage paths are valid
+         */
+        bool init(utility::ErrorState& errorState) final;
+
+        /**
+         * Registers a counter, or returns the counter registered before with the same name and labels
+         * @param name the name of the metric, without the _total suffix
+         * @param help the description of the metric
+         * @param labels the labels of this series of the metric
+         * @return the counter, valid as long as the resource
+         */
+        Counter& addCounter(const std::string& name, const std::string& help, const Labels& labels = {});
+
+        /**
+         * Registers a gauge, or returns the gauge registered before with the same name and labels
+         * @param name the name of the metric
+         * @param help the description of the metric
+         * @param labels the labels of this series of the metric
+         * @return the gauge, valid as long as the resource
+         */
+        Gauge& addGauge(const std::string& name, const std::string& help, const Labels& labels = {});
+
+        /**
+         * Registers a histogram, or returns the histogram registered before with the same name and labels
+         * @param name the name of the metric
+         * @param help the description of the metric
+         * @param bounds the upper bounds of the buckets, all series of a metric must use the same bounds
+         * @param labels the labels of this series of the metric
+         * @return the histogram, valid as long as the resource
+         */
+        Histogram& addHistogram(const std::string& name, const std::string& help, const std::vector<double>& bounds, const Labels& labels = {});
+
+        /**
+         * Registers the histogram of the request duration of a REST function, shared by all functions
+         * @param function the id of the function
+         * @return the histogram, valid as long as the resource
+         */
+        Histogram& addRequestHistogram(const std::string& function);
+
+        /**
+         * Formats all metrics in the Prometheus text format, the size of the storage paths is measured now
+         * @return the formatted metrics
+         */
+        std::string format();
+
+        std::vector<std::string> mStoragePaths; ///< Property: "StoragePaths" - Files and directories of which the size is reported, like the database
+    private:
+        enum class EType : int
+        {
+            Counter,
+            Gauge,
+            Histogram
+        };
+
+        struct Series
+        {
+            std::string mLabels; // Formatted labels, without braces
+            std::unique_ptr<Counter> mCounter;
+            std::unique_ptr<Gauge> mGauge;
+            std::unique_ptr<Histogram> mHistogram;
+        };
+
+        struct Family
+        {
+            std::string mName;
+            std::string mHelp;
+            EType mType;
+            std::vector<Series> mSeries;
+        };
+
+        Series& addSeries(const std::string& name, const std::string& help, EType type, const Labels& labels);
+
+        std::mutex mMutex;
+        std::vector<Family> mFamilies; // In order of registration
+        std::vector<Gauge*> mStorageSizes; // Size of every storage path
+    };
+}
@@ -0,0 +1,23 @@
+#include "metricscall.h"
+
+RTTI_BEGIN_CLASS(nap::MetricsCall)
+    RTTI_PROPERTY("Metrics", &nap::MetricsCall::mMetrics, nap::rtti::EPropertyMetaData::Required, "The metrics to return")
+RTTI_END_CLASS
+
+namespace nap
+{
+    bool MetricsCall::init(utility::ErrorState &errorState)
+    {
+        return true;
+    }
+
+
+    RestResponse MetricsCall::call(const RestValueMap &values)
+    {
+        // The version of the text format is part of the content type Prometheus expects
+        RestResponse response;
+        response.mData = mMetrics->format();
+        response.mContentType = "text/plain; version=0.0.4; charset=utf-8";
+        return response;
+    }
+}
@@ -0,0 +1,24 @@
+#pragma once
+
+#include <restfunction.h>
+#include <nap/resourceptr.h>
+
+#include "metrics.h"
+
+namespace nap
+{
+    /**
+     * MetricsCall is a RestFunction that returns all metrics in the Prometheus text format, to be scraped by Prometheus.
+     * Counters and histograms count since the application started.
+     */
+    class NAPAPI MetricsCall : public RestFunction
+    {
+    RTTI_ENABLE(RestFunction)
+    public:
+        bool init(utility::ErrorState &errorState) final;
+
+        RestResponse call(const RestValueMap &values) override;
+
+        ResourcePtr<Metrics> mMetrics; ///< Property "Metrics" : The metrics to return
+    };
+}
@@ -0,0 +1,145 @@
+#include "overheadcall.h"
+#include "trace.h"
+#include "restutils.h"
+#include "restcontenttypes.h"
+#include "nap/logger.h"
+#include "rapidjson/document.h"
+#include "rapidjson/stringbuffer.h"
+#include "rapidjson/prettywriter.h"
+#include "utils.h"
+
+#include <cctype>
+#include <cstdlib>
+
+RTTI_BEGIN_CLASS(nap::OverheadCall)
+    RTTI_PROPERTY("FetchFlightsCall", &nap::OverheadCall::mFetchFlightsCall, nap::rtti::EPropertyMetaData::Required, "Resolves the location of a new subscription")
+    RTTI_PROPERTY("OverheadSubscriptions", &nap::OverheadCall::mOverheadSubscriptions, nap::rtti::EPropertyMetaData::Required, "The registered subscriptions")
+    RTTI_PROPERTY("PollTimeout", &nap::OverheadCall::mPollTimeout, nap::rtti::EPropertyMetaData::Default, "Maximum time in seconds a request is held")
+    RTTI_PROPERTY("MaxWaiters", &nap::OverheadCall::mMaxWaiters, nap::rtti::EPropertyMetaData::Default, "Maximum number of requests held at the same time, the expected number of clients")
+    RTTI_PROPERTY("RetryAfter", &nap::OverheadCall::mRetryAfter, nap::rtti::EPropertyMetaData::Default, "Seconds a client waits before polling again when its request can't be held")
+    RTTI_PROPERTY("Metrics", &nap::OverheadCall::mMetrics, nap::rtti::EPropertyMetaData::Default, "Optional metrics the request duration is reported in")
+RTTI_END_CLASS
+
+namespace nap
+{
+    bool OverheadCall::init(utility::ErrorState &errorState)
+    {
+        if(mMetrics != nullptr)
+            mRequestDuration = &mMetrics->addRequestHistogram(mID);
+
+        if(!errorState.check(mPollTimeout >= 0.0f, "PollTimeout can't be negative"))
+            return false;
+
+        if(!errorState.check(mMaxWaiters >= 0, "MaxWaiters can't be negative"))
+            return false;
+
+        return errorState.check(mRetryAfter > 0.0f, "RetryAfter must be greater than 0");
+    }
+
+
+    RestResponse OverheadCall::call(const RestValueMap &values)
+    {
+        TRACE_ZONE("OverheadCall::call");
+        // The amount of milliseconds it took to execute the request is added to the response
+        SteadyTimer timer;
+        timer.start();
+        Metrics::ScopedTimer request_timer(mRequestDuration);
+
+        utility::ErrorState error_state;
+        std::string id;
+        uint64 cursor = 0;
+        bool busy = false;
+        std::vector<OverheadSubscriptions::Entry> entries;
+        if(values.find("id") == values.end())
+        {
+            // Subscribe, the first entries are the aircraft overhead right now
+            float lat, lon, altitude, radius;
+            if(!mFetchFlightsCall->getLocation(values, lat, lon, error_state))
+                return utility::generateErrorResponse(error_state.toString());
+            if(!extractValue("altitude", values, altitude, error_state))
+                return utility::generateErrorResponse(error_state.toString());
+            if(!extractValue("radius", values, radius, error_state))
+                return utility::generateErrorResponse(error_state.toString());
+            if(radius <= 0.0f)
+                return utility::generateErrorResponse("radius must be greater than 0");
+
+            if(!mOverheadSubscriptions->subscribe(lat, lon, radius, altitude, id, error_state))
+                return utility::generateErrorResponse(error_state.toString());
+            if(!mOverheadSubscriptions->poll(id, 0, std::chrono::milliseconds(0), entries, error_state))
+                return utility::generateErrorResponse(error_state.toString());
+        }else
+        {
+            if(!extractValue("id", values, id, error_state))
+                return utility::generateErrorResponse(error_state.toString());
+
+            // The cursor is a sequence number of the subscription, passed as string like the timestamps
+            if(values.find("cursor") != values.end())
+            {
+                std::string cursor_value;
+                if(!extractValue("cursor", values, cursor_value, error_state))
+                    return utility::generateErrorResponse(error_state.toString());
+
+                char* cursor_end = nullptr;
+                cursor = std::strtoull(cursor_value.c_str(), &cursor_end, 10);
+                if(cursor_value.empty() || !std::isdigit(static_cast<unsigned char>(cursor_value[0])) || *cursor_end != '\0')
+                    return utility::generateErrorResponse("cursor must be a non negative integer");
+            }
+
+            // Held requests take a request thread of the server, when all waiter slots are taken the poll returns what is available right away
+            bool hold = mWaiters.fetch_add(1) < mMaxWaiters;
+            auto timeout = std::chrono::milliseconds(hold ? static_cast<int64>(mPollTimeout * 1000.0f) : 0);
+            bool polled = mOverheadSubscriptions->poll(id, cursor, timeout, entries, error_state);
+            mWaiters.fetch_sub(1);
+            if(!polled)
+                return utility::generateErrorResponse(error_state.toString());
+
+            // Nothing to return and the request couldn't wait for it, the client backs off instead of polling again right away
+            busy = !hold && entries.empty();
+        }
+
+        // Create the json document
+        rapidjson::Document document(rapidjson::kObjectType);
+        rapidjson::Value data(rapidjson::kObjectType);
+        document.AddMember("status", busy ? "busy" : "ok", document.GetAllocator());
+        data.AddMember("id", rapidjson::Value(id.c_str(), document.GetAllocator()), document.GetAllocator());
+
+        // Add the aircraft that entered the area
+        rapidjson::Value flights(rapidjson::kArrayType);
+        for(const auto& entry : entries)
+        {
+            const auto& state = entry.mState;
+            rapidjson::Value flight(rapidjson::kObjectType);
+            flight.AddMember("icao", rapidjson::Value(formatICAO(state.mICAO).c_str(), document.GetAllocator()), document.GetAllocator());
+            flight.AddMember("reg", rapidjson::Value(state.mRegistration.c_str(), document.GetAllocator()), document.GetAllocator());
+            flight.AddMember("aircraft_type", rapidjson::Value(state.mAircraftType.c_str(), document.GetAllocator()), document.GetAllocator());
+            flight.AddMember("lat", state.mLatitude, document.GetAllocator());
+            flight.AddMember("lon", state.mLongitude, document.GetAllocator());
+            flight.AddMember("altitude", state.mAltitude, document.GetAllocator());
+            flight.AddMember("timestamp", entry.mTimeStamp, document.GetAllocator());
+            flight.AddMember("distance", entry.mDistance, document.GetAllocator());
+            flights.PushBack(flight, document.GetAllocator());
+        }
+        data.AddMember("flights", flights, document.GetAllocator());
+
+        // The cursor to pass with the next request
+        uint64 next_cursor = entries.empty() ? cursor : entries.back().mSequence;
+        data.AddMember("cursor", next_cursor, document.GetAllocator());
+        if(busy)
+            data.AddMember("retry_after", mRetryAfter, document.GetAllocator());
+        data.AddMember("ms", timer.getMillis().count(), document.GetAllocator());
+        document.AddMember("data", data, document.GetAllocator());
+
+        // Serialize the response
+        rapidjson::StringBuffer buffer;
+        rapidjson::PrettyWriter<rapidjson::StringBuffer> writer(buffer);
+        writer.SetMaxDecimalPlaces(4);
+        document.Accept(writer);
+
+        // Create the response
+        RestResponse response;
+        response.mData = buffer.GetString();
+        response.mContentType = rest::contenttypes::json;
+
+        return response;
+    }
+}
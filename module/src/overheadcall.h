@@ -0,0 +1,39 @@
+#pragma once
+
+#include <restfunction.h>
+#include <atomic>
+
+#include "fetchflightscall.h"
+#include "overheadsubscriptions.h"
+#include "metrics.h"
+
+namespace nap
+{
+    /**
+     * OverheadCall is a long poll RestFunction that returns the aircraft entering an area as soon as they're ingested.
+     * The first request, without an id, subscribes to the area and returns the aircraft that are overhead right now.
+     * Follow up requests pass the id and the returned cursor, and are held until new aircraft enter the area or the
+     * PollTimeout passes. A held request occupies a request thread of the server while it waits, so the server needs
+     * MaxConcurrentRequests of at least MaxWaiters plus the requests of the other calls. Beyond MaxWaiters held requests a poll
+     * returns the entries that are available right away, or when there are none a busy status with the number of seconds
+     * after which the client should poll again.
+     */
+    class NAPAPI OverheadCall : public RestFunction
+    {
+    RTTI_ENABLE(RestFunction)
+    public:
+        bool init(utility::ErrorState &errorState) final;
+
+        RestResponse call(const RestValueMap &values) override;
+
+        ResourcePtr<FetchFlightsCall> mFetchFlightsCall; ///< Property "FetchFlightsCall" : Resolves the location of a new subscription
+        ResourcePtr<OverheadSubscriptions> mOverheadSubscriptions; ///< Property "OverheadSubscriptions" : The registered subscriptions
+        float mPollTimeout = 25.0f; ///< Property "PollTimeout" : Maximum time in seconds a request is held
+        int mMaxWaiters = 64; ///< Property "MaxWaiters" : Maximum number of requests held at the same time, the expected number of clients
+        float mRetryAfter = 5.0f; ///< Property "RetryAfter" : Seconds a client waits before polling again when its request can't be held
+        ResourcePtr<Metrics> mMetrics; ///< Property "Metrics" : Optional metrics the request duration is reported in
+    private:
+        Metrics::Histogram* mRequestDuration = nullptr;
+        std::atomic<int> mWaiters = { 0 };
+    };
+}
@@ -0,0 +1,222 @@
+#include "overheadsubscriptions.h"
+#include "utils.h"
+
+#include <nap/logger.h>
+#include <math.h>
+
+RTTI_BEGIN_CLASS(nap::OverheadSubscriptions)
+    RTTI_PROPERTY("StatesCache", &nap::OverheadSubscriptions::mStatesCache, nap::rtti::EPropertyMetaData::Default)
+    RTTI_PROPERTY("MaxSubscriptions", &nap::OverheadSubscriptions::mMaxSubscriptions, nap::rtti::EPropertyMetaData::Default)
+    RTTI_PROPERTY("MaxEntries", &nap::OverheadSubscriptions::mMaxEntries, nap::rtti::EPropertyMetaData::Default)
+    RTTI_PROPERTY("ExpireSeconds", &nap::OverheadSubscriptions::mExpireSeconds, nap::rtti::EPropertyMetaData::Default)
+    RTTI_PROPERTY("CellSize", &nap::OverheadSubscriptions::mCellSize, nap::rtti::EPropertyMetaData::Default)
+RTTI_END_CLASS
+
+namespace nap
+{
+    double calcGPSDistance(double latitude_new, double longitude_new, double latitude_old, double longitude_old);
+
+    // Meters per degree latitude, used to convert the radius of a subscription into a bounding box
+    static constexpr double sMetersPerDegree = 111320.0;
+
+    bool OverheadSubscriptions::init(utility::ErrorState &errorState)
+    {
+        if(!errorState.check(mMaxSubscriptions > 0, "MaxSubscriptions must be greater than 0"))
+            return false;
+
+        if(!errorState.check(mMaxEntries > 0, "MaxEntries must be greater than 0"))
+            return false;
+
+        if(!errorState.check(mExpireSeconds > 0, "ExpireSeconds must be greater than 0"))
+            return false;
+
+        if(!errorState.check(mCellSize > 0.0f, "CellSize must be greater than 0"))
+            return false;
+
+        // Ids are random so subscriptions of other clients can't be guessed
+        mRandom.seed(std::random_device()());
+        return true;
+    }
+
+
+    bool OverheadSubscriptions::subscribe(float latitude, float longitude, float radius, float altitude, std::string& id, utility::ErrorState& errorState)
+    {
+        std::lock_guard<std::mutex> lock(mMutex);
+        if(!errorState.check(mSubscriptions.size() < static_cast<size_t>(mMaxSubscriptions), "Maximum number of subscriptions reached"))
+            return false;
+
+        auto subscription = std::make_unique<Subscription>();
+        do
+        {
+            subscription->mID = utility::stringFormat("%016llx", static_cast<unsigned long long>(mRandom()));
+        }while(mSubscriptions.find(subscription->mID) != mSubscriptions.end());
+
+        subscription->mLatitude = latitude;
+        subscription->mLongitude = longitude;
+        subscription->mRadius = radius;
+        subscription->mAltitude = altitude;
+        subscription->mLastPoll = SystemClock::now();
+
+        // The aircraft that are overhead right now are the first entries.
+        // The lock is held, so no snapshot is published in between
+        uint64 newest = mStatesCache != nullptr ? mStatesCache->getMostRecentTimeStamp() : 0;
+        if(newest != 0)
+        {
+            std::vector<FlightStates> snapshots;
+            mStatesCache->getStates(newest, newest, altitude, snapshots);
+            for(const auto& snapshot : snapshots)
+            {
+                for(const auto& state : snapshot.mStates)
+                    match(*subscription, state, snapshot.mTimeStamp);
+            }
+            subscription->mInside.swap(subscription->mCurrent);
+        }
+
+        // Register the subscription in every grid cell its area overlaps
+        double lat_delta = radius / sMetersPerDegree;
+        double lon_delta = radius / (sMetersPerDegree * std::max(std::cos(latitude * M_PI / 180.0), 0.01));
+        for(int32 cell_lat = toCellIndex(latitude - lat_delta); cell_lat <= toCellIndex(latitude + lat_delta); cell_lat++)
+        {
+            for(int32 cell_lon = toCellIndex(longitude - lon_delta); cell_lon <= toCellIndex(longitude + lon_delta); cell_lon++)
+            {
+                uint64 key = toCellKey(cell_lat, cell_lon);
+                mGrid[key].emplace_back(subscription.get());
+                subscription->mCells.emplace_back(key);
+            }
+        }
+
+        id = subscription->mID;
+        mSubscriptions.emplace(id, std::move(subscription));
+        return true;
+    }
+
+
+    bool OverheadSubscriptions::poll(const std::string& id, uint64 cursor, std::chrono::milliseconds timeout,
+                                     std::vector<Entry>& entries, utility::ErrorState& errorState)
+    {
+        std::unique_lock<std::mutex> lock(mMutex);
+
+        // The subscription is looked up again after every wake up, it might have expired in the meantime
+        Subscription* subscription = nullptr;
+        auto ready = [this, &id, cursor, &subscription]()
+        {
+            auto it = mSubscriptions.find(id);
+            subscription = it != mSubscriptions.end() ? it->second.get() : nullptr;
+            return subscription == nullptr || subscription->mSequence > cursor;
+        };
+
+        if(!ready())
+        {
+            subscription->mLastPoll = SystemClock::now();
+            mCondition.wait_for(lock, timeout, ready);
+        }
+
+        if(!errorState.check(subscription != nullptr, "Unknown subscription %s", id.c_str()))
+            return false;
+
+        subscription->mLastPoll = SystemClock::now();
+        for(const auto& entry : subscription->mEntries)
+        {
+            if(entry.mSequence > cursor)
+                entries.emplace_back(entry);
+        }
+        return true;
+    }
+
+
+    void OverheadSubscriptions::addStates(uint64 timestamp, const std::vector<FlightState>& states)
+    {
+        {
+            std::lock_guard<std::mutex> lock(mMutex);
+
+            // Only the subscriptions in the cell of an aircraft can contain it
+            for(const auto& state : states)
+            {
+                auto it = mGrid.find(toCellKey(toCellIndex(state.mLatitude), toCellIndex(state.mLongitude)));
+                if(it == mGrid.end())
+                    continue;
+
+                for(auto* subscription : it->second)
+                    match(*subscription, state, timestamp);
+            }
+
+            // The aircraft inside the area now are compared to the next snapshot
+            auto now = SystemClock::now();
+            std::vector<std::string> expired;
+            for(auto& pair : mSubscriptions)
+            {
+                auto& subscription = *pair.second;
+                if(now - subscription.mLastPoll > std::chrono::seconds(mExpireSeconds))
+                {
+                    expired.emplace_back(pair.first);
+                    continue;
+                }
+
+                subscription.mInside.swap(subscription.mCurrent);
+                subscription.mCurrent.clear();
+            }
+
+            for(const auto& id : expired)
+                removeSubscription(id);
+        }
+
+        mCondition.notify_all();
+    }
+
+
+    void OverheadSubscriptions::match(Subscription& subscription, const FlightState& state, uint64 timestamp)
+    {
+        if(subscription.mAltitude > 0 && state.mAltitude > subscription.mAltitude)
+            return;
+
+        float distance = static_cast<float>(calcGPSDistance(subscription.mLatitude, subscription.mLongitude, state.mLatitude, state.mLongitude));
+        if(distance >= subscription.mRadius)
+            return;
+
+        subscription.mCurrent.emplace(state.mICAO);
+        if(subscription.mInside.find(state.mICAO) != subscription.mInside.end())
+            return;
+
+        Entry entry;
+        entry.mSequence = ++subscription.mSequence;
+        entry.mTimeStamp = timestamp;
+        entry.mDistance = distance;
+        entry.mState = state;
+        subscription.mEntries.emplace_back(std::move(entry));
+        while(subscription.mEntries.size() > static_cast<size_t>(mMaxEntries))
+            subscription.mEntries.pop_front();
+    }
+
+
+    void OverheadSubscriptions::removeSubscription(const std::string& id)
+    {
+        auto it = mSubscriptions.find(id);
+        if(it == mSubscriptions.end())
+            return;
+
+        for(uint64 key : it->second->mCells)
+        {
+            auto cell = mGrid.find(key);
+            if(cell == mGrid.end())
+                continue;
+
+            auto& subscriptions = cell->second;
+            subscriptions.erase(std::remove(subscriptions.begin(), subscriptions.end(), it->second.get()), subscriptions.end());
+            if(subscriptions.empty())
+                mGrid.erase(cell);
+        }
+        mSubscriptions.erase(it);
+    }
+
+
+    uint64 OverheadSubscriptions::toCellKey(int32 latitude, int32 longitude) const
+    {
+        return (static_cast<uint64>(static_cast<uint32>(latitude)) << 32) | static_cast<uint32>(longitude);
+    }
+
+
+    int32 OverheadSubscriptions::toCellIndex(float coordinate) const
+    {
+        return static_cast<int32>(std::floor(coordinate / mCellSize));
+    }
+}
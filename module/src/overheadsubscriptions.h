@@ -0,0 +1,106 @@
+#pragma once
+
+#include <nap/resource.h>
+#include <nap/resourceptr.h>
+#include <mutex>
+#include <condition_variable>
+#include <random>
+#include <deque>
+#include <unordered_map>
+#include <unordered_set>
+
+#include "statescache.h"
+
+namespace nap
+{
+    /**
+     * Subscriptions to the aircraft entering an area, used to push "overhead now" to clients.
+     * Every new snapshot is matched against all subscriptions in one pass, using a grid of the subscribed areas.
+     * An aircraft enters an area when it is inside the area and wasn't in the previous snapshot.
+     * Clients wait for the aircraft entering their area with poll(), which returns as soon as the snapshot is published.
+     * Subscriptions that aren't polled for ExpireSeconds are removed. All methods are thread safe
+     */
+    class NAPAPI OverheadSubscriptions : public Resource
+    {
+    RTTI_ENABLE(Resource)
+    public:
+        /**
+         * An aircraft entering the area of a subscription
+         */
+        struct Entry
+        {
+            uint64 mSequence = 0; ///< Sequence number of the entry within the subscription
+            uint64 mTimeStamp = 0; ///< Timestamp of the snapshot the aircraft entered the area in
+            float mDistance = 0.0f; ///< Distance in meters to the center of the area
+            FlightState mState; ///< The state of the aircraft
+        };
+
+        /**
+         * @param errorState the error state to store errors in
+         * @return true if the properties are valid
+         */
+        bool init(utility::ErrorState &errorState) final;
+
+        /**
+         * Registers a subscription. The aircraft inside the area in the most recent cached snapshot are the first entries
+         * @param latitude latitude of the center of the area
+         * @param longitude longitude of the center of the area
+         * @param radius radius in meters
+         * @param altitude maximum altitude of the aircraft, ignored when <= 0
+         * @param id the id of the new subscription
+         * @param errorState the error state to store errors in
+         * @return true if the subscription was registered
+         */
+        bool subscribe(float latitude, float longitude, float radius, float altitude, std::string& id, utility::ErrorState& errorState);
+
+        /**
+         * Waits until aircraft entered the area of a subscription after the cursor, or until the timeout
+         * @param id the id of the subscription
+         * @param cursor sequence number of the last entry the client received, 0 for none
+         * @param timeout maximum time to wait
+         * @param entries the entries after the cursor, empty on timeout
+         * @param errorState the error state to store errors in
+         * @return false if the subscription doesn't exist
+         */
+        bool poll(const std::string& id, uint64 cursor, std::chrono::milliseconds timeout, std::vector<Entry>& entries, utility::ErrorState& errorState);
+
+        /**
+         * Matches a new snapshot against all subscriptions and wakes up the waiting clients, called by the logger for every snapshot
+         * @param timestamp the timestamp of the snapshot in uint64 YYYYMMDDHHMMSS
+         * @param states all states of the snapshot
+         */
+        void addStates(uint64 timestamp, const std::vector<FlightState>& states);
+
+        ResourcePtr<StatesCache> mStatesCache; ///< Property: "StatesCache" - Optional cache used to find the aircraft inside the area of a new subscription
+        int mMaxSubscriptions = 10000; ///< Property: "MaxSubscriptions" - Maximum number of subscriptions
+        int mMaxEntries = 1000; ///< Property: "MaxEntries" - Number of entries kept per subscription for clients that poll too late
+        int mExpireSeconds = 300; ///< Property: "ExpireSeconds" - Seconds after which a subscription that isn't polled is removed
+        float mCellSize = 0.05f; ///< Property: "CellSize" - Size in degrees of the grid cells used to find the subscriptions near an aircraft
+    private:
+        struct Subscription
+        {
+            std::string mID;
+            float mLatitude = 0.0f;
+            float mLongitude = 0.0f;
+            float mRadius = 0.0f;
+            float mAltitude = 0.0f;
+            std::unordered_set<uint64> mInside; // Aircraft inside the area in the previous snapshot
+            std::unordered_set<uint64> mCurrent; // Aircraft inside the area in the snapshot being matched
+            std::deque<Entry> mEntries;
+            uint64 mSequence = 0;
+            std::vector<uint64> mCells;
+            SystemTimeStamp mLastPoll;
+        };
+
+        void match(Subscription& subscription, const FlightState& state, uint64 timestamp);
+        void removeSubscription(const std::string& id);
+        uint64 toCellKey(int32 latitude, int32 longitude) const;
+        int32 toCellIndex(float coordinate) const;
+
+        std::mutex mMutex;
+        std::condition_variable mCondition;
+        std::unordered_map<std::string, std::unique_ptr<Subscription>> mSubscriptions;
+        std::unordered_map<uint64, std::vector<Subscription*>> mGrid;
+        std::mt19937_64 mRandom;
+    };
+}
@@ -1,20 +1,39 @@
 #include "planeloggercomponent.h"
 #include "flightstate.h"
+#include "utils.h"
+#include "trace.h"
 
 #include <nap/logger.h>
 #include <rapidjson/rapidjson.h>
 #include <rapidjson/document.h>
-#include <rapidjson/writer.h>
+#include <unordered_set>
+#include <cstring>
 
 RTTI_BEGIN_CLASS(nap::PlaneLoggerComponent)
     RTTI_PROPERTY("RestClient", &nap::PlaneLoggerComponent::mRestClient, nap::rtti::EPropertyMetaData::Required)
     RTTI_PROPERTY("Interval", &nap::PlaneLoggerComponent::mInterval, nap::rtti::EPropertyMetaData::Default)
     RTTI_PROPERTY("FlightStatesDatabase", &nap::PlaneLoggerComponent::mFlightStatesDatabase, nap::rtti::EPropertyMetaData::Required)
     RTTI_PROPERTY("StatesCache", &nap::PlaneLoggerComponent::mStatesCache, nap::rtti::EPropertyMetaData::Required)
+    RTTI_PROPERTY("PositionIndex", &nap::PlaneLoggerComponent::mPositionIndex, nap::rtti::EPropertyMetaData::Default)
+    RTTI_PROPERTY("WorkerPool", &nap::PlaneLoggerComponent::mWorkerPool, nap::rtti::EPropertyMetaData::Default)
+    RTTI_PROPERTY("Scheduler", &nap::PlaneLoggerComponent::mScheduler, nap::rtti::EPropertyMetaData::Default)
+    RTTI_PROPERTY("Compression", &nap::PlaneLoggerComponent::mCompression, nap::rtti::EPropertyMetaData::Default)
+    RTTI_PROPERTY("TrafficRollups", &nap::PlaneLoggerComponent::mTrafficRollups, nap::rtti::EPropertyMetaData::Default)
+    RTTI_PROPERTY("DisturbanceWatches", &nap::PlaneLoggerComponent::mDisturbanceWatches, nap::rtti::EPropertyMetaData::Default)
+    RTTI_PROPERTY("OverheadSubscriptions", &nap::PlaneLoggerComponent::mOverheadSubscriptions, nap::rtti::EPropertyMetaData::Default)
     RTTI_PROPERTY("RetainHours", &nap::PlaneLoggerComponent::mRetainHours, nap::rtti::EPropertyMetaData::Default)
     RTTI_PROPERTY("CacheHours", &nap::PlaneLoggerComponent::mCacheHours, nap::rtti::EPropertyMetaData::Default)
     RTTI_PROPERTY("Adress", &nap::PlaneLoggerComponent::mAdress, nap::rtti::EPropertyMetaData::Default)
     RTTI_PROPERTY("Bounds", &nap::PlaneLoggerComponent::mBounds, nap::rtti::EPropertyMetaData::Default)
+    RTTI_PROPERTY("Tiles", &nap::PlaneLoggerComponent::mTiles, nap::rtti::EPropertyMetaData::Default)
+    RTTI_PROPERTY("Limit", &nap::PlaneLoggerComponent::mLimit, nap::rtti::EPropertyMetaData::Default)
+    RTTI_PROPERTY("MaxSplitDepth", &nap::PlaneLoggerComponent::mMaxSplitDepth, nap::rtti::EPropertyMetaData::Default)
+    RTTI_PROPERTY("DeltaEncoding", &nap::PlaneLoggerComponent::mDeltaEncoding, nap::rtti::EPropertyMetaData::Default)
+    RTTI_PROPERTY("KeyFrameInterval", &nap::PlaneLoggerComponent::mKeyFrameInterval, nap::rtti::EPropertyMetaData::Default)
+    RTTI_PROPERTY("DeltaThreshold", &nap::PlaneLoggerComponent::mDeltaThreshold, nap::rtti::EPropertyMetaData::Default)
+    RTTI_PROPERTY("RecordDirectory", &nap::PlaneLoggerComponent::mRecordDirectory, nap::rtti::EPropertyMetaData::Default)
+    RTTI_PROPERTY("UseFeedTime", &nap::PlaneLoggerComponent::mUseFeedTime, nap::rtti::EPropertyMetaData::Default)
+    RTTI_PROPERTY("Metrics", &nap::PlaneLoggerComponent::mMetrics, nap::rtti::EPropertyMetaData::Default)
 RTTI_END_CLASS
 
 RTTI_BEGIN_CLASS_NO_DEFAULT_CONSTRUCTOR(nap::PlaneLoggerComponentInstance)
@@ -35,80 +54,189 @@ namespace nap
     {}
 
 
+    PlaneLoggerComponentInstance::~PlaneLoggerComponentInstance()
+    {
+        mStopWarmUp = true;
+        if(mWarmUpThread.joinable())
+            mWarmUpThread.join();
+    }
+
+
     bool PlaneLoggerComponentInstance::init(utility::ErrorState &errorState)
     {
         auto* resource = getComponent<PlaneLoggerComponent>();
         mRestClient = resource->mRestClient.get();
         mInterval = resource->mInterval;
         mFlightStatesTableName = resource->mFlightStatesTableName;
-        mFlightStatesTable = resource->mFlightStatesDatabase->getDatabaseTable<FlightStatesData>(mFlightStatesTableName);
+        mFlightStatesStore = resource->mFlightStatesDatabase->getFlightStatesStore(mFlightStatesTableName, errorState);
+        if(mFlightStatesStore == nullptr)
+            return false;
         mStatesCache = resource->mStatesCache.get();
+        mPositionIndex = resource->mPositionIndex.get();
+        mWorkerPool = resource->mWorkerPool.get();
         mRetainHours = resource->mRetainHours;
         mCacheHours = resource->mCacheHours;
         mAddress = resource->mAdress;
         mBounds = resource->mBounds;
+        mLimit = resource->mLimit;
+        mMaxSplitDepth = resource->mMaxSplitDepth;
+        mScheduler = resource->mScheduler.get();
+        mCompression = resource->mCompression.get();
+        mTrafficRollups = resource->mTrafficRollups.get();
+        mDisturbanceWatches = resource->mDisturbanceWatches.get();
+        mOverheadSubscriptions = resource->mOverheadSubscriptions.get();
+
+        mDeltaEncoding = resource->mDeltaEncoding;
+        mKeyFrameInterval = resource->mKeyFrameInterval;
+        mDeltaThreshold = resource->mDeltaThreshold;
+        mUseFeedTime = resource->mUseFeedTime;
+        if(resource->mMetrics != nullptr)
+            initMetrics(*resource->mMetrics);
+
+        // Record the raw responses, so the feed can be replayed to test ingest without polling the live feed
+        if(!resource->mRecordDirectory.empty())
+        {
+            mRecording = std::make_unique<FeedRecording>(resource->mRecordDirectory);
+            if(!mRecording->init(errorState))
+                return false;
+        }
+
+        if(!errorState.check(mLimit > 0, "Limit must be greater than 0"))
+            return false;
+
+        // Readers only look back this far to find the keyframe of a delta
+        if(!errorState.check(mKeyFrameInterval > 0.0f && mKeyFrameInterval <= FlightStatesData::kMaxKeyFrameMinutes * 60,
+                             "KeyFrameInterval must be between 0 and %d seconds", FlightStatesData::kMaxKeyFrameMinutes * 60))
+            return false;
+
+        // Poll the configured tiles, or the bounds as one tile when no tiles are configured
+        if(resource->mTiles.empty())
+        {
+            mTiles.push_back({ mBounds, 0, false });
+        }else
+        {
+            for(const auto& bounds : resource->mTiles)
+                mTiles.push_back({ bounds, 0, false });
+        }
 
-        mTime = mInterval;
+        // Poll right away
+        mNextPoll = SteadyClock::now();
 
-        // Fill cache with data from the last cache hours
+        // Fill cache with data from the last cache hours in the background, so we can start serving requests right away
+        // Until the cache is warm, the part of a requested window that isn't cached yet is read from the database
+        uint64 now_uint64 = utility::uint64FromDateTime(getCurrentDateTime());
+        uint64 yes_uint64 = utility::uint64FromDateTime(DateTime(SystemClock::now() - std::chrono::hours(mCacheHours)));
+        mWarmUpThread = std::thread([this, yes_uint64, now_uint64]()
+        {
+            TRACE_THREAD_NAME("cache warm-up");
+            warmUpCache(yes_uint64, now_uint64);
+        });
+
+        return true;
+    }
+
+
+    void PlaneLoggerComponentInstance::warmUpCache(uint64 begin, uint64 end)
+    {
+        TRACE_ZONE("PlaneLogger::warmUpCache");
         nap::Logger::info(*this, "Filling cache with data from the last %d hours", mCacheHours);
-        auto now = getCurrentDateTime();
-        std::string now_format = utility::stringFormat("%d%02d%02d%02d%02d%02d",
-                                                       now.getYear(), now.getMonth(), now.getDayInTheMonth(),
-                                                       now.getHour(), now.getMinute(), now.getSecond());
-        uint64 now_uint64 = std::stoull(now_format);
-
-        auto yes = DateTime(SystemClock::now() - std::chrono::hours(mCacheHours));
-        std::string yes_format = utility::stringFormat("%d%02d%02d%02d%02d%02d",
-                                                       yes.getYear(), yes.getMonth(), yes.getDayInTheMonth(),
-                                                       yes.getHour(), yes.getMinute(), yes.getSecond());
-        uint64 yes_uint64 = std::stoull(yes_format);
+        SteadyTimer timer;
+        timer.start();
 
+        // Split the history in hourly chunks, newest first
         utility::ErrorState e;
-        rtti::Factory factory;
-        std::vector<std::unique_ptr<rtti::Object>> objects;
-        if(mFlightStatesTable->query(utility::stringFormat("%s > %s AND %s < %s",
-                                                           FlightStatesData::kTimeStampPropertyName,
-                                                           std::to_string(yes_uint64).c_str(),
-                                                           FlightStatesData::kTimeStampPropertyName,
-                                                           std::to_string(now_uint64).c_str()),
-                                     objects, factory, e))
+        std::vector<std::pair<uint64, uint64>> ranges;
+        if(!utility::splitTimeRange(begin, end, mCacheHours, std::chrono::minutes(60), ranges, e))
+        {
+            nap::Logger::error(*this, "Error filling cache : %s", e.toString().c_str());
+            return;
+        }
+        std::reverse(ranges.begin(), ranges.end());
+
+        // Chunks are loaded in parallel but handed to the cache in order, newest first.
+        // This way the cache always covers one connected period that grows back in time.
+        // When a chunk fails to load, older chunks are not added because the cache would have a gap.
+        // Once the cache is full, older chunks would only be evicted again, so they aren't loaded anymore
+        std::mutex commit_mutex;
+        std::vector<std::vector<FlightStates>> loaded(ranges.size());
+        std::vector<int> status(ranges.size(), 0);
+        size_t next_commit = 0;
+        size_t committed_count = 0;
+        std::atomic<bool> cache_full = { false };
+        auto load_range = [&](size_t index)
         {
-            // Iterate over all the objects
-            for(auto &object: objects)
+            if(mStopWarmUp || cache_full)
+                return;
+
+            std::vector<FlightStates> states;
+            utility::ErrorState error_state;
+            bool success = queryStates(ranges[index].first, ranges[index].second, states, error_state);
+            if(!success)
+                nap::Logger::error(*this, "Error filling cache : %s", error_state.toString().c_str());
+
+            std::lock_guard<std::mutex> lock(commit_mutex);
+            loaded[index] = std::move(states);
+            status[index] = success ? 1 : -1;
+            while(next_commit < ranges.size() && status[next_commit] != 0)
             {
-                assert(object->get_type().is_derived_from<FlightStatesData>());
-
-                // Cast the object to the correct type
-                auto* data = static_cast<FlightStatesData*>(object.get());
-                std::vector<FlightState> states;
-
-                // Parse the data
-                if(data->ParseData(states, -1, e))
+                if(status[next_commit] < 0)
                 {
-                    // sort by altitude
-                    std::sort(states.begin(), states.end(), [](const FlightState& a, const FlightState& b)
-                    {
-                        return a.mAltitude < b.mAltitude;
-                    });
-
-                    for(const auto &state: states)
-                    {
-                        mStatesCache->addStates(data->mTimeStamp, states);
-                    }
-                }else
+                    next_commit = ranges.size();
+                    break;
+                }
+                // Only chunks handed to the cache are counted, chunks after a gap are discarded
+                committed_count += loaded[next_commit].size();
+                if(!mStatesCache->loadStates(std::move(loaded[next_commit++])))
                 {
-                    nap::Logger::error(*this, "Error parsing data : %s", e.toString().c_str());
+                    cache_full = true;
+                    next_commit = ranges.size();
+                    break;
                 }
             }
+        };
+
+        if(mWorkerPool != nullptr)
+        {
+            mWorkerPool->parallelFor(ranges.size(), load_range);
         }else
         {
-            nap::Logger::error(*this, "Error querying database : %s", e.toString().c_str());
+            for(size_t i = 0; i < ranges.size(); i++)
+                load_range(i);
         }
 
-        DEBUG_LOG(*this, "Cache filled with %i states", objects.size());
+        nap::Logger::info(*this, "Cache filled with %d states in %.2f seconds, covering %d minutes in %.1f MB%s", static_cast<int>(committed_count), timer.getElapsedTime(),
+                          static_cast<int>(mStatesCache->getCoveredSeconds() / 60), mStatesCache->getByteCount() / (1024.0 * 1024.0),
+                          cache_full ? ", the cache is full" : "");
+    }
+
 
-        return true;
+    bool PlaneLoggerComponentInstance::queryStates(uint64 begin, uint64 end, std::vector<FlightStates>& states, utility::ErrorState& errorState)
+    {
+        auto add_snapshot = [&states](uint64 timestamp, const std::vector<FlightState>& snapshotStates)
+        {
+            FlightStates snapshot;
+            snapshot.mTimeStamp = timestamp;
+            snapshot.mStates = snapshotStates;
+            states.emplace_back(std::move(snapshot));
+        };
+        return mFlightStatesStore->readSnapshots(begin, end, mCompression, add_snapshot, errorState);
+    }
+
+
+    void PlaneLoggerComponentInstance::initMetrics(Metrics& metrics)
+    {
+        // Aircraft per poll, up to twice the most the feed reports over Europe
+        static const std::vector<double> aircraft_buckets = { 100, 250, 500, 1000, 2000, 4000, 8000, 16000 };
+        mPollDuration = &metrics.addHistogram("overmyroof_poll_seconds", "Duration of a poll, from the first request until every tile responded", Metrics::kDurationBuckets);
+        mParseDuration = &metrics.addHistogram("overmyroof_parse_seconds", "Duration of parsing the response of a tile", Metrics::kDurationBuckets);
+        mPollAircraft = &metrics.addHistogram("overmyroof_poll_aircraft", "Aircraft in a snapshot", aircraft_buckets);
+        mIngestLag = &metrics.addHistogram("overmyroof_ingest_lag_seconds", "Duration from the start of a poll until its snapshot is stored", Metrics::kDurationBuckets);
+        mStatesInsertDuration = &metrics.addHistogram("overmyroof_db_insert_seconds", "Duration of writing a snapshot to the database", Metrics::kDurationBuckets, { { "store", "states" } });
+        mPositionsInsertDuration = &metrics.addHistogram("overmyroof_db_insert_seconds", "Duration of writing a snapshot to the database", Metrics::kDurationBuckets, { { "store", "positions" } });
+        mStatesDeleteDuration = &metrics.addHistogram("overmyroof_db_delete_seconds", "Duration of removing rows older than the retain hours", Metrics::kDurationBuckets, { { "store", "states" } });
+        mPositionsDeleteDuration = &metrics.addHistogram("overmyroof_db_delete_seconds", "Duration of removing rows older than the retain hours", Metrics::kDurationBuckets, { { "store", "positions" } });
+        mPollFailures = &metrics.addCounter("overmyroof_poll_failures", "Polls dropped because a tile failed");
+        mLastSnapshot = &metrics.addGauge("overmyroof_last_snapshot_timestamp_seconds", "Unix time at which the last snapshot was stored");
     }
 
 
@@ -117,278 +245,515 @@ namespace nap
         if(mQuerying)
             return;
 
-        mTime += deltaTime;
-        if(mTime > mInterval)
+        // The poll timer is an absolute deadline, so the cadence doesn't drift with frame timing or request duration
+        auto now = SteadyClock::now();
+        if(now >= mNextPoll)
         {
             mQuerying = true;
 
-            mTime = 0.0;
-
-            DEBUG_LOG(*this, "Getting flight states from url %s address %s", mRestClient->mURL.c_str(), mAddress.c_str());
-
-            std::vector<std::unique_ptr<APIBaseValue>> params;
-            params.emplace_back(std::make_unique<APIValue<int>>("faa", 1));
-            params.emplace_back(std::make_unique<APIValue<int>>("satellite", 1));
-            params.emplace_back(std::make_unique<APIValue<int>>("mlat", 1));
-            params.emplace_back(std::make_unique<APIValue<int>>("flarm", 1));
-            params.emplace_back(std::make_unique<APIValue<int>>("adsb", 1));
-            params.emplace_back(std::make_unique<APIValue<int>>("gnd", 1));
-            params.emplace_back(std::make_unique<APIValue<int>>("air", 1));
-            params.emplace_back(std::make_unique<APIValue<int>>("vehicles", 1));
-            params.emplace_back(std::make_unique<APIValue<int>>("estimated", 1));
-            params.emplace_back(std::make_unique<APIValue<int>>("maxage", 14400));
-            params.emplace_back(std::make_unique<APIValue<int>>("gliders", 1));
-            params.emplace_back(std::make_unique<APIValue<int>>("stats", 1));
-            params.emplace_back(std::make_unique<APIValue<int>>("limit", 5000));
-            params.emplace_back(std::make_unique<APIDoubleArray>("bounds", std::vector<double>{mBounds[0], mBounds[1], mBounds[2], mBounds[3]}));
-            mRestClient->get(mAddress, params, [this](const RestResponse& response)
+            // When we fell behind more than an interval, skip the missed polls instead of catching up
+            mNextPoll += std::chrono::duration_cast<SteadyClock::duration>(std::chrono::duration<float>(mInterval));
+            if(mNextPoll <= now)
+                mNextPoll = now + std::chrono::duration_cast<SteadyClock::duration>(std::chrono::duration<float>(mInterval));
+
+            // Poll all tiles concurrently, the responses are merged into one snapshot once every tile responded
+            TRACE_ZONE("PlaneLogger::poll");
+            auto round = std::make_shared<PollRound>();
+            round->mTiles = mTiles;
+            round->mResults.resize(mTiles.size());
+            round->mResponses.resize(mTiles.size());
+            round->mPending = mTiles.size();
+            round->mStart = now;
+
+            // Responses can arrive while the tiles are polled, they add split tiles to the round and poll those themselves.
+            // The last response replaces the tiles of the component, so the bounds are copied before the first request
+            std::vector<glm::vec4> bounds;
+            for(const auto& tile : mTiles)
+                bounds.emplace_back(tile.mBounds);
+            for(size_t i = 0; i < bounds.size(); i++)
+                pollTile(round, i, bounds[i]);
+        }
+    }
+
+
+    void PlaneLoggerComponentInstance::pollTile(const std::shared_ptr<PollRound>& round, size_t index, const glm::vec4& bounds)
+    {
+        DEBUG_LOG(*this, "Getting flight states from url %s address %s", mRestClient->mURL.c_str(), mAddress.c_str());
+
+        std::vector<std::unique_ptr<APIBaseValue>> params;
+        params.emplace_back(std::make_unique<APIValue<int>>("faa", 1));
+        params.emplace_back(std::make_unique<APIValue<int>>("satellite", 1));
+        params.emplace_back(std::make_unique<APIValue<int>>("mlat", 1));
+        params.emplace_back(std::make_unique<APIValue<int>>("flarm", 1));
+        params.emplace_back(std::make_unique<APIValue<int>>("adsb", 1));
+        params.emplace_back(std::make_unique<APIValue<int>>("gnd", 1));
+        params.emplace_back(std::make_unique<APIValue<int>>("air", 1));
+        params.emplace_back(std::make_unique<APIValue<int>>("vehicles", 1));
+        params.emplace_back(std::make_unique<APIValue<int>>("estimated", 1));
+        params.emplace_back(std::make_unique<APIValue<int>>("maxage", 14400));
+        params.emplace_back(std::make_unique<APIValue<int>>("gliders", 1));
+        params.emplace_back(std::make_unique<APIValue<int>>("stats", 1));
+        params.emplace_back(std::make_unique<APIValue<int>>("limit", mLimit));
+        params.emplace_back(std::make_unique<APIDoubleArray>("bounds", std::vector<double>{bounds[0], bounds[1], bounds[2], bounds[3]}));
+        mRestClient->get(mAddress, params, [this, round, index](const RestResponse& response)
+        {
+            std::vector<FlightState> states;
+            uint64 feed_time = 0;
+            int count;
+            {
+                Metrics::ScopedTimer parse_timer(mParseDuration);
+                TRACE_ZONE("PlaneLogger::parseFeed");
+                count = parseFeed(response.mData, states, feed_time);
+            }
+
+            // When the response hit the limit, aircraft were dropped. Split the tile in four and poll those right away,
+            // the split tiles are used for all following polls
+            std::vector<std::pair<size_t, glm::vec4>> split_tiles;
             {
-                FlightStatesData state;
+                std::lock_guard<std::mutex> lock(round->mMutex);
+                const Tile tile = round->mTiles[index];
+                round->mFeedTime = std::max(round->mFeedTime, feed_time);
+                round->mTiles[index].mCount = count;
+                if(count >= mLimit && tile.mDepth < mMaxSplitDepth)
+                {
+                    nap::Logger::info(*this, "Tile %.3f, %.3f, %.3f, %.3f hit the limit of %d aircraft, splitting it",
+                                      tile.mBounds[0], tile.mBounds[1], tile.mBounds[2], tile.mBounds[3], mLimit);
+                    round->mTiles[index].mSplit = true;
+                    float mid_lat = (tile.mBounds[0] + tile.mBounds[1]) * 0.5f;
+                    float mid_lon = (tile.mBounds[2] + tile.mBounds[3]) * 0.5f;
+                    for(const auto& child : { glm::vec4(tile.mBounds[0], mid_lat, tile.mBounds[2], mid_lon),
+                                              glm::vec4(tile.mBounds[0], mid_lat, mid_lon, tile.mBounds[3]),
+                                              glm::vec4(mid_lat, tile.mBounds[1], tile.mBounds[2], mid_lon),
+                                              glm::vec4(mid_lat, tile.mBounds[1], mid_lon, tile.mBounds[3]) })
+                    {
+                        split_tiles.emplace_back(round->mTiles.size(), child);
+                        round->mTiles.push_back({ child, tile.mDepth + 1, false, tile.mParents });
+                        round->mTiles.back().mParents.emplace_back(tile.mBounds);
+                        round->mResults.emplace_back();
+                        round->mResponses.emplace_back();
+                    }
+                    round->mPending += split_tiles.size();
+                }else
+                {
+                    round->mResults[index] = std::move(states);
+                    if(mRecording != nullptr)
+                        round->mResponses[index] = response.mData;
+                }
+            }
 
-                // set timestamp
-                auto now = getCurrentDateTime();
-                std::string now_format = utility::stringFormat("%d%02d%02d%02d%02d%02d",
-                                                               now.getYear(), now.getMonth(), now.getDayInTheMonth(),
-                                                               now.getHour(), now.getMinute(), now.getSecond());
-                uint64 now_uint64 = std::stoull(now_format);
-                state.mTimeStamp = now_uint64;
+            for(const auto& split_tile : split_tiles)
+                pollTile(round, split_tile.first, split_tile.second);
 
-                // create json document
-                rapidjson::Document document(rapidjson::kObjectType);
-                rapidjson::Value flights(rapidjson::kArrayType);
+            completeTile(round, false);
+        }, [this, round](const utility::ErrorState& error)
+        {
+            nap::Logger::error(*this, "Error getting flight states : %s", error.toString().c_str());
+            completeTile(round, true);
+        });
+    }
 
-                // parse fetched data
-                rapidjson::Document fetched_data(rapidjson::kObjectType);
-                fetched_data.Parse(response.mData.c_str());
 
-                //
-                FlightStates states;
-                states.mTimeStamp = now_uint64;
+    void PlaneLoggerComponentInstance::completeTile(const std::shared_ptr<PollRound>& round, bool failed)
+    {
+        {
+            std::lock_guard<std::mutex> lock(round->mMutex);
+            round->mFailed = round->mFailed || failed;
+            if(--round->mPending > 0)
+                return;
+        }
+
+        // All tiles responded, the tiles that weren't split are polled from now on
+        TRACE_ZONE("PlaneLogger::completePoll");
+        mTiles.clear();
+        for(const auto& tile : round->mTiles)
+        {
+            if(!tile.mSplit)
+                mTiles.emplace_back(tile);
+        }
+
+        // The counts of a failed poll are incomplete
+        if(!round->mFailed)
+            mergeTiles();
+
+        auto seconds_since_start = [&round]() { return std::chrono::duration<double>(SteadyClock::now() - round->mStart).count(); };
+        if(mPollDuration != nullptr)
+            mPollDuration->observe(seconds_since_start());
+
+        // A snapshot with missing tiles would look like aircraft disappeared, so it is dropped entirely
+        if(round->mFailed && mPollFailures != nullptr)
+            mPollFailures->increment();
+        if(!round->mFailed)
+        {
+            // Merge the tiles into one snapshot, aircraft near a tile border can be reported by both tiles
+            std::vector<FlightState> states;
+            std::unordered_set<uint64> icaos;
+            for(auto& result : round->mResults)
+            {
+                for(auto& state : result)
+                {
+                    if(state.mICAO != 0 && !icaos.insert(state.mICAO).second)
+                        continue;
+                    states.emplace_back(std::move(state));
+                }
+            }
 
+            // sort by altitude
+            std::sort(states.begin(), states.end(), [](const FlightState& a, const FlightState& b)
+            {
+                return a.mAltitude < b.mAltitude;
+            });
+
+            // A replayed feed reports the moment it was recorded, a poll that got the same response again is skipped
+            bool feed_time = mUseFeedTime && round->mFeedTime != 0;
+            uint64 timestamp = feed_time ? round->mFeedTime : utility::uint64FromDateTime(getCurrentDateTime());
+            if(!feed_time || timestamp > mLastTimeStamp)
+            {
+                if(mRecording != nullptr)
+                {
+                    std::vector<std::string> responses;
+                    for(size_t i = 0; i < round->mTiles.size(); i++)
+                    {
+                        if(!round->mTiles[i].mSplit)
+                            responses.emplace_back(std::move(round->mResponses[i]));
+                    }
+
+                    utility::ErrorState err;
+                    if(!mRecording->add(timestamp, FeedRecording::merge(responses), err))
+                        nap::Logger::error(*this, "Error recording feed : %s", err.toString().c_str());
+                }
+
+                storeStates(timestamp, states);
+                mLastTimeStamp = timestamp;
+
+                if(mIngestLag != nullptr)
+                {
+                    mIngestLag->observe(seconds_since_start());
+                    mPollAircraft->observe(static_cast<double>(states.size()));
+                    mLastSnapshot->set(std::chrono::duration<double>(SystemClock::now().time_since_epoch()).count());
+                }
+            }
+        }
+
+        mQuerying = false;
+        if(mScheduler != nullptr)
+            mScheduler->wake();
+    }
+
+
+    int PlaneLoggerComponentInstance::parseFeed(const std::string& data, std::vector<FlightState>& states, uint64& feedTime)
+    {
+        // parse fetched data
+        rapidjson::Document fetched_data(rapidjson::kObjectType);
+        fetched_data.Parse(data.c_str());
+
+        // Every aircraft is an array member of the document
+        int count = 0;
+        for (auto p = fetched_data.MemberBegin(); p != fetched_data.MemberEnd(); ++p)
+        {
+            // A replayed feed reports the moment it was recorded
+            if(p->value.IsUint64() && std::strcmp(p->name.GetString(), FeedRecording::kFeedTimeMember) == 0)
+            {
+                feedTime = p->value.GetUint64();
+                continue;
+            }
+
+            if(p->value.IsArray())
+            {
+                count++;
+
+                // Following are the indexes that represent some of the data returned in the array by the FlightRadars24 API
+                static const int lat_index = 1;
+                static const int lon_index = 2;
+                static const int altitude_index = 4;
+                static const int aircraft_type_index = 8;
+                static const int icao_index = 16;
+                static const int reg_index = 18;
+
+                // The following data is extracted from the array and stored in the database
                 // We make unique pointers to string because rapidjson::Value is not copyable
-                std::vector<std::unique_ptr<std::string>> strings;
-                int states_added = 0;
-                for (auto p = fetched_data.MemberBegin(); p != fetched_data.MemberEnd(); ++p)
+                float lat = 0.0f;
+                float lon = 0.0f;
+                std::unique_ptr<std::string> icao = std::make_unique<std::string>("");
+                std::unique_ptr<std::string> reg = std::make_unique<std::string>("");
+                std::unique_ptr<std::string> aircraft_type = std::make_unique<std::string>("");
+                float altitude = 0.0f;
+
+                // Proceed to extract the data from the array
+                int idx = 0;
+                int added = 0;
+                bool add_flight = true;
+                for (auto q = p->value.Begin(); q != p->value.End(); ++q)
                 {
-                    if(p->value.IsArray())
+                    if(idx==lat_index) // lat
                     {
-                        // Following are the indexes that represent some of the data returned in the array by the FlightRadars24 API
-                        static const int lat_index = 1;
-                        static const int lon_index = 2;
-                        static const int altitude_index = 4;
-                        static const int aircraft_type_index = 8;
-                        static const int icao_index = 16;
-                        static const int reg_index = 18;
-
-                        // The following data is extracted from the array and stored in the database
-                        // We make unique pointers to string because rapidjson::Value is not copyable
-                        float lat = 0.0f;
-                        float lon = 0.0f;
-                        std::unique_ptr<std::string> icao = std::make_unique<std::string>("");
-                        std::unique_ptr<std::string> reg = std::make_unique<std::string>("");
-                        std::unique_ptr<std::string> aircraft_type = std::make_unique<std::string>("");
-                        float altitude = 0.0f;
-
-                        // Proceed to extract the data from the array
-                        int idx = 0;
-                        int added = 0;
-                        bool add_flight = true;
-                        for (auto q = p->value.Begin(); q != p->value.End(); ++q)
+                        if(q->IsFloat())
                         {
-                            if(idx==lat_index) // lat
-                            {
-                                if(q->IsFloat())
-                                {
-                                    lat = q->GetFloat();
-                                    added++;
-                                }else
-                                {
-                                    nap::Logger::error("lat is not float");
-                                    add_flight = false;
-                                    break;
-                                }
-                            }else if(idx==lon_index) // lon
-                            {
-                                if(q->IsFloat())
-                                {
-                                    lon = q->GetFloat();
-                                    added++;
-                                }else
-                                {
-                                    nap::Logger::error("lon is not float");
-                                    add_flight = false;
-                                    break;
-                                }
-                            }else if(idx==altitude_index)
-                            {
-                                if(q->IsInt())
-                                {
-                                    // to feet
-                                    altitude = q->GetInt() * 0.3048f;
-                                    if(altitude <= 0.0f)
-                                    {
-                                        add_flight = false;
-                                        break;
-                                    }else
-                                    {
-                                        added++;
-                                    }
-                                }else
-                                {
-                                    nap::Logger::error("altitude is not float");
-                                    add_flight = false;
-                                    break;
-                                }
-                            }else if(idx==aircraft_type_index)
-                            {
-                                if(q->IsString())
-                                {
-                                    aircraft_type = std::make_unique<std::string>(q->GetString());
-                                    added++;
-                                }else
-                                {
-                                    nap::Logger::error("aircraft_type is not string");
-                                    add_flight = false;
-                                    break;
-                                }
-                            }else if(idx==icao_index)// icao
+                            lat = q->GetFloat();
+                            added++;
+                        }else
+                        {
+                            nap::Logger::error("lat is not float");
+                            add_flight = false;
+                            break;
+                        }
+                    }else if(idx==lon_index) // lon
+                    {
+                        if(q->IsFloat())
+                        {
+                            lon = q->GetFloat();
+                            added++;
+                        }else
+                        {
+                            nap::Logger::error("lon is not float");
+                            add_flight = false;
+                            break;
+                        }
+                    }else if(idx==altitude_index)
+                    {
+                        if(q->IsInt())
+                        {
+                            // to feet
+                            altitude = q->GetInt() * 0.3048f;
+                            if(altitude <= 0.0f)
                             {
-                                if(q->IsString())
-                                {
-                                    icao = std::make_unique<std::string>(q->GetString());
-                                    added++;
-                                }else
-                                {
-                                    nap::Logger::error("icao is not string");
-                                    add_flight = false;
-                                    break;
-                                }
-                            }else if(idx==reg_index)// reg
+                                add_flight = false;
+                                break;
+                            }else
                             {
-                                if(q->IsString())
-                                {
-                                    reg = std::make_unique<std::string>(q->GetString());
-                                    added++;
-                                }else
-                                {
-                                    nap::Logger::error("reg is not string");
-                                    add_flight = false;
-                                    break;
-                                }
+                                added++;
                             }
-
-                            idx++;
+                        }else
+                        {
+                            nap::Logger::error("altitude is not float");
+                            add_flight = false;
+                            break;
                         }
-
-                        // Some data is missing, so we don't add the flight
-                        if(added != 6)
+                    }else if(idx==aircraft_type_index)
+                    {
+                        if(q->IsString())
+                        {
+                            aircraft_type = std::make_unique<std::string>(q->GetString());
+                            added++;
+                        }else
+                        {
+                            nap::Logger::error("aircraft_type is not string");
                             add_flight = false;
-
-                        if(add_flight)
+                            break;
+                        }
+                    }else if(idx==icao_index)// icao
+                    {
+                        if(q->IsString())
+                        {
+                            icao = std::make_unique<std::string>(q->GetString());
+                            added++;
+                        }else
+                        {
+                            nap::Logger::error("icao is not string");
+                            add_flight = false;
+                            break;
+                        }
+                    }else if(idx==reg_index)// reg
+                    {
+                        if(q->IsString())
+                        {
+                            reg = std::make_unique<std::string>(q->GetString());
+                            added++;
+                        }else
                         {
-                            FlightState flight_state;
-                            flight_state.mAircraftType = *aircraft_type;
-                            flight_state.mAltitude = altitude;
-                            flight_state.mICAO = *icao;
-                            flight_state.mLatitude = lat;
-                            flight_state.mLongitude = lon;
-                            flight_state.mRegistration = *reg;
-                            states.mStates.emplace_back(flight_state);
-
-                            states_added++;
+                            nap::Logger::error("reg is not string");
+                            add_flight = false;
+                            break;
                         }
                     }
-                }
 
-                // sort by altitude
-                std::sort(states.mStates.begin(), states.mStates.end(), [](const FlightState& a, const FlightState& b)
-                {
-                    return a.mAltitude < b.mAltitude;
-                });
+                    idx++;
+                }
 
-                // add to cache
-                mStatesCache->addStates(now_uint64, states.mStates);
+                // Some data is missing, so we don't add the flight
+                if(added != 6)
+                    add_flight = false;
 
-                // add to database
-                for(const auto &state: states.mStates)
+                if(add_flight)
                 {
-                    rapidjson::Value flight(rapidjson::kObjectType);
-                    rapidjson::Value data(rapidjson::kArrayType);
-
-                    data.PushBack(state.mLatitude, document.GetAllocator());
-                    data.PushBack(state.mLongitude, document.GetAllocator());
-                    data.PushBack(state.mAltitude, document.GetAllocator());
-                    data.PushBack(rapidjson::StringRef(state.mICAO.c_str()), document.GetAllocator());
-                    data.PushBack(rapidjson::StringRef(state.mRegistration.c_str()), document.GetAllocator());
-                    data.PushBack(rapidjson::StringRef(state.mAircraftType.c_str()), document.GetAllocator());
-
-                    flight.AddMember("data", data, document.GetAllocator());
-                    flights.PushBack(flight, document.GetAllocator());
+                    FlightState flight_state;
+                    flight_state.mAircraftType = *aircraft_type;
+                    flight_state.mAltitude = altitude;
+                    flight_state.mICAO = parseICAO(icao->c_str());
+                    flight_state.mLatitude = lat;
+                    flight_state.mLongitude = lon;
+                    flight_state.mRegistration = *reg;
+                    states.emplace_back(flight_state);
                 }
+            }
+        }
 
-                // Add the flights to the document
-                document.AddMember("flights", flights, document.GetAllocator());
+        return count;
+    }
 
-                // Serialize the document
-                rapidjson::StringBuffer buffer;
-                rapidjson::Writer<rapidjson::StringBuffer> writer(buffer);
-                document.Accept(writer);
 
-                // Write the data to the database
-                state.mData = buffer.GetString();
-                utility::ErrorState err;
-                if(!mFlightStatesTable->add(state, err))
-                {
-                    nap::Logger::error(*this, "Error writing to database : %s", err.toString().c_str());
-                }else
-                {
-                    DEBUG_LOG(*this, "Successfully wrote %i states to database", states_added);
-                }
+    void PlaneLoggerComponentInstance::mergeTiles()
+    {
+        // The four tiles split from the same tile are merged back into it when together they hold less than half the limit,
+        // so tiles split during busy hours don't multiply the requests forever. A merged tile is split again when it hits the limit
+        std::vector<Tile> tiles;
+        std::vector<bool> merged(mTiles.size(), false);
+        for(size_t i = 0; i < mTiles.size(); i++)
+        {
+            if(merged[i])
+                continue;
 
-                // Remove entries older than retain hours property
-                auto past = DateTime(SystemClock::now() - std::chrono::hours(mRetainHours));
-                uint64 past_uint64 = std::stoull(utility::stringFormat("%d%02d%02d%02d%02d%02d",
-                                                                       past.getYear(), past.getMonth(), past.getDayInTheMonth(),
-                                                                       past.getHour(), past.getMinute(), past.getSecond()));
-                DEBUG_LOG(*this, "Removing entries older than %s", past.toString().c_str());
-                if(!mFlightStatesTable->remove(utility::stringFormat("%s < %s",
-                                                                     FlightStatesData::kTimeStampPropertyName,
-                                                                     std::to_string(past_uint64).c_str()), err))
+            const auto& tile = mTiles[i];
+            std::vector<size_t> siblings;
+            int count = 0;
+            for(size_t j = i; j < mTiles.size() && !tile.mParents.empty(); j++)
+            {
+                if(!merged[j] && mTiles[j].mParents == tile.mParents)
                 {
-                    nap::Logger::error(*this, "Error removing old entries : %s", err.toString().c_str());
+                    siblings.emplace_back(j);
+                    count += mTiles[j].mCount;
                 }
+            }
+
+            // A sibling that is split itself has other parents, so all four are only found when none is split
+            if(siblings.size() < 4 || count >= mLimit / 2)
+            {
+                tiles.emplace_back(tile);
+                merged[i] = true;
+                continue;
+            }
+
+            Tile parent = { tile.mParents.back(), tile.mDepth - 1, false, tile.mParents, count };
+            parent.mParents.pop_back();
+            nap::Logger::info(*this, "Tiles of %.3f, %.3f, %.3f, %.3f hold %d aircraft, merging them",
+                              parent.mBounds[0], parent.mBounds[1], parent.mBounds[2], parent.mBounds[3], count);
+            tiles.emplace_back(std::move(parent));
+            for(size_t sibling : siblings)
+                merged[sibling] = true;
+        }
+        mTiles = std::move(tiles);
+    }
 
-                // Perform indexing
-                DEBUG_LOG(*this, "Performing indexing...");
-                auto property_path = DatabasePropertyPath::sCreate(RTTI_OF(FlightStatesData),
-                                                                                 rtti::Path::fromString(FlightStatesData::kTimeStampPropertyName),
-                                                                                 err);
-                if(!err.hasErrors())
-                {
-                    if(!mFlightStatesTable->getOrCreateIndex(*property_path, err))
-                    {
-                        nap::Logger::error(*this, "Error creating index : %s", err.toString().c_str());
-                    }
-                }else
-                {
-                    nap::Logger::error(*this, "Error creating path : %s", err.toString().c_str());
-                }
-                DEBUG_LOG(*this, "Indexing done");
 
-                mQuerying = false;
-            }, [this](const utility::ErrorState& error)
+    void PlaneLoggerComponentInstance::storeStates(uint64 timestamp, const std::vector<FlightState>& states)
+    {
+        TRACE_ZONE("PlaneLogger::storeStates");
+        // Keyframes and retention follow the time of the snapshot, which is the time a replayed feed was recorded
+        DateTime snapshot_time;
+        utility::ErrorState time_error;
+        auto now = utility::dateTimeFromUINT64(timestamp, snapshot_time, time_error) ? snapshot_time.getTimeStamp() : SystemClock::now();
+
+        FlightStatesData states_data;
+        states_data.mTimeStamp = timestamp;
+        if(mDeltaEncoding)
+        {
+            // Deltas are created against the reconstructed previous snapshot instead of the previous poll,
+            // this way the stored positions never drift further than the threshold from the real positions
+            std::vector<FlightState> snapshot = states;
+            FlightStatesDelta::sortByICAO(snapshot);
+            if(!mHasBaseStates || now - mLastKeyFrame >= std::chrono::duration<float>(mKeyFrameInterval))
             {
-                nap::Logger::error(*this, "Error getting flight states : %s", error.toString().c_str());
-                mQuerying = false;
-            });
+                states_data.WriteData(states);
+                mBaseStates = std::move(snapshot);
+                mLastKeyFrame = now;
+            }else
+            {
+                FlightStatesDelta delta;
+                FlightStatesDelta::create(mBaseStates, snapshot, mDeltaThreshold, delta);
+                states_data.WriteDelta(delta);
+                delta.apply(mBaseStates);
+            }
+            mHasBaseStates = true;
+
+            // add to cache, the cache holds the same states readers of the database reconstruct
+            mStatesCache->addStates(timestamp, mBaseStates);
+        }else
+        {
+            states_data.WriteData(states);
+
+            // add to cache
+            mStatesCache->addStates(timestamp, states);
+        }
+
+        // Publish the snapshot to the clients waiting for aircraft overhead before it is written to the database
+        if(mOverheadSubscriptions != nullptr)
+            mOverheadSubscriptions->addStates(timestamp, mDeltaEncoding ? mBaseStates : states);
+
+        // Compress, when that fails the row is stored uncompressed
+        utility::ErrorState err;
+        if(mCompression != nullptr && !mCompression->compress(states_data.mData, err))
+        {
+            nap::Logger::error(*this, "Error compressing states : %s", err.toString().c_str());
+        }
+
+        // Write the data to the database
+        bool added;
+        {
+            Metrics::ScopedTimer insert_timer(mStatesInsertDuration);
+            TRACE_ZONE("FlightStatesStore::add");
+            added = mFlightStatesStore->add(states_data, err);
+        }
+        if(!added)
+        {
+            nap::Logger::error(*this, "Error writing to database : %s", err.toString().c_str());
+
+            // The next row can't be a delta to a row that wasn't written
+            mHasBaseStates = false;
+        }else
+        {
+            DEBUG_LOG(*this, "Successfully wrote %i states to database", states.size());
+        }
+
+        // Add to the position index, only when the row was written so the index never holds snapshots the database doesn't.
+        // A snapshot that fails to be indexed is recorded as a gap, queries read it from the database instead
+        if(mPositionIndex != nullptr && added)
+        {
+            Metrics::ScopedTimer insert_timer(mPositionsInsertDuration);
+            TRACE_ZONE("PositionIndex::addStates");
+            if(!mPositionIndex->addStates(timestamp, states, err))
+                nap::Logger::error(*this, "Error writing to position index : %s", err.toString().c_str());
+        }
+
+        // Update the live traffic aggregates with the same states readers of the database reconstruct
+        if(mTrafficRollups != nullptr)
+            mTrafficRollups->addStates(timestamp, mDeltaEncoding ? mBaseStates : states);
+
+        // Evaluate the disturbance watches with the new snapshot
+        if(mDisturbanceWatches != nullptr)
+            mDisturbanceWatches->addStates(timestamp, mDeltaEncoding ? mBaseStates : states);
+
+        // Remove entries older than retain hours property
+        auto past = DateTime(now - std::chrono::hours(mRetainHours));
+        uint64 past_uint64 = std::stoull(utility::stringFormat("%d%02d%02d%02d%02d%02d",
+                                                               past.getYear(), past.getMonth(), past.getDayInTheMonth(),
+                                                               past.getHour(), past.getMinute(), past.getSecond()));
+        DEBUG_LOG(*this, "Removing entries older than %s", past.toString().c_str());
+        {
+            Metrics::ScopedTimer delete_timer(mStatesDeleteDuration);
+            TRACE_ZONE("FlightStatesStore::removeOlderThan");
+            if(!mFlightStatesStore->removeOlderThan(past_uint64, err))
+                nap::Logger::error(*this, "Error removing old entries : %s", err.toString().c_str());
         }
+        if(mPositionIndex != nullptr)
+        {
+            Metrics::ScopedTimer delete_timer(mPositionsDeleteDuration);
+            TRACE_ZONE("PositionIndex::removeOlderThan");
+            if(!mPositionIndex->removeOlderThan(past_uint64, err))
+                nap::Logger::error(*this, "Error removing old positions : %s", err.toString().c_str());
+        }
+    }
+
+
+    SteadyTimeStamp PlaneLoggerComponentInstance::getNextDeadline() const
+    {
+        // While a poll is in flight the next one can't start, the response wakes up the scheduler
+        return mQuerying ? SteadyTimeStamp::max() : mNextPoll;
     }
 
 
     void PlaneLoggerComponentInstance::clear()
     {
         utility::ErrorState err;
-        if(!mFlightStatesTable->clear(err))
+        if(!mFlightStatesStore->clear(err))
         {
             nap::Logger::error(*this, "Error clearing database : %s", err.toString().c_str());
         }
@@ -8,6 +8,17 @@
 #include <entity.h>
 #include <rtti/factory.h>
 #include <statescache.h>
+#include <positionindex.h>
+#include <workerpool.h>
+#include <mainloopscheduler.h>
+#include <flightstatescompression.h>
+#include <flightstatesstore.h>
+#include <trafficrollups.h>
+#include <disturbancewatches.h>
+#include <overheadsubscriptions.h>
+#include <feedrecording.h>
+#include <metrics.h>
+#include <thread>
 
 #include "flightstate.h"
 #include "rect.h"
@@ -27,12 +38,28 @@ namespace nap
         ResourcePtr<RestClient> mRestClient;
         ResourcePtr<DatabaseTableResource> mFlightStatesDatabase;
         ResourcePtr<StatesCache> mStatesCache;
+        ResourcePtr<PositionIndex> mPositionIndex;
+        ResourcePtr<WorkerPool> mWorkerPool;
+        ResourcePtr<MainLoopScheduler> mScheduler;
+        ResourcePtr<FlightStatesCompression> mCompression;
+        ResourcePtr<TrafficRollups> mTrafficRollups; ///< Property: "TrafficRollups" - Optional traffic aggregates updated with every snapshot
+        ResourcePtr<DisturbanceWatches> mDisturbanceWatches; ///< Property: "DisturbanceWatches" - Optional disturbance watches evaluated with every snapshot
+        ResourcePtr<OverheadSubscriptions> mOverheadSubscriptions; ///< Property: "OverheadSubscriptions" - Optional subscriptions notified of every snapshot
         std::string mFlightStatesTableName = "states";
         float mInterval = 10.0f;
         int mRetainHours = 768;
         int mCacheHours = 24;
         std::string mAdress = "/zones/fcgi/feed.js";
         glm::vec4 mBounds = {53.445884435606054, 50.749405057563486, 3.5163031843031223, 7.9136148705580505};
+        std::vector<glm::vec4> mTiles; ///< Property: "Tiles" - Bounds of the regions polled concurrently, Bounds is used when empty
+        int mLimit = 5000; ///< Property: "Limit" - Maximum number of aircraft requested per tile
+        int mMaxSplitDepth = 3; ///< Property: "MaxSplitDepth" - How many times a tile hitting the limit is split in four
+        bool mDeltaEncoding = false; ///< Property: "DeltaEncoding" - Store only the changes to the previous poll between keyframes
+        float mKeyFrameInterval = 300.0f; ///< Property: "KeyFrameInterval" - Seconds between keyframes when delta encoding
+        float mDeltaThreshold = 50.0f; ///< Property: "DeltaThreshold" - Meters an aircraft has to move before its position is stored again
+        std::string mRecordDirectory; ///< Property: "RecordDirectory" - Directory to record the raw feed responses in for replay, empty disables recording
+        bool mUseFeedTime = false; ///< Property: "UseFeedTime" - Timestamp snapshots with the time a replayed feed was recorded instead of the clock
+        ResourcePtr<Metrics> mMetrics; ///< Property: "Metrics" - Optional metrics the poll, parse and database durations are reported in
     };
 
     class NAPAPI PlaneLoggerComponentInstance : public ComponentInstance
@@ -41,23 +68,99 @@ namespace nap
     public:
         PlaneLoggerComponentInstance(EntityInstance& entityInstance, Component& component);
 
+        ~PlaneLoggerComponentInstance() override;
+
         void update(double deltaTime) override;
 
         bool init(utility::ErrorState &errorState) override;
 
         void clear();
+
+        /**
+         * @return the moment the next poll is due, used by the main loop to sleep until there is work to do
+         */
+        SteadyTimeStamp getNextDeadline() const;
     private:
+        /**
+         * A region that is polled separately
+         */
+        struct Tile
+        {
+            glm::vec4 mBounds;
+            int mDepth = 0;
+            bool mSplit = false;
+            std::vector<glm::vec4> mParents; // Bounds of the tiles this tile was split from, the one it was split from last
+            int mCount = 0; // Aircraft in the last response
+        };
+
+        /**
+         * All tile requests of one poll, merged into one snapshot when the last tile responds
+         */
+        struct PollRound
+        {
+            std::mutex mMutex;
+            std::vector<Tile> mTiles;
+            std::vector<std::vector<FlightState>> mResults;
+            std::vector<std::string> mResponses; // Raw responses, only kept when recording
+            uint64 mFeedTime = 0;
+            SteadyTimeStamp mStart; // Moment the poll started
+            size_t mPending = 0;
+            bool mFailed = false;
+        };
+
+        void pollTile(const std::shared_ptr<PollRound>& round, size_t index, const glm::vec4& bounds);
+        void completeTile(const std::shared_ptr<PollRound>& round, bool failed);
+        void mergeTiles();
+        void storeStates(uint64 timestamp, const std::vector<FlightState>& states);
+        static int parseFeed(const std::string& data, std::vector<FlightState>& states, uint64& feedTime);
+        void warmUpCache(uint64 begin, uint64 end);
+        bool queryStates(uint64 begin, uint64 end, std::vector<FlightStates>& states, utility::ErrorState& errorState);
+        void initMetrics(Metrics& metrics);
+
         RestClient* mRestClient;
-        DatabaseTable* mFlightStatesTable;
+        FlightStatesStore* mFlightStatesStore = nullptr;
         StatesCache* mStatesCache;
+        PositionIndex* mPositionIndex = nullptr;
+        WorkerPool* mWorkerPool = nullptr;
+        MainLoopScheduler* mScheduler = nullptr;
+        FlightStatesCompression* mCompression = nullptr;
+        TrafficRollups* mTrafficRollups = nullptr;
+        DisturbanceWatches* mDisturbanceWatches = nullptr;
+        OverheadSubscriptions* mOverheadSubscriptions = nullptr;
+        std::unique_ptr<FeedRecording> mRecording;
+
+        // Metrics, null without metrics
+        Metrics::Histogram* mPollDuration = nullptr;
+        Metrics::Histogram* mParseDuration = nullptr;
+        Metrics::Histogram* mPollAircraft = nullptr;
+        Metrics::Histogram* mIngestLag = nullptr;
+        Metrics::Histogram* mStatesInsertDuration = nullptr;
+        Metrics::Histogram* mPositionsInsertDuration = nullptr;
+        Metrics::Histogram* mStatesDeleteDuration = nullptr;
+        Metrics::Histogram* mPositionsDeleteDuration = nullptr;
+        Metrics::Counter* mPollFailures = nullptr;
+        Metrics::Gauge* mLastSnapshot = nullptr;
+        bool mUseFeedTime = false;
+        uint64 mLastTimeStamp = 0;
+        std::thread mWarmUpThread;
+        std::atomic<bool> mStopWarmUp = { false };
 
         float mInterval = 10.0f;
-        double mTime = 0.0;
+        SteadyTimeStamp mNextPoll;
         int mRetainHours = 768;
         int mCacheHours = 24;
         std::string mFlightStatesTableName = "states";
-        bool mQuerying = false;
+        std::atomic<bool> mQuerying = { false };
         std::string mAddress = "/zones/fcgi/feed.js";
         glm::vec4 mBounds = {53.445884435606054, 50.749405057563486, 3.5163031843031223, 7.9136148705580505};
+        std::vector<Tile> mTiles;
+        int mLimit = 5000;
+        int mMaxSplitDepth = 3;
+        bool mDeltaEncoding = false;
+        float mKeyFrameInterval = 300.0f;
+        float mDeltaThreshold = 50.0f;
+        std::vector<FlightState> mBaseStates;
+        bool mHasBaseStates = false;
+        SystemTimeStamp mLastKeyFrame;
     };
 }
\ No newline at end of file
@@ -0,0 +1,452 @@
+#include "positionindex.h"
+
+#include <nap/logger.h>
+#include <sqlite3.h>
+#include <math.h>
+
+RTTI_BEGIN_CLASS(nap::PositionIndex)
+    RTTI_PROPERTY("DatabaseName", &nap::PositionIndex::mDatabaseName, nap::rtti::EPropertyMetaData::Default)
+    RTTI_PROPERTY("TableName", &nap::PositionIndex::mTableName, nap::rtti::EPropertyMetaData::Default)
+RTTI_END_CLASS
+
+namespace nap
+{
+    // Latitude and longitude are stored in the R*Tree as integers in 1e-5 degrees, which is roughly one meter
+    static constexpr double sCoordinateScale = 100000.0;
+
+    // Meters per degree latitude, used to convert the search radius into a bounding box
+    static constexpr double sMetersPerDegree = 111320.0;
+
+    /**
+     * Converts a timestamp in uint64 YYYYMMDDHHMMSS into a 32 bit time coordinate of the R*Tree.
+     * Every month is treated as having 31 days, the mapping is therefore not exact in seconds but it is monotonic,
+     * which is all the bounding box pre-filter requires. The exact timestamp is stored alongside as auxiliary column.
+     */
+    static int32 toIndexTime(uint64 timestamp)
+    {
+        int64 second = timestamp % 100; timestamp /= 100;
+        int64 minute = timestamp % 100; timestamp /= 100;
+        int64 hour = timestamp % 100; timestamp /= 100;
+        int64 day = timestamp % 100; timestamp /= 100;
+        int64 month = timestamp % 100; timestamp /= 100;
+        int64 year = static_cast<int64>(timestamp) - 2020;
+        int64 time = (((((year * 12 + (month - 1)) * 31 + (day - 1)) * 24 + hour) * 60 + minute) * 60) + second;
+        return static_cast<int32>(std::clamp<int64>(time, INT32_MIN, INT32_MAX));
+    }
+
+
+    PositionIndex::~PositionIndex()
+    {
+        for(auto& reader : mReaders)
+            closeReader(*reader);
+
+        sqlite3_finalize(mInsertStatement);
+        sqlite3_finalize(mRemoveStatement);
+        sqlite3_finalize(mFindAircraftStatement);
+        sqlite3_finalize(mInsertAircraftStatement);
+        if(mDatabase != nullptr)
+            sqlite3_close(mDatabase);
+    }
+
+
+    bool PositionIndex::init(utility::ErrorState &errorState)
+    {
+        if(!errorState.check(sqlite3_open(mDatabaseName.c_str(), &mDatabase) == SQLITE_OK,
+                             "Failed to open position index database %s", mDatabaseName.c_str()))
+            return false;
+
+        // Wait for locks instead of failing when another connection is writing
+        // Write ahead logging allows the readers to query while a snapshot is being inserted
+        sqlite3_busy_timeout(mDatabase, 5000);
+        if(!exec("PRAGMA journal_mode=WAL", errorState))
+            return false;
+
+        if(!exec(utility::stringFormat("CREATE TABLE IF NOT EXISTS %s_meta (Key TEXT PRIMARY KEY, Value INTEGER)", mTableName.c_str()), errorState))
+            return false;
+
+        // Indexes written by previous versions copied every column of the observation into the R*Tree
+        if(!dropOutdatedTable(errorState))
+            return false;
+
+        // Coordinates are point boxes: minLat == maxLat etc. The timestamp of the snapshot, the altitude and the aircraft
+        // are auxiliary columns. The identity of the aircraft is stored once per aircraft instead of once per observation
+        if(!exec(utility::stringFormat("CREATE VIRTUAL TABLE IF NOT EXISTS %s USING rtree_i32("
+                                       "id, minTime, maxTime, minLat, maxLat, minLon, maxLon, "
+                                       "+TimeStamp INTEGER, +Altitude REAL, +Aircraft INTEGER)", mTableName.c_str()), errorState))
+            return false;
+
+        if(!exec(utility::stringFormat("CREATE TABLE IF NOT EXISTS %s_aircraft (id INTEGER PRIMARY KEY, ICAO TEXT NOT NULL, "
+                                       "Registration TEXT NOT NULL, AircraftType TEXT NOT NULL, UNIQUE(ICAO, Registration, AircraftType))",
+                                       mTableName.c_str()), errorState))
+            return false;
+
+        // Snapshots that are missing from the index, queries read these from the flight states database
+        if(!exec(utility::stringFormat("CREATE TABLE IF NOT EXISTS %s_gaps (Begin INTEGER PRIMARY KEY, End INTEGER NOT NULL)", mTableName.c_str()), errorState))
+            return false;
+
+        // Read the moment we started indexing
+        sqlite3_stmt* statement = nullptr;
+        if(!prepare(mDatabase, utility::stringFormat("SELECT Value FROM %s_meta WHERE Key = 'IndexedSince'", mTableName.c_str()), &statement, errorState))
+            return false;
+        if(sqlite3_step(statement) == SQLITE_ROW)
+            mIndexedSince = static_cast<uint64>(sqlite3_column_int64(statement, 0));
+        sqlite3_finalize(statement);
+
+        // Read the gaps
+        if(!prepare(mDatabase, utility::stringFormat("SELECT Begin, End FROM %s_gaps", mTableName.c_str()), &statement, errorState))
+            return false;
+        while(sqlite3_step(statement) == SQLITE_ROW)
+            mGaps[static_cast<uint64>(sqlite3_column_int64(statement, 0))] = static_cast<uint64>(sqlite3_column_int64(statement, 1));
+        sqlite3_finalize(statement);
+
+        if(!prepare(mDatabase, utility::stringFormat("INSERT INTO %s (minTime, maxTime, minLat, maxLat, minLon, maxLon, TimeStamp, Altitude, Aircraft) "
+                                                     "VALUES (?1, ?1, ?2, ?2, ?3, ?3, ?4, ?5, ?6)", mTableName.c_str()),
+                    &mInsertStatement, errorState))
+            return false;
+
+        if(!prepare(mDatabase, utility::stringFormat("SELECT id FROM %s_aircraft WHERE ICAO = ?1 AND Registration = ?2 AND AircraftType = ?3",
+                                                     mTableName.c_str()), &mFindAircraftStatement, errorState))
+            return false;
+
+        if(!prepare(mDatabase, utility::stringFormat("INSERT INTO %s_aircraft (ICAO, Registration, AircraftType) VALUES (?1, ?2, ?3)",
+                                                     mTableName.c_str()), &mInsertAircraftStatement, errorState))
+            return false;
+
+        // The R*Tree constraints do the bounding box pre-filter, the auxiliary columns are checked on the remaining rows only.
+        // The cross join keeps the R*Tree as outer loop, the aircraft are looked up by id for the remaining rows
+        mQuery = utility::stringFormat("SELECT p.TimeStamp, p.minLat, p.minLon, p.Altitude, a.ICAO, a.Registration, a.AircraftType "
+                                       "FROM %s AS p CROSS JOIN %s_aircraft AS a ON a.id = p.Aircraft "
+                                       "WHERE p.minTime >= ?1 AND p.maxTime <= ?2 AND p.minLat >= ?3 AND p.maxLat <= ?4 AND p.minLon >= ?5 AND p.maxLon <= ?6 "
+                                       "AND p.TimeStamp > ?7 AND p.TimeStamp < ?8 AND (?9 <= 0 OR p.Altitude <= ?9) "
+                                       "ORDER BY p.TimeStamp, p.Altitude", mTableName.c_str(), mTableName.c_str());
+
+        if(!prepare(mDatabase, utility::stringFormat("DELETE FROM %s WHERE minTime < ?1", mTableName.c_str()), &mRemoveStatement, errorState))
+            return false;
+
+        return true;
+    }
+
+
+    bool PositionIndex::addStates(uint64 timestamp, const std::vector<FlightState>& states, utility::ErrorState& errorState)
+    {
+        std::lock_guard<std::mutex> lock(mMutex);
+        bool success = insertStates(timestamp, states, errorState);
+
+        // Queries read the snapshots the index misses from the flight states database
+        if(!success && mIndexedSince.load() > 0)
+            addGap(timestamp);
+
+        mLastTimeStamp = timestamp;
+        return success;
+    }
+
+
+    bool PositionIndex::insertStates(uint64 timestamp, const std::vector<FlightState>& states, utility::ErrorState& errorState)
+    {
+        // Insert all states of the snapshot in one transaction
+        if(!exec("BEGIN TRANSACTION", errorState))
+            return false;
+
+        // Record when indexing started, so queries know which part of the history is covered.
+        // Written with the first snapshot, so the start is never recorded without its states
+        bool first = mIndexedSince.load() == 0;
+        bool success = !first || exec(utility::stringFormat("INSERT OR REPLACE INTO %s_meta (Key, Value) VALUES ('IndexedSince', %s)",
+                                                            mTableName.c_str(), std::to_string(timestamp).c_str()), errorState);
+
+        int32 time = toIndexTime(timestamp);
+        for(size_t i = 0; success && i < states.size(); i++)
+        {
+            const auto& state = states[i];
+            int64 aircraft = 0;
+            if(!getAircraftId(state, aircraft, errorState))
+            {
+                success = false;
+                break;
+            }
+
+            sqlite3_bind_int(mInsertStatement, 1, time);
+            sqlite3_bind_int(mInsertStatement, 2, static_cast<int>(std::round(state.mLatitude * sCoordinateScale)));
+            sqlite3_bind_int(mInsertStatement, 3, static_cast<int>(std::round(state.mLongitude * sCoordinateScale)));
+            sqlite3_bind_int64(mInsertStatement, 4, static_cast<sqlite3_int64>(timestamp));
+            sqlite3_bind_double(mInsertStatement, 5, state.mAltitude);
+            sqlite3_bind_int64(mInsertStatement, 6, aircraft);
+            int result = sqlite3_step(mInsertStatement);
+            sqlite3_reset(mInsertStatement);
+            if(result != SQLITE_DONE)
+            {
+                errorState.fail("Failed to insert position : %s", sqlite3_errmsg(mDatabase));
+                success = false;
+            }
+        }
+
+        if(!exec(success ? "COMMIT" : "ROLLBACK", errorState) || !success)
+        {
+            // A failed commit leaves the transaction open. Aircraft inserted by it are gone, make sure the ids aren't used
+            if(success)
+                sqlite3_exec(mDatabase, "ROLLBACK", nullptr, nullptr, nullptr);
+            mPendingAircraftIds.clear();
+            return false;
+        }
+
+        mAircraftIds.insert(mPendingAircraftIds.begin(), mPendingAircraftIds.end());
+        mPendingAircraftIds.clear();
+        if(first)
+            mIndexedSince = timestamp;
+        return true;
+    }
+
+
+    bool PositionIndex::getAircraftId(const FlightState& state, int64& id, utility::ErrorState& errorState)
+    {
+        std::string icao = formatICAO(state.mICAO);
+        std::string key = icao + '\n' + state.mRegistration + '\n' + state.mAircraftType;
+        auto it = mAircraftIds.find(key);
+        if(it != mAircraftIds.end())
+        {
+            id = it->second;
+            return true;
+        }
+        it = mPendingAircraftIds.find(key);
+        if(it != mPendingAircraftIds.end())
+        {
+            id = it->second;
+            return true;
+        }
+
+        // Look the aircraft up, added by an earlier run or removed from the cache when unreferenced aircraft were pruned
+        for(auto* statement : { mFindAircraftStatement, mInsertAircraftStatement })
+        {
+            sqlite3_bind_text(statement, 1, icao.c_str(), static_cast<int>(icao.size()), SQLITE_STATIC);
+            sqlite3_bind_text(statement, 2, state.mRegistration.c_str(), static_cast<int>(state.mRegistration.size()), SQLITE_STATIC);
+            sqlite3_bind_text(statement, 3, state.mAircraftType.c_str(), static_cast<int>(state.mAircraftType.size()), SQLITE_STATIC);
+            int result = sqlite3_step(statement);
+            if(result == SQLITE_ROW)
+                id = sqlite3_column_int64(statement, 0);
+            else if(result == SQLITE_DONE && statement == mInsertAircraftStatement)
+                id = sqlite3_last_insert_rowid(mDatabase);
+            sqlite3_reset(statement);
+
+            if(result == SQLITE_ROW)
+            {
+                mAircraftIds.emplace(std::move(key), id);
+                return true;
+            }
+            if(result != SQLITE_DONE)
+            {
+                errorState.fail("Failed to insert aircraft : %s", sqlite3_errmsg(mDatabase));
+                return false;
+            }
+        }
+
+        // Only known to exist when the transaction is committed
+        mPendingAircraftIds.emplace(std::move(key), id);
+        return true;
+    }
+
+
+    void PositionIndex::addGap(uint64 timestamp)
+    {
+        // Extend the gap when the previous snapshot is missing as well, otherwise the gap only covers this snapshot
+        uint64 begin = timestamp - 1;
+        {
+            std::lock_guard<std::mutex> lock(mGapsMutex);
+            if(!mGaps.empty() && mGaps.rbegin()->second == mLastTimeStamp)
+                begin = mGaps.rbegin()->first;
+            mGaps[begin] = timestamp;
+        }
+
+        utility::ErrorState error_state;
+        if(!exec(utility::stringFormat("INSERT OR REPLACE INTO %s_gaps (Begin, End) VALUES (%s, %s)", mTableName.c_str(),
+                                       std::to_string(begin).c_str(), std::to_string(timestamp).c_str()), error_state))
+        {
+            nap::Logger::error(*this, "Failed to record position index gap, queries read it from the database until restart : %s",
+                               error_state.toString().c_str());
+        }
+    }
+
+
+    void PositionIndex::getGaps(uint64 begin, uint64 end, std::vector<std::pair<uint64, uint64>>& gaps) const
+    {
+        std::lock_guard<std::mutex> lock(mGapsMutex);
+        for(const auto& gap : mGaps)
+        {
+            if(gap.second <= begin || gap.first >= end)
+                continue;
+            gaps.emplace_back(std::max(gap.first, begin), std::min(gap.second, end));
+        }
+    }
+
+
+    bool PositionIndex::getStates(uint64 begin, uint64 end, float lat, float lon, float radius, float altitude,
+                                  std::vector<FlightStates>& states, utility::ErrorState& errorState, const AircraftFilter* filter)
+    {
+        // Convert the radius into a bounding box, widened by one unit on each side to account for rounding
+        double lat_delta = radius / sMetersPerDegree;
+        double lon_delta = radius / (sMetersPerDegree * std::max(std::cos(lat * M_PI / 180.0), 0.01));
+        int min_lat = static_cast<int>(std::floor((lat - lat_delta) * sCoordinateScale)) - 1;
+        int max_lat = static_cast<int>(std::ceil((lat + lat_delta) * sCoordinateScale)) + 1;
+        int min_lon = static_cast<int>(std::floor((lon - lon_delta) * sCoordinateScale)) - 1;
+        int max_lon = static_cast<int>(std::ceil((lon + lon_delta) * sCoordinateScale)) + 1;
+
+        auto reader = acquireReader(errorState);
+        if(reader == nullptr)
+            return false;
+
+        sqlite3_stmt* query = reader->mQueryStatement;
+        sqlite3_bind_int(query, 1, toIndexTime(begin));
+        sqlite3_bind_int(query, 2, toIndexTime(end));
+        sqlite3_bind_int(query, 3, min_lat);
+        sqlite3_bind_int(query, 4, max_lat);
+        sqlite3_bind_int(query, 5, min_lon);
+        sqlite3_bind_int(query, 6, max_lon);
+        sqlite3_bind_int64(query, 7, static_cast<sqlite3_int64>(begin));
+        sqlite3_bind_int64(query, 8, static_cast<sqlite3_int64>(end));
+        sqlite3_bind_double(query, 9, altitude);
+
+        int result;
+        while((result = sqlite3_step(query)) == SQLITE_ROW)
+        {
+            const char* registration = reinterpret_cast<const char*>(sqlite3_column_text(query, 5));
+            const char* aircraft_type = reinterpret_cast<const char*>(sqlite3_column_text(query, 6));
+            if(filter != nullptr && !filter->matches(aircraft_type, registration))
+                continue;
+
+            uint64 timestamp = static_cast<uint64>(sqlite3_column_int64(query, 0));
+            if(states.empty() || states.back().mTimeStamp != timestamp)
+            {
+                states.emplace_back();
+                states.back().mTimeStamp = timestamp;
+            }
+
+            FlightState state;
+            state.mLatitude = static_cast<float>(sqlite3_column_int(query, 1) / sCoordinateScale);
+            state.mLongitude = static_cast<float>(sqlite3_column_int(query, 2) / sCoordinateScale);
+            state.mAltitude = static_cast<float>(sqlite3_column_double(query, 3));
+            state.mICAO = parseICAO(reinterpret_cast<const char*>(sqlite3_column_text(query, 4)));
+            state.mRegistration = registration;
+            state.mAircraftType = aircraft_type;
+            states.back().mStates.emplace_back(std::move(state));
+        }
+        sqlite3_reset(query);
+
+        bool success = errorState.check(result == SQLITE_DONE, "Failed to query position index : %s", sqlite3_errmsg(reader->mDatabase));
+        releaseReader(std::move(reader));
+        return success;
+    }
+
+
+    bool PositionIndex::removeOlderThan(uint64 timestamp, utility::ErrorState& errorState)
+    {
+        std::lock_guard<std::mutex> lock(mMutex);
+        sqlite3_bind_int(mRemoveStatement, 1, toIndexTime(timestamp));
+        int result = sqlite3_step(mRemoveStatement);
+        sqlite3_reset(mRemoveStatement);
+        if(!errorState.check(result == SQLITE_DONE, "Failed to remove positions : %s", sqlite3_errmsg(mDatabase)))
+            return false;
+
+        // Gaps that are entirely expired
+        {
+            std::lock_guard<std::mutex> gaps_lock(mGapsMutex);
+            for(auto it = mGaps.begin(); it != mGaps.end() && it->second < timestamp;)
+                it = mGaps.erase(it);
+        }
+        if(!exec(utility::stringFormat("DELETE FROM %s_gaps WHERE End < %s", mTableName.c_str(), std::to_string(timestamp).c_str()), errorState))
+            return false;
+
+        // Aircraft that are no longer observed, this scans the whole index so it is done once a day
+        uint64 day = timestamp / 1000000;
+        if(day == mPrunedDay)
+            return true;
+        if(!exec(utility::stringFormat("DELETE FROM %s_aircraft WHERE id NOT IN (SELECT Aircraft FROM %s)",
+                                       mTableName.c_str(), mTableName.c_str()), errorState))
+            return false;
+        mAircraftIds.clear();
+        mPrunedDay = day;
+        return true;
+    }
+
+
+    bool PositionIndex::dropOutdatedTable(utility::ErrorState& errorState)
+    {
+        // The current table has 10 columns: id, 6 coordinates and 3 auxiliary columns
+        sqlite3_stmt* statement = nullptr;
+        if(sqlite3_prepare_v2(mDatabase, utility::stringFormat("SELECT * FROM %s LIMIT 0", mTableName.c_str()).c_str(), -1, &statement, nullptr) != SQLITE_OK)
+        {
+            // Doesn't exist yet
+            sqlite3_finalize(statement);
+            return true;
+        }
+        int columns = sqlite3_column_count(statement);
+        sqlite3_finalize(statement);
+        if(columns == 10)
+            return true;
+
+        // Everything is read from the flight states database until the index is rebuilt by new snapshots
+        nap::Logger::warn(*this, "Position index %s has an outdated layout, rebuilding it", mTableName.c_str());
+        return exec(utility::stringFormat("DROP TABLE %s", mTableName.c_str()), errorState) &&
+               exec(utility::stringFormat("DELETE FROM %s_meta WHERE Key = 'IndexedSince'", mTableName.c_str()), errorState) &&
+               exec(utility::stringFormat("DROP TABLE IF EXISTS %s_gaps", mTableName.c_str()), errorState);
+    }
+
+
+    std::unique_ptr<PositionIndex::Reader> PositionIndex::acquireReader(utility::ErrorState& errorState)
+    {
+        {
+            std::lock_guard<std::mutex> lock(mReaderMutex);
+            if(!mReaders.empty())
+            {
+                auto reader = std::move(mReaders.back());
+                mReaders.pop_back();
+                return reader;
+            }
+        }
+
+        // All readers are in use, open a new connection
+        auto reader = std::make_unique<Reader>();
+        if(!errorState.check(sqlite3_open_v2(mDatabaseName.c_str(), &reader->mDatabase, SQLITE_OPEN_READONLY, nullptr) == SQLITE_OK,
+                             "Failed to open position index database %s", mDatabaseName.c_str()) ||
+           !prepare(reader->mDatabase, mQuery, &reader->mQueryStatement, errorState))
+        {
+            closeReader(*reader);
+            return nullptr;
+        }
+        sqlite3_busy_timeout(reader->mDatabase, 5000);
+
+        return reader;
+    }
+
+
+    void PositionIndex::releaseReader(std::unique_ptr<Reader> reader)
+    {
+        std::lock_guard<std::mutex> lock(mReaderMutex);
+        mReaders.emplace_back(std::move(reader));
+    }
+
+
+    void PositionIndex::closeReader(Reader& reader)
+    {
+        sqlite3_finalize(reader.mQueryStatement);
+        if(reader.mDatabase != nullptr)
+            sqlite3_close(reader.mDatabase);
+    }
+
+
+    bool PositionIndex::exec(const std::string& sql, utility::ErrorState& errorState)
+    {
+        char* error = nullptr;
+        if(sqlite3_exec(mDatabase, sql.c_str(), nullptr, nullptr, &error) != SQLITE_OK)
+        {
+            errorState.fail("SQL error : %s", error != nullptr ? error : "unknown");
+            sqlite3_free(error);
+            return false;
+        }
+        return true;
+    }
+
+
+    bool PositionIndex::prepare(sqlite3* database, const std::string& sql, sqlite3_stmt** statement, utility::ErrorState& errorState)
+    {
+        return errorState.check(sqlite3_prepare_v2(database, sql.c_str(), -1, statement, nullptr) == SQLITE_OK,
+                                "Failed to prepare statement : %s", sqlite3_errmsg(database));
+    }
+}
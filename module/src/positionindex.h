@@ -0,0 +1,137 @@
+#pragma once
+
+#include <nap/resource.h>
+#include <mutex>
+#include <map>
+#include <unordered_map>
+
+#include "statescache.h"
+#include "aircraftfilter.h"
+
+// Forward declares
+struct sqlite3;
+struct sqlite3_stmt;
+
+namespace nap
+{
+    /**
+     * A spatial index over all logged aircraft observations
+     * Every observation is stored as a point in a SQLite R*Tree with time as an additional dimension,
+     * this allows radius queries over long periods to be pre-filtered by bounding box inside SQLite,
+     * only returning the observations that are possibly within the radius instead of every snapshot in range.
+     * The R*Tree only holds the coordinates, the snapshot timestamp and the id of the aircraft,
+     * the identity of every aircraft is stored once in a separate table and joined in by queries.
+     * Snapshots that failed to be indexed are recorded as gaps, queries read those from the flight states database.
+     * The index lives in its own database file so writes don't contend with the flight states database
+     * The index is thread safe, queries run concurrently on separate read connections
+     */
+    class NAPAPI PositionIndex : public Resource
+    {
+    RTTI_ENABLE(Resource)
+    public:
+        /**
+         * Destructor, closes the database
+         */
+        ~PositionIndex() override;
+
+        /**
+         * Opens the database and creates the R*Tree if it doesn't exist
+         * @param errorState the error state to store errors in
+         * @return true if the index was initialized
+         */
+        bool init(utility::ErrorState &errorState) final;
+
+        /**
+         * Add all states of one snapshot to the index, thread safe
+         * When the states can't be written the snapshot is recorded as a gap in the index
+         * @param timestamp the timestamp of the states in uint64 YYYYMMDDHHMMSS
+         * @param states all states
+         * @param errorState the error state to store errors in
+         * @return true if the states were added
+         */
+        bool addStates(uint64 timestamp, const std::vector<FlightState>& states, utility::ErrorState& errorState);
+
+        /**
+         * Get all observations between begin and end within the bounding box of the given radius, thread safe
+         * The returned states are grouped per timestamp and ordered by time. States are pre-filtered by bounding box only,
+         * callers still need to perform the exact distance check
+         * @param begin the begin timestamp in uint64 YYYYMMDDHHMMSS, exclusive
+         * @param end the end timestamp in uint64 YYYYMMDDHHMMSS, exclusive
+         * @param lat latitude of the center of the search area
+         * @param lon longitude of the center of the search area
+         * @param radius radius of the search area in meters
+         * @param altitude the maximum altitude of the states, ignored when <= 0
+         * @param states vector to store the states in
+         * @param errorState the error state to store errors in
+         * @param filter optional filter on aircraft type and registration, checked before a state is created
+         * @return true if the query succeeded
+         */
+        bool getStates(uint64 begin, uint64 end, float lat, float lon, float radius, float altitude,
+                       std::vector<FlightStates>& states, utility::ErrorState& errorState, const AircraftFilter* filter = nullptr);
+
+        /**
+         * Remove all observations older than the given timestamp, thread safe
+         * @param timestamp timestamp in uint64 YYYYMMDDHHMMSS
+         * @param errorState the error state to store errors in
+         * @return true if the observations were removed
+         */
+        bool removeOlderThan(uint64 timestamp, utility::ErrorState& errorState);
+
+        /**
+         * Get the timestamp of the first snapshot ever added to the index.
+         * Anything older was logged before the index existed and must be read from the flight states database
+         * @return timestamp in uint64 YYYYMMDDHHMMSS, 0 if nothing has been indexed yet
+         */
+        uint64 getIndexedSince() const { return mIndexedSince.load(); }
+
+        /**
+         * Get the ranges between begin and end that hold snapshots that are missing from the index, thread safe
+         * These must be read from the flight states database instead
+         * @param begin the begin timestamp in uint64 YYYYMMDDHHMMSS, exclusive
+         * @param end the end timestamp in uint64 YYYYMMDDHHMMSS, inclusive
+         * @param gaps the missing ranges in time order, every range has an exclusive begin and inclusive end
+         */
+        void getGaps(uint64 begin, uint64 end, std::vector<std::pair<uint64, uint64>>& gaps) const;
+
+        std::string mDatabaseName = "positions.db"; ///< Property: "DatabaseName" - The database file that holds the index
+        std::string mTableName = "positions"; ///< Property: "TableName" - Name of the R*Tree table
+    private:
+        /**
+         * A read only connection to the index, queries on different threads each use their own reader
+         */
+        struct Reader
+        {
+            sqlite3* mDatabase = nullptr;
+            sqlite3_stmt* mQueryStatement = nullptr;
+        };
+
+        bool insertStates(uint64 timestamp, const std::vector<FlightState>& states, utility::ErrorState& errorState);
+        bool getAircraftId(const FlightState& state, int64& id, utility::ErrorState& errorState);
+        void addGap(uint64 timestamp);
+        bool dropOutdatedTable(utility::ErrorState& errorState);
+
+        std::unique_ptr<Reader> acquireReader(utility::ErrorState& errorState);
+        void releaseReader(std::unique_ptr<Reader> reader);
+        void closeReader(Reader& reader);
+
+        bool exec(const std::string& sql, utility::ErrorState& errorState);
+        bool prepare(sqlite3* database, const std::string& sql, sqlite3_stmt** statement, utility::ErrorState& errorState);
+
+        std::mutex mMutex;
+        sqlite3* mDatabase = nullptr;
+        sqlite3_stmt* mInsertStatement = nullptr;
+        sqlite3_stmt* mRemoveStatement = nullptr;
+        sqlite3_stmt* mFindAircraftStatement = nullptr;
+        sqlite3_stmt* mInsertAircraftStatement = nullptr;
+        std::unordered_map<std::string, int64> mAircraftIds;        ///< Aircraft ids by identity, only holds committed ids
+        std::unordered_map<std::string, int64> mPendingAircraftIds; ///< Aircraft added by the current transaction
+        uint64 mLastTimeStamp = 0;                                  ///< Timestamp of the last snapshot added
+        uint64 mPrunedDay = 0;                                      ///< Day the unreferenced aircraft were last removed
+        std::string mQuery;
+        std::mutex mReaderMutex;
+        std::vector<std::unique_ptr<Reader>> mReaders;
+        std::atomic<uint64> mIndexedSince = { 0 };
+        mutable std::mutex mGapsMutex;
+        std::map<uint64, uint64> mGaps;                             ///< Snapshots missing from the index, exclusive begin to inclusive end
+    };
+}
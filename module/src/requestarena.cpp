@@ -0,0 +1,39 @@
+#include "requestarena.h"
+
+namespace nap
+{
+    // The buffer is allocated by the first request a thread serves and kept for the lifetime of the thread
+    static thread_local std::unique_ptr<char[]> sThreadBuffer;
+    static thread_local bool sThreadBufferInUse = false;
+
+    static char* acquireBuffer(std::unique_ptr<char[]>& ownedBuffer, bool& threadBuffer)
+    {
+        threadBuffer = !sThreadBufferInUse;
+        if(!threadBuffer)
+        {
+            ownedBuffer = std::make_unique<char[]>(RequestArena::kBufferSize);
+            return ownedBuffer.get();
+        }
+
+        if(sThreadBuffer == nullptr)
+            sThreadBuffer = std::make_unique<char[]>(RequestArena::kBufferSize);
+        sThreadBufferInUse = true;
+        return sThreadBuffer.get();
+    }
+
+
+    RequestArena::RequestArena() :
+        mBuffer(acquireBuffer(mOwnedBuffer, mThreadBuffer)),
+        mJsonAllocator(mBuffer, kJsonBufferSize),
+        mResource(mBuffer + kJsonBufferSize, kBufferSize - kJsonBufferSize)
+    {
+    }
+
+
+    RequestArena::~RequestArena()
+    {
+        // The members release the chunks they took from the heap, the buffer is only handed back
+        if(mThreadBuffer)
+            sThreadBufferInUse = false;
+    }
+}
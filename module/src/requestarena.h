@@ -0,0 +1,53 @@
+#pragma once
+
+#include <nap/numeric.h>
+#include <rapidjson/document.h>
+#include <rapidjson/stringbuffer.h>
+#include <memory>
+#include <memory_resource>
+
+namespace nap
+{
+    /**
+     * The memory of a single request, released in one go when the request is done
+     * Result rows, the sets used to merge them, the response document and the serialized response are allocated from
+     * a buffer that every thread reuses for the requests it serves, so a typical request doesn't allocate from the heap.
+     * Requests that need more continue in chunks from the heap, which are freed with the arena.
+     * Not thread safe, an arena belongs to the thread that handles the request. Everything allocated from the arena
+     * must be destroyed before it, declare the arena first.
+     */
+    class NAPAPI RequestArena
+    {
+    public:
+        // Size of the buffer every thread reuses
+        static constexpr size_t kBufferSize = 1024 * 1024;
+
+        // Part of the buffer used by the response document and the serialized response
+        static constexpr size_t kJsonBufferSize = 256 * 1024;
+
+        // Serialized response of which the memory comes from the arena
+        using JsonBuffer = rapidjson::GenericStringBuffer<rapidjson::UTF8<>, rapidjson::MemoryPoolAllocator<>>;
+
+        RequestArena();
+        ~RequestArena();
+
+        RequestArena(const RequestArena&) = delete;
+        RequestArena& operator=(const RequestArena&) = delete;
+
+        /**
+         * @return the memory resource for containers of the request
+         */
+        std::pmr::memory_resource* getResource() { return &mResource; }
+
+        /**
+         * @return the allocator for the response document and the serialized response
+         */
+        rapidjson::MemoryPoolAllocator<>& getJsonAllocator() { return mJsonAllocator; }
+    private:
+        std::unique_ptr<char[]> mOwnedBuffer; // Only used when another arena on this thread holds the buffer of the thread
+        char* mBuffer;
+        bool mThreadBuffer;
+        rapidjson::MemoryPoolAllocator<> mJsonAllocator;
+        std::pmr::monotonic_buffer_resource mResource;
+    };
+}
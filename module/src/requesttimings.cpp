@@ -0,0 +1,61 @@
+#include "requesttimings.h"
+
+#include <utility/stringutils.h>
+#include <algorithm>
+
+namespace nap
+{
+    RequestTimings::Scope::~Scope()
+    {
+        if(mTimings != nullptr)
+            mTimings->addTime(mStage, getMillis(mStart, std::chrono::steady_clock::now()));
+    }
+
+
+    void RequestTimings::addTime(const std::string& stage, double milliseconds)
+    {
+        auto it = std::find_if(mStages.begin(), mStages.end(), [&stage](const auto& entry) { return entry.first == stage; });
+        if(it == mStages.end())
+            mStages.emplace_back(stage, milliseconds);
+        else
+            it->second += milliseconds;
+    }
+
+
+    void RequestTimings::addCount(const std::string& name, uint64 count)
+    {
+        auto it = std::find_if(mCounts.begin(), mCounts.end(), [&name](const auto& entry) { return entry.first == name; });
+        if(it == mCounts.end())
+            mCounts.emplace_back(name, count);
+        else
+            it->second += count;
+    }
+
+
+    void RequestTimings::addToJson(rapidjson::Value& data, rapidjson::Document& document) const
+    {
+        rapidjson::Value stages(rapidjson::kObjectType);
+        for(const auto& stage : mStages)
+            stages.AddMember(rapidjson::Value(stage.first.c_str(), document.GetAllocator()), stage.second, document.GetAllocator());
+
+        rapidjson::Value counts(rapidjson::kObjectType);
+        for(const auto& count : mCounts)
+            counts.AddMember(rapidjson::Value(count.first.c_str(), document.GetAllocator()), count.second, document.GetAllocator());
+
+        rapidjson::Value timings(rapidjson::kObjectType);
+        timings.AddMember("ms", stages, document.GetAllocator());
+        timings.AddMember("counts", counts, document.GetAllocator());
+        data.AddMember("timings", timings, document.GetAllocator());
+    }
+
+
+    std::string RequestTimings::toString() const
+    {
+        std::string result;
+        for(const auto& stage : mStages)
+            result += utility::stringFormat("%s%s=%.3fms", result.empty() ? "" : " ", stage.first.c_str(), stage.second);
+        for(const auto& count : mCounts)
+            result += utility::stringFormat("%s%s=%s", result.empty() ? "" : " ", count.first.c_str(), std::to_string(count.second).c_str());
+        return result;
+    }
+}
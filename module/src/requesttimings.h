@@ -0,0 +1,68 @@
+#pragma once
+
+#include <nap/numeric.h>
+#include <rapidjson/document.h>
+#include <chrono>
+#include <string>
+#include <vector>
+
+namespace nap
+{
+    /**
+     * Time spent per stage of a request and the number of rows, snapshots and aircraft it examined
+     * Stages and counts with the same name accumulate, they are reported in the order they were first added.
+     * Not thread safe, work done on worker threads is collected per task and added afterwards.
+     */
+    class NAPAPI RequestTimings
+    {
+    public:
+        /**
+         * Adds the milliseconds since construction to a stage on destruction, does nothing without timings
+         */
+        class NAPAPI Scope
+        {
+        public:
+            Scope(RequestTimings* timings, const char* stage) : mTimings(timings), mStage(stage), mStart(std::chrono::steady_clock::now()) {}
+            ~Scope();
+        private:
+            RequestTimings* mTimings;
+            const char* mStage;
+            std::chrono::steady_clock::time_point mStart;
+        };
+
+        /**
+         * @param stage the name of the stage
+         * @param milliseconds the time spent in the stage
+         */
+        void addTime(const std::string& stage, double milliseconds);
+
+        /**
+         * @param name what was counted
+         * @param count the number to add
+         */
+        void addCount(const std::string& name, uint64 count);
+
+        /**
+         * Adds a "timings" object with the stages in milliseconds and the counts to the data of a response
+         * @param data the data object of the response
+         * @param document the document that owns the data
+         */
+        void addToJson(rapidjson::Value& data, rapidjson::Document& document) const;
+
+        /**
+         * @return the stages and counts on a single line, for logging
+         */
+        std::string toString() const;
+
+        /**
+         * @return milliseconds between two moments of a steady clock
+         */
+        static double getMillis(std::chrono::steady_clock::time_point begin, std::chrono::steady_clock::time_point end)
+        {
+            return std::chrono::duration<double, std::milli>(end - begin).count();
+        }
+    private:
+        std::vector<std::pair<std::string, double>> mStages;
+        std::vector<std::pair<std::string, uint64>> mCounts;
+    };
+}
@@ -1,60 +1,261 @@
 #include "statescache.h"
+#include "trace.h"
+#include "utils.h"
 
 RTTI_BEGIN_CLASS(nap::StatesCache)
     RTTI_PROPERTY("MaxEntries", &nap::StatesCache::mMaxEntries, nap::rtti::EPropertyMetaData::Default)
+    RTTI_PROPERTY("MaxMegaBytes", &nap::StatesCache::mMaxMegaBytes, nap::rtti::EPropertyMetaData::Default)
+    RTTI_PROPERTY("KeyFrameInterval", &nap::StatesCache::mKeyFrameInterval, nap::rtti::EPropertyMetaData::Default)
+    RTTI_PROPERTY("Metrics", &nap::StatesCache::mMetrics, nap::rtti::EPropertyMetaData::Default)
 RTTI_END_CLASS
 
 namespace nap
 {
+    // Memory of a node of the map next to the entry: three pointers and the color of the tree
+    static constexpr size_t sMapNodeOverhead = 4 * sizeof(void*);
+
+    /**
+     * @return the memory a string allocated for its characters, 0 when they are stored inline
+     */
+    static size_t getHeapSize(const std::string& value)
+    {
+        static const size_t inline_capacity = std::string().capacity();
+        return value.capacity() > inline_capacity ? value.capacity() + 1 : 0;
+    }
+
+
+    /**
+     * @return the memory used by the states in the vector and their strings
+     */
+    static size_t getHeapSize(const std::vector<FlightState>& states)
+    {
+        size_t size = states.capacity() * sizeof(FlightState);
+        for(const auto& state : states)
+            size += getHeapSize(state.mRegistration) + getHeapSize(state.mAircraftType);
+        return size;
+    }
+
+
     bool StatesCache::init(utility::ErrorState &errorState)
     {
         if(!errorState.check(mMaxEntries > 0, "MaxEntries must be greater than 0"))
             return false;
 
+        if(!errorState.check(mKeyFrameInterval > 0, "KeyFrameInterval must be greater than 0"))
+            return false;
+
+        if(!errorState.check(mMaxMegaBytes >= 0, "MaxMegaBytes must be 0 or greater"))
+            return false;
+
+        if(mMetrics != nullptr)
+        {
+            mEntriesGauge = &mMetrics->addGauge("overmyroof_cache_entries", "Number of snapshots in the states cache");
+            mBytesGauge = &mMetrics->addGauge("overmyroof_cache_bytes", "Memory used by the snapshots in the states cache");
+            mSpanGauge = &mMetrics->addGauge("overmyroof_cache_span_seconds", "Seconds between the oldest and the most recent snapshot in the states cache");
+        }
+
         return true;
     }
 
 
     void StatesCache::addStates(uint64 timestamp, const std::vector<FlightState>& states)
     {
+        TRACE_ZONE("StatesCache::addStates");
+        std::vector<FlightState> sorted_states = states;
+        FlightStatesDelta::sortByICAO(sorted_states);
+
         std::lock_guard<std::mutex> lock(mMutex);
-        mStates[timestamp].mStates = states;
-        mStates[timestamp].mTimeStamp = timestamp;
+
+        // Entries only hold the changes to the previous entry, so states can only be appended
+        if(!mStates.empty() && timestamp <= mStates.rbegin()->first)
+            return;
+
+        insert(timestamp, sorted_states, mStates.empty() ? nullptr : &mNewestStates, mNewestSinceKeyFrame);
+        mNewestStates = std::move(sorted_states);
+        mNewestBytes = getHeapSize(mNewestStates);
         mNewestTimeStamp = timestamp;
-        while(mStates.size() > mMaxEntries)
-            mStates.erase(mStates.begin());
+        if(mOldestTimeStamp.load() == 0)
+            mOldestTimeStamp = timestamp;
+        evict();
+        mOldestTimeStamp = std::max(mOldestTimeStamp.load(), mStates.begin()->first);
+        updateMetrics();
+    }
+
+
+    bool StatesCache::loadStates(std::vector<FlightStates>&& states)
+    {
+        TRACE_ZONE("StatesCache::loadStates");
+        if(states.empty())
+            return true;
+
+        for(auto& state : states)
+            FlightStatesDelta::sortByICAO(state.mStates);
+
+        std::lock_guard<std::mutex> lock(mMutex);
+
+        // The loaded states are older than the cached states, they form their own chain starting with a keyframe
+        const std::vector<FlightState>* previous = nullptr;
+        int since_key_frame = 0;
+        for(const auto& state : states)
+        {
+            if(mStates.find(state.mTimeStamp) == mStates.end())
+                insert(state.mTimeStamp, state.mStates, previous, since_key_frame);
+            previous = &state.mStates;
+        }
+
+        if(mNewestTimeStamp.load() == 0)
+        {
+            mNewestStates = std::move(states.back().mStates);
+            mNewestBytes = getHeapSize(mNewestStates);
+            mNewestSinceKeyFrame = since_key_frame;
+            mNewestTimeStamp = mStates.rbegin()->first;
+        }
+
+        // The loaded states are the oldest, when the cache is full they are the first to be evicted
+        bool fits = !isFull();
+        evict();
         mOldestTimeStamp = mStates.begin()->first;
+        states.clear();
+        updateMetrics();
+        return fits;
     }
 
 
-    bool StatesCache::getStates(uint64 begin, uint64 end, float altitude, std::vector<FlightStates>& states)
+    bool StatesCache::getStates(uint64 begin, uint64 end, float altitude, std::vector<FlightStates>& states, const AircraftFilter* filter)
     {
+        TRACE_ZONE("StatesCache::getStates");
+        if(filter != nullptr && filter->isEmpty())
+            filter = nullptr;
+
+        std::lock_guard<std::mutex> lock(mMutex);
+        auto it = mStates.lower_bound(begin);
+        if(it == mStates.end() || it->first > end)
+            return true;
+
+        // Deltas need the snapshot before them, reconstruct from the keyframe before begin
+        auto key_frame = it;
+        while(!key_frame->second.mKeyFrame)
+            --key_frame;
+
+        std::vector<FlightState> current;
+        for(auto entry = key_frame; entry != mStates.end() && entry->first <= end; ++entry)
         {
-            std::lock_guard<std::mutex> lock(mMutex);
-            auto it = mStates.lower_bound(begin);
-            while(it != mStates.end() && it->first <= end)
+            if(entry->second.mKeyFrame)
+                current = entry->second.mStates;
+            else
+                entry->second.mDelta.apply(current);
+
+            if(entry->first < begin || (filter != nullptr && !filter->matchesTypes(entry->second.mTypes)))
+                continue;
+
+            // Only the states that pass the filters are copied
+            states.emplace_back();
+            states.back().mTimeStamp = entry->first;
+            auto& snapshot = states.back().mStates;
+            for(const auto& state : current)
             {
-                states.push_back(it->second);
-                ++it;
+                if(altitude > 0 && state.mAltitude > altitude)
+                    continue;
+
+                if(filter != nullptr && !filter->matches(state))
+                    continue;
+
+                snapshot.emplace_back(state);
             }
         }
 
-        if(altitude <= 0)
+        return true;
+    }
+
+
+    void StatesCache::insert(uint64 timestamp, const std::vector<FlightState>& states, const std::vector<FlightState>* previous, int& sinceKeyFrame)
+    {
+        Entry entry;
+        for(const auto& state : states)
+            AircraftTypes::addToBitmap(state.mAircraftType, entry.mTypes);
+
+        if(previous == nullptr || sinceKeyFrame + 1 >= mKeyFrameInterval)
         {
-            return true;
+            entry.mKeyFrame = true;
+            entry.mStates = states;
+            sinceKeyFrame = 0;
+        }else
+        {
+            // The states in the cache are exact, every change is kept
+            FlightStatesDelta::create(*previous, states, 0.0f, entry.mDelta);
+            sinceKeyFrame++;
         }
+        entry.updateSize();
+        mEntryBytes += entry.mSize;
+        mStates.emplace(timestamp, std::move(entry));
+    }
 
-        for(auto& state : states)
+
+    bool StatesCache::isFull() const
+    {
+        // The newest snapshot is needed for the next delta, its memory counts towards the budget but can't be evicted
+        if(mStates.size() > mMaxEntries)
+            return true;
+        return mMaxMegaBytes > 0 && mEntryBytes + mNewestBytes > static_cast<size_t>(mMaxMegaBytes) * 1024 * 1024;
+    }
+
+
+    void StatesCache::evict()
+    {
+        // The most recent entry is always kept, even when it exceeds the budget by itself
+        while(mStates.size() > 1 && isFull())
         {
-            // remove all flight below the altitude
-            auto itr = std::find_if(state.mStates.begin(), state.mStates.end(), [altitude](const FlightState& flight){ return flight.mAltitude > altitude; });
-            if(itr != state.mStates.end())
+            // The oldest entry is a keyframe, when the next entry is a delta it becomes the new keyframe
+            auto oldest = mStates.begin();
+            auto next = std::next(oldest);
+            mEntryBytes -= oldest->second.mSize;
+            if(!next->second.mKeyFrame)
             {
-                state.mStates.erase(itr, state.mStates.end());
+                mEntryBytes -= next->second.mSize;
+                next->second.mDelta.apply(oldest->second.mStates);
+                next->second.mStates = std::move(oldest->second.mStates);
+                next->second.mDelta = FlightStatesDelta();
+                next->second.mKeyFrame = true;
+                next->second.updateSize();
+                mEntryBytes += next->second.mSize;
             }
+            mStates.erase(oldest);
         }
+    }
 
-        return true;
+
+    void StatesCache::updateMetrics()
+    {
+        mBytes = mEntryBytes + mNewestBytes;
+        mEntryCount = mStates.size();
+        if(mEntriesGauge == nullptr)
+            return;
+        mEntriesGauge->set(static_cast<double>(mStates.size()));
+        mBytesGauge->set(static_cast<double>(mBytes.load()));
+        mSpanGauge->set(static_cast<double>(getCoveredSeconds()));
+    }
+
+
+    int64 StatesCache::getCoveredSeconds() const
+    {
+        uint64 oldest = mOldestTimeStamp.load();
+        uint64 newest = mNewestTimeStamp.load();
+        if(oldest == 0 || newest <= oldest)
+            return 0;
+
+        DateTime oldest_time, newest_time;
+        utility::ErrorState error_state;
+        if(!utility::dateTimeFromUINT64(oldest, oldest_time, error_state) || !utility::dateTimeFromUINT64(newest, newest_time, error_state))
+            return 0;
+        return std::chrono::duration_cast<std::chrono::seconds>(newest_time.getTimeStamp() - oldest_time.getTimeStamp()).count();
+    }
+
+
+    void StatesCache::Entry::updateSize()
+    {
+        mSize = sizeof(uint64) + sizeof(Entry) + sMapNodeOverhead + getHeapSize(mStates) + getHeapSize(mDelta.mAdded) +
+                mDelta.mMoved.capacity() * sizeof(FlightPosition) + mDelta.mRemoved.capacity() * sizeof(uint64) +
+                mTypes.capacity() * sizeof(uint64);
     }
 
 
@@ -4,6 +4,8 @@
 #include <atomic>
 
 #include "flightstate.h"
+#include "aircraftfilter.h"
+#include "metrics.h"
 
 namespace nap
 {
@@ -20,7 +22,14 @@ namespace nap
     /**
      * A cache for storing flight states
      * The cache is thread safe
-     * The cache will remove the oldest entries if the max number of entries is reached
+     * The cache will remove the oldest entries if the max number of entries or the memory budget is reached.
+     * The memory of an entry is its snapshot or delta, including strings too long to be stored inline, and its
+     * node in the map. Snapshots are much larger at peak hours than at night, the budget bounds the memory either way.
+     * The cache is complete between the oldest and most recent timestamp, older history can be bulk loaded
+     * in the background while new states are added, the oldest timestamp only moves back once the loaded
+     * history connects to what is already cached
+     * Consecutive snapshots are nearly identical, so only every KeyFrameInterval entries a full snapshot is kept,
+     * the entries in between only hold the changes to the previous entry. The oldest entry is always a keyframe.
      */
     class NAPAPI StatesCache : public Resource
     {
@@ -40,15 +49,29 @@ namespace nap
          */
         void addStates(uint64 timestamp, const std::vector<FlightState>& states);
 
+        /**
+         * Bulk load states older than the cached states, thread safe
+         * The states must connect to the cached states: no snapshots may exist between the newest loaded state
+         * and the oldest cached state. Extends the oldest timestamp of the cache to the oldest loaded state that
+         * fits in the cache.
+         * @param states the states to load, ordered by timestamp, emptied by this call
+         * @return false when loaded states were evicted right away, older states won't fit either
+         */
+        bool loadStates(std::vector<FlightStates>&& states);
+
         /**
          * Get states from the cache between begin and end, thread safe
+         * The states of every snapshot are ordered by ICAO
+         * Every entry keeps a bitmap of the aircraft types it holds, with a type filter the snapshots without
+         * any of the types are skipped and only the matching states are copied
          * @param begin the begin timestamp in uint64 YYYYMMDDHHMMSS
          * @param end the end timestamp in uint64 YYYYMMDDHHMMSS
          * @param altitude the maximum altitude of the states
          * @param states vector to store the states in
+         * @param filter optional filter on aircraft type and registration
          * @return true if states were found
          */
-        bool getStates(uint64 begin, uint64 end, float altitude, std::vector<FlightStates>& states);
+        bool getStates(uint64 begin, uint64 end, float altitude, std::vector<FlightStates>& states, const AircraftFilter* filter = nullptr);
 
         /**
          * Get the most recent timestamp in the cache
@@ -57,8 +80,8 @@ namespace nap
         uint64 getMostRecentTimeStamp(){ return mNewestTimeStamp.load();}
 
         /**
-         * Get the oldest timestamp in the cache
-         * @return timestamp in uint64 YYYYMMDDHHMMSS
+         * Get the oldest timestamp from which the cache is complete
+         * @return timestamp in uint64 YYYYMMDDHHMMSS, 0 when the cache is empty
          */
         uint64 getOldestTimeStamp(){ return mOldestTimeStamp.load();}
 
@@ -69,11 +92,60 @@ namespace nap
          */
         uint64 getClosestTimeStamp(uint64 timestamp);
 
+        /**
+         * @return the memory used by the entries and the newest snapshot in bytes, thread safe
+         */
+        size_t getByteCount() const { return mBytes.load(); }
+
+        /**
+         * @return the number of cached snapshots, thread safe
+         */
+        size_t getEntryCount() const { return mEntryCount.load(); }
+
+        /**
+         * @return the seconds between the oldest and the most recent timestamp, 0 when the cache is empty
+         */
+        int64 getCoveredSeconds() const;
+
         int mMaxEntries = 8640; ///< Property: "MaxEntries" - The maximum number of entries in the cache
+        int mMaxMegaBytes = 0; ///< Property: "MaxMegaBytes" - The memory budget of the cache in megabytes, 0 only limits the number of entries
+        int mKeyFrameInterval = 60; ///< Property: "KeyFrameInterval" - Number of entries between full snapshots
+        ResourcePtr<Metrics> mMetrics; ///< Property: "Metrics" - Optional metrics the number of entries and their size are reported in
     private:
+        /**
+         * A cached snapshot, either complete or the changes to the previous entry
+         */
+        struct Entry
+        {
+            bool mKeyFrame = false;
+            std::vector<FlightState> mStates;
+            FlightStatesDelta mDelta;
+            std::vector<uint64> mTypes; // Bitmap of the ids of the aircraft types in the snapshot
+            size_t mSize = 0; // Memory used by the entry and its node in the map, see updateSize()
+
+            /**
+             * Measures the memory used by the entry, call after changing the entry
+             */
+            void updateSize();
+        };
+
+        void insert(uint64 timestamp, const std::vector<FlightState>& states, const std::vector<FlightState>* previous, int& sinceKeyFrame);
+        bool isFull() const;
+        void evict();
+        void updateMetrics();
+
         std::mutex mMutex;
-        std::map<uint64, FlightStates> mStates;
-        std::atomic<uint64> mNewestTimeStamp;
-        std::atomic<uint64> mOldestTimeStamp;
+        std::map<uint64, Entry> mStates;
+        std::vector<FlightState> mNewestStates;
+        int mNewestSinceKeyFrame = 0;
+        std::atomic<uint64> mNewestTimeStamp = { 0 };
+        std::atomic<uint64> mOldestTimeStamp = { 0 };
+        size_t mEntryBytes = 0; // Memory used by all entries
+        size_t mNewestBytes = 0; // Memory used by the newest snapshot, kept to create the next delta
+        std::atomic<size_t> mBytes = { 0 };
+        std::atomic<size_t> mEntryCount = { 0 };
+        Metrics::Gauge* mEntriesGauge = nullptr;
+        Metrics::Gauge* mBytesGauge = nullptr;
+        Metrics::Gauge* mSpanGauge = nullptr;
     };
 }
\ No newline at end of file
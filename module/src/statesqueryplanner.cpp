@@ -0,0 +1,307 @@
+#include "statesqueryplanner.h"
+#include "utils.h"
+#include "trace.h"
+
+#include <limits>
+
+namespace nap
+{
+    double calcGPSDistance(double latitude_new, double longitude_new, double latitude_old, double longitude_old);
+
+    // Chunks shorter than this aren't worth scheduling as a separate task
+    static constexpr int sMinChunkMinutes = 15;
+
+    void ScanChunk::addStates(const std::vector<FlightState>& states, uint64 timestamp, const StatesQuery& query)
+    {
+        mExamined += states.size();
+        std::chrono::steady_clock::time_point start;
+        if(mTimed)
+            start = std::chrono::steady_clock::now();
+
+        for(const auto& state : states)
+        {
+            // The filter only compares a few short strings, cheaper than the lookup and the distance
+            if(!query.mFilter.matches(state))
+            {
+                continue;
+            }
+
+            // Aircraft without identifier can't be told apart, every one of them is kept
+            if(state.mICAO != 0 && mSeen.find(state.mICAO) != mSeen.end())
+            {
+                continue;
+            }
+
+            // Reconstructed snapshots are not ordered by altitude
+            if(query.mAltitude > 0 && state.mAltitude > query.mAltitude)
+            {
+                continue;
+            }
+
+            double distance = calcGPSDistance(query.mLatitude, query.mLongitude, state.mLatitude, state.mLongitude);
+            if(distance < query.mRadius)
+            {
+                mFlights.push_back({ state, timestamp, static_cast<float>(distance) });
+                if(state.mICAO != 0)
+                    mSeen.insert(state.mICAO);
+            }
+        }
+
+        if(mTimed)
+            mFilterMillis += RequestTimings::getMillis(start, std::chrono::steady_clock::now());
+    }
+
+
+    bool CacheStatesTier::getCoverage(uint64& begin, uint64& end) const
+    {
+        // The cache is complete from its oldest timestamp, inclusive
+        uint64 oldest = mCache.getOldestTimeStamp();
+        if(oldest == 0)
+            return false;
+
+        begin = oldest - 1;
+        end = mCache.getMostRecentTimeStamp();
+        return true;
+    }
+
+
+    bool CacheStatesTier::scan(ScanChunk& chunk, const StatesQuery& query, utility::ErrorState& errorState)
+    {
+        TRACE_ZONE("CacheStatesTier::scan");
+        std::vector<FlightStates> states;
+        mCache.getStates(chunk.mBegin + 1, chunk.mEnd, query.mAltitude, states, &query.mFilter);
+        for(const auto& state : states)
+            chunk.addStates(state.mStates, state.mTimeStamp, query);
+        chunk.mRows += states.size();
+        return true;
+    }
+
+
+    bool DatabaseStatesTier::getCoverage(uint64& begin, uint64& end) const
+    {
+        // Everything that was ever logged and not removed by retention
+        begin = 0;
+        end = std::numeric_limits<uint64>::max();
+        return true;
+    }
+
+
+    bool DatabaseStatesTier::scan(ScanChunk& chunk, const StatesQuery& query, utility::ErrorState& errorState)
+    {
+        TRACE_ZONE("DatabaseStatesTier::scan");
+        // The position index covers everything logged since it was created, the bounding box pre-filter is executed
+        // inside SQLite so only observations near the location are read. Older snapshots are scanned in full.
+        uint64 indexed_since = mPositionIndex != nullptr ? mPositionIndex->getIndexedSince() : 0;
+        bool use_index = indexed_since > 0 && indexed_since < chunk.mEnd;
+
+        // Both ranges exclude begin and include end
+        auto add_states = [&chunk, &query](uint64 timestamp, const std::vector<FlightState>& states)
+        {
+            chunk.addStates(states, timestamp, query);
+            chunk.mRows++;
+        };
+        auto scan_range = [this, &add_states, &errorState](uint64 begin, uint64 end)
+        {
+            return mStore.readSnapshots(begin, end, mCompression, add_states, errorState);
+        };
+        auto index_range = [this, &chunk, &query, &errorState](uint64 begin, uint64 end)
+        {
+            // The index excludes its end timestamp
+            std::vector<FlightStates> indexed_states;
+            if(!mPositionIndex->getStates(begin, end + 1, query.mLatitude, query.mLongitude, query.mRadius, query.mAltitude,
+                                          indexed_states, errorState, &query.mFilter))
+            {
+                return false;
+            }
+
+            // The index only pre-filtered on bounding box, addStates performs the exact distance check
+            for(const auto& state : indexed_states)
+                chunk.addStates(state.mStates, state.mTimeStamp, query);
+            chunk.mRows += indexed_states.size();
+            return true;
+        };
+
+        if(!use_index || chunk.mBegin < indexed_since)
+        {
+            if(!scan_range(chunk.mBegin, use_index ? indexed_since : chunk.mEnd))
+                return false;
+        }
+
+        if(use_index)
+        {
+            // Snapshots that failed to be indexed are read from the database
+            uint64 begin = std::max(chunk.mBegin, indexed_since);
+            std::vector<std::pair<uint64, uint64>> gaps;
+            mPositionIndex->getGaps(begin, chunk.mEnd, gaps);
+            for(const auto& gap : gaps)
+            {
+                if(gap.first > begin && !index_range(begin, gap.first))
+                    return false;
+                if(!scan_range(gap.first, gap.second))
+                    return false;
+                begin = gap.second;
+            }
+            if(begin < chunk.mEnd && !index_range(begin, chunk.mEnd))
+                return false;
+        }
+
+        return true;
+    }
+
+
+    void StatesQueryPlanner::addTier(std::unique_ptr<StatesTier> tier)
+    {
+        // The share of snapshots read from the cheapest tier is the hit ratio of the cache
+        if(mMetrics != nullptr)
+            mTierSnapshots[tier.get()] = &mMetrics->addCounter("overmyroof_query_snapshots", "Snapshots read by flight states queries", { { "tier", tier->getName() } });
+        mTiers.emplace_back(std::move(tier));
+        std::stable_sort(mTiers.begin(), mTiers.end(), [](const auto& a, const auto& b)
+        {
+            return a->getCost() < b->getCost();
+        });
+    }
+
+
+    void StatesQueryPlanner::plan(uint64 begin, uint64 end, std::vector<PlannedRange>& ranges) const
+    {
+        // Hand out the parts that are still unassigned to the tiers, cheapest first
+        std::vector<std::pair<uint64, uint64>> unassigned = { { begin, end } };
+        for(const auto& tier : mTiers)
+        {
+            uint64 tier_begin = 0;
+            uint64 tier_end = 0;
+            if(!tier->getCoverage(tier_begin, tier_end))
+                continue;
+
+            std::vector<std::pair<uint64, uint64>> remaining;
+            for(const auto& range : unassigned)
+            {
+                uint64 overlap_begin = std::max(range.first, tier_begin);
+                uint64 overlap_end = std::min(range.second, tier_end);
+                if(overlap_begin >= overlap_end)
+                {
+                    remaining.emplace_back(range);
+                    continue;
+                }
+
+                ranges.push_back({ tier.get(), overlap_begin, overlap_end });
+                if(range.first < overlap_begin)
+                    remaining.emplace_back(range.first, overlap_begin);
+                if(overlap_end < range.second)
+                    remaining.emplace_back(overlap_end, range.second);
+            }
+            unassigned = std::move(remaining);
+        }
+
+        std::sort(ranges.begin(), ranges.end(), [](const PlannedRange& a, const PlannedRange& b)
+        {
+            return a.mBegin < b.mBegin;
+        });
+    }
+
+
+    bool StatesQueryPlanner::execute(uint64 begin, uint64 end, const StatesQuery& query, Result& result, utility::ErrorState& errorState,
+                                     RequestTimings* timings) const
+    {
+        TRACE_ZONE("StatesQueryPlanner::execute");
+        std::vector<PlannedRange> ranges;
+        {
+            RequestTimings::Scope plan_scope(timings, "plan");
+            plan(begin, end, ranges);
+        }
+
+        // Split the ranges of tiers that can be read in parallel into chunks, every chunk is read by a single task.
+        // Every chunk keeps the earliest observation of each aircraft, merging the chunks in time order
+        // therefore gives the same result as a single sequential scan
+        std::vector<ScanChunk> chunks;
+        std::vector<StatesTier*> chunk_tiers;
+        int chunk_count = mWorkerPool != nullptr ? mWorkerPool->getThreadCount() * 4 : 1;
+        for(const auto& range : ranges)
+        {
+            std::vector<std::pair<uint64, uint64>> chunk_ranges;
+            if(range.mTier->isSplittable())
+            {
+                // The split excludes its end timestamp, the range includes it
+                if(!utility::splitTimeRange(range.mBegin, range.mEnd + 1, chunk_count, std::chrono::minutes(sMinChunkMinutes), chunk_ranges, errorState))
+                    return false;
+            }else
+            {
+                chunk_ranges.emplace_back(range.mBegin, range.mEnd);
+            }
+
+            for(const auto& chunk_range : chunk_ranges)
+            {
+                chunks.emplace_back();
+                chunks.back().mBegin = chunk_range.first;
+                chunks.back().mEnd = chunk_range.second;
+                chunks.back().mTimed = timings != nullptr;
+                chunk_tiers.emplace_back(range.mTier);
+            }
+        }
+
+        auto scan_chunk = [&](size_t index)
+        {
+            auto& chunk = chunks[index];
+            auto start = chunk.mTimed ? std::chrono::steady_clock::now() : std::chrono::steady_clock::time_point();
+            chunk.mSuccess = chunk_tiers[index]->scan(chunk, query, chunk.mErrorState);
+            if(chunk.mTimed)
+                chunk.mScanMillis = RequestTimings::getMillis(start, std::chrono::steady_clock::now());
+        };
+        {
+            RequestTimings::Scope scan_scope(timings, "scan");
+            if(mWorkerPool != nullptr)
+            {
+                mWorkerPool->parallelFor(chunks.size(), scan_chunk);
+            }else
+            {
+                for(size_t i = 0; i < chunks.size(); i++)
+                    scan_chunk(i);
+            }
+        }
+
+        // Merge
+        RequestTimings::Scope merge_scope(timings, "merge");
+        TRACE_ZONE("StatesQueryPlanner::merge");
+        size_t flight_count = 0;
+        for(const auto& chunk : chunks)
+            flight_count += chunk.mFlights.size();
+        result.mFlights.reserve(result.mFlights.size() + flight_count);
+        std::pmr::unordered_set<uint64> seen(result.mFlights.get_allocator().resource());
+        seen.reserve(flight_count);
+        for(size_t i = 0; i < chunks.size(); i++)
+        {
+            auto& chunk = chunks[i];
+            if(!chunk.mSuccess)
+            {
+                errorState.fail("Error reading from %s : %s", chunk_tiers[i]->getName(), chunk.mErrorState.toString().c_str());
+                return false;
+            }
+
+            for(auto& flight : chunk.mFlights)
+            {
+                if(flight.mState.mICAO != 0 && !seen.insert(flight.mState.mICAO).second)
+                    continue;
+
+                result.mFlights.emplace_back(std::move(flight));
+            }
+            result.mRows += chunk.mRows;
+
+            auto counter = mTierSnapshots.find(chunk_tiers[i]);
+            if(counter != mTierSnapshots.end())
+                counter->second->increment(chunk.mRows);
+
+            // Reading includes fetching and decoding, filtering is the area and aircraft filter of addStates
+            if(timings != nullptr)
+            {
+                std::string tier = chunk_tiers[i]->getName();
+                timings->addTime(tier + "_read", std::max(chunk.mScanMillis - chunk.mFilterMillis, 0.0));
+                timings->addTime(tier + "_filter", chunk.mFilterMillis);
+                timings->addCount(tier + "_chunks", 1);
+                timings->addCount(tier + "_snapshots", chunk.mRows);
+                timings->addCount(tier + "_aircraft_examined", chunk.mExamined);
+            }
+        }
+
+        return true;
+    }
+}
@@ -0,0 +1,212 @@
+#pragma once
+
+#include <nap/numeric.h>
+#include <unordered_set>
+#include <unordered_map>
+
+#include "statescache.h"
+#include "positionindex.h"
+#include "workerpool.h"
+#include "flightstatescompression.h"
+#include "flightstatesstore.h"
+#include "aircraftfilter.h"
+#include "metrics.h"
+#include "requesttimings.h"
+
+namespace nap
+{
+    /**
+     * The area, altitude and aircraft a flight states query filters on
+     */
+    struct NAPAPI StatesQuery
+    {
+        float mLatitude = 0.0f;
+        float mLongitude = 0.0f;
+        float mRadius = 0.0f; ///< Radius in meters
+        float mAltitude = 0.0f; ///< Maximum altitude, ignored when <= 0
+        AircraftFilter mFilter; ///< Aircraft types and registrations, checked before the distance
+    };
+
+
+    /**
+     * A part of the requested time range that is fetched, decoded and filtered by a single task
+     */
+    struct NAPAPI ScanChunk
+    {
+        /**
+         * Adds the states of one snapshot that are within the query area and weren't seen earlier in this chunk
+         * @param states the states of the snapshot
+         * @param timestamp the timestamp of the snapshot
+         * @param query the query to filter on
+         */
+        void addStates(const std::vector<FlightState>& states, uint64 timestamp, const StatesQuery& query);
+
+        uint64 mBegin = 0; ///< Begin timestamp, exclusive
+        uint64 mEnd = 0; ///< End timestamp, inclusive
+        std::vector<FlightRow> mFlights; ///< Earliest observation within radius of every aircraft, in time order
+        size_t mRows = 0; ///< Number of snapshots read
+        size_t mExamined = 0; ///< Number of aircraft states passed to addStates
+        bool mTimed = false; ///< If the time spent in addStates and scan is measured
+        double mFilterMillis = 0.0; ///< Time spent in addStates, when timed
+        double mScanMillis = 0.0; ///< Time spent in scan including addStates, when timed
+        bool mSuccess = true;
+        utility::ErrorState mErrorState;
+        std::unordered_set<uint64> mSeen;
+    };
+
+
+    /**
+     * A source of flight states history
+     * Every tier holds a continuous time range completely, the planner reads every part of a request from the cheapest
+     * tier that holds it. New tiers, like an archive of older history, only need to implement this interface.
+     */
+    class NAPAPI StatesTier
+    {
+    public:
+        virtual ~StatesTier() = default;
+
+        /**
+         * @return name of the tier, used for logging
+         */
+        virtual const char* getName() const = 0;
+
+        /**
+         * Get the time range the tier holds completely
+         * @param begin the begin timestamp in uint64 YYYYMMDDHHMMSS, exclusive
+         * @param end the end timestamp in uint64 YYYYMMDDHHMMSS, inclusive
+         * @return false if the tier holds nothing
+         */
+        virtual bool getCoverage(uint64& begin, uint64& end) const = 0;
+
+        /**
+         * @return relative cost of reading from this tier, ranges are read from the tier with the lowest cost
+         */
+        virtual int getCost() const = 0;
+
+        /**
+         * @return if a range can be read in parallel chunks
+         */
+        virtual bool isSplittable() const = 0;
+
+        /**
+         * Reads the range of the chunk and adds the states within the query area to it, called from worker threads
+         * @param chunk the chunk to read
+         * @param query the query to filter on
+         * @param errorState the error state to store errors in
+         * @return true if the chunk was read
+         */
+        virtual bool scan(ScanChunk& chunk, const StatesQuery& query, utility::ErrorState& errorState) = 0;
+    };
+
+
+    /**
+     * Reads from the in memory states cache
+     */
+    class NAPAPI CacheStatesTier : public StatesTier
+    {
+    public:
+        CacheStatesTier(StatesCache& cache) : mCache(cache) {}
+
+        const char* getName() const override { return "cache"; }
+        bool getCoverage(uint64& begin, uint64& end) const override;
+        int getCost() const override { return 0; }
+        bool isSplittable() const override { return false; }
+        bool scan(ScanChunk& chunk, const StatesQuery& query, utility::ErrorState& errorState) override;
+    private:
+        StatesCache& mCache;
+    };
+
+
+    /**
+     * Reads from the flight states store, using the position index for the part it covers
+     * Ranges are only read in parallel chunks when the store reads concurrently, the SQLite store shares one connection
+     */
+    class NAPAPI DatabaseStatesTier : public StatesTier
+    {
+    public:
+        DatabaseStatesTier(FlightStatesStore& store, PositionIndex* positionIndex, FlightStatesCompression* compression) :
+            mStore(store), mPositionIndex(positionIndex), mCompression(compression) {}
+
+        const char* getName() const override { return "database"; }
+        bool getCoverage(uint64& begin, uint64& end) const override;
+        int getCost() const override { return 10; }
+        bool isSplittable() const override { return mStore.isConcurrent(); }
+        bool scan(ScanChunk& chunk, const StatesQuery& query, utility::ErrorState& errorState) override;
+    private:
+        FlightStatesStore& mStore;
+        PositionIndex* mPositionIndex = nullptr;
+        FlightStatesCompression* mCompression = nullptr;
+    };
+
+
+    /**
+     * Splits the time range of a query over the tiers, reads the parts concurrently and merges them in time order
+     */
+    class NAPAPI StatesQueryPlanner
+    {
+    public:
+        /**
+         * The states found by a query, the earliest observation of every aircraft within the query area
+         */
+        struct Result
+        {
+            /**
+             * @param resource the memory the rows are allocated from, like the arena of the request
+             */
+            Result(std::pmr::memory_resource* resource = std::pmr::get_default_resource()) : mFlights(resource) {}
+
+            FlightRows mFlights; ///< Earliest observation within radius of every aircraft, in time order
+            size_t mRows = 0; ///< Number of snapshots read
+        };
+
+        /**
+         * A part of the time range with the tier to read it from
+         */
+        struct PlannedRange
+        {
+            StatesTier* mTier = nullptr;
+            uint64 mBegin = 0; ///< Begin timestamp, exclusive
+            uint64 mEnd = 0; ///< End timestamp, inclusive
+        };
+
+        /**
+         * @param workerPool optional pool to read the parts on, parts are read sequentially without one
+         * @param metrics optional metrics the number of snapshots read from every tier is counted in
+         */
+        StatesQueryPlanner(WorkerPool* workerPool, Metrics* metrics = nullptr) : mWorkerPool(workerPool), mMetrics(metrics) {}
+
+        /**
+         * Adds a tier to read from
+         * @param tier the tier
+         */
+        void addTier(std::unique_ptr<StatesTier> tier);
+
+        /**
+         * Assigns every part of the time range to the cheapest tier that holds it
+         * @param begin the begin timestamp in uint64 YYYYMMDDHHMMSS, exclusive
+         * @param end the end timestamp in uint64 YYYYMMDDHHMMSS, inclusive
+         * @param ranges the planned ranges in time order
+         */
+        void plan(uint64 begin, uint64 end, std::vector<PlannedRange>& ranges) const;
+
+        /**
+         * Plans and executes a query
+         * Timings holds per tier the time spent reading and decoding snapshots and the time spent filtering them,
+         * summed over the chunks, which are read in parallel, and the snapshots and aircraft examined
+         * @param begin the begin timestamp in uint64 YYYYMMDDHHMMSS, exclusive
+         * @param end the end timestamp in uint64 YYYYMMDDHHMMSS, inclusive
+         * @param query the area to filter on
+         * @param result the merged result
+         * @param errorState the error state to store errors in
+         * @param timings optional timings the stages of the query are added to
+         * @return true if the query succeeded
+         */
+        bool execute(uint64 begin, uint64 end, const StatesQuery& query, Result& result, utility::ErrorState& errorState,
+                     RequestTimings* timings = nullptr) const;
+    private:
+        std::vector<std::unique_ptr<StatesTier>> mTiers;
+        WorkerPool* mWorkerPool = nullptr;
+        Metrics* mMetrics = nullptr;
+        std::unordered_map<const StatesTier*, Metrics::Counter*> mTierSnapshots;
+    };
+}
@@ -0,0 +1,212 @@
+#include "trace.h"
+
+#include <utility/stringutils.h>
+#include <algorithm>
+#include <atomic>
+#include <deque>
+#include <fstream>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+namespace nap
+{
+    namespace trace
+    {
+        // Zones kept per thread, the oldest are overwritten. Request threads are short lived and many, so the
+        // buffers are kept small: 16k zones of 24 bytes per thread
+        static constexpr uint64 sZonesPerThread = 1 << 14;
+
+        // Buffers of threads that exited that are kept in the trace, older ones are dropped.
+        // Memory is bounded by the number of live threads plus these
+        static constexpr size_t sFinishedBuffers = 8;
+
+        /**
+         * A finished zone, times in nanoseconds since the start of the trace
+         */
+        struct Event
+        {
+            const char* mName;
+            int64 mBegin;
+            int64 mDuration;
+        };
+
+        /**
+         * Ring buffer of zones written by a single thread and read when the trace is formatted
+         * The count is published after the event is written, a reader drops events that may have been
+         * overwritten while it copied them.
+         */
+        struct ThreadBuffer
+        {
+            std::unique_ptr<Event[]> mEvents = std::make_unique<Event[]>(sZonesPerThread);
+            std::atomic<uint64> mCount = { 0 };
+            uint64 mThreadID = 0;
+            std::mutex mNameMutex;
+            std::string mName;
+        };
+
+        /**
+         * All buffers. The buffers of the most recently finished threads outlive their thread,
+         * so their zones are still in the trace
+         */
+        struct Registry
+        {
+            std::mutex mMutex;
+            std::vector<std::shared_ptr<ThreadBuffer>> mBuffers;
+            std::deque<ThreadBuffer*> mFinished;
+            uint64 mNextThreadID = 1;
+            const std::chrono::steady_clock::time_point mStart = std::chrono::steady_clock::now();
+        };
+
+
+        /**
+         * Owns the buffer of a thread, hands it back to the registry when the thread exits
+         */
+        struct ThreadBufferOwner
+        {
+            ~ThreadBufferOwner();
+            std::shared_ptr<ThreadBuffer> mBuffer;
+        };
+
+
+        static Registry& getRegistry()
+        {
+            static Registry registry;
+            return registry;
+        }
+
+
+        static ThreadBuffer& getThreadBuffer()
+        {
+            thread_local ThreadBufferOwner owner;
+            if(owner.mBuffer == nullptr)
+            {
+                owner.mBuffer = std::make_shared<ThreadBuffer>();
+                auto& registry = getRegistry();
+                std::lock_guard<std::mutex> lock(registry.mMutex);
+                owner.mBuffer->mThreadID = registry.mNextThreadID++;
+                registry.mBuffers.emplace_back(owner.mBuffer);
+            }
+            return *owner.mBuffer;
+        }
+
+
+        ThreadBufferOwner::~ThreadBufferOwner()
+        {
+            if(mBuffer == nullptr)
+                return;
+
+            // Keep the zones of the thread until enough other threads finished, a trace being formatted keeps its own reference
+            auto& registry = getRegistry();
+            std::lock_guard<std::mutex> lock(registry.mMutex);
+            registry.mFinished.emplace_back(mBuffer.get());
+            while(registry.mFinished.size() > sFinishedBuffers)
+            {
+                auto* oldest = registry.mFinished.front();
+                registry.mFinished.pop_front();
+                registry.mBuffers.erase(std::find_if(registry.mBuffers.begin(), registry.mBuffers.end(), [oldest](const auto& buffer)
+                {
+                    return buffer.get() == oldest;
+                }));
+            }
+        }
+
+
+        static std::string escape(const std::string& value)
+        {
+            std::string escaped;
+            for(char c : value)
+            {
+                if(c == '"' || c == '\\')
+                    escaped += '\\';
+                if(static_cast<unsigned char>(c) >= 0x20)
+                    escaped += c;
+            }
+            return escaped;
+        }
+
+
+        Zone::~Zone()
+        {
+            auto end = std::chrono::steady_clock::now();
+            auto start = getRegistry().mStart;
+            auto& buffer = getThreadBuffer();
+            uint64 count = buffer.mCount.load(std::memory_order_relaxed);
+            auto& event = buffer.mEvents[count % sZonesPerThread];
+            event.mName = mName;
+            event.mBegin = std::chrono::duration_cast<std::chrono::nanoseconds>(mBegin - start).count();
+            event.mDuration = std::chrono::duration_cast<std::chrono::nanoseconds>(end - mBegin).count();
+            buffer.mCount.store(count + 1, std::memory_order_release);
+        }
+
+
+        void setThreadName(const std::string& name)
+        {
+            auto& buffer = getThreadBuffer();
+            std::lock_guard<std::mutex> lock(buffer.mNameMutex);
+            buffer.mName = name;
+        }
+
+
+        std::string formatChromeTrace()
+        {
+            std::vector<std::shared_ptr<ThreadBuffer>> buffers;
+            {
+                auto& registry = getRegistry();
+                std::lock_guard<std::mutex> lock(registry.mMutex);
+                buffers = registry.mBuffers;
+            }
+
+            std::string result = "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[";
+            bool first = true;
+            auto add_event = [&result, &first](const std::string& event)
+            {
+                result += first ? "\n" : ",\n";
+                result += event;
+                first = false;
+            };
+
+            std::vector<Event> events;
+            for(const auto& buffer : buffers)
+            {
+                std::string name;
+                {
+                    std::lock_guard<std::mutex> lock(buffer->mNameMutex);
+                    name = buffer->mName.empty() ? utility::stringFormat("thread %s", std::to_string(buffer->mThreadID).c_str()) : buffer->mName;
+                }
+                add_event(utility::stringFormat("{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":%s,\"args\":{\"name\":\"%s\"}}",
+                                                std::to_string(buffer->mThreadID).c_str(), escape(name).c_str()));
+
+                // Copy the newest events, then drop the ones the thread may have overwritten meanwhile
+                uint64 end = buffer->mCount.load(std::memory_order_acquire);
+                uint64 begin = end > sZonesPerThread ? end - sZonesPerThread : 0;
+                events.clear();
+                for(uint64 i = begin; i < end; i++)
+                    events.emplace_back(buffer->mEvents[i % sZonesPerThread]);
+                uint64 written = buffer->mCount.load(std::memory_order_acquire);
+                size_t skip = written > begin + sZonesPerThread ? static_cast<size_t>(written - begin - sZonesPerThread) : 0;
+
+                for(size_t i = skip; i < events.size(); i++)
+                {
+                    add_event(utility::stringFormat("{\"name\":\"%s\",\"ph\":\"X\",\"pid\":1,\"tid\":%s,\"ts\":%.3f,\"dur\":%.3f}",
+                                                    escape(events[i].mName).c_str(), std::to_string(buffer->mThreadID).c_str(),
+                                                    events[i].mBegin / 1000.0, events[i].mDuration / 1000.0));
+                }
+            }
+
+            result += "\n]}\n";
+            return result;
+        }
+
+
+        bool writeChromeTrace(const std::string& path, utility::ErrorState& errorState)
+        {
+            std::ofstream file(path, std::ios::binary | std::ios::trunc);
+            if(!errorState.check(file.is_open(), "Failed to open %s", path.c_str()))
+                return false;
+
+            file << formatChromeTrace();
+            return errorState.check(file.good(), "Failed to write trace to %s", path.c_str());
+        }
+    }
+}
@@ -0,0 +1,75 @@
+#pragma once
+
+#include <nap/numeric.h>
+#include <utility/errorstate.h>
+#include <chrono>
+#include <string>
+
+/**
+ * Scoped trace zones, compiled in when OVERMYROOF_TRACE is defined (the OVERMYROOF_TRACE CMake option)
+ * Without it the macros expand to nothing and cost nothing. A zone records its name, begin and duration on
+ * destruction to a ring buffer owned by the calling thread, so recording takes no locks.
+ * TRACE_ZONE("name") traces the rest of the enclosing scope, the name must be a string literal.
+ * TRACE_THREAD_NAME("name") names the calling thread in the trace.
+ */
+#ifdef OVERMYROOF_TRACE
+#define TRACE_CONCAT_INNER(a, b) a##b
+#define TRACE_CONCAT(a, b) TRACE_CONCAT_INNER(a, b)
+#define TRACE_ZONE(name) nap::trace::Zone TRACE_CONCAT(trace_zone_, __LINE__)(name)
+#define TRACE_THREAD_NAME(name) nap::trace::setThreadName(name)
+#else
+#define TRACE_ZONE(name)
+#define TRACE_THREAD_NAME(name)
+#endif
+
+namespace nap
+{
+    namespace trace
+    {
+        /**
+         * @return true if the module was built with tracing
+         */
+        constexpr bool isEnabled()
+        {
+#ifdef OVERMYROOF_TRACE
+            return true;
+#else
+            return false;
+#endif
+        }
+
+        /**
+         * Records the time between construction and destruction, use TRACE_ZONE instead
+         */
+        class NAPAPI Zone
+        {
+        public:
+            Zone(const char* name) : mName(name), mBegin(std::chrono::steady_clock::now()) {}
+            ~Zone();
+        private:
+            const char* mName;
+            std::chrono::steady_clock::time_point mBegin;
+        };
+
+        /**
+         * Names the calling thread in the trace, use TRACE_THREAD_NAME instead
+         * @param name the name of the thread
+         */
+        NAPAPI void setThreadName(const std::string& name);
+
+        /**
+         * Formats the zones of all live and recently finished threads that are still in their ring buffers as Chrome trace json,
+         * to be opened in chrome://tracing or ui.perfetto.dev. Thread safe, threads keep recording meanwhile.
+         * @return the trace, without zones when the module was built without tracing
+         */
+        NAPAPI std::string formatChromeTrace();
+
+        /**
+         * Writes the Chrome trace of all threads to a file
+         * @param path the file to write to
+         * @param errorState the error state to store errors in
+         * @return true if the trace was written
+         */
+        NAPAPI bool writeChromeTrace(const std::string& path, utility::ErrorState& errorState);
+    }
+}
@@ -0,0 +1,27 @@
+#include "tracecall.h"
+#include "trace.h"
+#include "restutils.h"
+#include "restcontenttypes.h"
+
+RTTI_BEGIN_CLASS(nap::TraceCall)
+RTTI_END_CLASS
+
+namespace nap
+{
+    bool TraceCall::init(utility::ErrorState &errorState)
+    {
+        return true;
+    }
+
+
+    RestResponse TraceCall::call(const RestValueMap &values)
+    {
+        if(!trace::isEnabled())
+            return utility::generateErrorResponse("Tracing is disabled, build with the OVERMYROOF_TRACE CMake option");
+
+        RestResponse response;
+        response.mData = trace::formatChromeTrace();
+        response.mContentType = rest::contenttypes::json;
+        return response;
+    }
+}
@@ -0,0 +1,20 @@
+#pragma once
+
+#include <restfunction.h>
+
+namespace nap
+{
+    /**
+     * TraceCall is a RestFunction that returns the trace zones recorded by all threads as Chrome trace json,
+     * to be opened in chrome://tracing or ui.perfetto.dev. Zones are only recorded when the module is built with
+     * the OVERMYROOF_TRACE CMake option, otherwise the call returns an error.
+     */
+    class NAPAPI TraceCall : public RestFunction
+    {
+    RTTI_ENABLE(RestFunction)
+    public:
+        bool init(utility::ErrorState &errorState) final;
+
+        RestResponse call(const RestValueMap &values) override;
+    };
+}
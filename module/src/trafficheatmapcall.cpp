@@ -0,0 +1,124 @@
+#include "trafficheatmapcall.h"
+#include "trace.h"
+#include "restutils.h"
+#include "restcontenttypes.h"
+#include "nap/logger.h"
+#include "rapidjson/document.h"
+#include "rapidjson/stringbuffer.h"
+#include "rapidjson/prettywriter.h"
+#include <nap/datetime.h>
+#include <math.h>
+#include "utils.h"
+
+RTTI_BEGIN_CLASS(nap::TrafficHeatmapCall)
+    RTTI_PROPERTY("TrafficRollups", &nap::TrafficHeatmapCall::mTrafficRollups, nap::rtti::EPropertyMetaData::Required, "Hourly and daily traffic aggregates")
+    RTTI_PROPERTY("MaxDurationDays", &nap::TrafficHeatmapCall::mMaxDurationDays, nap::rtti::EPropertyMetaData::Default, "Maximum duration in days of the window")
+    RTTI_PROPERTY("MaxCells", &nap::TrafficHeatmapCall::mMaxCells, nap::rtti::EPropertyMetaData::Default, "Maximum number of cells in the bounding box")
+    RTTI_PROPERTY("Metrics", &nap::TrafficHeatmapCall::mMetrics, nap::rtti::EPropertyMetaData::Default, "Optional metrics the request duration is reported in")
+RTTI_END_CLASS
+
+namespace nap
+{
+    bool TrafficHeatmapCall::init(utility::ErrorState &errorState)
+    {
+        if(mMetrics != nullptr)
+            mRequestDuration = &mMetrics->addRequestHistogram(mID);
+
+        if(!errorState.check(mMaxDurationDays > 0, "MaxDurationDays must be greater than 0"))
+            return false;
+
+        return errorState.check(mMaxCells > 0, "MaxCells must be greater than 0");
+    }
+
+
+    RestResponse TrafficHeatmapCall::call(const RestValueMap &values)
+    {
+        TRACE_ZONE("TrafficHeatmapCall::call");
+        // The amount of milliseconds it took to execute the request is added to the response
+        SteadyTimer timer;
+        timer.start();
+        Metrics::ScopedTimer request_timer(mRequestDuration);
+
+        utility::ErrorState error_state;
+        float min_lat, min_lon, max_lat, max_lon;
+        std::string begin, end;
+        if(!extractValue("min_lat", values, min_lat, error_state))
+            return utility::generateErrorResponse(error_state.toString());
+        if(!extractValue("min_lon", values, min_lon, error_state))
+            return utility::generateErrorResponse(error_state.toString());
+        if(!extractValue("max_lat", values, max_lat, error_state))
+            return utility::generateErrorResponse(error_state.toString());
+        if(!extractValue("max_lon", values, max_lon, error_state))
+            return utility::generateErrorResponse(error_state.toString());
+        if(!extractValue("begin", values, begin, error_state))
+            return utility::generateErrorResponse(error_state.toString());
+        if(!extractValue("end", values, end, error_state))
+            return utility::generateErrorResponse(error_state.toString());
+
+        if(min_lat > max_lat || min_lon > max_lon)
+            return utility::generateErrorResponse("min_lat and min_lon must be smaller than max_lat and max_lon");
+
+        // Limit the size of the response
+        float cell_size = mTrafficRollups->mCellSize;
+        double cell_count = (std::floor(max_lat / cell_size) - std::floor(min_lat / cell_size) + 1.0) *
+                            (std::floor(max_lon / cell_size) - std::floor(min_lon / cell_size) + 1.0);
+        if(cell_count > mMaxCells)
+            return utility::generateErrorResponse(utility::stringFormat("Bounding box exceeds the maximum of %d cells", mMaxCells));
+
+        // The requested window is (begin, end]
+        uint64 begin_timestamp = std::stoull(begin);
+        uint64 end_timestamp = std::stoull(end);
+        DateTime begin_dt;
+        DateTime end_dt;
+        if(!utility::dateTimeFromUINT64(begin_timestamp, begin_dt, error_state) || !utility::dateTimeFromUINT64(end_timestamp, end_dt, error_state))
+            return utility::generateErrorResponse(error_state.toString());
+
+        if(end_timestamp <= begin_timestamp)
+            return utility::generateErrorResponse("end must be after begin");
+
+        if(end_dt.getTimeStamp() - begin_dt.getTimeStamp() > std::chrono::hours(24 * mMaxDurationDays))
+            return utility::generateErrorResponse(utility::stringFormat("Duration exceeds maximum duration of %d days", mMaxDurationDays));
+
+        std::vector<TrafficRollups::Cell> cells;
+        if(!mTrafficRollups->getHeatmap(begin_timestamp, end_timestamp, min_lat, min_lon, max_lat, max_lon, cells, error_state))
+            return utility::generateErrorResponse(error_state.toString());
+
+        // Create the json document
+        rapidjson::Document document(rapidjson::kObjectType);
+        rapidjson::Value data(rapidjson::kObjectType);
+        document.AddMember("status", "ok", document.GetAllocator());
+
+        rapidjson::Value cells_value(rapidjson::kArrayType);
+        for(const auto& cell : cells)
+        {
+            float lat, lon;
+            mTrafficRollups->getCellCenter(cell, lat, lon);
+
+            rapidjson::Value cell_value(rapidjson::kObjectType);
+            cell_value.AddMember("lat", lat, document.GetAllocator());
+            cell_value.AddMember("lon", lon, document.GetAllocator());
+            cell_value.AddMember("aircraft", static_cast<uint64>(cell.mAircraft.size()), document.GetAllocator());
+            cell_value.AddMember("observations", cell.mObservations, document.GetAllocator());
+            cell_value.AddMember("min_altitude", cell.mMinAltitude, document.GetAllocator());
+            cell_value.AddMember("mean_altitude", static_cast<float>(cell.mAltitudeSum / static_cast<double>(cell.mObservations)), document.GetAllocator());
+            cells_value.PushBack(cell_value, document.GetAllocator());
+        }
+        data.AddMember("cell_size", cell_size, document.GetAllocator());
+        data.AddMember("cells", cells_value, document.GetAllocator());
+        data.AddMember("rolled_until", mTrafficRollups->getRolledUntil(), document.GetAllocator());
+        data.AddMember("ms", timer.getMillis().count(), document.GetAllocator());
+        document.AddMember("data", data, document.GetAllocator());
+
+        // Serialize the response
+        rapidjson::StringBuffer buffer;
+        rapidjson::PrettyWriter<rapidjson::StringBuffer> writer(buffer);
+        writer.SetMaxDecimalPlaces(4);
+        document.Accept(writer);
+
+        RestResponse response;
+        response.mData = buffer.GetString();
+        response.mContentType = rest::contenttypes::json;
+
+        return response;
+    }
+}
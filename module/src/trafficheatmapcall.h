@@ -0,0 +1,30 @@
+#pragma once
+
+#include <restfunction.h>
+
+#include "trafficrollups.h"
+#include "metrics.h"
+
+namespace nap
+{
+    /**
+     * TrafficHeatmapCall is a RestFunction that returns the traffic per cell of the traffic rollups within a bounding box.
+     * Every hour that overlaps the requested window is included, the cells are read from the rolled up hours and days
+     * and from the live aggregates of the hours that aren't rolled up yet, no flight states are scanned.
+     */
+    class NAPAPI TrafficHeatmapCall : public RestFunction
+    {
+    RTTI_ENABLE(RestFunction)
+    public:
+        bool init(utility::ErrorState &errorState) final;
+
+        RestResponse call(const RestValueMap &values) override;
+
+        ResourcePtr<TrafficRollups> mTrafficRollups; ///< Property "TrafficRollups" : Hourly and daily traffic aggregates
+        int mMaxDurationDays = 366; ///< Property "MaxDurationDays" : Maximum duration in days of the window
+        int mMaxCells = 250000; ///< Property "MaxCells" : Maximum number of cells in the bounding box
+        ResourcePtr<Metrics> mMetrics; ///< Property "Metrics" : Optional metrics the request duration is reported in
+    private:
+        Metrics::Histogram* mRequestDuration = nullptr;
+    };
+}
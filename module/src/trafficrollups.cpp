@@ -0,0 +1,638 @@
+#include "trafficrollups.h"
+#include "utils.h"
+#include "trace.h"
+
+#include <nap/logger.h>
+#include <sqlite3.h>
+#include <math.h>
+
+RTTI_BEGIN_CLASS(nap::TrafficRollups)
+    RTTI_PROPERTY("FlightStatesDatabase", &nap::TrafficRollups::mFlightStatesDatabase, nap::rtti::EPropertyMetaData::Required)
+    RTTI_PROPERTY("Compression", &nap::TrafficRollups::mCompression, nap::rtti::EPropertyMetaData::Default)
+    RTTI_PROPERTY("FlightStatesTableName", &nap::TrafficRollups::mFlightStatesTableName, nap::rtti::EPropertyMetaData::Default)
+    RTTI_PROPERTY("DatabaseName", &nap::TrafficRollups::mDatabaseName, nap::rtti::EPropertyMetaData::Default)
+    RTTI_PROPERTY("TableName", &nap::TrafficRollups::mTableName, nap::rtti::EPropertyMetaData::Default)
+    RTTI_PROPERTY("CellSize", &nap::TrafficRollups::mCellSize, nap::rtti::EPropertyMetaData::Default)
+    RTTI_PROPERTY("BackfillHours", &nap::TrafficRollups::mBackfillHours, nap::rtti::EPropertyMetaData::Default)
+    RTTI_PROPERTY("MaxHoursPerUpdate", &nap::TrafficRollups::mMaxHoursPerUpdate, nap::rtti::EPropertyMetaData::Default)
+    RTTI_PROPERTY("RetentionDays", &nap::TrafficRollups::mRetentionDays, nap::rtti::EPropertyMetaData::Default)
+    RTTI_PROPERTY("UpdateInterval", &nap::TrafficRollups::mUpdateInterval, nap::rtti::EPropertyMetaData::Default)
+RTTI_END_CLASS
+
+namespace nap
+{
+    // Units of a timestamp in uint64 YYYYMMDDHHMMSS, a period is the timestamp of its first second
+    static constexpr uint64 sHour = 10000;
+    static constexpr uint64 sDay = 1000000;
+
+    // Time between the end of an hour and rolling it up, so the last snapshot of the hour is stored
+    static constexpr int sSettleSeconds = 60;
+
+    // Hours of live aggregates kept while the job catches up, older hours are dropped
+    static constexpr size_t sMaxLiveHours = 48;
+
+    // Cell size is stored in the meta table in micro degrees, the aggregates are rebuilt when it changes
+    static constexpr double sCellSizeScale = 1000000.0;
+
+    static uint64 toCellKey(int32 latitude, int32 longitude)
+    {
+        return (static_cast<uint64>(static_cast<uint32>(latitude)) << 32) | static_cast<uint32>(longitude);
+    }
+
+
+    /**
+     * The aircraft of a cell are stored as comma separated ICAO=altitude pairs
+     */
+    static std::string encodeAircraft(const std::unordered_map<uint64, float>& aircraft)
+    {
+        std::string text;
+        for(const auto& pair : aircraft)
+        {
+            if(!text.empty())
+                text += ',';
+            text += formatICAO(pair.first);
+            text += '=';
+            text += std::to_string(static_cast<int>(std::round(pair.second)));
+        }
+        return text;
+    }
+
+
+    static void decodeAircraft(const char* text, std::unordered_map<uint64, float>& aircraft)
+    {
+        while(text != nullptr && *text != '\0')
+        {
+            const char* separator = strchr(text, '=');
+            if(separator == nullptr)
+                return;
+
+            char* next = nullptr;
+            float altitude = strtof(separator + 1, &next);
+            uint64 icao = parseICAO(std::string(text, separator).c_str());
+            auto it = aircraft.find(icao);
+            if(it == aircraft.end())
+                aircraft.emplace(icao, altitude);
+            else
+                it->second = std::min(it->second, altitude);
+
+            text = *next == ',' ? next + 1 : next;
+        }
+    }
+
+
+    /**
+     * Reads the aggregate columns Observations, MinAltitude, AltitudeSum and Aircraft starting at the given column
+     */
+    static void readCell(sqlite3_stmt* statement, int column, TrafficRollups::Cell& cell)
+    {
+        TrafficRollups::Cell period;
+        period.mObservations = static_cast<uint64>(sqlite3_column_int64(statement, column));
+        period.mMinAltitude = static_cast<float>(sqlite3_column_double(statement, column + 1));
+        period.mAltitudeSum = sqlite3_column_double(statement, column + 2);
+        decodeAircraft(reinterpret_cast<const char*>(sqlite3_column_text(statement, column + 3)), period.mAircraft);
+        cell.merge(period);
+    }
+
+
+    void TrafficRollups::Cell::merge(const Cell& other)
+    {
+        if(other.mObservations == 0)
+            return;
+
+        mMinAltitude = mObservations == 0 ? other.mMinAltitude : std::min(mMinAltitude, other.mMinAltitude);
+        mObservations += other.mObservations;
+        mAltitudeSum += other.mAltitudeSum;
+        for(const auto& pair : other.mAircraft)
+        {
+            auto it = mAircraft.find(pair.first);
+            if(it == mAircraft.end())
+                mAircraft.emplace(pair);
+            else
+                it->second = std::min(it->second, pair.second);
+        }
+    }
+
+
+    TrafficRollups::~TrafficRollups()
+    {
+        {
+            std::lock_guard<std::mutex> lock(mStopMutex);
+            mStop = true;
+        }
+        mStopCondition.notify_all();
+        if(mThread.joinable())
+            mThread.join();
+
+        sqlite3_finalize(mInsertStatement);
+        sqlite3_finalize(mRemovePeriodStatement);
+        sqlite3_finalize(mQueryStatement);
+        if(mDatabase != nullptr)
+            sqlite3_close(mDatabase);
+    }
+
+
+    bool TrafficRollups::init(utility::ErrorState &errorState)
+    {
+        if(!errorState.check(mCellSize > 0.0f, "CellSize must be greater than 0"))
+            return false;
+
+        if(!errorState.check(mBackfillHours >= 0, "BackfillHours must be 0 or greater"))
+            return false;
+
+        if(!errorState.check(mMaxHoursPerUpdate > 0, "MaxHoursPerUpdate must be greater than 0"))
+            return false;
+
+        if(!errorState.check(mRetentionDays > 0, "RetentionDays must be greater than 0"))
+            return false;
+
+        if(!errorState.check(mUpdateInterval > 0.0f, "UpdateInterval must be greater than 0"))
+            return false;
+
+        mFlightStatesStore = mFlightStatesDatabase->getFlightStatesStore(mFlightStatesTableName, errorState);
+        if(mFlightStatesStore == nullptr)
+            return false;
+
+        if(!errorState.check(sqlite3_open(mDatabaseName.c_str(), &mDatabase) == SQLITE_OK,
+                             "Failed to open rollups database %s", mDatabaseName.c_str()))
+            return false;
+
+        sqlite3_busy_timeout(mDatabase, 5000);
+        if(!exec("PRAGMA journal_mode=WAL", errorState))
+            return false;
+
+        // Keyed on cell first, so an area query reads one contiguous range per row of cells
+        if(!exec(utility::stringFormat("CREATE TABLE IF NOT EXISTS %s (Resolution INTEGER, CellLat INTEGER, CellLon INTEGER, Period INTEGER, "
+                                       "Observations INTEGER, MinAltitude REAL, AltitudeSum REAL, Aircraft TEXT, "
+                                       "PRIMARY KEY (Resolution, CellLat, CellLon, Period)) WITHOUT ROWID", mTableName.c_str()), errorState))
+            return false;
+
+        if(!exec(utility::stringFormat("CREATE INDEX IF NOT EXISTS %s_period ON %s (Resolution, Period)", mTableName.c_str(), mTableName.c_str()), errorState))
+            return false;
+
+        if(!exec(utility::stringFormat("CREATE TABLE IF NOT EXISTS %s_meta (Key TEXT PRIMARY KEY, Value INTEGER)", mTableName.c_str()), errorState))
+            return false;
+
+        // Read the progress of the job
+        sqlite3_stmt* statement = nullptr;
+        if(!prepare(utility::stringFormat("SELECT Key, Value FROM %s_meta", mTableName.c_str()), &statement, errorState))
+            return false;
+
+        uint64 cell_size = 0;
+        while(sqlite3_step(statement) == SQLITE_ROW)
+        {
+            std::string key = reinterpret_cast<const char*>(sqlite3_column_text(statement, 0));
+            uint64 value = static_cast<uint64>(sqlite3_column_int64(statement, 1));
+            if(key == "RolledSince")
+                mRolledSince = value;
+            else if(key == "RolledUntil")
+                mRolledUntil = value;
+            else if(key == "CellSize")
+                cell_size = value;
+        }
+        sqlite3_finalize(statement);
+
+        // Aggregates of another cell size can't be combined with new ones, start over
+        uint64 current_cell_size = static_cast<uint64>(std::round(mCellSize * sCellSizeScale));
+        if(cell_size != current_cell_size)
+        {
+            if(cell_size != 0)
+                nap::Logger::warn(*this, "CellSize changed, rebuilding traffic rollups");
+
+            if(!exec(utility::stringFormat("DELETE FROM %s", mTableName.c_str()), errorState) ||
+               !exec(utility::stringFormat("DELETE FROM %s_meta", mTableName.c_str()), errorState) ||
+               !setMeta("CellSize", current_cell_size, errorState))
+                return false;
+
+            mRolledSince = 0;
+            mRolledUntil = 0;
+        }
+
+        if(!prepare(utility::stringFormat("INSERT OR REPLACE INTO %s (Resolution, CellLat, CellLon, Period, Observations, MinAltitude, AltitudeSum, Aircraft) "
+                                          "VALUES (?1, ?2, ?3, ?4, ?5, ?6, ?7, ?8)", mTableName.c_str()), &mInsertStatement, errorState))
+            return false;
+
+        if(!prepare(utility::stringFormat("DELETE FROM %s WHERE Resolution = ?1 AND Period = ?2", mTableName.c_str()), &mRemovePeriodStatement, errorState))
+            return false;
+
+        if(!prepare(utility::stringFormat("SELECT CellLon, Observations, MinAltitude, AltitudeSum, Aircraft FROM %s "
+                                          "WHERE Resolution = ?1 AND CellLat = ?2 AND CellLon >= ?3 AND CellLon <= ?4 AND Period >= ?5 AND Period < ?6",
+                                          mTableName.c_str()), &mQueryStatement, errorState))
+            return false;
+
+        mThread = std::thread([this](){ run(); });
+        return true;
+    }
+
+
+    bool TrafficRollups::getCells(uint64 begin, uint64 end, float minLatitude, float minLongitude, float maxLatitude, float maxLongitude,
+                                  std::vector<Cell>& cells, uint64& coveredBegin, uint64& coveredEnd, utility::ErrorState& errorState)
+    {
+        coveredBegin = end;
+        coveredEnd = end;
+
+        uint64 rolled_since = mRolledSince.load();
+        uint64 rolled_until = mRolledUntil.load();
+        if(rolled_until <= rolled_since)
+            return true;
+
+        uint64 first_hour = 0;
+        uint64 last_hour_end = 0;
+        if(!getCoveredHours(begin, end, rolled_since, rolled_until, first_hour, last_hour_end, errorState))
+            return false;
+
+        if(first_hour >= last_hour_end)
+            return true;
+
+        if(!utility::getSnapshotRange(first_hour, last_hour_end, coveredBegin, coveredEnd, errorState))
+            return false;
+
+        std::unordered_map<uint64, Cell> merged;
+        if(!readPeriods(first_hour, last_hour_end, toCellIndex(minLatitude), toCellIndex(minLongitude),
+                        toCellIndex(maxLatitude), toCellIndex(maxLongitude), merged, errorState))
+            return false;
+
+        cells.reserve(cells.size() + merged.size());
+        for(auto& pair : merged)
+            cells.emplace_back(std::move(pair.second));
+
+        return true;
+    }
+
+
+    bool TrafficRollups::getCoveredHours(uint64 begin, uint64 end, uint64 rolledSince, uint64 rolledUntil,
+                                         uint64& firstHour, uint64& lastHourEnd, utility::ErrorState& errorState)
+    {
+        // The window is (begin, end], only the hours completely inside it are covered
+        if(!utility::nextPeriod(begin - begin % sHour, sHour, firstHour, errorState))
+            return false;
+        firstHour = std::max(firstHour, rolledSince);
+
+        uint64 after_end = 0;
+        if(!utility::addToTimeStamp(end, std::chrono::seconds(1), after_end, errorState))
+            return false;
+        lastHourEnd = std::min(after_end - after_end % sHour, rolledUntil);
+        return true;
+    }
+
+
+    void TrafficRollups::addStates(uint64 timestamp, const std::vector<FlightState>& states)
+    {
+        TRACE_ZONE("TrafficRollups::addStates");
+        uint64 hour = timestamp - timestamp % sHour;
+        if(hour < mRolledUntil.load())
+            return;
+
+        std::lock_guard<std::mutex> lock(mLiveMutex);
+        aggregate(states, mLiveHours[hour]);
+        while(mLiveHours.size() > sMaxLiveHours)
+            mLiveHours.erase(mLiveHours.begin());
+    }
+
+
+    bool TrafficRollups::getHeatmap(uint64 begin, uint64 end, float minLatitude, float minLongitude, float maxLatitude, float maxLongitude,
+                                    std::vector<Cell>& cells, utility::ErrorState& errorState)
+    {
+        // Every hour that overlaps (begin, end]
+        uint64 first_hour = begin - begin % sHour;
+        uint64 last_hour_end = 0;
+        if(!utility::nextPeriod(end - end % sHour, sHour, last_hour_end, errorState))
+            return false;
+
+        int32 min_latitude = toCellIndex(minLatitude);
+        int32 min_longitude = toCellIndex(minLongitude);
+        int32 max_latitude = toCellIndex(maxLatitude);
+        int32 max_longitude = toCellIndex(maxLongitude);
+
+        std::unordered_map<uint64, Cell> merged;
+        uint64 rolled_until = mRolledUntil.load();
+        if(!readPeriods(std::max(first_hour, mRolledSince.load()), std::min(last_hour_end, rolled_until),
+                        min_latitude, min_longitude, max_latitude, max_longitude, merged, errorState))
+            return false;
+
+        // The hours the job hasn't rolled up yet
+        {
+            std::lock_guard<std::mutex> lock(mLiveMutex);
+            for(auto it = mLiveHours.lower_bound(std::max(first_hour, rolled_until)); it != mLiveHours.end() && it->first < last_hour_end; ++it)
+            {
+                for(const auto& pair : it->second)
+                {
+                    const auto& cell = pair.second;
+                    if(cell.mLatitude < min_latitude || cell.mLatitude > max_latitude || cell.mLongitude < min_longitude || cell.mLongitude > max_longitude)
+                        continue;
+
+                    auto& merged_cell = merged[pair.first];
+                    merged_cell.mLatitude = cell.mLatitude;
+                    merged_cell.mLongitude = cell.mLongitude;
+                    merged_cell.merge(cell);
+                }
+            }
+        }
+
+        cells.reserve(cells.size() + merged.size());
+        for(auto& pair : merged)
+            cells.emplace_back(std::move(pair.second));
+
+        return true;
+    }
+
+
+    void TrafficRollups::getCellCenter(const Cell& cell, float& latitude, float& longitude) const
+    {
+        latitude = (static_cast<float>(cell.mLatitude) + 0.5f) * mCellSize;
+        longitude = (static_cast<float>(cell.mLongitude) + 0.5f) * mCellSize;
+    }
+
+
+    void TrafficRollups::run()
+    {
+        TRACE_THREAD_NAME("traffic rollups");
+        auto stopping = [this]()
+        {
+            std::lock_guard<std::mutex> lock(mStopMutex);
+            return mStop;
+        };
+
+        // Without aggregates the job starts with the history that is already logged
+        if(mRolledUntil.load() == 0)
+        {
+            utility::ErrorState error_state;
+            uint64 start = utility::uint64FromDateTime(DateTime(SystemClock::now() - std::chrono::hours(mBackfillHours)));
+            start -= start % sHour;
+
+            std::lock_guard<std::mutex> lock(mMutex);
+            if(!setMeta("RolledSince", start, error_state) || !setMeta("RolledUntil", start, error_state))
+            {
+                nap::Logger::error(*this, "Failed to start traffic rollups : %s", error_state.toString().c_str());
+                return;
+            }
+            mRolledSince = start;
+            mRolledUntil = start;
+        }
+
+        while(true)
+        {
+            // Roll up the hours that are completed, a backlog is spread over updates so the raw history isn't scanned in one go
+            for(int hours = 0; hours < mMaxHoursPerUpdate && !stopping(); hours++)
+            {
+                utility::ErrorState error_state;
+                uint64 hour = mRolledUntil.load();
+                uint64 hour_end = 0;
+                if(!utility::nextPeriod(hour, sHour, hour_end, error_state))
+                {
+                    nap::Logger::error(*this, "Invalid rollup period %s : %s", std::to_string(hour).c_str(), error_state.toString().c_str());
+                    return;
+                }
+
+                uint64 settled = utility::uint64FromDateTime(DateTime(SystemClock::now() - std::chrono::seconds(sSettleSeconds)));
+                if(hour_end > settled)
+                    break;
+
+                if(!rollUpHour(hour, error_state))
+                {
+                    // Retried on the next update
+                    nap::Logger::error(*this, "Failed to roll up hour %s : %s", std::to_string(hour).c_str(), error_state.toString().c_str());
+                    break;
+                }
+            }
+
+            std::unique_lock<std::mutex> lock(mStopMutex);
+            mStopCondition.wait_for(lock, std::chrono::duration<float>(mUpdateInterval), [this](){ return mStop; });
+            if(mStop)
+                return;
+        }
+    }
+
+
+    bool TrafficRollups::rollUpHour(uint64 hour, utility::ErrorState& errorState)
+    {
+        TRACE_ZONE("TrafficRollups::rollUpHour");
+        uint64 hour_end = 0;
+        if(!utility::nextPeriod(hour, sHour, hour_end, errorState))
+            return false;
+
+        // The hour is [hour, hour_end)
+        uint64 begin = 0;
+        uint64 end = 0;
+        if(!utility::getSnapshotRange(hour, hour_end, begin, end, errorState))
+            return false;
+
+        // Aggregate outside of the lock, queries only wait for the write
+        std::unordered_map<uint64, Cell> cells;
+        auto add_snapshot = [this, &cells](uint64 timestamp, const std::vector<FlightState>& states)
+        {
+            aggregate(states, cells);
+        };
+        if(!mFlightStatesStore->readSnapshots(begin, end, mCompression.get(), add_snapshot, errorState))
+            return false;
+
+        // The aggregates and the progress are written in one transaction, so a failed hour is simply rolled up again
+        std::lock_guard<std::mutex> lock(mMutex);
+        if(!exec("BEGIN TRANSACTION", errorState))
+            return false;
+
+        bool success = writeCells(EResolution::Hour, hour, cells, errorState) &&
+                       setMeta("RolledUntil", hour_end, errorState);
+
+        // The last hour of a day completes the day, days that started before the job did are incomplete
+        uint64 day = hour - hour % sDay;
+        if(success && hour_end % sDay == 0 && day >= mRolledSince.load())
+            success = rollUpDay(day, errorState);
+
+        if(!exec(success ? "COMMIT" : "ROLLBACK", errorState) || !success)
+            return false;
+
+        mRolledUntil = hour_end;
+
+        // The live aggregates of the hour are replaced by the rolled up ones
+        std::lock_guard<std::mutex> live_lock(mLiveMutex);
+        mLiveHours.erase(mLiveHours.begin(), mLiveHours.lower_bound(hour_end));
+        return true;
+    }
+
+
+    bool TrafficRollups::rollUpDay(uint64 day, utility::ErrorState& errorState)
+    {
+        TRACE_ZONE("TrafficRollups::rollUpDay");
+        uint64 day_end = 0;
+        if(!utility::nextPeriod(day, sDay, day_end, errorState))
+            return false;
+
+        // Merge the hours of the day
+        std::unordered_map<uint64, Cell> cells;
+        sqlite3_stmt* statement = nullptr;
+        if(!prepare(utility::stringFormat("SELECT CellLat, CellLon, Observations, MinAltitude, AltitudeSum, Aircraft FROM %s "
+                                          "WHERE Resolution = ?1 AND Period >= ?2 AND Period < ?3", mTableName.c_str()), &statement, errorState))
+            return false;
+
+        sqlite3_bind_int(statement, 1, static_cast<int>(EResolution::Hour));
+        sqlite3_bind_int64(statement, 2, static_cast<sqlite3_int64>(day));
+        sqlite3_bind_int64(statement, 3, static_cast<sqlite3_int64>(day_end));
+        int result;
+        while((result = sqlite3_step(statement)) == SQLITE_ROW)
+        {
+            int32 latitude = sqlite3_column_int(statement, 0);
+            int32 longitude = sqlite3_column_int(statement, 1);
+            auto& cell = cells[toCellKey(latitude, longitude)];
+            cell.mLatitude = latitude;
+            cell.mLongitude = longitude;
+            readCell(statement, 2, cell);
+        }
+        sqlite3_finalize(statement);
+        if(!errorState.check(result == SQLITE_DONE, "Failed to read hour rollups : %s", sqlite3_errmsg(mDatabase)))
+            return false;
+
+        if(!writeCells(EResolution::Day, day, cells, errorState))
+            return false;
+
+        // Retention, once a day
+        uint64 expired = 0;
+        if(!utility::subtractFromTimeStamp(day, std::chrono::hours(24 * mRetentionDays), expired, errorState))
+            return false;
+
+        return exec(utility::stringFormat("DELETE FROM %s WHERE Period < %s", mTableName.c_str(), std::to_string(expired).c_str()), errorState);
+    }
+
+
+    bool TrafficRollups::writeCells(EResolution resolution, uint64 period, const std::unordered_map<uint64, Cell>& cells, utility::ErrorState& errorState)
+    {
+        // Replace anything a previous attempt left behind
+        sqlite3_bind_int(mRemovePeriodStatement, 1, static_cast<int>(resolution));
+        sqlite3_bind_int64(mRemovePeriodStatement, 2, static_cast<sqlite3_int64>(period));
+        int result = sqlite3_step(mRemovePeriodStatement);
+        sqlite3_reset(mRemovePeriodStatement);
+        if(!errorState.check(result == SQLITE_DONE, "Failed to remove rollups : %s", sqlite3_errmsg(mDatabase)))
+            return false;
+
+        for(const auto& pair : cells)
+        {
+            const auto& cell = pair.second;
+            std::string aircraft = encodeAircraft(cell.mAircraft);
+            sqlite3_bind_int(mInsertStatement, 1, static_cast<int>(resolution));
+            sqlite3_bind_int(mInsertStatement, 2, cell.mLatitude);
+            sqlite3_bind_int(mInsertStatement, 3, cell.mLongitude);
+            sqlite3_bind_int64(mInsertStatement, 4, static_cast<sqlite3_int64>(period));
+            sqlite3_bind_int64(mInsertStatement, 5, static_cast<sqlite3_int64>(cell.mObservations));
+            sqlite3_bind_double(mInsertStatement, 6, cell.mMinAltitude);
+            sqlite3_bind_double(mInsertStatement, 7, cell.mAltitudeSum);
+            sqlite3_bind_text(mInsertStatement, 8, aircraft.c_str(), static_cast<int>(aircraft.size()), SQLITE_STATIC);
+            result = sqlite3_step(mInsertStatement);
+            sqlite3_reset(mInsertStatement);
+            if(!errorState.check(result == SQLITE_DONE, "Failed to insert rollup : %s", sqlite3_errmsg(mDatabase)))
+                return false;
+        }
+
+        return true;
+    }
+
+
+    bool TrafficRollups::readPeriods(uint64 firstHour, uint64 lastHourEnd, int32 minLatitude, int32 minLongitude, int32 maxLatitude, int32 maxLongitude,
+                                     std::unordered_map<uint64, Cell>& cells, utility::ErrorState& errorState)
+    {
+        if(firstHour >= lastHourEnd)
+            return true;
+
+        // Whole days are read from the day aggregates, the hours around them from the hour aggregates
+        uint64 first_day = firstHour;
+        if(firstHour % sDay != 0 && !utility::nextPeriod(firstHour - firstHour % sDay, sDay, first_day, errorState))
+            return false;
+        uint64 last_day_end = lastHourEnd - lastHourEnd % sDay;
+
+        std::lock_guard<std::mutex> lock(mMutex);
+        if(first_day >= last_day_end)
+            return readCells(EResolution::Hour, firstHour, lastHourEnd, minLatitude, minLongitude, maxLatitude, maxLongitude, cells, errorState);
+
+        return readCells(EResolution::Hour, firstHour, first_day, minLatitude, minLongitude, maxLatitude, maxLongitude, cells, errorState) &&
+               readCells(EResolution::Day, first_day, last_day_end, minLatitude, minLongitude, maxLatitude, maxLongitude, cells, errorState) &&
+               readCells(EResolution::Hour, last_day_end, lastHourEnd, minLatitude, minLongitude, maxLatitude, maxLongitude, cells, errorState);
+    }
+
+
+    void TrafficRollups::aggregate(const std::vector<FlightState>& states, std::unordered_map<uint64, Cell>& cells) const
+    {
+        for(const auto& state : states)
+        {
+            int32 latitude = toCellIndex(state.mLatitude);
+            int32 longitude = toCellIndex(state.mLongitude);
+            auto& cell = cells[toCellKey(latitude, longitude)];
+            cell.mLatitude = latitude;
+            cell.mLongitude = longitude;
+            cell.mMinAltitude = cell.mObservations == 0 ? state.mAltitude : std::min(cell.mMinAltitude, state.mAltitude);
+            cell.mObservations++;
+            cell.mAltitudeSum += state.mAltitude;
+
+            auto it = cell.mAircraft.find(state.mICAO);
+            if(it == cell.mAircraft.end())
+                cell.mAircraft.emplace(state.mICAO, state.mAltitude);
+            else
+                it->second = std::min(it->second, state.mAltitude);
+        }
+    }
+
+
+    bool TrafficRollups::readCells(EResolution resolution, uint64 begin, uint64 end, int32 minLatitude, int32 minLongitude, int32 maxLatitude, int32 maxLongitude,
+                                   std::unordered_map<uint64, Cell>& cells, utility::ErrorState& errorState)
+    {
+        if(begin >= end)
+            return true;
+
+        // One range scan of the primary key per row of cells
+        for(int32 latitude = minLatitude; latitude <= maxLatitude; latitude++)
+        {
+            sqlite3_bind_int(mQueryStatement, 1, static_cast<int>(resolution));
+            sqlite3_bind_int(mQueryStatement, 2, latitude);
+            sqlite3_bind_int(mQueryStatement, 3, minLongitude);
+            sqlite3_bind_int(mQueryStatement, 4, maxLongitude);
+            sqlite3_bind_int64(mQueryStatement, 5, static_cast<sqlite3_int64>(begin));
+            sqlite3_bind_int64(mQueryStatement, 6, static_cast<sqlite3_int64>(end));
+
+            int result;
+            while((result = sqlite3_step(mQueryStatement)) == SQLITE_ROW)
+            {
+                int32 longitude = sqlite3_column_int(mQueryStatement, 0);
+                auto& cell = cells[toCellKey(latitude, longitude)];
+                cell.mLatitude = latitude;
+                cell.mLongitude = longitude;
+                readCell(mQueryStatement, 1, cell);
+            }
+            sqlite3_reset(mQueryStatement);
+
+            if(!errorState.check(result == SQLITE_DONE, "Failed to query rollups : %s", sqlite3_errmsg(mDatabase)))
+                return false;
+        }
+
+        return true;
+    }
+
+
+    bool TrafficRollups::setMeta(const char* key, uint64 value, utility::ErrorState& errorState)
+    {
+        return exec(utility::stringFormat("INSERT OR REPLACE INTO %s_meta (Key, Value) VALUES ('%s', %s)",
+                                          mTableName.c_str(), key, std::to_string(value).c_str()), errorState);
+    }
+
+
+    int32 TrafficRollups::toCellIndex(float coordinate) const
+    {
+        return static_cast<int32>(std::floor(coordinate / mCellSize));
+    }
+
+
+    bool TrafficRollups::exec(const std::string& sql, utility::ErrorState& errorState)
+    {
+        char* error = nullptr;
+        if(sqlite3_exec(mDatabase, sql.c_str(), nullptr, nullptr, &error) != SQLITE_OK)
+        {
+            errorState.fail("SQL error : %s", error != nullptr ? error : "unknown");
+            sqlite3_free(error);
+            return false;
+        }
+        return true;
+    }
+
+
+    bool TrafficRollups::prepare(const std::string& sql, sqlite3_stmt** statement, utility::ErrorState& errorState)
+    {
+        return errorState.check(sqlite3_prepare_v2(mDatabase, sql.c_str(), -1, statement, nullptr) == SQLITE_OK,
+                                "Failed to prepare statement : %s", sqlite3_errmsg(mDatabase));
+    }
+}
@@ -0,0 +1,182 @@
+#pragma once
+
+#include <nap/resource.h>
+#include <nap/resourceptr.h>
+#include <nap/numeric.h>
+#include <mutex>
+#include <thread>
+#include <condition_variable>
+#include <unordered_map>
+#include <map>
+
+#include "databasetableresource.h"
+#include "flightstatescompression.h"
+#include "flightstatesstore.h"
+
+// Forward declares
+struct sqlite3;
+struct sqlite3_stmt;
+
+namespace nap
+{
+    /**
+     * Hourly and daily aggregates of the logged traffic per spatial cell
+     * A background job reads every completed hour from the flight states store once and stores, per cell of CellSize degrees,
+     * the number of observations, the altitude statistics and the lowest altitude of every aircraft seen in the cell.
+     * When the last hour of a day is rolled up the hours of that day are merged into a day aggregate.
+     * Queries over long periods read a few aggregates per cell instead of every snapshot, only the parts of the period that
+     * don't cover a whole hour, or haven't been rolled up yet, need to be read from the raw history.
+     * Snapshots added by the logger are aggregated in memory for the hours the job hasn't rolled up yet,
+     * so heatmaps include the current hour without waiting for the job.
+     * The aggregates live in their own database file, all methods are thread safe
+     */
+    class NAPAPI TrafficRollups : public Resource
+    {
+    RTTI_ENABLE(Resource)
+    public:
+        /**
+         * The traffic within one cell
+         */
+        struct Cell
+        {
+            int32 mLatitude = 0; ///< Latitude index, the cell spans [mLatitude, mLatitude + 1) * CellSize degrees
+            int32 mLongitude = 0; ///< Longitude index, the cell spans [mLongitude, mLongitude + 1) * CellSize degrees
+            uint64 mObservations = 0; ///< Number of aircraft observations in all snapshots
+            float mMinAltitude = 0.0f; ///< Lowest observed altitude
+            double mAltitudeSum = 0.0; ///< Sum of all observed altitudes
+            std::unordered_map<uint64, float> mAircraft; ///< Lowest altitude of every aircraft, by ICAO
+
+            /**
+             * Adds the traffic of another period of the same cell
+             * @param other the traffic to add
+             */
+            void merge(const Cell& other);
+        };
+
+        /**
+         * Destructor, stops the job and closes the database
+         */
+        ~TrafficRollups() override;
+
+        /**
+         * Opens the database and starts the rollup job
+         * @param errorState the error state to store errors in
+         * @return true if the rollups were initialized
+         */
+        bool init(utility::ErrorState &errorState) final;
+
+        /**
+         * Get the traffic of all cells overlapping the given area, summed over the part of (begin, end] that is rolled up.
+         * The covered part is (coveredBegin, coveredEnd], the remainder of the period must be read from the raw history.
+         * When nothing is covered both are set to end.
+         * @param begin the begin timestamp in uint64 YYYYMMDDHHMMSS, exclusive
+         * @param end the end timestamp in uint64 YYYYMMDDHHMMSS, inclusive
+         * @param minLatitude southern edge of the area
+         * @param minLongitude western edge of the area
+         * @param maxLatitude northern edge of the area
+         * @param maxLongitude eastern edge of the area
+         * @param cells the traffic of every cell that has any
+         * @param coveredBegin begin of the covered part in uint64 YYYYMMDDHHMMSS, exclusive
+         * @param coveredEnd end of the covered part in uint64 YYYYMMDDHHMMSS, inclusive
+         * @param errorState the error state to store errors in
+         * @return true if the query succeeded
+         */
+        bool getCells(uint64 begin, uint64 end, float minLatitude, float minLongitude, float maxLatitude, float maxLongitude,
+                      std::vector<Cell>& cells, uint64& coveredBegin, uint64& coveredEnd, utility::ErrorState& errorState);
+
+        /**
+         * Get the rolled up hours completely inside (begin, end], nothing is covered when firstHour >= lastHourEnd
+         * @param begin the begin timestamp in uint64 YYYYMMDDHHMMSS, exclusive
+         * @param end the end timestamp in uint64 YYYYMMDDHHMMSS, inclusive
+         * @param rolledSince the first rolled up hour in uint64 YYYYMMDDHHMMSS
+         * @param rolledUntil the end of the last rolled up hour in uint64 YYYYMMDDHHMMSS, exclusive
+         * @param firstHour the first covered hour in uint64 YYYYMMDDHHMMSS
+         * @param lastHourEnd the end of the last covered hour in uint64 YYYYMMDDHHMMSS, exclusive
+         * @param errorState the error state to store errors in
+         * @return true if the timestamps could be parsed
+         */
+        static bool getCoveredHours(uint64 begin, uint64 end, uint64 rolledSince, uint64 rolledUntil,
+                                    uint64& firstHour, uint64& lastHourEnd, utility::ErrorState& errorState);
+
+        /**
+         * Adds a snapshot to the live aggregates of its hour, called by the logger for every stored snapshot
+         * @param timestamp the timestamp of the snapshot in uint64 YYYYMMDDHHMMSS
+         * @param states all states of the snapshot
+         */
+        void addStates(uint64 timestamp, const std::vector<FlightState>& states);
+
+        /**
+         * Get the traffic of all cells overlapping the given area during every hour that overlaps (begin, end].
+         * Rolled up hours are read from the database, the hours after them from the live aggregates.
+         * @param begin the begin timestamp in uint64 YYYYMMDDHHMMSS, exclusive
+         * @param end the end timestamp in uint64 YYYYMMDDHHMMSS, inclusive
+         * @param minLatitude southern edge of the area
+         * @param minLongitude western edge of the area
+         * @param maxLatitude northern edge of the area
+         * @param maxLongitude eastern edge of the area
+         * @param cells the traffic of every cell that has any
+         * @param errorState the error state to store errors in
+         * @return true if the query succeeded
+         */
+        bool getHeatmap(uint64 begin, uint64 end, float minLatitude, float minLongitude, float maxLatitude, float maxLongitude,
+                        std::vector<Cell>& cells, utility::ErrorState& errorState);
+
+        /**
+         * Get the center of a cell
+         * @param cell the cell
+         * @param latitude latitude of the center
+         * @param longitude longitude of the center
+         */
+        void getCellCenter(const Cell& cell, float& latitude, float& longitude) const;
+
+        /**
+         * @return timestamp of the end of the last rolled up hour in uint64 YYYYMMDDHHMMSS, exclusive, 0 before the job started
+         */
+        uint64 getRolledUntil() const { return mRolledUntil.load(); }
+
+        ResourcePtr<DatabaseTableResource> mFlightStatesDatabase; ///< Property: "FlightStatesDatabase" - The database holding the flight states
+        ResourcePtr<FlightStatesCompression> mCompression; ///< Property: "Compression" - Optional compression of the stored flight states
+        std::string mFlightStatesTableName = "states"; ///< Property: "FlightStatesTableName" - Flight states table name
+        std::string mDatabaseName = "rollups.db"; ///< Property: "DatabaseName" - The database file that holds the aggregates
+        std::string mTableName = "rollups"; ///< Property: "TableName" - Name of the aggregates table
+        float mCellSize = 0.01f; ///< Property: "CellSize" - Size of a cell in degrees
+        int mBackfillHours = 768; ///< Property: "BackfillHours" - Hours of existing history to roll up when no aggregates exist yet
+        int mMaxHoursPerUpdate = 24; ///< Property: "MaxHoursPerUpdate" - Hours rolled up per update at most, so catching up after a lag is spread over updates
+        int mRetentionDays = 400; ///< Property: "RetentionDays" - Days to keep the aggregates
+        float mUpdateInterval = 60.0f; ///< Property: "UpdateInterval" - Seconds between checks for completed hours
+    private:
+        enum class EResolution : int { Hour = 0, Day = 1 };
+
+        void run();
+        bool rollUpHour(uint64 hour, utility::ErrorState& errorState);
+        bool rollUpDay(uint64 day, utility::ErrorState& errorState);
+        bool writeCells(EResolution resolution, uint64 period, const std::unordered_map<uint64, Cell>& cells, utility::ErrorState& errorState);
+        bool readPeriods(uint64 firstHour, uint64 lastHourEnd, int32 minLatitude, int32 minLongitude, int32 maxLatitude, int32 maxLongitude,
+                         std::unordered_map<uint64, Cell>& cells, utility::ErrorState& errorState);
+        bool readCells(EResolution resolution, uint64 begin, uint64 end, int32 minLatitude, int32 minLongitude, int32 maxLatitude, int32 maxLongitude,
+                       std::unordered_map<uint64, Cell>& cells, utility::ErrorState& errorState);
+        bool setMeta(const char* key, uint64 value, utility::ErrorState& errorState);
+        void aggregate(const std::vector<FlightState>& states, std::unordered_map<uint64, Cell>& cells) const;
+        int32 toCellIndex(float coordinate) const;
+
+        bool exec(const std::string& sql, utility::ErrorState& errorState);
+        bool prepare(const std::string& sql, sqlite3_stmt** statement, utility::ErrorState& errorState);
+
+        FlightStatesStore* mFlightStatesStore = nullptr;
+        std::mutex mMutex;
+        sqlite3* mDatabase = nullptr;
+        sqlite3_stmt* mInsertStatement = nullptr;
+        sqlite3_stmt* mRemovePeriodStatement = nullptr;
+        sqlite3_stmt* mQueryStatement = nullptr;
+        std::atomic<uint64> mRolledSince = { 0 };
+        std::atomic<uint64> mRolledUntil = { 0 };
+
+        std::mutex mLiveMutex;
+        std::map<uint64, std::unordered_map<uint64, Cell>> mLiveHours;
+
+        std::thread mThread;
+        std::mutex mStopMutex;
+        std::condition_variable mStopCondition;
+        bool mStop = false;
+    };
+}
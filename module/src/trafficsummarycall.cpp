@@ -0,0 +1,211 @@
+#include "trafficsummarycall.h"
+#include "trace.h"
+#include "restutils.h"
+#include "restcontenttypes.h"
+#include "nap/logger.h"
+#include "rapidjson/document.h"
+#include "rapidjson/stringbuffer.h"
+#include "rapidjson/prettywriter.h"
+#include <nap/datetime.h>
+#include <math.h>
+#include <limits>
+#include "utils.h"
+
+RTTI_BEGIN_CLASS(nap::TrafficSummaryCall)
+    RTTI_PROPERTY("FetchFlightsCall", &nap::TrafficSummaryCall::mFetchFlightsCall, nap::rtti::EPropertyMetaData::Required, "Resolves the location and reads the raw history")
+    RTTI_PROPERTY("TrafficRollups", &nap::TrafficSummaryCall::mTrafficRollups, nap::rtti::EPropertyMetaData::Required, "Hourly and daily traffic aggregates")
+    RTTI_PROPERTY("MaxDurationDays", &nap::TrafficSummaryCall::mMaxDurationDays, nap::rtti::EPropertyMetaData::Default, "Maximum duration in days to summarize")
+    RTTI_PROPERTY("DistanceBuckets", &nap::TrafficSummaryCall::mDistanceBuckets, nap::rtti::EPropertyMetaData::Default, "Upper bounds in meters of the distance buckets, not below the accuracy of the rollups")
+    RTTI_PROPERTY("Metrics", &nap::TrafficSummaryCall::mMetrics, nap::rtti::EPropertyMetaData::Default, "Optional metrics the request duration is reported in")
+RTTI_END_CLASS
+
+namespace nap
+{
+    double calcGPSDistance(double latitude_new, double longitude_new, double latitude_old, double longitude_old);
+
+    // Meters per degree latitude, used to convert the search radius into a bounding box
+    static constexpr double sMetersPerDegree = 111320.0;
+
+    /**
+     * Closest approach and lowest altitude of an aircraft within the search area
+     */
+    struct Overflight
+    {
+        float mDistance = 0.0f;
+        float mAltitude = 0.0f;
+    };
+
+
+    static void addOverflight(std::unordered_map<uint64, Overflight>& overflights, uint64 icao, float distance, float altitude)
+    {
+        auto it = overflights.find(icao);
+        if(it == overflights.end())
+        {
+            overflights.emplace(icao, Overflight{ distance, altitude });
+            return;
+        }
+
+        it->second.mDistance = std::min(it->second.mDistance, distance);
+        it->second.mAltitude = std::min(it->second.mAltitude, altitude);
+    }
+
+
+    bool TrafficSummaryCall::init(utility::ErrorState &errorState)
+    {
+        if(mMetrics != nullptr)
+            mRequestDuration = &mMetrics->addRequestHistogram(mID);
+
+        if(!errorState.check(mMaxDurationDays > 0, "MaxDurationDays must be greater than 0"))
+            return false;
+
+        if(!errorState.check(std::is_sorted(mDistanceBuckets.begin(), mDistanceBuckets.end()), "DistanceBuckets must be in ascending order"))
+            return false;
+
+        // Rolled up traffic is located at the center of its cell, a smaller bucket can't be told apart from the next one
+        float accuracy = static_cast<float>(mTrafficRollups->mCellSize * sMetersPerDegree * M_SQRT1_2);
+        return errorState.check(mDistanceBuckets.empty() || mDistanceBuckets.front() >= accuracy,
+                                "DistanceBuckets must not be below %.0f meters, the accuracy of the traffic rollups", accuracy);
+    }
+
+
+    RestResponse TrafficSummaryCall::call(const RestValueMap &values)
+    {
+        TRACE_ZONE("TrafficSummaryCall::call");
+        // The amount of milliseconds it took to execute the request is added to the response
+        SteadyTimer timer;
+        timer.start();
+        Metrics::ScopedTimer request_timer(mRequestDuration);
+
+        utility::ErrorState error_state;
+        float lat, lon, altitude, radius;
+        std::string begin, end;
+        if(!mFetchFlightsCall->getLocation(values, lat, lon, error_state))
+            return utility::generateErrorResponse(error_state.toString());
+        if(!extractValue("altitude", values, altitude, error_state))
+            return utility::generateErrorResponse(error_state.toString());
+        if(!extractValue("radius", values, radius, error_state))
+            return utility::generateErrorResponse(error_state.toString());
+        if(!extractValue("begin", values, begin, error_state))
+            return utility::generateErrorResponse(error_state.toString());
+        if(!extractValue("end", values, end, error_state))
+            return utility::generateErrorResponse(error_state.toString());
+
+        // The requested window is (begin, end]
+        uint64 begin_timestamp = std::stoull(begin);
+        uint64 end_timestamp = std::stoull(end);
+        DateTime begin_dt;
+        DateTime end_dt;
+        if(!utility::dateTimeFromUINT64(begin_timestamp, begin_dt, error_state) || !utility::dateTimeFromUINT64(end_timestamp, end_dt, error_state))
+            return utility::generateErrorResponse(error_state.toString());
+
+        if(end_timestamp <= begin_timestamp)
+            return utility::generateErrorResponse("end must be after begin");
+
+        if(end_dt.getTimeStamp() - begin_dt.getTimeStamp() > std::chrono::hours(24 * mMaxDurationDays))
+            return utility::generateErrorResponse(utility::stringFormat("Duration exceeds maximum duration of %d days", mMaxDurationDays));
+
+        // Read the rollups of all cells overlapping the bounding box of the search area
+        double lat_delta = radius / sMetersPerDegree;
+        double lon_delta = radius / (sMetersPerDegree * std::max(std::cos(lat * M_PI / 180.0), 0.01));
+        std::vector<TrafficRollups::Cell> cells;
+        uint64 covered_begin = 0;
+        uint64 covered_end = 0;
+        if(!mTrafficRollups->getCells(begin_timestamp, end_timestamp, lat - lat_delta, lon - lon_delta, lat + lat_delta, lon + lon_delta,
+                                      cells, covered_begin, covered_end, error_state))
+            return utility::generateErrorResponse(error_state.toString());
+
+        // A cell counts when its center is within the radius
+        std::unordered_map<uint64, Overflight> overflights;
+        for(const auto& cell : cells)
+        {
+            float cell_lat, cell_lon;
+            mTrafficRollups->getCellCenter(cell, cell_lat, cell_lon);
+            float distance = static_cast<float>(calcGPSDistance(lat, lon, cell_lat, cell_lon));
+            if(distance >= radius)
+                continue;
+
+            for(const auto& aircraft : cell.mAircraft)
+            {
+                if(altitude > 0 && aircraft.second > altitude)
+                    continue;
+                addOverflight(overflights, aircraft.first, distance, aircraft.second);
+            }
+        }
+
+        // The parts of the window before and after the rolled up hours are read from the raw history
+        StatesQuery query;
+        query.mLatitude = lat;
+        query.mLongitude = lon;
+        query.mRadius = radius;
+        query.mAltitude = altitude;
+        std::vector<std::pair<uint64, uint64>> raw_ranges = { { begin_timestamp, covered_begin }, { covered_end, end_timestamp } };
+        size_t raw_rows = 0;
+        for(const auto& range : raw_ranges)
+        {
+            if(range.second <= range.first)
+                continue;
+
+            StatesQueryPlanner::Result result;
+            if(!mFetchFlightsCall->getPlanner().execute(range.first, range.second, query, result, error_state))
+                return utility::generateErrorResponse(error_state.toString());
+
+            for(const auto& flight : result.mFlights)
+                addOverflight(overflights, flight.mState.mICAO, flight.mDistance, flight.mState.mAltitude);
+            raw_rows += result.mRows;
+        }
+
+        // Count the aircraft per distance bucket by their closest approach
+        std::vector<float> bounds;
+        for(float bound : mDistanceBuckets)
+        {
+            if(bound < radius)
+                bounds.emplace_back(bound);
+        }
+        bounds.emplace_back(radius);
+
+        std::vector<int> bucket_counts(bounds.size(), 0);
+        float min_altitude = std::numeric_limits<float>::max();
+        for(const auto& pair : overflights)
+        {
+            size_t bucket = std::upper_bound(bounds.begin(), bounds.end(), pair.second.mDistance) - bounds.begin();
+            bucket_counts[std::min(bucket, bounds.size() - 1)]++;
+            min_altitude = std::min(min_altitude, pair.second.mAltitude);
+        }
+
+        // Create the json document
+        rapidjson::Document document(rapidjson::kObjectType);
+        rapidjson::Value data(rapidjson::kObjectType);
+        document.AddMember("status", "ok", document.GetAllocator());
+
+        data.AddMember("aircraft", static_cast<uint64>(overflights.size()), document.GetAllocator());
+        if(!overflights.empty())
+            data.AddMember("min_altitude", min_altitude, document.GetAllocator());
+
+        rapidjson::Value buckets(rapidjson::kArrayType);
+        for(size_t i = 0; i < bounds.size(); i++)
+        {
+            rapidjson::Value bucket(rapidjson::kObjectType);
+            bucket.AddMember("max_distance", bounds[i], document.GetAllocator());
+            bucket.AddMember("aircraft", bucket_counts[i], document.GetAllocator());
+            buckets.PushBack(bucket, document.GetAllocator());
+        }
+        data.AddMember("distance_buckets", buckets, document.GetAllocator());
+        data.AddMember("rollup_begin", covered_begin, document.GetAllocator());
+        data.AddMember("rollup_end", covered_end, document.GetAllocator());
+        data.AddMember("raw_snapshots", static_cast<uint64>(raw_rows), document.GetAllocator());
+        data.AddMember("ms", timer.getMillis().count(), document.GetAllocator());
+        document.AddMember("data", data, document.GetAllocator());
+
+        // Serialize the response
+        rapidjson::StringBuffer buffer;
+        rapidjson::PrettyWriter<rapidjson::StringBuffer> writer(buffer);
+        writer.SetMaxDecimalPlaces(4);
+        document.Accept(writer);
+
+        RestResponse response;
+        response.mData = buffer.GetString();
+        response.mContentType = rest::contenttypes::json;
+
+        return response;
+    }
+}
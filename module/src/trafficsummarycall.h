@@ -0,0 +1,33 @@
+#pragma once
+
+#include <restfunction.h>
+
+#include "fetchflightscall.h"
+#include "trafficrollups.h"
+#include "metrics.h"
+
+namespace nap
+{
+    /**
+     * TrafficSummaryCall is a RestFunction that summarizes the traffic around a location over long periods, up to months.
+     * Whole hours and days are answered from the traffic rollups, only the edges of the period and the part that isn't rolled up
+     * yet are read from the raw history using the planner of the fetch flights call.
+     * Rolled up traffic is located by the center of its cell, distances are therefore approximate up to half the cell size.
+     */
+    class NAPAPI TrafficSummaryCall : public RestFunction
+    {
+    RTTI_ENABLE(RestFunction)
+    public:
+        bool init(utility::ErrorState &errorState) final;
+
+        RestResponse call(const RestValueMap &values) override;
+
+        ResourcePtr<FetchFlightsCall> mFetchFlightsCall; ///< Property "FetchFlightsCall" : Resolves the location and reads the raw history
+        ResourcePtr<TrafficRollups> mTrafficRollups; ///< Property "TrafficRollups" : Hourly and daily traffic aggregates
+        int mMaxDurationDays = 366; ///< Property "MaxDurationDays" : Maximum duration in days to summarize
+        std::vector<float> mDistanceBuckets = { 1000.0f, 2000.0f, 5000.0f }; ///< Property "DistanceBuckets" : Upper bounds in meters of the distance buckets, the radius is the last bound. Not below the accuracy of the rollups, half the diagonal of a cell
+        ResourcePtr<Metrics> mMetrics; ///< Property "Metrics" : Optional metrics the request duration is reported in
+    private:
+        Metrics::Histogram* mRequestDuration = nullptr;
+    };
+}
@@ -1,22 +1,173 @@
 #include "utils.h"
-#include <iomanip>
+#include <algorithm>
+#include <ctime>
 
 namespace nap
 {
     namespace utility
     {
-        bool dateTimeFromUINT64(uint64 timestamp, DateTime& dt, utility::ErrorState errorState)
+        /**
+         * Days since 1970-01-01 of a date in the proleptic Gregorian calendar
+         */
+        static int64 daysFromCivil(int64 year, int64 month, int64 day)
         {
+            year -= month <= 2 ? 1 : 0;
+            int64 era = (year >= 0 ? year : year - 399) / 400;
+            int64 year_of_era = year - era * 400;
+            int64 day_of_year = (153 * (month > 2 ? month - 3 : month + 9) + 2) / 5 + day - 1;
+            int64 day_of_era = year_of_era * 365 + year_of_era / 4 - year_of_era / 100 + day_of_year;
+            return era * 146097 + day_of_era - 719468;
+        }
+
+
+        static void civilFromDays(int64 days, int64& year, int64& month, int64& day)
+        {
+            days += 719468;
+            int64 era = (days >= 0 ? days : days - 146096) / 146097;
+            int64 day_of_era = days - era * 146097;
+            int64 year_of_era = (day_of_era - day_of_era / 1460 + day_of_era / 36524 - day_of_era / 146096) / 365;
+            int64 day_of_year = day_of_era - (365 * year_of_era + year_of_era / 4 - year_of_era / 100);
+            int64 month_index = (5 * day_of_year + 2) / 153;
+            day = day_of_year - (153 * month_index + 2) / 5 + 1;
+            month = month_index < 10 ? month_index + 3 : month_index - 9;
+            year = year_of_era + era * 400 + (month <= 2 ? 1 : 0);
+        }
+
+
+        /**
+         * Timestamps are the local date and time of the moment, so arithmetic on them is done on the date and time
+         * fields as if they were UTC. Every day has 24 hours, the local time zone and daylight saving time never shift the result
+         * @return the seconds since 1970-01-01 00:00:00 of the date and time fields of the timestamp
+         */
+        static bool toFieldSeconds(uint64 timestamp, int64& seconds, utility::ErrorState& errorState)
+        {
+            int64 year = static_cast<int64>(timestamp / 10000000000ull);
+            int64 month = static_cast<int64>(timestamp / 100000000ull % 100);
+            int64 day = static_cast<int64>(timestamp / 1000000ull % 100);
+            int64 hour = static_cast<int64>(timestamp / 10000ull % 100);
+            int64 minute = static_cast<int64>(timestamp / 100ull % 100);
+            int64 second = static_cast<int64>(timestamp % 100);
+
+            // The last day of the month is the day before the first of the next month
+            bool valid = year >= 1970 && year <= 9999 && month >= 1 && month <= 12 && day >= 1 && hour < 24 && minute < 60 && second < 60;
+            if(valid)
+                valid = day <= daysFromCivil(month == 12 ? year + 1 : year, month == 12 ? 1 : month + 1, 1) - daysFromCivil(year, month, 1);
+            if(!errorState.check(valid, "Invalid timestamp %s", std::to_string(timestamp).c_str()))
+                return false;
+
+            seconds = ((daysFromCivil(year, month, day) * 24 + hour) * 60 + minute) * 60 + second;
+            return true;
+        }
+
+
+        static uint64 fromFieldSeconds(int64 seconds)
+        {
+            int64 days = (seconds >= 0 ? seconds : seconds - 86399) / 86400;
+            int64 time = seconds - days * 86400;
+            int64 year, month, day;
+            civilFromDays(days, year, month, day);
+            return static_cast<uint64>(year) * 10000000000ull + static_cast<uint64>(month) * 100000000ull + static_cast<uint64>(day) * 1000000ull +
+                   static_cast<uint64>(time / 3600) * 10000ull + static_cast<uint64>(time / 60 % 60) * 100ull + static_cast<uint64>(time % 60);
+        }
+
+
+        bool dateTimeFromUINT64(uint64 timestamp, DateTime& dt, utility::ErrorState& errorState)
+        {
+            int64 seconds = 0;
+            if(!toFieldSeconds(timestamp, seconds, errorState))
+                return false;
+
+            // The timestamp is local time, mktime decides whether daylight saving time applies
             std::tm t{};
-            std::istringstream ss(std::to_string(timestamp));
+            t.tm_year = static_cast<int>(timestamp / 10000000000ull) - 1900;
+            t.tm_mon = static_cast<int>(timestamp / 100000000ull % 100) - 1;
+            t.tm_mday = static_cast<int>(timestamp / 1000000ull % 100);
+            t.tm_hour = static_cast<int>(timestamp / 10000ull % 100);
+            t.tm_min = static_cast<int>(timestamp / 100ull % 100);
+            t.tm_sec = static_cast<int>(timestamp % 100);
+            t.tm_isdst = -1;
+            std::time_t time = mktime(&t);
+            if(!errorState.check(time != -1, "Failed to convert timestamp %s to local time", std::to_string(timestamp).c_str()))
+                return false;
+
+            dt = DateTime(std::chrono::system_clock::from_time_t(time));
+            return true;
+        }
+
+
+        uint64 uint64FromDateTime(const DateTime& dt)
+        {
+            return std::stoull(utility::stringFormat("%d%02d%02d%02d%02d%02d",
+                                                     dt.getYear(), dt.getMonth(), dt.getDayInTheMonth(),
+                                                     dt.getHour(), dt.getMinute(), dt.getSecond()));
+        }
 
-            ss >> std::get_time(&t, "%Y%m%d%H%M%S");
-            if(!errorState.check(!ss.fail(), "failed to parse time string"))
+
+        bool splitTimeRange(uint64 begin, uint64 end, int count, std::chrono::minutes minDuration,
+                            std::vector<std::pair<uint64, uint64>>& ranges, utility::ErrorState& errorState)
+        {
+            if(end <= begin + 1)
+                return true;
+
+            int64 begin_seconds = 0;
+            if(!toFieldSeconds(begin, begin_seconds, errorState))
+                return false;
+
+            int64 end_seconds = 0;
+            if(!toFieldSeconds(end, end_seconds, errorState))
                 return false;
 
-            dt = DateTime(std::chrono::system_clock::from_time_t(mktime(&t)));
+            // Timestamps are integers, so the last timestamp before end is end - 1
+            int64 duration = std::max<int64>((end_seconds - begin_seconds) / std::max(count, 1),
+                                             std::chrono::duration_cast<std::chrono::seconds>(minDuration).count());
+            duration = std::max<int64>(duration, 1);
+            uint64 range_begin = begin;
+            for(int64 time = begin_seconds + duration; range_begin < end - 1; time += duration)
+            {
+                uint64 range_end = std::clamp(fromFieldSeconds(time), range_begin, end - 1);
+                ranges.emplace_back(range_begin, range_end);
+                range_begin = range_end;
+            }
+
+            return true;
+        }
+
+
+        bool subtractFromTimeStamp(uint64 timestamp, SystemClock::duration duration, uint64& result, utility::ErrorState& errorState)
+        {
+            int64 seconds = 0;
+            if(!toFieldSeconds(timestamp, seconds, errorState))
+                return false;
+
+            result = fromFieldSeconds(seconds - std::chrono::duration_cast<std::chrono::seconds>(duration).count());
+            return true;
+        }
+
+
+        bool addToTimeStamp(uint64 timestamp, SystemClock::duration duration, uint64& result, utility::ErrorState& errorState)
+        {
+            return subtractFromTimeStamp(timestamp, -duration, result, errorState);
+        }
+
+
+        bool getSnapshotRange(uint64 periodBegin, uint64 periodEnd, uint64& begin, uint64& end, utility::ErrorState& errorState)
+        {
+            return subtractFromTimeStamp(periodBegin, std::chrono::seconds(1), begin, errorState) &&
+                   subtractFromTimeStamp(periodEnd, std::chrono::seconds(1), end, errorState);
+        }
+
+
+        bool nextPeriod(uint64 period, uint64 unit, uint64& next, utility::ErrorState& errorState)
+        {
+            if(!errorState.check(unit == 10000 || unit == 1000000, "Periods are hours or days"))
+                return false;
+
+            int64 seconds = 0;
+            if(!toFieldSeconds(period - period % unit, seconds, errorState))
+                return false;
 
+            next = fromFieldSeconds(seconds + (unit == 10000 ? 3600 : 86400));
             return true;
         }
     }
-}
\ No newline at end of file
+}
@@ -7,6 +7,80 @@ namespace nap
 {
     namespace utility
     {
-        bool NAPAPI dateTimeFromUINT64(uint64 timestamp, DateTime& dt, utility::ErrorState errorState);
+        /**
+         * Converts a timestamp in uint64 YYYYMMDDHHMMSS, the local date and time, into the moment it represents
+         * A time that occurs twice when daylight saving time ends is one of both moments
+         * @param timestamp the timestamp in uint64 YYYYMMDDHHMMSS
+         * @param dt the resulting date time
+         * @param errorState the error state to store errors in
+         * @return false if the timestamp isn't a valid date and time
+         */
+        bool NAPAPI dateTimeFromUINT64(uint64 timestamp, DateTime& dt, utility::ErrorState& errorState);
+
+        /**
+         * Converts a date time into a timestamp in uint64 YYYYMMDDHHMMSS
+         * @param dt the date time to convert
+         * @return timestamp in uint64 YYYYMMDDHHMMSS
+         */
+        uint64 NAPAPI uint64FromDateTime(const DateTime& dt);
+
+        // Arithmetic on timestamps is done on their date and time fields, every day has 24 hours. A timestamp that
+        // doesn't exist locally because daylight saving time starts can be the result, it simply never holds data
+
+        /**
+         * Splits the time range (begin, end) into at most count consecutive ranges of at least minDuration
+         * The resulting ranges are (begin, end], the last one ends at the last timestamp before end
+         * @param begin the begin timestamp in uint64 YYYYMMDDHHMMSS, exclusive
+         * @param end the end timestamp in uint64 YYYYMMDDHHMMSS, exclusive
+         * @param count maximum number of ranges
+         * @param minDuration minimum duration of a range
+         * @param ranges the resulting ranges, ordered by time
+         * @param errorState the error state to store errors in
+         * @return true if the timestamps could be parsed
+         */
+        bool NAPAPI splitTimeRange(uint64 begin, uint64 end, int count, std::chrono::minutes minDuration,
+                                   std::vector<std::pair<uint64, uint64>>& ranges, utility::ErrorState& errorState);
+
+        /**
+         * Moves a timestamp back in time
+         * @param timestamp the timestamp in uint64 YYYYMMDDHHMMSS
+         * @param duration the duration to move back
+         * @param result the resulting timestamp in uint64 YYYYMMDDHHMMSS
+         * @param errorState the error state to store errors in
+         * @return true if the timestamp could be parsed
+         */
+        bool NAPAPI subtractFromTimeStamp(uint64 timestamp, SystemClock::duration duration, uint64& result, utility::ErrorState& errorState);
+
+        /**
+         * Moves a timestamp forward in time
+         * @param timestamp the timestamp in uint64 YYYYMMDDHHMMSS
+         * @param duration the duration to move forward
+         * @param result the resulting timestamp in uint64 YYYYMMDDHHMMSS
+         * @param errorState the error state to store errors in
+         * @return true if the timestamp could be parsed
+         */
+        bool NAPAPI addToTimeStamp(uint64 timestamp, SystemClock::duration duration, uint64& result, utility::ErrorState& errorState);
+
+        /**
+         * Get the range of snapshot timestamps of a period, snapshot ranges exclude their begin and include their end
+         * @param periodBegin the first timestamp of the period in uint64 YYYYMMDDHHMMSS
+         * @param periodEnd the first timestamp after the period in uint64 YYYYMMDDHHMMSS
+         * @param begin the begin of the snapshot range in uint64 YYYYMMDDHHMMSS, exclusive
+         * @param end the end of the snapshot range in uint64 YYYYMMDDHHMMSS, inclusive
+         * @param errorState the error state to store errors in
+         * @return true if the timestamps could be parsed
+         */
+        bool NAPAPI getSnapshotRange(uint64 periodBegin, uint64 periodEnd, uint64& begin, uint64& end, utility::ErrorState& errorState);
+
+        /**
+         * Get the start of the hour or day after the given one, in the date and time fields of the timestamps
+         * Consecutive periods are contiguous and don't overlap, also on the days daylight saving time starts or ends
+         * @param period the start of an hour or day in uint64 YYYYMMDDHHMMSS
+         * @param unit the length of the period in uint64 YYYYMMDDHHMMSS units, 10000 for an hour or 1000000 for a day
+         * @param next the start of the next period in uint64 YYYYMMDDHHMMSS
+         * @param errorState the error state to store errors in
+         * @return true if the timestamp could be parsed
+         */
+        bool NAPAPI nextPeriod(uint64 period, uint64 unit, uint64& next, utility::ErrorState& errorState);
     }
-}
\ No newline at end of file
+}
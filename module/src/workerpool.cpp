@@ -0,0 +1,150 @@
+#include "workerpool.h"
+#include "trace.h"
+
+RTTI_BEGIN_CLASS(nap::WorkerPool)
+    RTTI_PROPERTY("NumThreads", &nap::WorkerPool::mNumThreads, nap::rtti::EPropertyMetaData::Default)
+RTTI_END_CLASS
+
+namespace nap
+{
+    WorkerPool::~WorkerPool()
+    {
+        {
+            std::lock_guard<std::mutex> lock(mWakeMutex);
+            mStop = true;
+        }
+        mWakeCondition.notify_all();
+
+        for(auto& thread : mThreads)
+            thread.join();
+    }
+
+
+    bool WorkerPool::init(utility::ErrorState &errorState)
+    {
+        if(!errorState.check(mNumThreads >= 0, "NumThreads must be 0 or greater"))
+            return false;
+
+        size_t thread_count = mNumThreads > 0 ? mNumThreads : std::max<size_t>(1, std::thread::hardware_concurrency());
+        for(size_t i = 0; i < thread_count; i++)
+            mQueues.emplace_back(std::make_unique<Queue>());
+
+        for(size_t i = 0; i < thread_count; i++)
+            mThreads.emplace_back([this, i](){ run(i); });
+
+        return true;
+    }
+
+
+    void WorkerPool::enqueue(Task task)
+    {
+        {
+            std::lock_guard<std::mutex> lock(mWakeMutex);
+            mPendingTasks++;
+        }
+
+        auto& queue = *mQueues[mNextQueue++ % mQueues.size()];
+        {
+            std::lock_guard<std::mutex> lock(queue.mMutex);
+            queue.mTasks.emplace_back(std::move(task));
+        }
+        mWakeCondition.notify_one();
+    }
+
+
+    void WorkerPool::parallelFor(size_t count, const std::function<void(size_t)>& task)
+    {
+        if(count == 0)
+            return;
+
+        // Shared between the tasks and the caller, tasks can still be notifying after the caller stops waiting
+        struct State
+        {
+            std::mutex mMutex;
+            std::condition_variable mCondition;
+            size_t mRemaining;
+        };
+        auto state = std::make_shared<State>();
+        state->mRemaining = count;
+
+        for(size_t i = 0; i < count; i++)
+        {
+            enqueue([state, &task, i]()
+            {
+                task(i);
+                std::lock_guard<std::mutex> lock(state->mMutex);
+                state->mRemaining--;
+                state->mCondition.notify_all();
+            });
+        }
+
+        // Help out until all tasks are done
+        while(true)
+        {
+            {
+                std::lock_guard<std::mutex> lock(state->mMutex);
+                if(state->mRemaining == 0)
+                    return;
+            }
+
+            if(!tryRunTask(0))
+            {
+                // Everything is taken, wait for the remaining tasks to finish
+                std::unique_lock<std::mutex> lock(state->mMutex);
+                state->mCondition.wait(lock, [&state](){ return state->mRemaining == 0; });
+                return;
+            }
+        }
+    }
+
+
+    void WorkerPool::run(size_t workerIndex)
+    {
+        TRACE_THREAD_NAME("worker " + std::to_string(workerIndex));
+        while(true)
+        {
+            if(tryRunTask(workerIndex))
+                continue;
+
+            std::unique_lock<std::mutex> lock(mWakeMutex);
+            mWakeCondition.wait(lock, [this](){ return mStop || mPendingTasks.load() > 0; });
+            if(mStop && mPendingTasks.load() == 0)
+                return;
+        }
+    }
+
+
+    bool WorkerPool::tryRunTask(size_t workerIndex)
+    {
+        // Take from the front of our own queue, steal from the back of the others
+        for(size_t i = 0; i < mQueues.size(); i++)
+        {
+            Task task;
+            auto& queue = *mQueues[(workerIndex + i) % mQueues.size()];
+            {
+                std::lock_guard<std::mutex> lock(queue.mMutex);
+                if(queue.mTasks.empty())
+                    continue;
+
+                if(i == 0)
+                {
+                    task = std::move(queue.mTasks.front());
+                    queue.mTasks.pop_front();
+                }else
+                {
+                    task = std::move(queue.mTasks.back());
+                    queue.mTasks.pop_back();
+                }
+                mPendingTasks--;
+            }
+
+            {
+                TRACE_ZONE("WorkerPool::task");
+                task();
+            }
+            return true;
+        }
+
+        return false;
+    }
+}
@@ -0,0 +1,73 @@
+#pragma once
+
+#include <nap/resource.h>
+#include <thread>
+#include <deque>
+#include <condition_variable>
+
+namespace nap
+{
+    /**
+     * A pool of worker threads that execute tasks
+     * Every worker owns a task queue, tasks are distributed round robin over the queues.
+     * An idle worker takes tasks from the front of its own queue and steals from the back of the others,
+     * so uneven tasks (like a busy hour next to a quiet night) don't leave workers idle.
+     * The pool is thread safe
+     */
+    class NAPAPI WorkerPool : public Resource
+    {
+    RTTI_ENABLE(Resource)
+    public:
+        using Task = std::function<void()>;
+
+        /**
+         * Destructor, stops all workers after they finished their current task
+         */
+        ~WorkerPool() override;
+
+        /**
+         * Starts the worker threads
+         * @param errorState the error state to store errors in
+         * @return true if the pool was initialized
+         */
+        bool init(utility::ErrorState &errorState) final;
+
+        /**
+         * Enqueue a task, thread safe
+         * @param task the task to execute on one of the workers
+         */
+        void enqueue(Task task);
+
+        /**
+         * Execute task(index) for every index in [0, count) and block until all are done, thread safe
+         * The calling thread helps executing tasks while waiting, so it is safe to call from a worker
+         * @param count number of tasks
+         * @param task the task to execute, receives the index of the task
+         */
+        void parallelFor(size_t count, const std::function<void(size_t)>& task);
+
+        /**
+         * @return the number of worker threads
+         */
+        int getThreadCount() const { return static_cast<int>(mThreads.size()); }
+
+        int mNumThreads = 0; ///< Property: "NumThreads" - Number of worker threads, 0 uses the number of hardware threads
+    private:
+        struct Queue
+        {
+            std::mutex mMutex;
+            std::deque<Task> mTasks;
+        };
+
+        void run(size_t workerIndex);
+        bool tryRunTask(size_t workerIndex);
+
+        std::vector<std::thread> mThreads;
+        std::vector<std::unique_ptr<Queue>> mQueues;
+        std::atomic<size_t> mNextQueue = { 0 };
+        std::atomic<size_t> mPendingTasks = { 0 };
+        std::mutex mWakeMutex;
+        std::condition_variable mWakeCondition;
+        bool mStop = false;
+    };
+}
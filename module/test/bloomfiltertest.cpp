@@ -0,0 +1,71 @@
+#include "testcheck.h"
+
+#include <bloomfilter.h>
+#include <flightstate.h>
+#include <utility/stringutils.h>
+
+using namespace nap;
+
+// Identifiers as the logger stores them, hex addresses and callsigns
+static std::vector<uint64> createAircraft(int count, int offset)
+{
+    std::vector<uint64> aircraft;
+    for(int i = 0; i < count; i++)
+    {
+        std::string icao = i % 2 == 0 ? utility::stringFormat("%06X", 0x480000 + offset + i) : utility::stringFormat("KLM%d", offset + i);
+        aircraft.emplace_back(parseICAO(icao.c_str()));
+    }
+    return aircraft;
+}
+
+
+static void testNoFalseNegatives()
+{
+    for(int count : { 0, 1, 10, 500, 5000 })
+    {
+        auto aircraft = createAircraft(count, 0);
+        BloomFilter filter(aircraft.size(), 10);
+        for(uint64 icao : aircraft)
+            filter.add(formatICAO(icao));
+
+        int missing = 0;
+        for(uint64 icao : aircraft)
+            missing += filter.mayContain(formatICAO(icao)) ? 0 : 1;
+        TEST_CHECK(missing == 0);
+
+        // A filter restored from its stored bits gives the same answers
+        BloomFilter restored(filter.getBits(), filter.getHashes());
+        missing = 0;
+        for(uint64 icao : aircraft)
+            missing += restored.mayContain(formatICAO(icao)) ? 0 : 1;
+        TEST_CHECK(missing == 0);
+    }
+}
+
+
+static void testFalsePositives()
+{
+    // About 1% at 10 bits per key
+    auto aircraft = createAircraft(5000, 0);
+    BloomFilter filter(aircraft.size(), 10);
+    for(uint64 icao : aircraft)
+        filter.add(formatICAO(icao));
+
+    int false_positives = 0;
+    auto others = createAircraft(10000, 100000);
+    for(uint64 icao : others)
+        false_positives += filter.mayContain(formatICAO(icao)) ? 1 : 0;
+    TEST_CHECK(false_positives < 300);
+
+    // An empty hour contains nothing
+    BloomFilter empty(0, 10);
+    TEST_CHECK(!empty.mayContain(formatICAO(aircraft.front())));
+}
+
+
+int main()
+{
+    testNoFalseNegatives();
+    testFalsePositives();
+    return test::result();
+}
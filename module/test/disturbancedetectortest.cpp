@@ -0,0 +1,140 @@
+#include "testcheck.h"
+
+#include <disturbancedetector.h>
+#include <cstdlib>
+#include <ctime>
+
+using namespace nap;
+
+static void setTimeZone(const char* zone)
+{
+#ifdef _WIN32
+    _putenv_s("TZ", zone);
+    _tzset();
+#else
+    setenv("TZ", zone, 1);
+    tzset();
+#endif
+}
+
+
+static uint64 at(int hour, int minute)
+{
+    return 20260612000000ull + static_cast<uint64>(hour) * 10000 + static_cast<uint64>(minute) * 100;
+}
+
+
+static void addFlights(DisturbanceDetector& detector, const std::vector<uint64>& timestamps)
+{
+    utility::ErrorState error_state;
+    for(auto timestamp : timestamps)
+        TEST_CHECK(detector.addFlight(timestamp, error_state));
+}
+
+
+static void testPeriods()
+{
+    // A burst of seven flights, one that is too short and a flight on its own
+    DisturbanceDetector detector(10, 3);
+    addFlights(detector, { at(12, 0), at(12, 5), at(12, 10), at(12, 15), at(12, 20), at(12, 25), at(12, 30),
+                           at(13, 0), at(13, 5), at(13, 12), at(14, 0) });
+    detector.finish();
+
+    std::vector<DisturbancePeriod> periods;
+    detector.takePeriods(periods);
+    TEST_CHECK(periods.size() == 1);
+    if(periods.size() != 1)
+        return;
+
+    TEST_CHECK(periods[0].mBegin == at(12, 0));
+    TEST_CHECK(periods[0].mEnd == at(12, 30));
+    TEST_CHECK(periods[0].mFirst == 0);
+    TEST_CHECK(periods[0].mOccurrences == 7);
+    TEST_CHECK(detector.getFlightCount() == 11);
+
+    // Taken periods are moved out of the detector
+    periods.clear();
+    detector.takePeriods(periods);
+    TEST_CHECK(periods.empty());
+}
+
+
+static void testFirstFlight()
+{
+    // Periods refer to the flights in the order they were added
+    DisturbanceDetector detector(10, 2);
+    addFlights(detector, { at(8, 0), at(9, 0), at(9, 1), at(9, 2), at(10, 0), at(10, 30), at(10, 31), at(10, 32) });
+    detector.finish();
+
+    std::vector<DisturbancePeriod> periods;
+    detector.takePeriods(periods);
+    TEST_CHECK(periods.size() == 2);
+    if(periods.size() != 2)
+        return;
+
+    TEST_CHECK(periods[0].mFirst == 1 && periods[0].mOccurrences == 3);
+    TEST_CHECK(periods[0].mBegin == at(9, 0) && periods[0].mEnd == at(9, 2));
+    TEST_CHECK(periods[1].mFirst == 5 && periods[1].mOccurrences == 3);
+    TEST_CHECK(periods[1].mBegin == at(10, 30) && periods[1].mEnd == at(10, 32));
+}
+
+
+static void testAdvance()
+{
+    utility::ErrorState error_state;
+    DisturbanceDetector detector(10, 3);
+    addFlights(detector, { at(14, 0), at(14, 1), at(14, 2), at(14, 3) });
+    TEST_CHECK(detector.isDisturbed());
+    TEST_CHECK(detector.getCurrentBegin() == at(14, 0));
+    TEST_CHECK(detector.getCurrentOccurrences() == 4);
+    TEST_CHECK(detector.getFirstPending() == 0);
+
+    // The period stays open while a next flight can still extend it
+    TEST_CHECK(detector.advance(at(14, 12), error_state));
+    TEST_CHECK(detector.isDisturbed());
+
+    std::vector<DisturbancePeriod> periods;
+    detector.takePeriods(periods);
+    TEST_CHECK(periods.empty());
+
+    // And is registered once it can't
+    TEST_CHECK(detector.advance(at(14, 13), error_state));
+    TEST_CHECK(!detector.isDisturbed());
+    detector.takePeriods(periods);
+    TEST_CHECK(periods.size() == 1 && periods[0].mOccurrences == 4 && periods[0].mEnd == at(14, 3));
+
+    // Only the last flight can start a new period
+    TEST_CHECK(detector.getFirstPending() == 3);
+
+    // Finishing doesn't register the period twice
+    detector.finish();
+    periods.clear();
+    detector.takePeriods(periods);
+    TEST_CHECK(periods.empty());
+}
+
+
+static void testDaylightSaving()
+{
+    // 01:55 and 03:05 are ten minutes apart on the night the clocks go forward
+    DisturbanceDetector detector(15, 2);
+    addFlights(detector, { 20260329015500ull, 20260329030500ull, 20260329031000ull });
+    TEST_CHECK(detector.isDisturbed());
+    TEST_CHECK(detector.getCurrentBegin() == 20260329015500ull);
+
+    // Timestamps that aren't a date are reported
+    utility::ErrorState error_state;
+    TEST_CHECK(!detector.addFlight(20260332120000ull, error_state));
+    TEST_CHECK(detector.getFlightCount() == 3);
+}
+
+
+int main()
+{
+    setTimeZone("Europe/Amsterdam");
+    testPeriods();
+    testFirstFlight();
+    testAdvance();
+    testDaylightSaving();
+    return test::result();
+}
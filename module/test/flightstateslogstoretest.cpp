@@ -0,0 +1,144 @@
+#include "testcheck.h"
+
+#include <flightstateslogstore.h>
+#include <filesystem>
+#include <fstream>
+
+using namespace nap;
+
+// Every row is its timestamp, the size of its data and the data
+static constexpr uint64 sRowHeaderSize = sizeof(uint64) + sizeof(uint32);
+
+static uint64 at(int hour, int minute, int second)
+{
+    return 20260101000000ull + static_cast<uint64>(hour) * 10000 + static_cast<uint64>(minute) * 100 + static_cast<uint64>(second);
+}
+
+
+static std::string rowData(uint64 timestamp)
+{
+    return "row" + std::to_string(timestamp);
+}
+
+
+static bool addRow(LogFlightStatesStore& store, uint64 timestamp)
+{
+    utility::ErrorState error_state;
+    FlightStatesData data;
+    data.mTimeStamp = timestamp;
+    data.mData = rowData(timestamp);
+    return store.add(data, error_state);
+}
+
+
+static size_t queryRows(LogFlightStatesStore& store, uint64 begin, uint64 end, std::vector<std::unique_ptr<FlightStatesData>>& rows)
+{
+    utility::ErrorState error_state;
+    rows.clear();
+    TEST_CHECK(store.query(begin, end, rows, error_state));
+    for(size_t i = 0; i < rows.size(); i++)
+    {
+        TEST_CHECK(rows[i]->mData == rowData(rows[i]->mTimeStamp));
+        TEST_CHECK(rows[i]->mTimeStamp > begin && rows[i]->mTimeStamp <= end);
+        TEST_CHECK(i == 0 || rows[i]->mTimeStamp > rows[i - 1]->mTimeStamp);
+    }
+    return rows.size();
+}
+
+
+/**
+ * Fills three hours of 15 minute segments with a row every 10 seconds, 90 rows per segment
+ */
+static void fill(const std::string& directory)
+{
+    LogFlightStatesStore store(directory, 15);
+    utility::ErrorState error_state;
+    TEST_CHECK(store.init(error_state));
+    for(int hour = 0; hour < 3; hour++)
+        for(int minute = 0; minute < 60; minute++)
+            for(int second = 0; second < 60; second += 10)
+                TEST_CHECK(addRow(store, at(hour, minute, second)));
+
+    // Ranges start after begin and include end, across segment boundaries
+    std::vector<std::unique_ptr<FlightStatesData>> rows;
+    TEST_CHECK(queryRows(store, at(0, 14, 50), at(1, 30, 0), rows) == 1 + 75 * 6);
+    TEST_CHECK(queryRows(store, at(1, 0, 5), at(1, 0, 9), rows) == 0);
+
+    // Rows must be added in time order
+    TEST_CHECK(!addRow(store, at(1, 0, 0)));
+}
+
+
+static void testPartialHeader(const std::string& directory)
+{
+    fill(directory);
+    {
+        std::ofstream segment(directory + "/20260101024500.log", std::ios::binary | std::ios::app);
+        uint64 timestamp = at(2, 59, 59);
+        segment.write(reinterpret_cast<const char*>(&timestamp), 5);
+    }
+
+    LogFlightStatesStore store(directory, 15);
+    utility::ErrorState error_state;
+    TEST_CHECK(store.init(error_state));
+    TEST_CHECK(std::filesystem::file_size(directory + "/20260101024500.log") == 90 * (sRowHeaderSize + rowData(at(2, 45, 0)).size()));
+
+    // The partial row is gone and the next row follows the last complete one
+    std::vector<std::unique_ptr<FlightStatesData>> rows;
+    TEST_CHECK(addRow(store, at(2, 59, 55)));
+    TEST_CHECK(queryRows(store, at(2, 59, 40), at(3, 0, 0), rows) == 2);
+    TEST_CHECK(queryRows(store, 0, at(9, 0, 0), rows) == 3 * 60 * 6 + 1);
+}
+
+
+static void testPartialData(const std::string& directory)
+{
+    fill(directory);
+
+    // Cut the newest segment in the data of its 64th row, the index entry of the 65th row points past the end
+    uint64 row_size = sRowHeaderSize + rowData(at(2, 45, 0)).size();
+    std::string path = directory + "/20260101024500.log";
+    std::filesystem::resize_file(path, 63 * row_size + sRowHeaderSize + 3);
+
+    LogFlightStatesStore store(directory, 15);
+    utility::ErrorState error_state;
+    TEST_CHECK(store.init(error_state));
+    TEST_CHECK(std::filesystem::file_size(path) == 63 * row_size);
+
+    // Only the index entry of the first row remains, an entry is a timestamp and an offset
+    TEST_CHECK(std::filesystem::file_size(directory + "/20260101024500.idx") == 2 * sizeof(uint64));
+
+    // Rows before the cut remain, new rows append behind them
+    std::vector<std::unique_ptr<FlightStatesData>> rows;
+    TEST_CHECK(queryRows(store, at(2, 44, 50), at(3, 0, 0), rows) == 63);
+    TEST_CHECK(rows.back()->mTimeStamp == at(2, 55, 20));
+    for(int second = 30; second < 60; second += 10)
+        TEST_CHECK(addRow(store, at(2, 55, second)));
+    TEST_CHECK(queryRows(store, at(2, 44, 50), at(3, 0, 0), rows) == 66);
+    TEST_CHECK(queryRows(store, at(2, 55, 0), at(2, 55, 40), rows) == 4);
+
+    // Retention removes whole segments before the segment of the timestamp
+    TEST_CHECK(store.removeOlderThan(at(1, 20, 0), error_state));
+    TEST_CHECK(queryRows(store, 0, at(9, 0, 0), rows) > 0);
+    TEST_CHECK(rows.front()->mTimeStamp == at(1, 15, 0));
+    TEST_CHECK(!std::filesystem::exists(directory + "/20260101010000.log"));
+
+    TEST_CHECK(store.clear(error_state));
+    TEST_CHECK(queryRows(store, 0, at(9, 0, 0), rows) == 0);
+}
+
+
+int main()
+{
+    std::error_code error;
+    auto directory = (std::filesystem::temp_directory_path() / "flightstateslogstoretest").string();
+
+    std::filesystem::remove_all(directory, error);
+    testPartialHeader(directory);
+
+    std::filesystem::remove_all(directory, error);
+    testPartialData(directory);
+
+    std::filesystem::remove_all(directory, error);
+    return test::result();
+}
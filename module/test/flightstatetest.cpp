@@ -0,0 +1,184 @@
+#include "testcheck.h"
+
+#include <flightstate.h>
+#include <algorithm>
+#include <random>
+
+using namespace nap;
+
+static std::vector<std::string> createIdentifiers(std::mt19937& random, int count)
+{
+    // Hex addresses, callsigns and the occasional identifier that doesn't fit a key
+    const char* alphabet = "0123456789ABCDEFKLMXYZ";
+    std::vector<std::string> identifiers;
+    for(int i = 0; i < count; i++)
+    {
+        std::string identifier;
+        int length = i % 50 == 0 ? 9 + random() % 8 : 1 + random() % 8;
+        for(int j = 0; j < length; j++)
+            identifier += alphabet[random() % 22];
+        identifiers.emplace_back(identifier);
+    }
+    return identifiers;
+}
+
+
+static void testICAO()
+{
+    std::mt19937 random(1);
+    auto identifiers = createIdentifiers(random, 2000);
+    for(const auto& identifier : identifiers)
+    {
+        uint64 key = parseICAO(identifier.c_str());
+        TEST_CHECK(key != 0);
+        TEST_CHECK(formatICAO(key) == identifier);
+    }
+
+    // Keys that are packed compare like their identifiers
+    for(size_t i = 0; i < identifiers.size(); i++)
+    {
+        const auto& a = identifiers[i];
+        const auto& b = identifiers[(i * 7 + 3) % identifiers.size()];
+        if(a.size() <= kMaxICAOLength && b.size() <= kMaxICAOLength)
+            TEST_CHECK((a < b) == (parseICAO(a.c_str()) < parseICAO(b.c_str())));
+    }
+
+    // Identifiers that don't fit keep their own key
+    TEST_CHECK(parseICAO("") == 0 && formatICAO(0).empty());
+    TEST_CHECK(parseICAO("KLM1234567") != parseICAO("KLM1234568"));
+    TEST_CHECK(parseICAO("KLM1234567") == parseICAO("KLM1234567"));
+    TEST_CHECK(formatICAO(parseICAO("KLM1234567")) == "KLM1234567");
+
+    // Looking up a key doesn't remember the identifier
+    TEST_CHECK(findICAO("484F6D") == parseICAO("484F6D"));
+    uint64 unseen = findICAO("TRANSAVIA42");
+    TEST_CHECK(unseen != 0 && formatICAO(unseen).empty());
+    TEST_CHECK(parseICAO("TRANSAVIA42") == unseen && formatICAO(unseen) == "TRANSAVIA42");
+}
+
+
+static std::vector<FlightState> createSnapshot(std::mt19937& random, const std::vector<std::string>& identifiers)
+{
+    std::vector<FlightState> states;
+    for(const auto& identifier : identifiers)
+    {
+        if(random() % 10 == 0)
+            continue;
+
+        FlightState state;
+        state.mICAO = random() % 20 == 0 ? 0 : parseICAO(identifier.c_str());
+        state.mRegistration = random() % 50 == 0 ? "PH-BXA" : "PH-BXB";
+        state.mAircraftType = "B738";
+        state.mLatitude = 52.0f + static_cast<float>(random() % 100) * 0.01f;
+        state.mLongitude = 4.0f + static_cast<float>(random() % 1000) * 0.001f;
+        state.mAltitude = static_cast<float>(random() % 40) * 250.0f;
+        states.emplace_back(state);
+    }
+    FlightStatesDelta::sortByICAO(states);
+    return states;
+}
+
+
+static bool equalStates(const FlightState& a, const FlightState& b)
+{
+    return a.mICAO == b.mICAO && a.mRegistration == b.mRegistration && a.mAircraftType == b.mAircraftType &&
+        a.mLatitude == b.mLatitude && a.mLongitude == b.mLongitude && a.mAltitude == b.mAltitude;
+}
+
+
+static void testDeltaRoundTrips()
+{
+    // Random snapshots reconstructed through deltas are the snapshots they were created from
+    std::mt19937 random(2);
+    auto identifiers = createIdentifiers(random, 300);
+    std::vector<FlightState> reconstructed;
+    for(int round = 0; round < 200; round++)
+    {
+        auto next = createSnapshot(random, identifiers);
+        FlightStatesDelta delta;
+        FlightStatesDelta::create(reconstructed, next, 0.0f, delta);
+        delta.apply(reconstructed);
+
+        TEST_CHECK(reconstructed.size() == next.size());
+        if(reconstructed.size() != next.size())
+            return;
+
+        for(size_t i = 0; i < next.size(); i++)
+            TEST_CHECK(equalStates(reconstructed[i], next[i]));
+    }
+}
+
+
+static void testEncoding()
+{
+    // Rows written the way the poller writes them decode to the snapshots the writer reconstructed
+    std::mt19937 random(3);
+    auto identifiers = createIdentifiers(random, 300);
+    std::vector<FlightState> reconstructed;
+    FlightStatesDecoder decoder;
+    utility::ErrorState error_state;
+    for(int round = 0; round < 50; round++)
+    {
+        auto next = createSnapshot(random, identifiers);
+
+        // The first row is a delta of which the keyframe isn't available
+        FlightStatesData data;
+        data.mTimeStamp = 20260101120000ull + static_cast<uint64>(round);
+        if(round % 10 == 1)
+        {
+            data.WriteData(next);
+            reconstructed = next;
+        }
+        else
+        {
+            FlightStatesDelta delta;
+            FlightStatesDelta::create(reconstructed, next, round % 2 == 0 ? 0.0f : 100.0f, delta);
+            delta.apply(reconstructed);
+            data.WriteDelta(delta);
+        }
+        TEST_CHECK(data.IsDelta() == (round % 10 != 1));
+
+        TEST_CHECK(decoder.decode(data, error_state));
+        TEST_CHECK(decoder.hasStates() == (round > 0));
+        if(!decoder.hasStates())
+            continue;
+
+        const auto& states = decoder.getStates();
+        TEST_CHECK(states.size() == reconstructed.size());
+        if(states.size() != reconstructed.size())
+            return;
+
+        for(size_t i = 0; i < states.size(); i++)
+            TEST_CHECK(equalStates(states[i], reconstructed[i]));
+    }
+
+    // Keyframes and deltas are only parsed as what they are
+    FlightStatesData keyframe;
+    keyframe.mTimeStamp = 20260101130000ull;
+    keyframe.WriteData(reconstructed);
+    FlightStatesDelta delta;
+    TEST_CHECK(!keyframe.ParseDelta(delta, error_state));
+
+    FlightStatesData empty_delta;
+    empty_delta.mTimeStamp = 20260101130001ull;
+    empty_delta.WriteDelta(FlightStatesDelta());
+    std::vector<FlightState> states;
+    TEST_CHECK(!empty_delta.ParseData(states, -1, error_state));
+    TEST_CHECK(empty_delta.ParseDelta(delta, error_state) && delta.mAdded.empty() && delta.mMoved.empty() && delta.mRemoved.empty());
+
+    // Keyframes ordered by altitude are cut off at the altitude
+    std::sort(reconstructed.begin(), reconstructed.end(), [](const auto& a, const auto& b) { return a.mAltitude < b.mAltitude; });
+    keyframe.WriteData(reconstructed);
+    TEST_CHECK(keyframe.ParseData(states, 2000.0f, error_state));
+    size_t below = std::count_if(reconstructed.begin(), reconstructed.end(), [](const auto& state) { return state.mAltitude <= 2000.0f; });
+    TEST_CHECK(states.size() == below);
+}
+
+
+int main()
+{
+    testICAO();
+    testDeltaRoundTrips();
+    testEncoding();
+    return test::result();
+}
@@ -0,0 +1,43 @@
+#pragma once
+
+#include <cstdio>
+
+namespace nap
+{
+    namespace test
+    {
+        // Number of failed checks of the test
+        inline int& failures()
+        {
+            static int count = 0;
+            return count;
+        }
+
+
+        /**
+         * Reports the failed check and continues, so a single run reports every failure
+         */
+        inline bool check(bool condition, const char* expression, const char* file, int line)
+        {
+            if(!condition)
+            {
+                std::fprintf(stderr, "%s:%d: check failed: %s\n", file, line, expression);
+                ++failures();
+            }
+            return condition;
+        }
+
+
+        /**
+         * @return the exit code of the test
+         */
+        inline int result()
+        {
+            if(failures() > 0)
+                std::fprintf(stderr, "%d checks failed\n", failures());
+            return failures() == 0 ? 0 : 1;
+        }
+    }
+}
+
+#define TEST_CHECK(condition) nap::test::check((condition), #condition, __FILE__, __LINE__)
@@ -0,0 +1,335 @@
+#include "testcheck.h"
+
+#include <trafficrollups.h>
+#include <databasetableresource.h>
+#include <flightstatesstore.h>
+#include <utils.h>
+#include <sqlite3.h>
+#include <cstdlib>
+#include <ctime>
+#include <filesystem>
+#include <thread>
+
+using namespace nap;
+
+static constexpr uint64 sHour = 10000;
+static constexpr uint64 sDay = 1000000;
+
+static void setTimeZone(const char* zone)
+{
+#ifdef _WIN32
+    _putenv_s("TZ", zone);
+    _tzset();
+#else
+    setenv("TZ", zone, 1);
+    tzset();
+#endif
+}
+
+
+/**
+ * Walks the hours of a day the way the rollup job does and checks the snapshot ranges that are read
+ * The hours must be contiguous and not overlap, and only the last hour completes the day
+ */
+static void rollUpDay(uint64 day)
+{
+    utility::ErrorState error_state;
+    uint64 day_end = 0;
+    TEST_CHECK(utility::nextPeriod(day, sDay, day_end, error_state));
+
+    uint64 previous_end = 0;
+    TEST_CHECK(utility::subtractFromTimeStamp(day, std::chrono::seconds(1), previous_end, error_state));
+
+    int hours = 0;
+    int completed_days = 0;
+    uint64 hour = day;
+    while(hour < day_end && hours <= 24)
+    {
+        uint64 hour_end = 0;
+        TEST_CHECK(utility::nextPeriod(hour, sHour, hour_end, error_state));
+        TEST_CHECK(hour_end == hour + sHour || hour_end == day_end);
+
+        uint64 begin = 0;
+        uint64 end = 0;
+        TEST_CHECK(utility::getSnapshotRange(hour, hour_end, begin, end, error_state));
+        TEST_CHECK(begin == previous_end);
+        TEST_CHECK(end == hour + 5959);
+
+        if(hour_end % sDay == 0)
+            completed_days++;
+
+        previous_end = end;
+        hour = hour_end;
+        hours++;
+    }
+
+    TEST_CHECK(hours == 24);
+    TEST_CHECK(completed_days == 1);
+    TEST_CHECK(hour == day_end);
+}
+
+
+static void testRollUpDays()
+{
+    rollUpDay(20260715000000);
+    rollUpDay(20260115000000);
+    rollUpDay(20260329000000);
+    rollUpDay(20261025000000);
+}
+
+
+static void testCoverage()
+{
+    utility::ErrorState error_state;
+    uint64 first_hour = 0;
+    uint64 last_hour_end = 0;
+
+    // Only the whole hours inside (begin, end] are covered, the remainder connects to them
+    TEST_CHECK(TrafficRollups::getCoveredHours(20260715083000, 20260715170000, 20260701000000, 20260801000000, first_hour, last_hour_end, error_state));
+    TEST_CHECK(first_hour == 20260715090000);
+    TEST_CHECK(last_hour_end == 20260715170000);
+
+    uint64 covered_begin = 0;
+    uint64 covered_end = 0;
+    TEST_CHECK(utility::getSnapshotRange(first_hour, last_hour_end, covered_begin, covered_end, error_state));
+    TEST_CHECK(covered_begin == 20260715085959);
+    TEST_CHECK(covered_end == 20260715165959);
+
+    // A window that starts at the end of an hour covers the next hour completely
+    TEST_CHECK(TrafficRollups::getCoveredHours(20260715085959, 20260715095959, 20260701000000, 20260801000000, first_hour, last_hour_end, error_state));
+    TEST_CHECK(first_hour == 20260715090000);
+    TEST_CHECK(last_hour_end == 20260715100000);
+
+    // Limited to what is rolled up
+    TEST_CHECK(TrafficRollups::getCoveredHours(20260715000000, 20260716000000, 20260715060000, 20260715120000, first_hour, last_hour_end, error_state));
+    TEST_CHECK(first_hour == 20260715060000);
+    TEST_CHECK(last_hour_end == 20260715120000);
+
+    // Less than an hour
+    TEST_CHECK(TrafficRollups::getCoveredHours(20260715081000, 20260715085000, 20260701000000, 20260801000000, first_hour, last_hour_end, error_state));
+    TEST_CHECK(first_hour >= last_hour_end);
+
+    // Across the end of daylight saving time
+    TEST_CHECK(TrafficRollups::getCoveredHours(20261025003000, 20261025043000, 20261001000000, 20261101000000, first_hour, last_hour_end, error_state));
+    TEST_CHECK(first_hour == 20261025010000);
+    TEST_CHECK(last_hour_end == 20261025040000);
+}
+
+
+static void testMerge()
+{
+    TrafficRollups::Cell cell;
+    TrafficRollups::Cell empty;
+    TrafficRollups::Cell other;
+    other.mObservations = 2;
+    other.mMinAltitude = 900.0f;
+    other.mAltitudeSum = 2000.0;
+    other.mAircraft = { { 1, 900.0f }, { 2, 1100.0f } };
+
+    // An empty cell takes the minimum of the other, merging nothing changes nothing
+    cell.merge(other);
+    cell.merge(empty);
+    TEST_CHECK(cell.mObservations == 2 && cell.mMinAltitude == 900.0f && cell.mAltitudeSum == 2000.0);
+
+    other.mMinAltitude = 700.0f;
+    other.mAircraft = { { 2, 700.0f }, { 3, 1500.0f } };
+    cell.merge(other);
+    TEST_CHECK(cell.mObservations == 4 && cell.mMinAltitude == 700.0f && cell.mAltitudeSum == 4000.0);
+    TEST_CHECK(cell.mAircraft.size() == 3 && cell.mAircraft[1] == 900.0f && cell.mAircraft[2] == 700.0f && cell.mAircraft[3] == 1500.0f);
+}
+
+
+static FlightState createState(const char* icao, float latitude, float longitude, float altitude)
+{
+    FlightState state;
+    state.mICAO = parseICAO(icao);
+    state.mRegistration = "PH-BXA";
+    state.mAircraftType = "B738";
+    state.mLatitude = latitude;
+    state.mLongitude = longitude;
+    state.mAltitude = altitude;
+    return state;
+}
+
+
+static TrafficRollups::Cell* findCell(std::vector<TrafficRollups::Cell>& cells, int32 latitude, int32 longitude)
+{
+    for(auto& cell : cells)
+    {
+        if(cell.mLatitude == latitude && cell.mLongitude == longitude)
+            return &cell;
+    }
+    return nullptr;
+}
+
+
+static int64 queryCount(const std::string& database, const std::string& sql)
+{
+    sqlite3* connection = nullptr;
+    sqlite3_stmt* statement = nullptr;
+    int64 count = -1;
+    if(sqlite3_open(database.c_str(), &connection) == SQLITE_OK && sqlite3_prepare_v2(connection, sql.c_str(), -1, &statement, nullptr) == SQLITE_OK &&
+       sqlite3_step(statement) == SQLITE_ROW)
+        count = sqlite3_column_int64(statement, 0);
+    sqlite3_finalize(statement);
+    sqlite3_close(connection);
+    return count;
+}
+
+
+/**
+ * Logs snapshots yesterday and lets the job roll up yesterday and today, starting at the beginning of yesterday
+ * The job works on the current time, so the hours are relative to it
+ */
+static void testRollUp()
+{
+    utility::ErrorState error_state;
+    std::error_code error;
+    auto directory = std::filesystem::temp_directory_path() / "trafficrollupstest";
+    std::filesystem::remove_all(directory, error);
+    std::filesystem::create_directories(directory, error);
+
+    // Don't start right before the hour changes, the backfill is computed from the current hour
+    auto seconds_in_hour = std::chrono::duration_cast<std::chrono::seconds>(SystemClock::now().time_since_epoch()).count() % 3600;
+    if(seconds_in_hour > 3590)
+        std::this_thread::sleep_for(std::chrono::seconds(3600 - seconds_in_hour + 1));
+
+    uint64 now = utility::uint64FromDateTime(getCurrentDateTime());
+    uint64 today = now - now % sDay;
+    uint64 yesterday = 0;
+    TEST_CHECK(utility::subtractFromTimeStamp(today, std::chrono::hours(24), yesterday, error_state));
+
+    // The job starts BackfillHours before now, rounded down to the hour
+    int backfill_hours = 1;
+    for(; backfill_hours < 72; backfill_hours++)
+    {
+        uint64 start = utility::uint64FromDateTime(DateTime(SystemClock::now() - std::chrono::hours(backfill_hours)));
+        if(start - start % sHour == yesterday)
+            break;
+    }
+    TEST_CHECK(backfill_hours < 72);
+
+    // An aggregate past the retention and one that isn't, of the cell size the job uses
+    std::string rollups_path = (directory / "rollups.db").string();
+    {
+        sqlite3* connection = nullptr;
+        TEST_CHECK(sqlite3_open(rollups_path.c_str(), &connection) == SQLITE_OK);
+        std::string kept = std::to_string(yesterday - sDay + 10 * sHour);
+        std::string sql = "CREATE TABLE rollups (Resolution INTEGER, CellLat INTEGER, CellLon INTEGER, Period INTEGER, "
+                          "Observations INTEGER, MinAltitude REAL, AltitudeSum REAL, Aircraft TEXT, "
+                          "PRIMARY KEY (Resolution, CellLat, CellLon, Period)) WITHOUT ROWID;"
+                          "CREATE TABLE rollups_meta (Key TEXT PRIMARY KEY, Value INTEGER);"
+                          "INSERT INTO rollups_meta VALUES ('CellSize', 10000);"
+                          "INSERT INTO rollups VALUES (0, 1, 1, 20200101000000, 1, 100.0, 100.0, '484F6D=100');"
+                          "INSERT INTO rollups VALUES (0, 1, 1, " + kept + ", 1, 100.0, 100.0, '484F6D=100');";
+        TEST_CHECK(sqlite3_exec(connection, sql.c_str(), nullptr, nullptr, nullptr) == SQLITE_OK);
+        sqlite3_close(connection);
+    }
+
+    DatabaseTableResource database;
+    database.mDatabaseName = (directory / "states.db").string();
+    database.mBackend = "Log";
+    database.mLogDirectory = (directory / "states").string();
+    database.mSegmentMinutes = 15;
+    TEST_CHECK(database.init(error_state));
+
+    // Two aircraft in one cell during the tenth hour, one of them in the next cell at the start of the eleventh hour
+    FlightStatesStore* store = database.getFlightStatesStore("states", error_state);
+    TEST_CHECK(store != nullptr);
+    if(store == nullptr)
+        return;
+
+    std::vector<std::pair<uint64, std::vector<FlightState>>> snapshots =
+    {
+        { yesterday + 10 * sHour + 30, { createState("484F6D", 52.005f, 4.005f, 1000.0f) } },
+        { yesterday + 10 * sHour + 2000, { createState("484F6D", 52.005f, 4.005f, 800.0f), createState("TRANSAVIA42X", 52.005f, 4.005f, 3000.0f) } },
+        { yesterday + 11 * sHour, { createState("484F6D", 52.015f, 4.005f, 500.0f) } }
+    };
+    for(auto& snapshot : snapshots)
+    {
+        FlightStatesDelta::sortByICAO(snapshot.second);
+        FlightStatesData data;
+        data.mTimeStamp = snapshot.first;
+        data.WriteData(snapshot.second);
+        TEST_CHECK(store->add(data, error_state));
+    }
+
+    TrafficRollups rollups;
+    rollups.mFlightStatesDatabase = &database;
+    rollups.mDatabaseName = rollups_path;
+    rollups.mBackfillHours = backfill_hours;
+    rollups.mMaxHoursPerUpdate = 6;
+    rollups.mUpdateInterval = 0.05f;
+    rollups.mRetentionDays = 400;
+    TEST_CHECK(rollups.init(error_state));
+
+    // Yesterday is rolled up once the job reached today
+    auto deadline = SystemClock::now() + std::chrono::seconds(60);
+    while(rollups.getRolledUntil() < today && SystemClock::now() < deadline)
+        std::this_thread::sleep_for(std::chrono::milliseconds(20));
+    TEST_CHECK(rollups.getRolledUntil() >= today);
+
+    uint64 icao = parseICAO("484F6D");
+    uint64 long_icao = parseICAO("TRANSAVIA42X");
+
+    // The whole day is read from the day aggregate
+    uint64 begin = 0;
+    uint64 end = 0;
+    TEST_CHECK(utility::getSnapshotRange(yesterday, today, begin, end, error_state));
+    std::vector<TrafficRollups::Cell> cells;
+    uint64 covered_begin = 0;
+    uint64 covered_end = 0;
+    TEST_CHECK(rollups.getCells(begin, end, 51.9f, 3.9f, 52.1f, 4.1f, cells, covered_begin, covered_end, error_state));
+    TEST_CHECK(covered_begin == begin && covered_end == end);
+    TEST_CHECK(cells.size() == 2);
+
+    auto* cell = findCell(cells, 5200, 400);
+    TEST_CHECK(cell != nullptr);
+    if(cell != nullptr)
+    {
+        TEST_CHECK(cell->mObservations == 3);
+        TEST_CHECK(cell->mMinAltitude == 800.0f);
+        TEST_CHECK(cell->mAltitudeSum == 4800.0);
+        TEST_CHECK(cell->mAircraft.size() == 2 && cell->mAircraft[icao] == 800.0f && cell->mAircraft[long_icao] == 3000.0f);
+    }
+
+    cell = findCell(cells, 5201, 400);
+    TEST_CHECK(cell != nullptr);
+    if(cell != nullptr)
+        TEST_CHECK(cell->mObservations == 1 && cell->mAircraft.size() == 1 && cell->mAircraft[icao] == 500.0f);
+
+    // Only the eleventh hour is completely inside the window, the first snapshot of the hour is part of it
+    cells.clear();
+    TEST_CHECK(rollups.getCells(yesterday + 10 * sHour + 3000, yesterday + 12 * sHour, 51.9f, 3.9f, 52.1f, 4.1f, cells, covered_begin, covered_end, error_state));
+    TEST_CHECK(covered_begin == yesterday + 10 * sHour + 5959 && covered_end == yesterday + 11 * sHour + 5959);
+    TEST_CHECK(cells.size() == 1 && cells[0].mLatitude == 5201 && cells[0].mObservations == 1);
+
+    // Cells outside of the area aren't read
+    cells.clear();
+    TEST_CHECK(rollups.getCells(begin, end, 52.011f, 3.9f, 52.1f, 4.1f, cells, covered_begin, covered_end, error_state));
+    TEST_CHECK(cells.size() == 1 && cells[0].mLatitude == 5201);
+
+    // The heatmap combines the hours the same way
+    cells.clear();
+    TEST_CHECK(rollups.getHeatmap(begin, end, 51.9f, 3.9f, 52.1f, 4.1f, cells, error_state));
+    TEST_CHECK(cells.size() == 2);
+
+    // The day aggregate was stored and the retention removed the expired aggregate only
+    TEST_CHECK(queryCount(rollups_path, "SELECT COUNT(*) FROM rollups WHERE Resolution = 1 AND Period = " + std::to_string(yesterday)) == 2);
+    TEST_CHECK(queryCount(rollups_path, "SELECT COUNT(*) FROM rollups WHERE Period = 20200101000000") == 0);
+    TEST_CHECK(queryCount(rollups_path, "SELECT COUNT(*) FROM rollups WHERE CellLat = 1") == 1);
+}
+
+
+int main()
+{
+    setTimeZone("Europe/Amsterdam");
+    testRollUpDays();
+    testCoverage();
+    testMerge();
+    testRollUp();
+
+    std::error_code error;
+    std::filesystem::remove_all(std::filesystem::temp_directory_path() / "trafficrollupstest", error);
+    return test::result();
+}
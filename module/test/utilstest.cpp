@@ -0,0 +1,171 @@
+#include "testcheck.h"
+
+#include <utils.h>
+#include <cstdlib>
+#include <ctime>
+
+using namespace nap;
+
+// Daylight saving time in Europe/Amsterdam starts at 2026-03-29 02:00 and ends at 2026-10-25 03:00
+static void setTimeZone(const char* zone)
+{
+#ifdef _WIN32
+    _putenv_s("TZ", zone);
+    _tzset();
+#else
+    setenv("TZ", zone, 1);
+    tzset();
+#endif
+}
+
+
+static uint64 subtract(uint64 timestamp, SystemClock::duration duration)
+{
+    utility::ErrorState error_state;
+    uint64 result = 0;
+    TEST_CHECK(utility::subtractFromTimeStamp(timestamp, duration, result, error_state));
+    return result;
+}
+
+
+static uint64 add(uint64 timestamp, SystemClock::duration duration)
+{
+    utility::ErrorState error_state;
+    uint64 result = 0;
+    TEST_CHECK(utility::addToTimeStamp(timestamp, duration, result, error_state));
+    return result;
+}
+
+
+static uint64 roundTrip(uint64 timestamp)
+{
+    utility::ErrorState error_state;
+    DateTime dt;
+    TEST_CHECK(utility::dateTimeFromUINT64(timestamp, dt, error_state));
+    return utility::uint64FromDateTime(dt);
+}
+
+
+static std::chrono::seconds between(uint64 begin, uint64 end)
+{
+    utility::ErrorState error_state;
+    DateTime begin_dt, end_dt;
+    TEST_CHECK(utility::dateTimeFromUINT64(begin, begin_dt, error_state));
+    TEST_CHECK(utility::dateTimeFromUINT64(end, end_dt, error_state));
+    return std::chrono::duration_cast<std::chrono::seconds>(end_dt.getTimeStamp() - begin_dt.getTimeStamp());
+}
+
+
+// Every hour of the day is one period, contiguous and without overlap
+static void checkHours(uint64 day)
+{
+    utility::ErrorState error_state;
+    uint64 hour = day;
+    for(int i = 0; i < 24; i++)
+    {
+        uint64 next = 0;
+        TEST_CHECK(utility::nextPeriod(hour, 10000, next, error_state));
+        TEST_CHECK(next == hour + 10000 || (i == 23 && next == add(day, std::chrono::hours(24))));
+        hour = next;
+    }
+    TEST_CHECK(hour == add(day, std::chrono::hours(24)));
+}
+
+
+static void testRoundTrips()
+{
+    // Summer
+    TEST_CHECK(roundTrip(20260715120000) == 20260715120000);
+    TEST_CHECK(subtract(20260715120000, std::chrono::seconds(1)) == 20260715115959);
+    TEST_CHECK(add(20260715115959, std::chrono::seconds(1)) == 20260715120000);
+    TEST_CHECK(subtract(20260715120000, std::chrono::minutes(10)) == 20260715115000);
+
+    // Winter
+    TEST_CHECK(roundTrip(20260115120000) == 20260115120000);
+    TEST_CHECK(subtract(20260115120000, std::chrono::seconds(1)) == 20260115115959);
+    TEST_CHECK(add(20260115115959, std::chrono::seconds(1)) == 20260115120000);
+
+    // Across month, year and leap days
+    TEST_CHECK(subtract(20260101000000, std::chrono::seconds(1)) == 20251231235959);
+    TEST_CHECK(add(20280228230000, std::chrono::hours(1)) == 20280229000000);
+    TEST_CHECK(add(20260228230000, std::chrono::hours(1)) == 20260301000000);
+
+    // Invalid timestamps
+    utility::ErrorState error_state;
+    DateTime dt;
+    TEST_CHECK(!utility::dateTimeFromUINT64(20260230120000, dt, error_state));
+    TEST_CHECK(!utility::dateTimeFromUINT64(20260715126000, dt, error_state));
+    TEST_CHECK(!utility::dateTimeFromUINT64(2026071512, dt, error_state));
+}
+
+
+static void testDaylightSavingTime()
+{
+    // Start, 02:00 doesn't exist and the day has 23 hours
+    TEST_CHECK(roundTrip(20260329010000) == 20260329010000);
+    TEST_CHECK(roundTrip(20260329030000) == 20260329030000);
+    TEST_CHECK(between(20260329010000, 20260329030000) == std::chrono::hours(1));
+    TEST_CHECK(subtract(20260329030000, std::chrono::seconds(1)) == 20260329025959);
+    checkHours(20260329000000);
+
+    // End, 02:00 to 03:00 happens twice and the day has 25 hours
+    TEST_CHECK(roundTrip(20261025010000) == 20261025010000);
+    TEST_CHECK(roundTrip(20261025040000) == 20261025040000);
+    TEST_CHECK(between(20261025010000, 20261025040000) == std::chrono::hours(4));
+    TEST_CHECK(subtract(20261025030000, std::chrono::seconds(1)) == 20261025025959);
+    checkHours(20261025000000);
+
+    // Summer and winter days
+    checkHours(20260715000000);
+    checkHours(20260115000000);
+}
+
+
+static void testPeriods()
+{
+    utility::ErrorState error_state;
+    uint64 next = 0;
+    TEST_CHECK(utility::nextPeriod(20260715123456, 10000, next, error_state) && next == 20260715130000);
+    TEST_CHECK(utility::nextPeriod(20261025000000, 1000000, next, error_state) && next == 20261026000000);
+    TEST_CHECK(utility::nextPeriod(20260329000000, 1000000, next, error_state) && next == 20260330000000);
+    TEST_CHECK(utility::nextPeriod(20261231000000, 1000000, next, error_state) && next == 20270101000000);
+    TEST_CHECK(!utility::nextPeriod(20260715120000, 100, next, error_state));
+
+    // Invalid timestamps
+    TEST_CHECK(!utility::subtractFromTimeStamp(20260230120000, std::chrono::seconds(1), next, error_state));
+    TEST_CHECK(!utility::subtractFromTimeStamp(20260715126000, std::chrono::seconds(1), next, error_state));
+    TEST_CHECK(!utility::subtractFromTimeStamp(2026071512, std::chrono::seconds(1), next, error_state));
+}
+
+
+static void testSplitTimeRange()
+{
+    // The ranges connect and cover the whole range, also across the end of daylight saving time
+    utility::ErrorState error_state;
+    std::vector<std::pair<uint64, uint64>> ranges;
+    TEST_CHECK(utility::splitTimeRange(20261025000000, 20261025060000, 6, std::chrono::minutes(1), ranges, error_state));
+    TEST_CHECK(ranges.size() == 6);
+    if(ranges.size() == 6)
+    {
+        TEST_CHECK(ranges.front().first == 20261025000000);
+        TEST_CHECK(ranges.back().second == 20261025060000 - 1);
+        for(size_t i = 1; i < ranges.size(); i++)
+            TEST_CHECK(ranges[i].first == ranges[i - 1].second && ranges[i].first == 20261025000000 + i * 10000);
+    }
+
+    // Never shorter than the minimum duration
+    ranges.clear();
+    TEST_CHECK(utility::splitTimeRange(20260715120000, 20260715121000, 10, std::chrono::minutes(5), ranges, error_state));
+    TEST_CHECK(ranges.size() == 2);
+}
+
+
+int main()
+{
+    setTimeZone("Europe/Amsterdam");
+    testRoundTrips();
+    testDaylightSavingTime();
+    testPeriods();
+    testSplitTimeRange();
+    return test::result();
+}
@@ -0,0 +1,411 @@
+// feedreplayserver.cpp : Serves a recorded feed to the plane logger at a configurable speed.
+//
+// Record the feed by setting RecordDirectory of the PlaneLoggerComponent. To replay, point the RestClient of the logger
+// at this server (http://localhost:8081), enable UseFeedTime, poll a single tile with a Limit above the number of recorded
+// aircraft and lower the Interval to at most the recorded interval divided by the speed. With --speed max every request
+// gets the next recorded response, the logger then ingests as fast as it can.
+// Every report interval the ingest rate and the growth of the storage paths are logged, the summary is written as json.
+// Usage: feedreplayserver --recording <directory> [--port 8081] [--path /zones/fcgi/feed.js] [--speed 100|max]
+//                         [--storage <path>]... [--report 10] [--output summary.json]
+
+// Local Includes
+#include "feedrecording.h"
+#include "utils.h"
+
+// Nap includes
+#include <nap/logger.h>
+#include <utility/stringutils.h>
+#include <rapidjson/document.h>
+#include <rapidjson/prettywriter.h>
+#include <rapidjson/stringbuffer.h>
+
+// External includes
+#include <algorithm>
+#include <chrono>
+#include <csignal>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <poll.h>
+#include <unistd.h>
+
+using namespace nap;
+
+/**
+ * A connection to the server with the part of the request received so far
+ */
+struct Connection
+{
+    int mSocket = -1;
+    std::string mRequest;
+};
+
+
+/**
+ * The position in the recording and the counters of the report
+ */
+struct Replay
+{
+    FeedRecording* mRecording = nullptr;
+    std::vector<std::unique_ptr<FlightStatesData>> mRows; // Rows of the segment that is replayed
+    size_t mNext = 0; // Next row to serve
+    bool mFinished = false; // All rows were served or skipped
+
+    double mSpeed = 0.0; // Recorded seconds per second, 0 replays every row as soon as it is requested
+    std::chrono::steady_clock::time_point mStart;
+    SystemTimeStamp mFirstFeedTime;
+    bool mStarted = false;
+
+    uint64 mFeedTime = 0; // Time of the row that was served last
+    std::string mResponse; // Row that was served last, with the time it was recorded
+    uint64 mSnapshots = 0; // Distinct rows served
+    uint64 mSkipped = 0; // Rows that became due while the logger was still busy
+    uint64 mRequests = 0;
+    uint64 mBytes = 0;
+};
+
+
+static bool toTime(uint64 timestamp, SystemTimeStamp& time)
+{
+    DateTime date_time;
+    utility::ErrorState error_state;
+    if(!utility::dateTimeFromUINT64(timestamp, date_time, error_state))
+        return false;
+    time = date_time.getTimeStamp();
+    return true;
+}
+
+
+/**
+ * @return the next row of the recording, nullptr when the recording is finished
+ */
+static const FlightStatesData* peekRow(Replay& replay, utility::ErrorState& errorState)
+{
+    while(replay.mNext >= replay.mRows.size())
+    {
+        replay.mRows.clear();
+        replay.mNext = 0;
+        if(!replay.mRecording->readNext(replay.mRows, errorState))
+            return nullptr;
+    }
+    return replay.mRows[replay.mNext].get();
+}
+
+
+static void serveRow(Replay& replay, const FlightStatesData& row)
+{
+    replay.mFeedTime = row.mTimeStamp;
+    replay.mResponse = row.mData;
+    FeedRecording::addFeedTime(row.mTimeStamp, replay.mResponse);
+    replay.mSnapshots++;
+}
+
+
+/**
+ * Moves the replay to the row that is due, the replay clock starts at the first request
+ */
+static void advance(Replay& replay, utility::ErrorState& errorState)
+{
+    const auto* row = peekRow(replay, errorState);
+    if(row == nullptr)
+        return;
+
+    if(!replay.mStarted)
+    {
+        if(!errorState.check(toTime(row->mTimeStamp, replay.mFirstFeedTime), "Invalid timestamp %s", std::to_string(row->mTimeStamp).c_str()))
+            return;
+        replay.mStart = std::chrono::steady_clock::now();
+        replay.mStarted = true;
+    }
+
+    // As fast as possible, every request gets the next row
+    if(replay.mSpeed <= 0.0)
+    {
+        serveRow(replay, *replay.mRows[replay.mNext++]);
+        return;
+    }
+
+    // Serve the newest row recorded before the replay clock, rows the logger didn't ask for in time are skipped
+    auto elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - replay.mStart) * replay.mSpeed;
+    auto clock = replay.mFirstFeedTime + std::chrono::duration_cast<SystemClock::duration>(elapsed);
+    std::unique_ptr<FlightStatesData> due;
+    SystemTimeStamp row_time;
+    while(row != nullptr && toTime(row->mTimeStamp, row_time) && row_time <= clock)
+    {
+        if(due != nullptr)
+            replay.mSkipped++;
+        due = std::move(replay.mRows[replay.mNext++]);
+        row = peekRow(replay, errorState);
+    }
+
+    if(due != nullptr)
+        serveRow(replay, *due);
+}
+
+
+static uint64 getStorageSize(const std::vector<std::string>& paths)
+{
+    uint64 size = 0;
+    for(const auto& path : paths)
+    {
+        std::error_code error;
+        if(std::filesystem::is_regular_file(path, error))
+        {
+            size += std::filesystem::file_size(path, error);
+            continue;
+        }
+
+        for(const auto& entry : std::filesystem::recursive_directory_iterator(path, error))
+        {
+            if(entry.is_regular_file(error))
+                size += entry.file_size(error);
+        }
+    }
+    return size;
+}
+
+
+static bool sendAll(int socket, const std::string& data)
+{
+    size_t sent = 0;
+    while(sent < data.size())
+    {
+        auto result = ::send(socket, data.data() + sent, data.size() - sent, 0);
+        if(result <= 0)
+            return false;
+        sent += static_cast<size_t>(result);
+    }
+    return true;
+}
+
+
+/**
+ * Responds to all complete requests of the connection, returns false when the connection has to be closed
+ */
+static bool handleRequests(Connection& connection, const std::string& path, Replay& replay, utility::ErrorState& errorState)
+{
+    size_t end;
+    while((end = connection.mRequest.find("\r\n\r\n")) != std::string::npos)
+    {
+        // The request line is METHOD TARGET VERSION, the query of the target is ignored
+        std::string request_line = connection.mRequest.substr(0, connection.mRequest.find("\r\n"));
+        connection.mRequest.erase(0, end + 4);
+        auto parts = utility::splitString(request_line, ' ');
+        std::string target = parts.size() > 1 ? parts[1] : "";
+        target = target.substr(0, target.find('?'));
+
+        std::string status = "200 OK";
+        std::string body;
+        if(parts.empty() || parts[0] != "GET" || target != path)
+        {
+            status = "404 Not Found";
+        }else
+        {
+            advance(replay, errorState);
+            if(replay.mResponse.empty())
+                status = "503 Service Unavailable";
+            replay.mRequests++;
+            replay.mBytes += replay.mResponse.size();
+            body = replay.mResponse;
+        }
+
+        std::string header = utility::stringFormat("HTTP/1.1 %s\r\nContent-Type: application/json\r\nContent-Length: %zu\r\nConnection: keep-alive\r\n\r\n",
+                                                   status.c_str(), body.size());
+        if(!sendAll(connection.mSocket, header) || !sendAll(connection.mSocket, body))
+            return false;
+    }
+    return true;
+}
+
+
+int main(int argc, char *argv[])
+{
+    std::string recording_directory;
+    int port = 8081;
+    std::string path = "/zones/fcgi/feed.js";
+    double speed = 100.0;
+    std::vector<std::string> storage;
+    double report_seconds = 10.0;
+    std::string output;
+
+    for(int i = 1; i < argc; i++)
+    {
+        std::string arg = argv[i];
+        if(arg == "--help" || i + 1 >= argc)
+        {
+            std::cout << "usage: feedreplayserver --recording <directory> [--port 8081] [--path /zones/fcgi/feed.js] "
+                         "[--speed 100|max] [--storage <path>]... [--report 10] [--output summary.json]" << std::endl;
+            return arg == "--help" ? 0 : -1;
+        }
+
+        std::string value = argv[++i];
+        if(arg == "--recording")
+            recording_directory = value;
+        else if(arg == "--port")
+            port = std::stoi(value);
+        else if(arg == "--path")
+            path = value;
+        else if(arg == "--speed")
+            speed = value == "max" ? 0.0 : std::stod(value);
+        else if(arg == "--storage")
+            storage.emplace_back(value);
+        else if(arg == "--report")
+            report_seconds = std::stod(value);
+        else if(arg == "--output")
+            output = value;
+        else
+        {
+            nap::Logger::fatal("unknown argument: %s", arg.c_str());
+            return -1;
+        }
+    }
+
+    utility::ErrorState error;
+    FeedRecording recording(recording_directory);
+    if(!error.check(std::filesystem::is_directory(recording_directory), "%s is not a directory", recording_directory.c_str()) ||
+       !recording.init(error))
+    {
+        nap::Logger::fatal("error opening recording: %s", error.toString().c_str());
+        return -1;
+    }
+
+    Replay replay;
+    replay.mRecording = &recording;
+    replay.mSpeed = speed;
+
+    // Listen on all interfaces, the logger can run in a container next to the server
+    std::signal(SIGPIPE, SIG_IGN);
+    int listener = ::socket(AF_INET, SOCK_STREAM, 0);
+    int reuse = 1;
+    ::setsockopt(listener, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse));
+    sockaddr_in address = {};
+    address.sin_family = AF_INET;
+    address.sin_addr.s_addr = htonl(INADDR_ANY);
+    address.sin_port = htons(static_cast<uint16_t>(port));
+    if(listener < 0 || ::bind(listener, reinterpret_cast<sockaddr*>(&address), sizeof(address)) != 0 || ::listen(listener, 16) != 0)
+    {
+        nap::Logger::fatal("error listening on port %d: %s", port, std::strerror(errno));
+        return -1;
+    }
+    nap::Logger::info("Replaying %s on port %d", recording_directory.c_str(), port);
+
+    uint64 initial_storage = getStorageSize(storage);
+    uint64 storage_size = initial_storage;
+    auto last_report = std::chrono::steady_clock::now();
+    uint64 last_snapshots = 0;
+    std::vector<Connection> connections;
+    while(true)
+    {
+        std::vector<pollfd> fds;
+        fds.push_back({ listener, POLLIN, 0 });
+        for(const auto& connection : connections)
+            fds.push_back({ connection.mSocket, POLLIN, 0 });
+        ::poll(fds.data(), fds.size(), 100);
+
+        if(fds[0].revents & POLLIN)
+        {
+            int socket = ::accept(listener, nullptr, nullptr);
+            if(socket >= 0)
+                connections.push_back({ socket, "" });
+        }
+
+        for(size_t i = 1; i < fds.size(); i++)
+        {
+            if(!(fds[i].revents & (POLLIN | POLLHUP | POLLERR)))
+                continue;
+
+            auto& connection = connections[i - 1];
+            char buffer[4096];
+            auto received = ::recv(connection.mSocket, buffer, sizeof(buffer), 0);
+            bool open = received > 0;
+            if(open)
+            {
+                connection.mRequest.append(buffer, static_cast<size_t>(received));
+                open = handleRequests(connection, path, replay, error);
+            }
+
+            if(!open)
+            {
+                ::close(connection.mSocket);
+                connection.mSocket = -1;
+            }
+        }
+        connections.erase(std::remove_if(connections.begin(), connections.end(), [](const Connection& connection)
+        {
+            return connection.mSocket < 0;
+        }), connections.end());
+
+        if(error.hasErrors())
+        {
+            nap::Logger::fatal("error reading recording: %s", error.toString().c_str());
+            return -1;
+        }
+
+        // The replay is finished once the last row was served and no later row is due
+        if(replay.mStarted)
+            replay.mFinished = peekRow(replay, error) == nullptr;
+
+        auto now = std::chrono::steady_clock::now();
+        double since_report = std::chrono::duration<double>(now - last_report).count();
+        if(replay.mStarted && (since_report >= report_seconds || replay.mFinished))
+        {
+            storage_size = getStorageSize(storage);
+            nap::Logger::info("Feed time %s, %llu snapshots, %llu skipped, %.1f snapshots/s, storage %.1f MB",
+                              std::to_string(replay.mFeedTime).c_str(), static_cast<unsigned long long>(replay.mSnapshots),
+                              static_cast<unsigned long long>(replay.mSkipped), (replay.mSnapshots - last_snapshots) / since_report, storage_size / 1e6);
+            last_report = now;
+            last_snapshots = replay.mSnapshots;
+        }
+
+        if(replay.mFinished)
+            break;
+    }
+
+    for(const auto& connection : connections)
+        ::close(connection.mSocket);
+    ::close(listener);
+
+    // Sustained rates over the whole replay, storage growth is extrapolated per recorded day
+    double elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - replay.mStart).count();
+    SystemTimeStamp last_feed_time = replay.mFirstFeedTime;
+    toTime(replay.mFeedTime, last_feed_time);
+    double feed_seconds = std::chrono::duration<double>(last_feed_time - replay.mFirstFeedTime).count();
+    double growth = static_cast<double>(storage_size) - static_cast<double>(initial_storage);
+
+    rapidjson::Document document(rapidjson::kObjectType);
+    document.AddMember("speed", speed, document.GetAllocator());
+    document.AddMember("elapsed_seconds", elapsed, document.GetAllocator());
+    document.AddMember("feed_seconds", feed_seconds, document.GetAllocator());
+    document.AddMember("requests", replay.mRequests, document.GetAllocator());
+    document.AddMember("snapshots", replay.mSnapshots, document.GetAllocator());
+    document.AddMember("skipped", replay.mSkipped, document.GetAllocator());
+    document.AddMember("snapshots_per_second", elapsed > 0.0 ? replay.mSnapshots / elapsed : 0.0, document.GetAllocator());
+    document.AddMember("feed_bytes_per_second", elapsed > 0.0 ? replay.mBytes / elapsed : 0.0, document.GetAllocator());
+    document.AddMember("effective_speed", elapsed > 0.0 ? feed_seconds / elapsed : 0.0, document.GetAllocator());
+    document.AddMember("storage_bytes", storage_size, document.GetAllocator());
+    document.AddMember("storage_growth_bytes", growth, document.GetAllocator());
+    document.AddMember("storage_growth_bytes_per_day", feed_seconds > 0.0 ? growth / feed_seconds * 86400.0 : 0.0, document.GetAllocator());
+
+    rapidjson::StringBuffer buffer;
+    rapidjson::PrettyWriter<rapidjson::StringBuffer> writer(buffer);
+    writer.SetMaxDecimalPlaces(4);
+    document.Accept(writer);
+
+    if(output.empty())
+    {
+        std::cout << buffer.GetString() << std::endl;
+        return 0;
+    }
+
+    std::ofstream file(output);
+    file << buffer.GetString() << std::endl;
+    if(!file)
+    {
+        nap::Logger::fatal("error: unable to write %s", output.c_str());
+        return -1;
+    }
+    return 0;
+}
@@ -0,0 +1,872 @@
+// loadgenerator.cpp : Drives find_flights and find_disturbances of a running instance and reports the latency distribution.
+//
+// Every worker keeps a connection to the instance and sends the next request as soon as the previous one is answered.
+// Requests are drawn from a mix of time windows: recent windows the states cache holds, windows older than the cache
+// that are read from the database and windows spanning the start of the cache. A share of the requests locates by
+// postal code instead of lat/lon. Point the URL of the Pro6pp RestClient at the built-in stub (--pro6pp-port) to keep
+// the geocoding local, the stub answers every lookup with a location derived from the address.
+// The instance must have been logging for longer than --history-hours for the database windows to hold flights.
+// Latency percentiles, a histogram and the throughput are written as json, in total and per endpoint, window and location.
+// The process exits with 1 when the p99 latency or the error rate exceeds the given limits, so it can gate a deploy.
+// Usage: loadgenerator [--host 127.0.0.1] [--port 8080] [--method post|get] [--concurrency 8] [--duration 30]
+//                      [--requests 0] [--warmup 2] [--mix cache:4,db:1,span:1] [--postal-share 0.2]
+//                      [--disturbance-share 0.5] [--cache-hours 24] [--history-hours 48] [--window 60] [--seed 1]
+//                      [--pro6pp-port 0] [--postal-codes 100] [--max-p99 0] [--max-error-rate 0] [--output report.json]
+
+// Local Includes
+#include "utils.h"
+
+// Nap includes
+#include <nap/logger.h>
+#include <utility/stringutils.h>
+#include <rapidjson/document.h>
+#include <rapidjson/prettywriter.h>
+#include <rapidjson/stringbuffer.h>
+
+// External includes
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <csignal>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <random>
+#include <thread>
+#include <arpa/inet.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+using namespace nap;
+
+// Queries are made around the busiest airport, below the altitude of the disturbance queries
+static constexpr float sQueryLatitude = 52.3086f;
+static constexpr float sQueryLongitude = 4.7639f;
+static constexpr float sQuerySpread = 0.1f;
+static constexpr float sQueryRadius = 5000.0f;
+static constexpr float sQueryAltitude = 3000.0f;
+static constexpr int sDisturbancePeriod = 30;
+static constexpr int sDisturbanceOccurrences = 3;
+
+// Database windows end at least this long before the start of the cache, so the cache has surely evicted them
+static constexpr int sCacheMarginMinutes = 5;
+
+// Upper bounds of the histogram buckets in milliseconds, slower requests end up in the overflow bucket
+static const std::vector<double> sHistogramBounds = { 1, 2, 5, 10, 20, 50, 100, 200, 500, 1000, 2000, 5000, 10000 };
+
+/**
+ * Where the window of a request is read from by the instance
+ */
+enum class EWindow : int
+{
+    Cache = 0, ///< Within the states cache
+    Database = 1, ///< Older than the states cache
+    Spanning = 2 ///< Starts before and ends within the states cache
+};
+
+static const std::vector<std::string> sWindowNames = { "cache", "db", "span" };
+static const std::vector<std::string> sEndpoints = { "find_flights", "find_disturbances" };
+static const std::vector<std::string> sLocationNames = { "latlon", "postal" };
+
+/**
+ * Requests are grouped by endpoint, window and location in the report
+ */
+static int getGroup(int endpoint, EWindow window, int location)
+{
+    return (endpoint * static_cast<int>(sWindowNames.size()) + static_cast<int>(window)) * static_cast<int>(sLocationNames.size()) + location;
+}
+
+static constexpr int sGroupCount = 12;
+
+
+struct Settings
+{
+    std::string mHost = "127.0.0.1";
+    int mPort = 8080;
+    bool mPost = true; // Values as a json body, otherwise as query parameters of a GET
+    int mConcurrency = 8;
+    double mDuration = 30.0;
+    uint64 mRequests = 0; // Stops after this many requests when not 0
+    double mWarmup = 2.0;
+    std::vector<float> mWindowWeights = { 4.0f, 1.0f, 1.0f };
+    float mPostalShare = 0.2f;
+    float mDisturbanceShare = 0.5f;
+    int mCacheHours = 24;
+    int mHistoryHours = 48;
+    int mWindowMinutes = 60;
+    uint32 mSeed = 1;
+    int mPro6ppPort = 0;
+    int mPostalCodes = 100;
+    double mMaxP99 = 0.0;
+    double mMaxErrorRate = 0.0;
+};
+
+
+/**
+ * The outcome of a single request
+ */
+struct Sample
+{
+    int mGroup = 0;
+    bool mOk = false;
+    double mMillis = 0.0; // Measured by the load generator, from sending the request until the whole response was read
+    double mServerMillis = -1.0; // The ms field of the response
+};
+
+
+/**
+ * A keep-alive connection to the instance
+ */
+struct Connection
+{
+    int mSocket = -1;
+    std::string mReceived; // Bytes received after the last response
+
+    void close()
+    {
+        if(mSocket >= 0)
+            ::close(mSocket);
+        mSocket = -1;
+        mReceived.clear();
+    }
+};
+
+
+static bool sendAll(int socket, const std::string& data)
+{
+    size_t sent = 0;
+    while(sent < data.size())
+    {
+        auto result = ::send(socket, data.data() + sent, data.size() - sent, 0);
+        if(result <= 0)
+            return false;
+        sent += static_cast<size_t>(result);
+    }
+    return true;
+}
+
+
+static bool receive(Connection& connection)
+{
+    char buffer[16384];
+    auto received = ::recv(connection.mSocket, buffer, sizeof(buffer), 0);
+    if(received <= 0)
+        return false;
+    connection.mReceived.append(buffer, static_cast<size_t>(received));
+    return true;
+}
+
+
+static bool connectTo(const sockaddr_in& address, Connection& connection)
+{
+    connection.close();
+    connection.mSocket = ::socket(AF_INET, SOCK_STREAM, 0);
+    if(connection.mSocket < 0)
+        return false;
+
+    // Requests are small and sent at once, don't wait for more data to fill a packet
+    int no_delay = 1;
+    ::setsockopt(connection.mSocket, IPPROTO_TCP, TCP_NODELAY, &no_delay, sizeof(no_delay));
+    if(::connect(connection.mSocket, reinterpret_cast<const sockaddr*>(&address), sizeof(address)) != 0)
+    {
+        connection.close();
+        return false;
+    }
+    return true;
+}
+
+
+/**
+ * Reads a single response, the connection is closed when the server asks for it
+ * @param status the http status code
+ * @param body the body of the response
+ * @return false when the response couldn't be read
+ */
+static bool readResponse(Connection& connection, int& status, std::string& body)
+{
+    size_t header_end;
+    while((header_end = connection.mReceived.find("\r\n\r\n")) == std::string::npos)
+    {
+        if(!receive(connection))
+            return false;
+    }
+
+    // The status line is VERSION CODE REASON, header names are case insensitive
+    std::string header = connection.mReceived.substr(0, header_end);
+    connection.mReceived.erase(0, header_end + 4);
+    auto lines = utility::splitString(header, '\n');
+    auto status_line = utility::splitString(lines[0], ' ');
+    status = status_line.size() > 1 ? std::atoi(status_line[1].c_str()) : 0;
+
+    long long content_length = -1;
+    bool close = false;
+    for(size_t i = 1; i < lines.size(); i++)
+    {
+        auto separator = lines[i].find(':');
+        if(separator == std::string::npos)
+            continue;
+
+        std::string name = lines[i].substr(0, separator);
+        std::string value = lines[i].substr(separator + 1);
+        auto first = value.find_first_not_of(" \t");
+        value = first == std::string::npos ? "" : value.substr(first, value.find_last_not_of(" \t\r") + 1 - first);
+        std::transform(name.begin(), name.end(), name.begin(), ::tolower);
+        std::transform(value.begin(), value.end(), value.begin(), ::tolower);
+        if(name == "content-length")
+            content_length = std::atoll(value.c_str());
+        else if(name == "connection")
+            close = value == "close";
+    }
+
+    // Without a length the body ends when the server closes the connection
+    if(content_length < 0)
+    {
+        while(receive(connection));
+        body = std::move(connection.mReceived);
+        connection.close();
+        return true;
+    }
+
+    while(connection.mReceived.size() < static_cast<size_t>(content_length))
+    {
+        if(!receive(connection))
+            return false;
+    }
+    body = connection.mReceived.substr(0, static_cast<size_t>(content_length));
+    connection.mReceived.erase(0, static_cast<size_t>(content_length));
+    if(close)
+        connection.close();
+    return true;
+}
+
+
+/**
+ * Creates the requests of a worker, every worker draws from its own random generator
+ */
+class RequestGenerator
+{
+public:
+    RequestGenerator(const Settings& settings, uint32 seed, const std::vector<std::string>& postalCodes) :
+        mSettings(settings), mRandom(seed), mPostalCodes(postalCodes),
+        mWindowDistribution(settings.mWindowWeights.begin(), settings.mWindowWeights.end())
+    {
+    }
+
+    /**
+     * @param group the group of the request in the report
+     * @return the request, including the body when the values are posted
+     */
+    std::string next(int& group)
+    {
+        std::uniform_real_distribution<float> unit(0.0f, 1.0f);
+        int endpoint = unit(mRandom) < mSettings.mDisturbanceShare ? 1 : 0;
+        int location = unit(mRandom) < mSettings.mPostalShare ? 1 : 0;
+        auto window = static_cast<EWindow>(mWindowDistribution(mRandom));
+        group = getGroup(endpoint, window, location);
+
+        // Values are name and json representation, strings are quoted
+        std::vector<std::pair<std::string, std::string>> values;
+        if(location == 1)
+        {
+            std::uniform_int_distribution<int> number(1, 200);
+            values.emplace_back("postal_code", quote(mPostalCodes[mRandom() % mPostalCodes.size()]));
+            values.emplace_back("streetnumber_and_premise", quote(std::to_string(number(mRandom))));
+        }else
+        {
+            std::uniform_real_distribution<float> spread(-sQuerySpread, sQuerySpread);
+            values.emplace_back("lat", utility::stringFormat("%.5f", sQueryLatitude + spread(mRandom)));
+            values.emplace_back("lon", utility::stringFormat("%.5f", sQueryLongitude + spread(mRandom)));
+        }
+        values.emplace_back("altitude", utility::stringFormat("%.1f", sQueryAltitude));
+        values.emplace_back("radius", utility::stringFormat("%.1f", sQueryRadius));
+
+        uint64 begin, end;
+        createWindow(window, begin, end);
+        values.emplace_back("begin", quote(std::to_string(begin)));
+        values.emplace_back("end", quote(std::to_string(end)));
+        if(endpoint == 1)
+        {
+            values.emplace_back("period", std::to_string(sDisturbancePeriod));
+            values.emplace_back("occurrences", std::to_string(sDisturbanceOccurrences));
+        }
+
+        std::string target = "/" + sEndpoints[endpoint];
+        if(!mSettings.mPost)
+        {
+            for(size_t i = 0; i < values.size(); i++)
+                target += utility::stringFormat("%c%s=%s", i == 0 ? '?' : '&', values[i].first.c_str(), unquote(values[i].second).c_str());
+            return utility::stringFormat("GET %s HTTP/1.1\r\nHost: %s\r\n\r\n", target.c_str(), mSettings.mHost.c_str());
+        }
+
+        std::string body = "{";
+        for(size_t i = 0; i < values.size(); i++)
+            body += utility::stringFormat("%s\"%s\":%s", i == 0 ? "" : ",", values[i].first.c_str(), values[i].second.c_str());
+        body += "}";
+        return utility::stringFormat("POST %s HTTP/1.1\r\nHost: %s\r\nContent-Type: application/json\r\nContent-Length: %zu\r\n\r\n%s",
+                                     target.c_str(), mSettings.mHost.c_str(), body.size(), body.c_str());
+    }
+
+private:
+    static std::string quote(const std::string& value) { return "\"" + value + "\""; }
+    static std::string unquote(const std::string& value) { return value.front() == '"' ? value.substr(1, value.size() - 2) : value; }
+
+    /**
+     * Creates a window of the given kind relative to now, the window is (begin, end] in uint64 YYYYMMDDHHMMSS
+     */
+    void createWindow(EWindow window, uint64& begin, uint64& end)
+    {
+        int cache_minutes = mSettings.mCacheHours * 60;
+        int window_minutes = mSettings.mWindowMinutes;
+        int end_minutes = 0; // Minutes before now the window ends
+        switch(window)
+        {
+        case EWindow::Cache:
+            end_minutes = std::uniform_int_distribution<int>(0, cache_minutes - window_minutes)(mRandom);
+            break;
+        case EWindow::Database:
+            end_minutes = cache_minutes + sCacheMarginMinutes +
+                          std::uniform_int_distribution<int>(0, mSettings.mHistoryHours * 60 - cache_minutes - sCacheMarginMinutes - window_minutes)(mRandom);
+            break;
+        case EWindow::Spanning:
+            end_minutes = cache_minutes - std::uniform_int_distribution<int>(1, window_minutes - 1)(mRandom);
+            break;
+        }
+
+        auto now = SystemClock::now();
+        end = utility::uint64FromDateTime(DateTime(now - std::chrono::minutes(end_minutes)));
+        begin = utility::uint64FromDateTime(DateTime(now - std::chrono::minutes(end_minutes + window_minutes)));
+    }
+
+    const Settings& mSettings;
+    std::mt19937 mRandom;
+    const std::vector<std::string>& mPostalCodes;
+    std::discrete_distribution<int> mWindowDistribution;
+};
+
+
+/**
+ * Checks the status of a response and reads the time the instance reports it took
+ */
+static bool parseResponse(const std::string& body, double& serverMillis)
+{
+    rapidjson::Document document;
+    document.Parse(body.c_str());
+    if(document.HasParseError() || !document.IsObject() || !document.HasMember("status") || !document["status"].IsString() ||
+       std::strcmp(document["status"].GetString(), "ok") != 0)
+        return false;
+
+    if(document.HasMember("data") && document["data"].IsObject() && document["data"].HasMember("ms") && document["data"]["ms"].IsNumber())
+        serverMillis = document["data"]["ms"].GetDouble();
+    return true;
+}
+
+
+/**
+ * State shared by the workers
+ */
+struct Run
+{
+    std::atomic<bool> mStop = { false };
+    std::atomic<bool> mMeasuring = { false }; // Samples are only kept once the warmup is over
+    std::atomic<uint64> mIssued = { 0 }; // Requests started while measuring, to stop at the requested number
+    std::atomic<uint64> mCompleted = { 0 };
+    std::atomic<uint64> mFailed = { 0 };
+};
+
+
+static void runWorker(const Settings& settings, const sockaddr_in& address, uint32 seed, const std::vector<std::string>& postalCodes,
+                      Run& run, std::vector<Sample>& samples)
+{
+    RequestGenerator generator(settings, seed, postalCodes);
+    Connection connection;
+    while(!run.mStop)
+    {
+        bool measuring = run.mMeasuring;
+        if(measuring && settings.mRequests > 0 && run.mIssued++ >= settings.mRequests)
+            break;
+
+        Sample sample;
+        std::string request = generator.next(sample.mGroup);
+        auto begin = std::chrono::steady_clock::now();
+
+        // A closed keep-alive connection is reopened once, a failure after that counts as an error
+        int status = 0;
+        std::string body;
+        bool received = false;
+        for(int attempt = 0; attempt < 2 && !received; attempt++)
+        {
+            if(connection.mSocket < 0 && !connectTo(address, connection))
+                break;
+            received = sendAll(connection.mSocket, request) && readResponse(connection, status, body);
+            if(!received)
+                connection.close();
+        }
+
+        sample.mMillis = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - begin).count();
+        sample.mOk = received && status == 200 && parseResponse(body, sample.mServerMillis);
+        if(measuring)
+        {
+            samples.emplace_back(sample);
+            run.mCompleted++;
+            if(!sample.mOk)
+                run.mFailed++;
+        }
+
+        // Don't hammer an instance that refuses connections
+        if(!received)
+            std::this_thread::sleep_for(std::chrono::milliseconds(100));
+    }
+    connection.close();
+}
+
+
+/**
+ * Answers every request with a location derived from the request, in the format of the Pro6pp autocomplete api
+ * Addresses map to the same location on every lookup, so results don't depend on the address cache of the instance.
+ */
+static void runPro6ppStub(int listener, Run& run, std::atomic<uint64>& lookups)
+{
+    struct StubConnection
+    {
+        int mSocket = -1;
+        std::string mRequest;
+    };
+
+    std::vector<StubConnection> connections;
+    while(!run.mStop)
+    {
+        std::vector<pollfd> fds;
+        fds.push_back({ listener, POLLIN, 0 });
+        for(const auto& connection : connections)
+            fds.push_back({ connection.mSocket, POLLIN, 0 });
+        ::poll(fds.data(), fds.size(), 100);
+
+        if(fds[0].revents & POLLIN)
+        {
+            int socket = ::accept(listener, nullptr, nullptr);
+            if(socket >= 0)
+                connections.push_back({ socket, "" });
+        }
+
+        for(size_t i = 1; i < fds.size(); i++)
+        {
+            if(!(fds[i].revents & (POLLIN | POLLHUP | POLLERR)))
+                continue;
+
+            auto& connection = connections[i - 1];
+            char buffer[4096];
+            auto received = ::recv(connection.mSocket, buffer, sizeof(buffer), 0);
+            bool open = received > 0;
+            if(open)
+                connection.mRequest.append(buffer, static_cast<size_t>(received));
+
+            size_t end;
+            while(open && (end = connection.mRequest.find("\r\n\r\n")) != std::string::npos)
+            {
+                std::string request_line = connection.mRequest.substr(0, connection.mRequest.find("\r\n"));
+                connection.mRequest.erase(0, end + 4);
+
+                // The target holds the postal code and street number
+                uint32 hash = static_cast<uint32>(std::hash<std::string>()(request_line));
+                float lat = sQueryLatitude + ((hash & 0xFFFF) / 65535.0f * 2.0f - 1.0f) * sQuerySpread;
+                float lon = sQueryLongitude + ((hash >> 16) / 65535.0f * 2.0f - 1.0f) * sQuerySpread;
+                std::string body = utility::stringFormat("{\"lat\":%.6f,\"lng\":%.6f}", lat, lon);
+                std::string response = utility::stringFormat("HTTP/1.1 200 OK\r\nContent-Type: application/json\r\nContent-Length: %zu\r\n\r\n%s",
+                                                             body.size(), body.c_str());
+                open = sendAll(connection.mSocket, response);
+                lookups++;
+            }
+
+            if(!open)
+            {
+                ::close(connection.mSocket);
+                connection.mSocket = -1;
+            }
+        }
+        connections.erase(std::remove_if(connections.begin(), connections.end(), [](const StubConnection& connection)
+        {
+            return connection.mSocket < 0;
+        }), connections.end());
+    }
+
+    for(const auto& connection : connections)
+        ::close(connection.mSocket);
+}
+
+
+/**
+ * @return the value at the given fraction of the sorted values, nearest rank
+ */
+static double percentile(const std::vector<double>& sorted, double fraction)
+{
+    if(sorted.empty())
+        return 0.0;
+    size_t rank = static_cast<size_t>(std::ceil(fraction * sorted.size()));
+    return sorted[std::clamp<size_t>(rank, 1, sorted.size()) - 1];
+}
+
+
+/**
+ * Adds the counts, throughput and latency distribution of the samples to the json object
+ * Failed requests are counted but left out of the latencies, a fast failure would otherwise improve the percentiles.
+ */
+static void addToJson(const std::vector<const Sample*>& samples, double elapsed, bool histogram, rapidjson::Value& result, rapidjson::Document& document)
+{
+    std::vector<double> latencies, server_latencies;
+    uint64 errors = 0;
+    double total = 0.0;
+    for(const auto* sample : samples)
+    {
+        if(!sample->mOk)
+        {
+            errors++;
+            continue;
+        }
+        latencies.emplace_back(sample->mMillis);
+        total += sample->mMillis;
+        if(sample->mServerMillis >= 0.0)
+            server_latencies.emplace_back(sample->mServerMillis);
+    }
+    std::sort(latencies.begin(), latencies.end());
+    std::sort(server_latencies.begin(), server_latencies.end());
+
+    auto& allocator = document.GetAllocator();
+    result.AddMember("requests", static_cast<uint64>(samples.size()), allocator);
+    result.AddMember("errors", errors, allocator);
+    result.AddMember("error_rate", samples.empty() ? 0.0 : static_cast<double>(errors) / samples.size(), allocator);
+    result.AddMember("requests_per_second", elapsed > 0.0 ? latencies.size() / elapsed : 0.0, allocator);
+
+    rapidjson::Value latency(rapidjson::kObjectType);
+    latency.AddMember("mean", latencies.empty() ? 0.0 : total / latencies.size(), allocator);
+    latency.AddMember("p50", percentile(latencies, 0.5), allocator);
+    latency.AddMember("p95", percentile(latencies, 0.95), allocator);
+    latency.AddMember("p99", percentile(latencies, 0.99), allocator);
+    latency.AddMember("max", latencies.empty() ? 0.0 : latencies.back(), allocator);
+    result.AddMember("latency_ms", latency, allocator);
+
+    // The time the instance spent on the request, the difference with the latency is queueing and transfer
+    rapidjson::Value server(rapidjson::kObjectType);
+    server.AddMember("p50", percentile(server_latencies, 0.5), allocator);
+    server.AddMember("p99", percentile(server_latencies, 0.99), allocator);
+    result.AddMember("server_ms", server, allocator);
+
+    if(!histogram)
+        return;
+
+    rapidjson::Value buckets(rapidjson::kArrayType);
+    size_t first = 0;
+    for(double bound : sHistogramBounds)
+    {
+        size_t last = std::upper_bound(latencies.begin() + first, latencies.end(), bound) - latencies.begin();
+        rapidjson::Value bucket(rapidjson::kObjectType);
+        bucket.AddMember("le_ms", bound, allocator);
+        bucket.AddMember("count", static_cast<uint64>(last - first), allocator);
+        buckets.PushBack(bucket, allocator);
+        first = last;
+    }
+    if(first < latencies.size())
+    {
+        rapidjson::Value bucket(rapidjson::kObjectType);
+        bucket.AddMember("gt_ms", sHistogramBounds.back(), allocator);
+        bucket.AddMember("count", static_cast<uint64>(latencies.size() - first), allocator);
+        buckets.PushBack(bucket, allocator);
+    }
+    result.AddMember("histogram", buckets, allocator);
+}
+
+
+static bool resolve(const std::string& host, int port, sockaddr_in& address)
+{
+    addrinfo hints = {};
+    hints.ai_family = AF_INET;
+    hints.ai_socktype = SOCK_STREAM;
+    addrinfo* result = nullptr;
+    if(::getaddrinfo(host.c_str(), std::to_string(port).c_str(), &hints, &result) != 0 || result == nullptr)
+        return false;
+    address = *reinterpret_cast<sockaddr_in*>(result->ai_addr);
+    ::freeaddrinfo(result);
+    return true;
+}
+
+
+static bool parseMix(const std::string& value, std::vector<float>& weights)
+{
+    weights.assign(sWindowNames.size(), 0.0f);
+    for(const auto& entry : utility::splitString(value, ','))
+    {
+        auto parts = utility::splitString(entry, ':');
+        auto it = std::find(sWindowNames.begin(), sWindowNames.end(), parts[0]);
+        if(parts.size() != 2 || it == sWindowNames.end())
+            return false;
+        weights[it - sWindowNames.begin()] = std::stof(parts[1]);
+    }
+    return std::any_of(weights.begin(), weights.end(), [](float weight) { return weight > 0.0f; });
+}
+
+
+int main(int argc, char *argv[])
+{
+    Settings settings;
+    std::string mix = "cache:4,db:1,span:1";
+    std::string output;
+
+    for(int i = 1; i < argc; i++)
+    {
+        std::string arg = argv[i];
+        if(arg == "--help" || i + 1 >= argc)
+        {
+            std::cout << "usage: loadgenerator [--host 127.0.0.1] [--port 8080] [--method post|get] [--concurrency 8] [--duration 30] "
+                         "[--requests 0] [--warmup 2] [--mix cache:4,db:1,span:1] [--postal-share 0.2] [--disturbance-share 0.5] "
+                         "[--cache-hours 24] [--history-hours 48] [--window 60] [--seed 1] [--pro6pp-port 0] [--postal-codes 100] "
+                         "[--max-p99 0] [--max-error-rate 0] [--output report.json]" << std::endl;
+            return arg == "--help" ? 0 : -1;
+        }
+
+        std::string value = argv[++i];
+        if(arg == "--host")
+            settings.mHost = value;
+        else if(arg == "--port")
+            settings.mPort = std::stoi(value);
+        else if(arg == "--method")
+            settings.mPost = value != "get";
+        else if(arg == "--concurrency")
+            settings.mConcurrency = std::stoi(value);
+        else if(arg == "--duration")
+            settings.mDuration = std::stod(value);
+        else if(arg == "--requests")
+            settings.mRequests = std::stoull(value);
+        else if(arg == "--warmup")
+            settings.mWarmup = std::stod(value);
+        else if(arg == "--mix")
+            mix = value;
+        else if(arg == "--postal-share")
+            settings.mPostalShare = std::stof(value);
+        else if(arg == "--disturbance-share")
+            settings.mDisturbanceShare = std::stof(value);
+        else if(arg == "--cache-hours")
+            settings.mCacheHours = std::stoi(value);
+        else if(arg == "--history-hours")
+            settings.mHistoryHours = std::stoi(value);
+        else if(arg == "--window")
+            settings.mWindowMinutes = std::stoi(value);
+        else if(arg == "--seed")
+            settings.mSeed = static_cast<uint32>(std::stoul(value));
+        else if(arg == "--pro6pp-port")
+            settings.mPro6ppPort = std::stoi(value);
+        else if(arg == "--postal-codes")
+            settings.mPostalCodes = std::stoi(value);
+        else if(arg == "--max-p99")
+            settings.mMaxP99 = std::stod(value);
+        else if(arg == "--max-error-rate")
+            settings.mMaxErrorRate = std::stod(value);
+        else if(arg == "--output")
+            output = value;
+        else
+        {
+            nap::Logger::fatal("unknown argument: %s", arg.c_str());
+            return -1;
+        }
+    }
+
+    // The windows must fit the cache and the history, the database window has to fit between both
+    utility::ErrorState error;
+    if(!error.check(parseMix(mix, settings.mWindowWeights), "invalid mix %s, expected weights of cache, db and span", mix.c_str()) ||
+       !error.check(settings.mConcurrency > 0, "concurrency must be greater than 0") ||
+       !error.check(settings.mWindowMinutes > 1 && settings.mWindowMinutes <= settings.mCacheHours * 60,
+                    "window must be greater than 1 minute and fit the cache") ||
+       !error.check(settings.mWindowWeights[static_cast<int>(EWindow::Database)] <= 0.0f ||
+                    settings.mHistoryHours * 60 >= settings.mCacheHours * 60 + sCacheMarginMinutes + settings.mWindowMinutes,
+                    "history must exceed the cache by at least the window to query the database") ||
+       !error.check(settings.mPostalShare <= 0.0f || settings.mPostalCodes > 0, "postal codes must be greater than 0"))
+    {
+        nap::Logger::fatal("error: %s", error.toString().c_str());
+        return -1;
+    }
+
+    sockaddr_in address = {};
+    if(!resolve(settings.mHost, settings.mPort, address))
+    {
+        nap::Logger::fatal("error resolving %s", settings.mHost.c_str());
+        return -1;
+    }
+
+    // Dutch postal codes are 4 digits and 2 letters, the lookups of a small pool mostly hit the address cache
+    std::mt19937 random(settings.mSeed);
+    std::vector<std::string> postal_codes;
+    for(int i = 0; i < settings.mPostalCodes; i++)
+    {
+        std::uniform_int_distribution<int> digits(1000, 9999);
+        std::uniform_int_distribution<int> letter('A', 'Z');
+        postal_codes.emplace_back(utility::stringFormat("%d%c%c", digits(random), letter(random), letter(random)));
+    }
+
+    std::signal(SIGPIPE, SIG_IGN);
+    Run run;
+    std::atomic<uint64> lookups = { 0 };
+    std::thread pro6pp_stub;
+    int pro6pp_listener = -1;
+    if(settings.mPro6ppPort > 0)
+    {
+        pro6pp_listener = ::socket(AF_INET, SOCK_STREAM, 0);
+        int reuse = 1;
+        ::setsockopt(pro6pp_listener, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse));
+        sockaddr_in stub_address = {};
+        stub_address.sin_family = AF_INET;
+        stub_address.sin_addr.s_addr = htonl(INADDR_ANY);
+        stub_address.sin_port = htons(static_cast<uint16_t>(settings.mPro6ppPort));
+        if(pro6pp_listener < 0 || ::bind(pro6pp_listener, reinterpret_cast<sockaddr*>(&stub_address), sizeof(stub_address)) != 0 ||
+           ::listen(pro6pp_listener, 16) != 0)
+        {
+            nap::Logger::fatal("error listening on port %d: %s", settings.mPro6ppPort, std::strerror(errno));
+            return -1;
+        }
+        pro6pp_stub = std::thread([&]() { runPro6ppStub(pro6pp_listener, run, lookups); });
+    }
+
+    nap::Logger::info("Loading %s:%d with %d connections", settings.mHost.c_str(), settings.mPort, settings.mConcurrency);
+    std::vector<std::vector<Sample>> worker_samples(settings.mConcurrency);
+    std::vector<std::thread> workers;
+    for(int i = 0; i < settings.mConcurrency; i++)
+    {
+        workers.emplace_back([&, i]()
+        {
+            runWorker(settings, address, settings.mSeed + static_cast<uint32>(i) + 1, postal_codes, run, worker_samples[i]);
+        });
+    }
+
+    // Warm up, then measure until the duration passed or the requested number of requests completed
+    std::this_thread::sleep_for(std::chrono::duration<double>(settings.mWarmup));
+    run.mMeasuring = true;
+    auto start = std::chrono::steady_clock::now();
+    auto last_report = start;
+    uint64 last_completed = 0;
+    while(true)
+    {
+        std::this_thread::sleep_for(std::chrono::milliseconds(100));
+        auto now = std::chrono::steady_clock::now();
+        double elapsed = std::chrono::duration<double>(now - start).count();
+        bool finished = settings.mRequests > 0 ? run.mCompleted >= settings.mRequests : elapsed >= settings.mDuration;
+        if(finished)
+            break;
+
+        double since_report = std::chrono::duration<double>(now - last_report).count();
+        if(since_report >= 5.0)
+        {
+            uint64 completed = run.mCompleted;
+            nap::Logger::info("%llu requests, %llu errors, %.1f requests/s", static_cast<unsigned long long>(completed),
+                              static_cast<unsigned long long>(run.mFailed.load()), (completed - last_completed) / since_report);
+            last_report = now;
+            last_completed = completed;
+        }
+    }
+
+    // Requests in flight are completed, they count towards the results
+    run.mStop = true;
+    for(auto& worker : workers)
+        worker.join();
+    double elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    if(pro6pp_stub.joinable())
+    {
+        pro6pp_stub.join();
+        ::close(pro6pp_listener);
+    }
+
+    std::vector<const Sample*> all;
+    std::vector<std::vector<const Sample*>> groups(sGroupCount);
+    for(const auto& samples : worker_samples)
+    {
+        for(const auto& sample : samples)
+        {
+            all.emplace_back(&sample);
+            groups[sample.mGroup].emplace_back(&sample);
+        }
+    }
+
+    // Write the report
+    rapidjson::Document document(rapidjson::kObjectType);
+    auto& allocator = document.GetAllocator();
+    document.AddMember("host", rapidjson::Value(settings.mHost.c_str(), allocator), allocator);
+    document.AddMember("port", settings.mPort, allocator);
+    document.AddMember("concurrency", settings.mConcurrency, allocator);
+    document.AddMember("mix", rapidjson::Value(mix.c_str(), allocator), allocator);
+    document.AddMember("postal_share", settings.mPostalShare, allocator);
+    document.AddMember("disturbance_share", settings.mDisturbanceShare, allocator);
+    document.AddMember("window_minutes", settings.mWindowMinutes, allocator);
+    document.AddMember("seed", settings.mSeed, allocator);
+    document.AddMember("elapsed_seconds", elapsed, allocator);
+    document.AddMember("pro6pp_lookups", lookups.load(), allocator);
+
+    rapidjson::Value total(rapidjson::kObjectType);
+    addToJson(all, elapsed, true, total, document);
+    document.AddMember("total", total, allocator);
+
+    rapidjson::Value results(rapidjson::kArrayType);
+    for(int endpoint = 0; endpoint < static_cast<int>(sEndpoints.size()); endpoint++)
+    {
+        for(int window = 0; window < static_cast<int>(sWindowNames.size()); window++)
+        {
+            for(int location = 0; location < static_cast<int>(sLocationNames.size()); location++)
+            {
+                const auto& samples = groups[getGroup(endpoint, static_cast<EWindow>(window), location)];
+                if(samples.empty())
+                    continue;
+
+                rapidjson::Value result(rapidjson::kObjectType);
+                result.AddMember("endpoint", rapidjson::Value(sEndpoints[endpoint].c_str(), allocator), allocator);
+                result.AddMember("window", rapidjson::Value(sWindowNames[window].c_str(), allocator), allocator);
+                result.AddMember("location", rapidjson::Value(sLocationNames[location].c_str(), allocator), allocator);
+                addToJson(samples, elapsed, false, result, document);
+                results.PushBack(result, allocator);
+            }
+        }
+    }
+    document.AddMember("results", results, allocator);
+
+    // The gate compares the overall latency and error rate with the limits, a p99 limit of 0 is not checked
+    // and an error rate limit of 0 allows no errors at all
+    std::vector<double> latencies;
+    uint64 errors = 0;
+    for(const auto* sample : all)
+    {
+        if(sample->mOk)
+            latencies.emplace_back(sample->mMillis);
+        else
+            errors++;
+    }
+    std::sort(latencies.begin(), latencies.end());
+    double p99 = percentile(latencies, 0.99);
+    double error_rate = all.empty() ? 1.0 : static_cast<double>(errors) / all.size();
+    bool passed = !all.empty() && (settings.mMaxP99 <= 0.0 || p99 <= settings.mMaxP99) &&
+                  (settings.mMaxErrorRate <= 0.0 ? errors == 0 : error_rate <= settings.mMaxErrorRate);
+    document.AddMember("max_p99_ms", settings.mMaxP99, allocator);
+    document.AddMember("max_error_rate", settings.mMaxErrorRate, allocator);
+    document.AddMember("passed", passed, allocator);
+
+    rapidjson::StringBuffer buffer;
+    rapidjson::PrettyWriter<rapidjson::StringBuffer> writer(buffer);
+    writer.SetMaxDecimalPlaces(4);
+    document.Accept(writer);
+
+    if(output.empty())
+    {
+        std::cout << buffer.GetString() << std::endl;
+    }else
+    {
+        std::ofstream file(output);
+        file << buffer.GetString() << std::endl;
+        if(!file)
+        {
+            nap::Logger::fatal("error: unable to write %s", output.c_str());
+            return -1;
+        }
+    }
+
+    if(!passed)
+        nap::Logger::error("Gate failed: p99 %.1f ms, %llu errors of %zu requests", p99, static_cast<unsigned long long>(errors), all.size());
+    return passed ? 0 : 1;
+}
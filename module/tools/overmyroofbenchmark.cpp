@@ -0,0 +1,403 @@
+// overmyroofbenchmark.cpp : Measures the hot paths of the module on generated traffic.
+//
+// Every hot path runs at several numbers of aircraft, the results are written as json so builds can be compared.
+// The size of the stored rows is measured with and without delta encoding on the same traffic.
+// Usage: overmyroofbenchmark [--seed 1] [--sizes 1000,4000,16000] [--snapshots 360] [--interval 10]
+//                            [--min-time 0.5] [--output results.json]
+
+// Local Includes
+#include "trafficgenerator.h"
+#include "statescache.h"
+#include "statesqueryplanner.h"
+#include "disturbancedetector.h"
+#include "disturbancewatches.h"
+#include "utils.h"
+
+// Nap includes
+#include <nap/logger.h>
+#include <utility/stringutils.h>
+#include <rapidjson/document.h>
+#include <rapidjson/prettywriter.h>
+#include <rapidjson/stringbuffer.h>
+
+// External includes
+#include <algorithm>
+#include <chrono>
+#include <fstream>
+#include <iostream>
+#include <functional>
+
+namespace nap
+{
+    double NAPAPI calcGPSDistance(double latitude_new, double longitude_new, double latitude_old, double longitude_old);
+}
+
+using namespace nap;
+
+// Queries are made around the busiest airport, below the altitude of the disturbance queries
+static constexpr float sQueryLatitude = 52.3086f;
+static constexpr float sQueryLongitude = 4.7639f;
+static constexpr float sQueryRadius = 10000.0f;
+static constexpr float sQueryAltitude = 3000.0f;
+
+// Watches are registered around the airports, the watches loop replays the most recent snapshots
+static constexpr int sWatchCount = 1000;
+static constexpr int sWatchSnapshots = 30;
+
+// Every measurement runs at least this often, also when the minimum time has passed
+static constexpr size_t sMinIterations = 5;
+
+// Delta encoding as configured by default in the logger
+static constexpr int sKeyFrameInterval = 300;
+static constexpr float sDeltaThreshold = 50.0f;
+
+// Generated history starts at a fixed moment, so the results don't depend on the moment the benchmark runs
+static constexpr uint64 sStartTimeStamp = 20240603060000;
+
+// Results of the measured code end up here, so the compiler can't optimize it away
+static volatile double sSink = 0.0;
+
+/**
+ * The timings of one hot path at one number of aircraft
+ */
+struct Measurement
+{
+    std::string mName;
+    int mSize = 0; ///< Number of aircraft in a snapshot
+    size_t mItems = 0; ///< Number of items processed by a single run
+    std::vector<double> mSamples; ///< Duration of every run in nanoseconds
+};
+
+
+/**
+ * The size of the rows the logger stores for the generated history at one number of aircraft, before compression
+ */
+struct StorageMeasurement
+{
+    int mSize = 0; ///< Number of aircraft in a snapshot
+    size_t mRows = 0; ///< Number of snapshots stored
+    size_t mKeyFrames = 0; ///< Number of rows stored as keyframe when delta encoding
+    uint64 mKeyFrameBytes = 0; ///< Total size of the rows when every row is a keyframe
+    uint64 mDeltaBytes = 0; ///< Total size of the rows when delta encoding
+};
+
+
+/**
+ * Runs the function once to warm up, then repeatedly until both the minimum time and number of iterations are reached
+ * @param function returns the number of items it processed
+ */
+static Measurement measure(const std::string& name, int size, double minSeconds, const std::function<size_t()>& function)
+{
+    Measurement measurement;
+    measurement.mName = name;
+    measurement.mSize = size;
+    function();
+
+    auto start = std::chrono::steady_clock::now();
+    do
+    {
+        auto begin = std::chrono::steady_clock::now();
+        measurement.mItems = function();
+        measurement.mSamples.emplace_back(std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - begin).count());
+    }while(measurement.mSamples.size() < sMinIterations ||
+           std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count() < minSeconds);
+
+    std::cerr << utility::stringFormat("%-24s %8d aircraft %10zu iterations", name.c_str(), size, measurement.mSamples.size()) << std::endl;
+    return measurement;
+}
+
+
+static bool benchmarkSize(uint32 seed, int size, int snapshots, int interval, double minSeconds,
+                          std::vector<Measurement>& measurements, std::vector<StorageMeasurement>& storage, utility::ErrorState& errorState)
+{
+    // Fill the cache with the history of the generated traffic
+    StatesCache cache;
+    cache.mMaxEntries = snapshots;
+    if(!cache.init(errorState))
+        return false;
+
+    // Every snapshot is also encoded the way the logger stores it, as keyframe and as delta against the reconstructed snapshot
+    StorageMeasurement rows;
+    rows.mSize = size;
+    std::vector<FlightState> base_states;
+
+    TrafficGenerator generator(seed, size);
+    std::vector<std::vector<FlightState>> recent;
+    uint64 timestamp = sStartTimeStamp;
+    for(int i = 0; i < snapshots; i++)
+    {
+        generator.advance(static_cast<float>(interval));
+        std::vector<FlightState> states;
+        generator.getStates(states);
+        cache.addStates(timestamp, states);
+
+        FlightStatesData keyframe_row;
+        keyframe_row.WriteData(states);
+        rows.mKeyFrameBytes += keyframe_row.mData.size();
+
+        std::vector<FlightState> snapshot = states;
+        FlightStatesDelta::sortByICAO(snapshot);
+        if((i * interval) % sKeyFrameInterval < interval)
+        {
+            base_states = std::move(snapshot);
+            rows.mDeltaBytes += keyframe_row.mData.size();
+            rows.mKeyFrames++;
+        }else
+        {
+            FlightStatesDelta delta;
+            FlightStatesDelta::create(base_states, snapshot, sDeltaThreshold, delta);
+            FlightStatesData delta_row;
+            delta_row.WriteDelta(delta);
+            delta.apply(base_states);
+            rows.mDeltaBytes += delta_row.mData.size();
+        }
+        rows.mRows++;
+        if(i >= snapshots - sWatchSnapshots)
+            recent.emplace_back(std::move(states));
+
+        if(!utility::addToTimeStamp(timestamp, std::chrono::seconds(interval), timestamp, errorState))
+            return false;
+    }
+    storage.emplace_back(rows);
+    std::cerr << utility::stringFormat("%-24s %8d aircraft %10.1f%% of keyframe size", "row_size", size,
+                                       100.0 * rows.mDeltaBytes / std::max<uint64>(rows.mKeyFrameBytes, 1)) << std::endl;
+
+    // Keyframe of the newest snapshot, as stored by the logger
+    FlightStatesData keyframe;
+    keyframe.mTimeStamp = cache.getMostRecentTimeStamp();
+    keyframe.WriteData(recent.back());
+
+    measurements.emplace_back(measure("parse_data", size, minSeconds, [&]()
+    {
+        std::vector<FlightState> states;
+        utility::ErrorState error_state;
+        keyframe.ParseData(states, -1, error_state);
+        return states.size();
+    }));
+
+    measurements.emplace_back(measure("parse_data_below_altitude", size, minSeconds, [&]()
+    {
+        std::vector<FlightState> states;
+        utility::ErrorState error_state;
+        keyframe.ParseData(states, sQueryAltitude, error_state);
+        return static_cast<size_t>(size);
+    }));
+
+    measurements.emplace_back(measure("gps_distance", size, minSeconds, [&]()
+    {
+        double total = 0.0;
+        for(const auto& state : recent.back())
+            total += calcGPSDistance(sQueryLatitude, sQueryLongitude, state.mLatitude, state.mLongitude);
+        sSink = total;
+        return recent.back().size();
+    }));
+
+    uint64 oldest = cache.getOldestTimeStamp();
+    uint64 newest = cache.getMostRecentTimeStamp();
+    measurements.emplace_back(measure("cache_get_states", size, minSeconds, [&]()
+    {
+        std::vector<FlightStates> states;
+        cache.getStates(oldest, newest, sQueryAltitude, states);
+        return states.size();
+    }));
+
+    // The core of find_flights, the whole window is read from the cache
+    StatesQueryPlanner planner(nullptr);
+    planner.addTier(std::make_unique<CacheStatesTier>(cache));
+    StatesQuery query;
+    query.mLatitude = sQueryLatitude;
+    query.mLongitude = sQueryLongitude;
+    query.mRadius = sQueryRadius;
+    query.mAltitude = sQueryAltitude;
+
+    StatesQueryPlanner::Result flights;
+    measurements.emplace_back(measure("get_flights", size, minSeconds, [&]()
+    {
+        flights = StatesQueryPlanner::Result();
+        utility::ErrorState error_state;
+        planner.execute(oldest - 1, newest, query, flights, error_state);
+        return flights.mRows;
+    }));
+
+    // The loop of find_disturbances over the found flights, which are in time order
+    measurements.emplace_back(measure("disturbance_detector", size, minSeconds, [&]()
+    {
+        DisturbanceDetector detector(5, 3);
+        utility::ErrorState error_state;
+        for(const auto& flight : flights.mFlights)
+            detector.addFlight(flight.mTimeStamp, error_state);
+        detector.finish();
+
+        std::vector<DisturbancePeriod> periods;
+        detector.takePeriods(periods);
+        sSink = static_cast<double>(periods.size());
+        return flights.mFlights.size();
+    }));
+
+    // Every new snapshot is evaluated against all registered watches
+    DisturbanceWatches watches;
+    if(!watches.init(errorState))
+        return false;
+
+    std::mt19937 random(seed);
+    std::normal_distribution<float> spread(0.0f, 0.2f);
+    const auto& airports = TrafficGenerator::getAirports();
+    for(int i = 0; i < sWatchCount; i++)
+    {
+        const auto& airport = airports[i % airports.size()];
+        std::string id;
+        if(!watches.addWatch(airport.mLatitude + spread(random), airport.mLongitude + spread(random), 2000.0f, sQueryAltitude, 5, 3, id, errorState))
+            return false;
+    }
+
+    size_t snapshot = 0;
+    uint64 watch_timestamp = newest;
+    measurements.emplace_back(measure("disturbance_watches", size, minSeconds, [&]()
+    {
+        utility::ErrorState error_state;
+        utility::addToTimeStamp(watch_timestamp, std::chrono::seconds(interval), watch_timestamp, error_state);
+        const auto& states = recent[snapshot++ % recent.size()];
+        watches.addStates(watch_timestamp, states);
+        return states.size();
+    }));
+
+    return true;
+}
+
+
+static void addToJson(const Measurement& measurement, rapidjson::Value& results, rapidjson::Document& document)
+{
+    std::vector<double> samples = measurement.mSamples;
+    std::sort(samples.begin(), samples.end());
+    double total = 0.0;
+    for(double sample : samples)
+        total += sample;
+    double median = samples[samples.size() / 2];
+
+    rapidjson::Value result(rapidjson::kObjectType);
+    result.AddMember("name", rapidjson::Value(measurement.mName.c_str(), document.GetAllocator()), document.GetAllocator());
+    result.AddMember("size", measurement.mSize, document.GetAllocator());
+    result.AddMember("iterations", static_cast<uint64>(samples.size()), document.GetAllocator());
+    result.AddMember("items", static_cast<uint64>(measurement.mItems), document.GetAllocator());
+    result.AddMember("mean_ns", total / samples.size(), document.GetAllocator());
+    result.AddMember("median_ns", median, document.GetAllocator());
+    result.AddMember("min_ns", samples.front(), document.GetAllocator());
+    result.AddMember("max_ns", samples.back(), document.GetAllocator());
+    result.AddMember("items_per_second", median > 0.0 ? measurement.mItems / (median / 1e9) : 0.0, document.GetAllocator());
+    results.PushBack(result, document.GetAllocator());
+}
+
+
+static void addToJson(const StorageMeasurement& measurement, rapidjson::Value& results, rapidjson::Document& document)
+{
+    rapidjson::Value result(rapidjson::kObjectType);
+    result.AddMember("size", measurement.mSize, document.GetAllocator());
+    result.AddMember("rows", static_cast<uint64>(measurement.mRows), document.GetAllocator());
+    result.AddMember("keyframes", static_cast<uint64>(measurement.mKeyFrames), document.GetAllocator());
+    result.AddMember("keyframe_bytes_per_row", static_cast<double>(measurement.mKeyFrameBytes) / std::max<size_t>(measurement.mRows, 1), document.GetAllocator());
+    result.AddMember("delta_bytes_per_row", static_cast<double>(measurement.mDeltaBytes) / std::max<size_t>(measurement.mRows, 1), document.GetAllocator());
+    result.AddMember("delta_ratio", static_cast<double>(measurement.mDeltaBytes) / std::max<uint64>(measurement.mKeyFrameBytes, 1), document.GetAllocator());
+    results.PushBack(result, document.GetAllocator());
+}
+
+
+int main(int argc, char *argv[])
+{
+    uint32 seed = 1;
+    std::vector<int> sizes = { 1000, 4000, 16000 };
+    int snapshots = 360;
+    int interval = 10;
+    double min_seconds = 0.5;
+    std::string output;
+
+    for(int i = 1; i < argc; i++)
+    {
+        std::string arg = argv[i];
+        if(arg == "--help" || i + 1 >= argc)
+        {
+            std::cout << "usage: overmyroofbenchmark [--seed 1] [--sizes 1000,4000,16000] [--snapshots 360] [--interval 10] "
+                         "[--min-time 0.5] [--output results.json]" << std::endl;
+            return arg == "--help" ? 0 : -1;
+        }
+
+        std::string value = argv[++i];
+        if(arg == "--seed")
+            seed = static_cast<uint32>(std::stoul(value));
+        else if(arg == "--sizes")
+        {
+            sizes.clear();
+            for(const auto& size : utility::splitString(value, ','))
+                sizes.emplace_back(std::stoi(size));
+        }
+        else if(arg == "--snapshots")
+            snapshots = std::stoi(value);
+        else if(arg == "--interval")
+            interval = std::stoi(value);
+        else if(arg == "--min-time")
+            min_seconds = std::stod(value);
+        else if(arg == "--output")
+            output = value;
+        else
+        {
+            nap::Logger::fatal("unknown argument: %s", arg.c_str());
+            return -1;
+        }
+    }
+
+    if(snapshots < sWatchSnapshots || interval <= 0)
+    {
+        nap::Logger::fatal("snapshots must be at least %d and interval greater than 0", sWatchSnapshots);
+        return -1;
+    }
+
+    std::vector<Measurement> measurements;
+    std::vector<StorageMeasurement> storage;
+    for(int size : sizes)
+    {
+        utility::ErrorState error;
+        if(!benchmarkSize(seed, size, snapshots, interval, min_seconds, measurements, storage, error))
+        {
+            nap::Logger::fatal("error: %s", error.toString().c_str());
+            return -1;
+        }
+    }
+
+    // Write the results
+    rapidjson::Document document(rapidjson::kObjectType);
+    document.AddMember("seed", seed, document.GetAllocator());
+    document.AddMember("snapshots", snapshots, document.GetAllocator());
+    document.AddMember("interval", interval, document.GetAllocator());
+    document.AddMember("min_time", min_seconds, document.GetAllocator());
+    rapidjson::Value results(rapidjson::kArrayType);
+    for(const auto& measurement : measurements)
+        addToJson(measurement, results, document);
+    document.AddMember("results", results, document.GetAllocator());
+
+    // Uncompressed row sizes, keyframes every KeyFrameInterval seconds and deltas with the default DeltaThreshold in between
+    rapidjson::Value storage_results(rapidjson::kArrayType);
+    for(const auto& measurement : storage)
+        addToJson(measurement, storage_results, document);
+    document.AddMember("key_frame_interval", sKeyFrameInterval, document.GetAllocator());
+    document.AddMember("delta_threshold", sDeltaThreshold, document.GetAllocator());
+    document.AddMember("storage", storage_results, document.GetAllocator());
+
+    rapidjson::StringBuffer buffer;
+    rapidjson::PrettyWriter<rapidjson::StringBuffer> writer(buffer);
+    writer.SetMaxDecimalPlaces(4);
+    document.Accept(writer);
+
+    if(output.empty())
+    {
+        std::cout << buffer.GetString() << std::endl;
+        return 0;
+    }
+
+    std::ofstream file(output);
+    file << buffer.GetString() << std::endl;
+    if(!file)
+    {
+        nap::Logger::fatal("error: unable to write %s", output.c_str());
+        return -1;
+    }
+    return 0;
+}
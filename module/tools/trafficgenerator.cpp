@@ -0,0 +1,212 @@
+#include "trafficgenerator.h"
+
+#include <utility/stringutils.h>
+#include <algorithm>
+#include <cmath>
+
+namespace nap
+{
+    // Meters per degree latitude, used to move aircraft and measure their distance to an airport
+    static constexpr float sMetersPerDegree = 111320.0f;
+
+    // Altitude gained per meter of ground distance, a 3 degree approach and a steeper climb out
+    static constexpr float sApproachSlope = 0.052f;
+    static constexpr float sClimbSlope = 0.07f;
+    static constexpr float sCruiseAltitude = 11000.0f;
+
+    // Arrivals spawn and departures are replaced within this distance of their airport
+    static constexpr float sTerminalRadius = 150000.0f;
+    static constexpr float sEnRouteRadius = 500000.0f;
+
+    struct AircraftType
+    {
+        const char* mCode;
+        float mWeight;
+    };
+
+    static const std::vector<AircraftType> sAircraftTypes =
+    {
+        { "A320", 14.0f }, { "B738", 14.0f }, { "A20N", 10.0f }, { "A321", 8.0f }, { "E190", 6.0f }, { "B38M", 6.0f },
+        { "A319", 5.0f }, { "AT76", 4.0f }, { "CRJ9", 3.0f }, { "DH8D", 3.0f }, { "B77W", 3.0f }, { "B789", 3.0f },
+        { "A359", 2.0f }, { "A333", 2.0f }, { "C172", 4.0f }, { "PA28", 3.0f }, { "PC12", 2.0f }, { "EC35", 2.0f }
+    };
+
+
+    const std::vector<TrafficGenerator::Airport>& TrafficGenerator::getAirports()
+    {
+        static const std::vector<Airport> airports =
+        {
+            { "EHAM", 52.3086f, 4.7639f, "PH-", 1.0f },
+            { "EGLL", 51.4700f, -0.4543f, "G-", 1.0f },
+            { "LFPG", 49.0097f, 2.5479f, "F-", 0.9f },
+            { "EDDF", 50.0379f, 8.5622f, "D-", 0.9f },
+            { "LEMD", 40.4983f, -3.5676f, "EC-", 0.7f },
+            { "EDDM", 48.3538f, 11.7861f, "D-", 0.6f },
+            { "LIRF", 41.8003f, 12.2389f, "I-", 0.5f },
+            { "EGKK", 51.1537f, -0.1821f, "G-", 0.5f },
+            { "EBBR", 50.9010f, 4.4844f, "OO-", 0.4f },
+            { "LSZH", 47.4582f, 8.5555f, "HB-", 0.4f },
+            { "EKCH", 55.6180f, 12.6508f, "OY-", 0.4f },
+            { "LOWW", 48.1103f, 16.5697f, "OE-", 0.4f },
+            { "EHEH", 51.4501f, 5.3745f, "PH-", 0.15f },
+            { "EHRD", 51.9569f, 4.4372f, "PH-", 0.1f }
+        };
+        return airports;
+    }
+
+
+    static void offset(float latitude, float longitude, float distance, float bearing, float& resultLatitude, float& resultLongitude)
+    {
+        resultLatitude = latitude + std::cos(bearing) * distance / sMetersPerDegree;
+        resultLongitude = longitude + std::sin(bearing) * distance / (sMetersPerDegree * std::cos(latitude * static_cast<float>(M_PI) / 180.0f));
+    }
+
+
+    static void toAirport(const FlightState& state, const TrafficGenerator::Airport& airport, float& distance, float& bearing)
+    {
+        float north = (airport.mLatitude - state.mLatitude) * sMetersPerDegree;
+        float east = (airport.mLongitude - state.mLongitude) * sMetersPerDegree * std::cos(state.mLatitude * static_cast<float>(M_PI) / 180.0f);
+        distance = std::sqrt(north * north + east * east);
+        bearing = std::atan2(east, north);
+    }
+
+
+    TrafficGenerator::TrafficGenerator(uint32 seed, int aircraftCount) : mRandom(seed)
+    {
+        std::vector<float> weights;
+        for(const auto& airport : getAirports())
+            weights.emplace_back(airport.mWeight);
+        mAirportDistribution = std::discrete_distribution<int>(weights.begin(), weights.end());
+
+        weights.clear();
+        for(const auto& type : sAircraftTypes)
+            weights.emplace_back(type.mWeight);
+        mTypeDistribution = std::discrete_distribution<int>(weights.begin(), weights.end());
+
+        mAircraft.resize(aircraftCount);
+        for(auto& aircraft : mAircraft)
+            spawn(aircraft);
+    }
+
+
+    void TrafficGenerator::advance(float seconds)
+    {
+        for(auto& aircraft : mAircraft)
+        {
+            auto& state = aircraft.mState;
+            float distance, bearing;
+            if(aircraft.mPhase == EPhase::Arrival)
+            {
+                // Arrivals fly straight at the airport and descend with the distance left
+                toAirport(state, *aircraft.mAirport, distance, bearing);
+                float step = aircraft.mSpeed * seconds;
+                if(step >= distance)
+                {
+                    spawn(aircraft);
+                    continue;
+                }
+                aircraft.mHeading = bearing;
+                offset(state.mLatitude, state.mLongitude, step, aircraft.mHeading, state.mLatitude, state.mLongitude);
+                state.mAltitude = std::min((distance - step) * sApproachSlope, sCruiseAltitude);
+                continue;
+            }
+
+            offset(state.mLatitude, state.mLongitude, aircraft.mSpeed * seconds, aircraft.mHeading, state.mLatitude, state.mLongitude);
+            toAirport(state, *aircraft.mAirport, distance, bearing);
+            if(aircraft.mPhase == EPhase::Departure)
+            {
+                if(distance > sTerminalRadius)
+                {
+                    spawn(aircraft);
+                    continue;
+                }
+                state.mAltitude = std::min(distance * sClimbSlope, sCruiseAltitude);
+            }else if(distance > sEnRouteRadius)
+            {
+                spawn(aircraft);
+            }
+        }
+    }
+
+
+    void TrafficGenerator::getStates(std::vector<FlightState>& states) const
+    {
+        size_t first = states.size();
+        for(const auto& aircraft : mAircraft)
+            states.emplace_back(aircraft.mState);
+
+        std::sort(states.begin() + first, states.end(), [](const FlightState& a, const FlightState& b)
+        {
+            return a.mAltitude < b.mAltitude;
+        });
+    }
+
+
+    void TrafficGenerator::spawn(Aircraft& aircraft)
+    {
+        const auto& airport = pickAirport();
+        aircraft.mAirport = &airport;
+
+        auto& state = aircraft.mState;
+        state.mICAO = createICAO();
+        state.mRegistration = createRegistration(airport.mRegistrationPrefix);
+        state.mAircraftType = sAircraftTypes[mTypeDistribution(mRandom)].mCode;
+
+        // Most traffic is close to an airport, the distance falls off exponentially
+        std::uniform_real_distribution<float> unit(0.0f, 1.0f);
+        float bearing = unit(mRandom) * 2.0f * static_cast<float>(M_PI);
+        float phase = unit(mRandom);
+        if(phase < 0.35f)
+        {
+            float distance = std::min(std::exponential_distribution<float>(1.0f / 30000.0f)(mRandom) + 2000.0f, sTerminalRadius);
+            aircraft.mPhase = EPhase::Arrival;
+            aircraft.mHeading = bearing + static_cast<float>(M_PI);
+            aircraft.mSpeed = 70.0f + 150.0f * distance / sTerminalRadius;
+            offset(airport.mLatitude, airport.mLongitude, distance, bearing, state.mLatitude, state.mLongitude);
+            state.mAltitude = std::min(distance * sApproachSlope, sCruiseAltitude);
+        }else if(phase < 0.7f)
+        {
+            float distance = std::min(std::exponential_distribution<float>(1.0f / 20000.0f)(mRandom) + 500.0f, sTerminalRadius);
+            aircraft.mPhase = EPhase::Departure;
+            aircraft.mHeading = bearing;
+            aircraft.mSpeed = 80.0f + 150.0f * distance / sTerminalRadius;
+            offset(airport.mLatitude, airport.mLongitude, distance, bearing, state.mLatitude, state.mLongitude);
+            state.mAltitude = std::min(distance * sClimbSlope, sCruiseAltitude);
+        }else
+        {
+            // En route traffic cruises at a flight level somewhere between the airports
+            float distance = sTerminalRadius + unit(mRandom) * (sEnRouteRadius - 2.0f * sTerminalRadius);
+            aircraft.mPhase = EPhase::EnRoute;
+            aircraft.mHeading = unit(mRandom) * 2.0f * static_cast<float>(M_PI);
+            aircraft.mSpeed = 220.0f + unit(mRandom) * 30.0f;
+            offset(airport.mLatitude, airport.mLongitude, distance, bearing, state.mLatitude, state.mLongitude);
+            state.mAltitude = 9000.0f + std::floor(unit(mRandom) * 10.0f) * 300.0f;
+        }
+    }
+
+
+    const TrafficGenerator::Airport& TrafficGenerator::pickAirport()
+    {
+        return getAirports()[mAirportDistribution(mRandom)];
+    }
+
+
+    uint64 TrafficGenerator::createICAO()
+    {
+        // Multiplying by an odd number permutes the 24 bit addresses, so they are unique without being sequential
+        uint32 address = (mNextICAO++ * 2654435761u) & 0xFFFFFF;
+        return parseICAO(utility::stringFormat("%06X", address).c_str());
+    }
+
+
+    std::string TrafficGenerator::createRegistration(const char* prefix)
+    {
+        // Registrations with a single letter country prefix have four more letters, the others three
+        std::string registration = prefix;
+        int letters = registration.size() == 2 ? 4 : 3;
+        std::uniform_int_distribution<int> letter('A', 'Z');
+        for(int i = 0; i < letters; i++)
+            registration += static_cast<char>(letter(mRandom));
+        return registration;
+    }
+}
@@ -0,0 +1,82 @@
+#pragma once
+
+#include <nap/numeric.h>
+#include <random>
+
+#include "flightstate.h"
+
+namespace nap
+{
+    /**
+     * Generates realistic traffic for benchmarks and tools, reproducible from a seed.
+     * Most aircraft are arriving at or departing from one of a set of busy airports, so traffic is dense and low
+     * near the airports and sparse and high en route, like the feed. Aircraft move every time the generator advances,
+     * aircraft that land or leave the area are replaced by new ones, so consecutive snapshots are nearly identical
+     * and aircraft come and go like they do in the logged history.
+     * The same seed generates the same traffic as long as the standard library is the same.
+     */
+    class TrafficGenerator
+    {
+    public:
+        /**
+         * An airport traffic is clustered around
+         */
+        struct Airport
+        {
+            const char* mCode;
+            float mLatitude;
+            float mLongitude;
+            const char* mRegistrationPrefix; ///< Registration prefix of the aircraft based at the airport
+            float mWeight; ///< Relative share of the traffic
+        };
+
+        /**
+         * @param seed seed of the random generator, the same seed generates the same traffic
+         * @param aircraftCount number of aircraft in the air at any moment
+         */
+        TrafficGenerator(uint32 seed, int aircraftCount);
+
+        /**
+         * Moves all aircraft, aircraft that land or leave the area are replaced
+         * @param seconds the time to advance in seconds
+         */
+        void advance(float seconds);
+
+        /**
+         * @param states vector to add the current states to, ordered by altitude like the feed
+         */
+        void getStates(std::vector<FlightState>& states) const;
+
+        /**
+         * @return the airports traffic is clustered around
+         */
+        static const std::vector<Airport>& getAirports();
+    private:
+        enum class EPhase
+        {
+            Arrival,
+            Departure,
+            EnRoute
+        };
+
+        struct Aircraft
+        {
+            FlightState mState;
+            EPhase mPhase = EPhase::EnRoute;
+            const Airport* mAirport = nullptr;
+            float mHeading = 0.0f; // Radians, clockwise from north
+            float mSpeed = 0.0f; // Meters per second
+        };
+
+        void spawn(Aircraft& aircraft);
+        const Airport& pickAirport();
+        uint64 createICAO();
+        std::string createRegistration(const char* prefix);
+
+        std::mt19937 mRandom;
+        std::discrete_distribution<int> mAirportDistribution;
+        std::discrete_distribution<int> mTypeDistribution;
+        std::vector<Aircraft> mAircraft;
+        uint32 mNextICAO = 0;
+    };
+}
@@ -4,6 +4,7 @@
 #include "rapidjson/stringbuffer.h"
 #include "rapidjson/writer.h"
 #include "planeloggercomponent.h"
+#include "trace.h"
 
 // External Includes
 #include <utility/fileutils.h>
@@ -12,6 +13,8 @@ namespace nap
 {    
     bool CoreApp::init(utility::ErrorState& error)
     {
+		TRACE_THREAD_NAME("main");
+
 		// Retrieve services
 		mSceneService	= getCore().getService<nap::SceneService>();
 
@@ -26,9 +29,19 @@ namespace nap
 		// Get the camera and origin Gnomon entity
         mPlaneLoggerEntity = mScene->findEntity("PlaneLoggerEntity");
 
-        // Cap the framerate
-        setFramerate(30.0f);
-        capFramerate(true);
+        // When a scheduler is present the main loop sleeps until the next poll is due or something wakes it up,
+        // otherwise fall back to ticking at a capped framerate
+        mScheduler = mResourceManager->findObject<MainLoopScheduler>("Scheduler");
+        if(mScheduler != nullptr)
+        {
+            mPlaneLogger = mPlaneLoggerEntity->findComponent<PlaneLoggerComponentInstance>();
+            capFramerate(false);
+        }else
+        {
+            // Cap the framerate
+            setFramerate(30.0f);
+            capFramerate(true);
+        }
 
 		// All done!
         return true;
@@ -44,5 +57,12 @@ namespace nap
 	// Update app
     void CoreApp::update(double deltaTime)
     {
+        // Sleep until the next deadline
+        if(mScheduler != nullptr)
+        {
+            auto deadline = mPlaneLogger != nullptr ? mPlaneLogger->getNextDeadline() : SteadyTimeStamp::max();
+            TRACE_ZONE("CoreApp::wait");
+            mScheduler->waitUntil(deadline);
+        }
     }
 }
@@ -13,6 +13,8 @@
 
 #include "restclient.h"
 #include "database.h"
+#include "mainloopscheduler.h"
+#include "planeloggercomponent.h"
 
 namespace nap 
 {
@@ -42,6 +44,7 @@ namespace nap
 
 		/**
 		 * Update is called every frame, before render.
+		 * When a scheduler is present, blocks until the next poll is due or the scheduler is woken up
 		 * @param deltaTime the time in seconds between calls
 		 */
 		void update(double deltaTime) override;
@@ -56,5 +59,7 @@ namespace nap
 		SceneService*				mSceneService = nullptr;		///< Manages all the objects in the scene
 		ObjectPtr<Scene>			mScene = nullptr;				///< Pointer to the main scene
         ObjectPtr<EntityInstance>	mPlaneLoggerEntity = nullptr;
+        ObjectPtr<MainLoopScheduler>	mScheduler = nullptr;		///< Optional, puts the main loop to sleep until there is work to do
+        PlaneLoggerComponentInstance*	mPlaneLogger = nullptr;
 	};
 }
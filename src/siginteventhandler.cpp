@@ -1,5 +1,8 @@
 #include "siginteventhandler.h"
+#include "mainloopscheduler.h"
+#include "trace.h"
 
+#include <nap/logger.h>
 #include <cstdlib>
 #include <csignal>
 #include <atomic>
@@ -11,9 +14,13 @@ RTTI_END_CLASS
 namespace nap
 {
     static std::atomic<bool> sExit = { false };
+    static bool sTraceWritten = false;
     void sigterm_callback_handler(int signum)
     {
         sExit = true;
+
+        // Make sure a sleeping main loop notices
+        MainLoopScheduler::wakeFromSignal();
     }
 
     void sigkill_callback_handler(int signum)
@@ -38,6 +45,19 @@ namespace nap
     {
         if (sExit)
         {
+            // Dump the trace zones before quitting, to OVERMYROOF_TRACE_FILE or trace.json in the working directory
+            if (trace::isEnabled() && !sTraceWritten)
+            {
+                sTraceWritten = true;
+                const char* path = std::getenv("OVERMYROOF_TRACE_FILE");
+                if (path == nullptr)
+                    path = "trace.json";
+                utility::ErrorState error_state;
+                if (trace::writeChromeTrace(path, error_state))
+                    nap::Logger::info("Wrote trace to %s", path);
+                else
+                    nap::Logger::error("Failed to write trace : %s", error_state.toString().c_str());
+            }
             mApp.quit();
         }
     }